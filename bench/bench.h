@@ -0,0 +1,122 @@
+/* bench.h - Shared helpers for hosted micro-benchmarks
+   Benchmarks link against libs00k_core.a, the real kernel subsystems built
+   for user space with the hosted HAL shim (see hal.h). Build and run them
+   all with `make bench`. */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "block_device.h"
+#include "hal.h"
+#include "memory_management.h"
+#include "security.h"
+
+/* Monotonic wall-clock time in nanoseconds */
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Emulated physical memory plus an authenticated user, which the page
+   allocator requires, then a fresh allocator */
+static inline int bench_setup(void) {
+    if (hal_map_physical_memory() != 0) {
+        return -1;
+    }
+    if (!security_init() || !security_authenticate_user("admin", "admin123")) {
+        fprintf(stderr, "bench: cannot authenticate benchmark user\n");
+        return -1;
+    }
+    init_memory_management();
+    return 0;
+}
+
+/* Comparison table in the style of the performance regression tests */
+static inline void bench_print_header(const char* title) {
+    printf("\n=== %s ===\n", title);
+    printf("%-40s %15s %15s %10s\n", "Benchmark", "Baseline (ns)", "Optimized (ns)", "Speedup");
+    printf("%-40s %15s %15s %10s\n", "----------------------------------------",
+           "---------------", "---------------", "----------");
+}
+
+static inline void bench_print_row(const char* name, double baseline_ns, double optimized_ns) {
+    printf("%-40s %15.1f %15.1f %9.2fx\n", name, baseline_ns, optimized_ns,
+           optimized_ns > 0.0 ? baseline_ns / optimized_ns : 0.0);
+}
+
+/* Single-implementation latency table */
+static inline void bench_print_latency_header(const char* title) {
+    printf("\n=== %s ===\n", title);
+    printf("%-40s %15s %15s\n", "Benchmark", "Latency (ns)", "Ops/s");
+    printf("%-40s %15s %15s\n", "----------------------------------------",
+           "---------------", "---------------");
+}
+
+static inline void bench_print_latency(const char* name, double ns_per_op) {
+    printf("%-40s %15.1f %15.0f\n", name, ns_per_op, ns_per_op > 0.0 ? 1e9 / ns_per_op : 0.0);
+}
+
+/* Device that passes everything through to inner until write_budget blocks
+   have been written, then silently drops every write and flush, as a power
+   cut at that point would. Counts blocks written and flushes. */
+typedef struct {
+    block_device_t device;
+    block_device_t* inner;
+    uint64_t write_budget;      /* UINT64_MAX never crashes */
+    uint64_t blocks_written;
+    uint64_t flushes;
+    bool crashed;
+} bench_crash_device_t;
+
+static inline int32_t bench_crash_read(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* buffer) {
+    return block_device_read(((bench_crash_device_t*)dev)->inner, block, count, buffer);
+}
+
+static inline int32_t bench_crash_write(block_device_t* dev, uint32_t block, uint32_t count,
+                                        const uint8_t* buffer) {
+    bench_crash_device_t* crash = (bench_crash_device_t*)dev;
+    if (crash->crashed) {
+        return 0;
+    }
+    if (count > crash->write_budget - crash->blocks_written) {
+        count = (uint32_t)(crash->write_budget - crash->blocks_written);   /* torn: only a prefix lands */
+        crash->crashed = true;
+    }
+    crash->blocks_written += count;
+    return count ? block_device_write(crash->inner, block, count, buffer) : 0;
+}
+
+static inline int32_t bench_crash_flush(block_device_t* dev) {
+    bench_crash_device_t* crash = (bench_crash_device_t*)dev;
+    if (crash->crashed) {
+        return 0;
+    }
+    crash->flushes++;
+    return block_device_flush(crash->inner);
+}
+
+static const block_device_ops_t bench_crash_ops = {
+    bench_crash_read, bench_crash_write, bench_crash_flush, NULL, NULL, NULL,
+};
+
+static inline void bench_crash_device_init(bench_crash_device_t* crash, block_device_t* inner,
+                                           uint64_t write_budget) {
+    crash->device.ops = &bench_crash_ops;
+    crash->device.block_count = inner->block_count;
+    crash->inner = inner;
+    crash->write_budget = write_budget;
+    crash->blocks_written = 0;
+    crash->flushes = 0;
+    crash->crashed = false;
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,104 @@
+/* bench_bitmap.c - Hierarchical bitmap vs. byte-by-byte free page search
+   The bitmap is kept nearly full (a handful of scattered free frames), which is
+   where a linear scan from the rotating hint hurts most. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "bitmap.h"
+
+#define BENCH_SEARCHES  20000
+#define BENCH_HOLES     16
+
+/* The byte scan the page allocator used before the summary levels */
+static uint32_t byte_scan_find(const uint8_t* bytes, uint32_t byte_count, uint32_t bits, uint32_t start) {
+    for (uint32_t pass = 0; pass < 2; pass++) {
+        uint32_t first = pass == 0 ? start >> 3 : 0;
+        uint32_t last = pass == 0 ? byte_count : start >> 3;
+        for (uint32_t i = first; i < last; i++) {
+            if (bytes[i] != 0xFF) {
+                uint32_t bit = (i << 3) + (uint32_t)__builtin_ctz(~bytes[i] & 0xFFu);
+                if (bit < bits) {
+                    return bit;
+                }
+            }
+        }
+    }
+    return HBITMAP_NONE;
+}
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+static double run_bytes(uint32_t bits) {
+    uint32_t byte_count = (bits + 7) / 8;
+    uint8_t* bytes = malloc(byte_count);
+    uint32_t state = 1, hint = 0;
+    for (uint32_t i = 0; i < byte_count; i++) {
+        bytes[i] = 0xFF;
+    }
+    for (uint32_t h = 0; h < BENCH_HOLES; h++) {
+        uint32_t bit = next_random(&state) % bits;
+        bytes[bit >> 3] &= (uint8_t)~(1u << (bit & 7));
+    }
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_SEARCHES; i++) {
+        uint32_t hole = next_random(&state) % bits;
+        bytes[hole >> 3] &= (uint8_t)~(1u << (hole & 7));
+        uint32_t bit = byte_scan_find(bytes, byte_count, bits, hint);
+        bytes[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+        hint = bit + 1 < bits ? bit + 1 : 0;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    free(bytes);
+    return (double)elapsed / BENCH_SEARCHES;
+}
+
+static double run_hbitmap(uint32_t bits) {
+    uint64_t* words = malloc(HBITMAP_WORDS(bits) * sizeof(uint64_t));
+    uint64_t* summary = malloc(HBITMAP_SUMMARY_WORDS(bits) * sizeof(uint64_t));
+    uint64_t* top = malloc(HBITMAP_TOP_WORDS(bits) * sizeof(uint64_t));
+    hbitmap_t bm;
+    uint32_t state = 1, hint = 0;
+    hbitmap_init(&bm, words, summary, top, bits);
+    hbitmap_set_range(&bm, 0, bits);
+    for (uint32_t h = 0; h < BENCH_HOLES; h++) {
+        hbitmap_clear(&bm, next_random(&state) % bits);
+    }
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_SEARCHES; i++) {
+        hbitmap_clear(&bm, next_random(&state) % bits);
+        uint32_t bit = hbitmap_find_zero(&bm, hint);
+        if (bit == HBITMAP_NONE) {
+            bit = hbitmap_find_zero(&bm, 0);
+        }
+        hbitmap_set(&bm, bit);
+        hint = bit + 1 < bits ? bit + 1 : 0;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    free(words);
+    free(summary);
+    free(top);
+    return (double)elapsed / BENCH_SEARCHES;
+}
+
+int main(void) {
+    static const struct {
+        const char* name;
+        uint64_t memory;
+    } sizes[] = {
+        { "16 MiB (4096 frames)", 16ull << 20 },
+        { "256 MiB (65536 frames)", 256ull << 20 },
+        { "4 GiB (1048576 frames)", 4ull << 30 },
+    };
+
+    bench_print_header("FREE PAGE SEARCH, NEARLY FULL (ns per search)");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint32_t bits = (uint32_t)(sizes[i].memory / PAGE_SIZE);
+        bench_print_row(sizes[i].name, run_bytes(bits), run_hbitmap(bits));
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/* bench_fs.c - File system operation latency on the real file_system.c */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "file_system.h"
+
+#define BENCH_ROUNDS     100000
+#define BENCH_DIR_FILES  2000
+#define BENCH_IO_SIZE    4096
+#define BENCH_INODES     4096
+
+static FileSystem fs;
+static memory_block_device_t device;
+static uint8_t data_area[2 * 1024 * 1024];
+static uint8_t buffer[BENCH_IO_SIZE];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs: %s failed\n", what);
+    exit(1);
+}
+
+/* Create, write one block, delete */
+static double run_create_delete(void) {
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        int32_t file = fs_create_file(&fs, "scratch", 0);
+        if (file < 0 || fs_write_file(&fs, (uint32_t)file, buffer, BLOCK_SIZE, 0) != BLOCK_SIZE) {
+            fail("create/write");
+        }
+        if (fs_delete(&fs, (uint32_t)file) != FS_SUCCESS) {
+            fail("delete");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BENCH_ROUNDS;
+}
+
+/* Populate a directory with BENCH_DIR_FILES entries */
+static int32_t populate_directory(char* last_name) {
+    int32_t dir = fs_create_directory(&fs, "many", 0);
+    if (dir < 0) {
+        fail("mkdir");
+    }
+    for (uint32_t i = 0; i < BENCH_DIR_FILES; i++) {
+        snprintf(last_name, MAX_FILENAME_LENGTH, "file%04u", i);
+        if (fs_create_file(&fs, last_name, (uint32_t)dir) < 0) {
+            fail("populate");
+        }
+    }
+    return dir;
+}
+
+/* Look up the newest entry of a large directory */
+static double run_lookup(int32_t dir, const char* name) {
+    volatile int32_t found = 0;
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        found = fs_find_file(&fs, name, (uint32_t)dir);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    if (found < 0) {
+        fail("lookup");
+    }
+    return (double)elapsed / BENCH_ROUNDS;
+}
+
+/* List a small directory that shares the table with the large one */
+static double run_list(void) {
+    File entries[4];
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        if (fs_list_directory(&fs, 0, entries, 4) < 0) {
+            fail("list");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BENCH_ROUNDS;
+}
+
+/* Sequential read or write of a whole file */
+static double run_io(int32_t file, uint32_t size, int write) {
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        int32_t done = write ? fs_write_file(&fs, (uint32_t)file, buffer, size, 0)
+                             : fs_read_file(&fs, (uint32_t)file, buffer, size, 0);
+        if (done != (int32_t)size) {
+            fail(write ? "write" : "read");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BENCH_ROUNDS;
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    memory_block_device_init(&device, data_area, sizeof(data_area));
+    if (fs_mkfs(&device.device, BENCH_INODES) != FS_SUCCESS || fs_mount(&fs, &device.device) != FS_SUCCESS) {
+        fail("fs_mkfs/fs_mount");
+    }
+
+    bench_print_latency_header("FILE SYSTEM (per operation)");
+    bench_print_latency("create + 512 B write + delete", run_create_delete());
+
+    int32_t file = fs_create_file(&fs, "data", 0);
+    if (file < 0) {
+        fail("create");
+    }
+    bench_print_latency("write 4 KiB at offset 0", run_io(file, BENCH_IO_SIZE, 1));
+    bench_print_latency("read 4 KiB at offset 0", run_io(file, BENCH_IO_SIZE, 0));
+
+    char name[MAX_FILENAME_LENGTH];
+    int32_t dir = populate_directory(name);
+    bench_print_latency("lookup among 2000 siblings", run_lookup(dir, name));
+    bench_print_latency("list root beside 2000 entries", run_list());
+    fs_destroy(&fs);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/* bench_fs_batch.c - Vectored and batched file operations against single calls
+   Small records (64 bytes) are read and written one call at a time, then
+   through fs_readv/fs_writev and fs_batch, which validate each file once
+   per call or run of operations and store a grown file's entry once. The
+   file system runs over the RAM device, so the numbers are per-call
+   overhead rather than device time. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "file_system.h"
+
+#define BATCH_FILES        4
+#define BATCH_FILE_SIZE    (64 * 1024)
+#define BATCH_RECORD       64
+#define BATCH_OPS          65536
+#define BATCH_SIZE         64      /* operations or spans per vectored call */
+#define BATCH_APPENDS      16384   /* 1 MiB per appended file */
+
+static FileSystem fs;
+static uint8_t data_area[8 * 1024 * 1024];
+static uint8_t records[BATCH_SIZE][BATCH_RECORD];
+static int32_t files[BATCH_FILES];
+static fs_op_t ops[BATCH_SIZE];
+static fs_span_t spans[BATCH_SIZE];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_batch: %s failed\n", what);
+    exit(1);
+}
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/* Random record-aligned reads and writes over all files, half of each */
+static double random_single(void) {
+    uint32_t state = 1;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BATCH_OPS; i++) {
+        uint32_t file = (uint32_t)files[next_random(&state) % BATCH_FILES];
+        uint32_t offset = next_random(&state) % (BATCH_FILE_SIZE / BATCH_RECORD) * BATCH_RECORD;
+        int32_t done = i & 1 ? fs_write_file(&fs, file, records[0], BATCH_RECORD, offset)
+                             : fs_read_file(&fs, file, records[0], BATCH_RECORD, offset);
+        if (done != BATCH_RECORD) {
+            fail("single");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BATCH_OPS;
+}
+
+static double random_batch(void) {
+    uint32_t state = 1;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BATCH_OPS; i += BATCH_SIZE) {
+        for (uint32_t j = 0; j < BATCH_SIZE; j++) {
+            ops[j].file_index = (uint32_t)files[next_random(&state) % BATCH_FILES];
+            ops[j].offset = next_random(&state) % (BATCH_FILE_SIZE / BATCH_RECORD) * BATCH_RECORD;
+            ops[j].type = (i + j) & 1 ? FS_OP_WRITE : FS_OP_READ;
+            ops[j].buffer = records[j];
+            ops[j].size = BATCH_RECORD;
+        }
+        if (fs_batch(&fs, ops, BATCH_SIZE) != BATCH_SIZE) {
+            fail("batch");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BATCH_OPS;
+}
+
+/* Sequential records of one file, as a log reader would consume them */
+static double sequential_single(void) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BATCH_OPS; i++) {
+        uint32_t offset = i % (BATCH_FILE_SIZE / BATCH_RECORD) * BATCH_RECORD;
+        if (fs_read_file(&fs, (uint32_t)files[0], records[i % BATCH_SIZE], BATCH_RECORD, offset) !=
+            BATCH_RECORD) {
+            fail("sequential read");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BATCH_OPS;
+}
+
+static double sequential_readv(void) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BATCH_OPS; i += BATCH_SIZE) {
+        uint32_t offset = i % (BATCH_FILE_SIZE / BATCH_RECORD) * BATCH_RECORD;
+        if (fs_readv(&fs, (uint32_t)files[0], spans, BATCH_SIZE, offset) != BATCH_SIZE * BATCH_RECORD) {
+            fail("readv");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BATCH_OPS;
+}
+
+/* Appends grow the file, so every call also stores its entry */
+static double append_single(int32_t file) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BATCH_APPENDS; i++) {
+        if (fs_write_file(&fs, (uint32_t)file, records[0], BATCH_RECORD, i * BATCH_RECORD) != BATCH_RECORD) {
+            fail("append");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BATCH_APPENDS;
+}
+
+static double append_writev(int32_t file) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < BATCH_APPENDS; i += BATCH_SIZE) {
+        if (fs_writev(&fs, (uint32_t)file, spans, BATCH_SIZE, i * BATCH_RECORD) != BATCH_SIZE * BATCH_RECORD) {
+            fail("writev");
+        }
+    }
+    return (double)(bench_now_ns() - start) / BATCH_APPENDS;
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    if (fs_init(&fs, data_area, sizeof(data_area)) != FS_SUCCESS) {
+        fail("fs_init");
+    }
+    static uint8_t contents[BATCH_FILE_SIZE];
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t i = 0; i < BATCH_FILES; i++) {
+        snprintf(name, sizeof(name), "records%u", i);
+        files[i] = fs_create_file(&fs, name, 0);
+        if (files[i] < 0 || fs_write_file(&fs, (uint32_t)files[i], contents, BATCH_FILE_SIZE, 0) != BATCH_FILE_SIZE) {
+            fail("populate");
+        }
+    }
+    for (uint32_t i = 0; i < BATCH_SIZE; i++) {
+        spans[i].data = records[i];
+        spans[i].length = BATCH_RECORD;
+    }
+    int32_t log_single = fs_create_file(&fs, "append1", 0);
+    int32_t log_vector = fs_create_file(&fs, "append2", 0);
+    if (log_single < 0 || log_vector < 0) {
+        fail("create");
+    }
+
+    bench_print_header("VECTORED AND BATCHED I/O (64 B records, ns per record)");
+    bench_print_row("random read/write vs fs_batch", random_single(), random_batch());
+    bench_print_row("sequential read vs fs_readv", sequential_single(), sequential_readv());
+    bench_print_row("append vs fs_writev", append_single(log_single), append_writev(log_vector));
+    fs_destroy(&fs);
+    return 0;
+}
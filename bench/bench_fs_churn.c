@@ -0,0 +1,102 @@
+/* bench_fs_churn.c - Space reclamation and allocation latency under create/delete churn
+   Files of random size are created and deleted at random until thousands of
+   operations have run. Whenever a write reports out-of-space, the fraction of
+   data blocks actually in use is recorded: a leaking allocator fails with
+   most of the area free, a reclaiming one only when it is really full. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "file_system.h"
+
+#define CHURN_OPERATIONS  200000
+#define CHURN_LIVE_FILES  512
+#define CHURN_MAX_SIZE    4096
+#define CHURN_INODES      1024
+
+static FileSystem fs;
+static memory_block_device_t device;
+static uint8_t data_area[640 * 1024];     /* 512 KiB of data: smaller than the live set can grow */
+static uint8_t payload[CHURN_MAX_SIZE];
+static int32_t live[CHURN_LIVE_FILES];
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/* Data blocks in use as a fraction of the blocks available for data */
+static double utilisation(void) {
+    uint32_t data = fs.total_blocks - fs.reserved_blocks;
+    return (double)(data - fs.free_block_count) / data;
+}
+
+int main(void) {
+    memory_block_device_init(&device, data_area, sizeof(data_area));
+    if (bench_setup() != 0 || fs_mkfs(&device.device, CHURN_INODES) != FS_SUCCESS ||
+        fs_mount(&fs, &device.device) != FS_SUCCESS) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < CHURN_LIVE_FILES; i++) {
+        live[i] = -1;
+    }
+
+    uint32_t state = 42;
+    uint32_t creates = 0, deletes = 0, writes = 0, out_of_space = 0;
+    double utilisation_sum = 0.0;
+    uint64_t write_ns = 0;
+    char name[MAX_FILENAME_LENGTH];
+
+    for (uint32_t op = 0; op < CHURN_OPERATIONS; op++) {
+        uint32_t slot = next_random(&state) % CHURN_LIVE_FILES;
+        if (live[slot] >= 0) {
+            fs_delete(&fs, (uint32_t)live[slot]);
+            live[slot] = -1;
+            deletes++;
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "churn%u", op);
+        live[slot] = fs_create_file(&fs, name, 0);
+        if (live[slot] < 0) {
+            fprintf(stderr, "create failed with %d\n", live[slot]);
+            return 1;
+        }
+        creates++;
+
+        uint32_t size = 1 + next_random(&state) % CHURN_MAX_SIZE;
+        uint64_t start = bench_now_ns();
+        int32_t written = fs_write_file(&fs, (uint32_t)live[slot], payload, size, 0);
+        write_ns += bench_now_ns() - start;
+        writes++;
+        if (written < 0) {
+            out_of_space++;
+            utilisation_sum += utilisation();
+        }
+    }
+
+    /* Share of live files whose blocks form a single extent */
+    uint32_t files = 0, contiguous = 0;
+    for (uint32_t i = 0; i < CHURN_LIVE_FILES; i++) {
+        if (live[i] < 0 || fs_entry(&fs, (uint32_t)live[i])->block_count == 0) {
+            continue;
+        }
+        File* file = fs_entry(&fs, (uint32_t)live[i]);
+        uint32_t b = 1;
+        while (b < file->block_count && file->blocks[b] == file->blocks[b - 1] + 1) {
+            b++;
+        }
+        files++;
+        contiguous += b == file->block_count;
+    }
+
+    bench_print_latency_header("FILE SYSTEM CHURN");
+    bench_print_latency("allocating write (random 1 B - 4 KiB)", (double)write_ns / writes);
+    printf("%-40s %15u\n", "Creates", creates);
+    printf("%-40s %15u\n", "Deletes", deletes);
+    printf("%-40s %15u\n", "Out-of-space writes", out_of_space);
+    printf("%-40s %14.1f%%\n", "Utilisation at out-of-space",
+           out_of_space ? 100.0 * utilisation_sum / out_of_space : 0.0);
+    printf("%-40s %14.1f%%\n", "Live files in one extent",
+           files ? 100.0 * contiguous / files : 0.0);
+    return 0;
+}
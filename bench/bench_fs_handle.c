@@ -0,0 +1,104 @@
+/* bench_fs_handle.c - Streaming through open handles against index-based calls
+   A 1 MiB file (mostly behind the indirect blocks) is read front to back in
+   64-byte records, once with fs_read_file and an offset kept by the caller
+   and once with fs_read on a handle, which keeps the position and the
+   mapping of its current block. Appends compare fs_write_file, which needs
+   the size from fs_get_file_info first, with fs_write on a handle seeked to
+   the end. The file system runs over the RAM device. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "file_system.h"
+
+#define HANDLE_FILE_SIZE   (1024 * 1024)
+#define HANDLE_RECORD      64
+#define HANDLE_ROUNDS      8
+#define HANDLE_APPENDS     16384
+
+static FileSystem fs;
+static uint8_t data_area[8 * 1024 * 1024];
+static uint8_t record[HANDLE_RECORD];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_handle: %s failed\n", what);
+    exit(1);
+}
+
+static double read_by_index(int32_t file) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t round = 0; round < HANDLE_ROUNDS; round++) {
+        for (uint32_t offset = 0; offset < HANDLE_FILE_SIZE; offset += HANDLE_RECORD) {
+            if (fs_read_file(&fs, (uint32_t)file, record, HANDLE_RECORD, offset) != HANDLE_RECORD) {
+                fail("fs_read_file");
+            }
+        }
+    }
+    return (double)(bench_now_ns() - start) / (HANDLE_ROUNDS * (HANDLE_FILE_SIZE / HANDLE_RECORD));
+}
+
+static double read_by_handle(int32_t file) {
+    int32_t handle = fs_open(&fs, (uint32_t)file);
+    if (handle < 0) {
+        fail("fs_open");
+    }
+    uint64_t start = bench_now_ns();
+    for (uint32_t round = 0; round < HANDLE_ROUNDS; round++) {
+        fs_seek(&fs, handle, 0, FS_SEEK_SET);
+        while (fs_read(&fs, handle, record, HANDLE_RECORD) == HANDLE_RECORD) {
+        }
+    }
+    double ns = (double)(bench_now_ns() - start) / (HANDLE_ROUNDS * (HANDLE_FILE_SIZE / HANDLE_RECORD));
+    fs_close(&fs, handle);
+    return ns;
+}
+
+static double append_by_index(int32_t file) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < HANDLE_APPENDS; i++) {
+        File info;
+        if (fs_get_file_info(&fs, (uint32_t)file, &info) != FS_SUCCESS ||
+            fs_write_file(&fs, (uint32_t)file, record, HANDLE_RECORD, info.size) != HANDLE_RECORD) {
+            fail("append");
+        }
+    }
+    return (double)(bench_now_ns() - start) / HANDLE_APPENDS;
+}
+
+static double append_by_handle(int32_t file) {
+    int32_t handle = fs_open(&fs, (uint32_t)file);
+    if (handle < 0 || fs_seek(&fs, handle, 0, FS_SEEK_END) < 0) {
+        fail("fs_open");
+    }
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < HANDLE_APPENDS; i++) {
+        if (fs_write(&fs, handle, record, HANDLE_RECORD) != HANDLE_RECORD) {
+            fail("fs_write");
+        }
+    }
+    double ns = (double)(bench_now_ns() - start) / HANDLE_APPENDS;
+    fs_close(&fs, handle);
+    return ns;
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    if (fs_init(&fs, data_area, sizeof(data_area)) != FS_SUCCESS) {
+        fail("fs_init");
+    }
+    static uint8_t contents[HANDLE_FILE_SIZE];
+    int32_t file = fs_create_file(&fs, "stream", 0);
+    int32_t log_index = fs_create_file(&fs, "log1", 0);
+    int32_t log_handle = fs_create_file(&fs, "log2", 0);
+    if (file < 0 || log_index < 0 || log_handle < 0 ||
+        fs_write_file(&fs, (uint32_t)file, contents, HANDLE_FILE_SIZE, 0) != HANDLE_FILE_SIZE) {
+        fail("populate");
+    }
+
+    bench_print_header("OPEN FILE HANDLES (64 B records, ns per record)");
+    bench_print_row("sequential read, index vs handle", read_by_index(file), read_by_handle(file));
+    bench_print_row("append, index vs handle", append_by_index(log_index), append_by_handle(log_handle));
+    fs_destroy(&fs);
+    return 0;
+}
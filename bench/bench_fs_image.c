@@ -0,0 +1,116 @@
+/* bench_fs_image.c - File system throughput on a RAM device vs. a disk image
+   The same workload runs over a memory device and over a 256 MiB image file
+   driven through pread/pwrite, exposing the per-request cost the in-memory
+   path hides. Set BENCH_IMAGE to place the image somewhere other than the
+   build directory (e.g. on a real disk instead of tmpfs). */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include "file_system.h"
+
+#define IMAGE_SIZE        (256u * 1024 * 1024)
+#define IMAGE_FILES       32
+#define IMAGE_FILE_SIZE   (4u * 1024 * 1024)
+#define IMAGE_RANDOM_OPS  20000
+#define IMAGE_RANDOM_SIZE 4096
+
+static FileSystem fs;
+static uint8_t buffer[IMAGE_FILE_SIZE];
+static int32_t files[IMAGE_FILES];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_image: %s failed\n", what);
+    exit(1);
+}
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+static double mib_per_s(uint64_t bytes, uint64_t ns) {
+    return (double)bytes / (1024.0 * 1024.0) * 1e9 / (double)ns;
+}
+
+/* Write, read back and randomly read IMAGE_FILES files on device */
+static void run(const char* name, block_device_t* device) {
+    if (fs_init_device(&fs, device) != FS_SUCCESS) {
+        fail("fs_init_device");
+    }
+    char file_name[MAX_FILENAME_LENGTH];
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < IMAGE_FILES; i++) {
+        snprintf(file_name, sizeof(file_name), "data%02u", i);
+        files[i] = fs_create_file(&fs, file_name, 0);
+        if (files[i] < 0 ||
+            fs_write_file(&fs, (uint32_t)files[i], buffer, IMAGE_FILE_SIZE, 0) != (int32_t)IMAGE_FILE_SIZE) {
+            fail("write");
+        }
+    }
+    if (fs_sync(&fs) != FS_SUCCESS) {
+        fail("sync");
+    }
+    uint64_t write_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < IMAGE_FILES; i++) {
+        if (fs_read_file(&fs, (uint32_t)files[i], buffer, IMAGE_FILE_SIZE, 0) != (int32_t)IMAGE_FILE_SIZE) {
+            fail("read");
+        }
+    }
+    uint64_t read_ns = bench_now_ns() - start;
+
+    uint32_t state = 11;
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < IMAGE_RANDOM_OPS; i++) {
+        int32_t file = files[next_random(&state) % IMAGE_FILES];
+        uint32_t offset = next_random(&state) % (IMAGE_FILE_SIZE / IMAGE_RANDOM_SIZE) * IMAGE_RANDOM_SIZE;
+        if (fs_read_file(&fs, (uint32_t)file, buffer, IMAGE_RANDOM_SIZE, offset) != IMAGE_RANDOM_SIZE) {
+            fail("random read");
+        }
+    }
+    uint64_t random_ns = bench_now_ns() - start;
+
+    uint64_t total = (uint64_t)IMAGE_FILES * IMAGE_FILE_SIZE;
+    printf("%-24s %16.1f %16.1f %16.0f\n", name, mib_per_s(total, write_ns), mib_per_s(total, read_ns),
+           (double)IMAGE_RANDOM_OPS * 1e9 / (double)random_ns);
+    fs_destroy(&fs);
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < IMAGE_FILE_SIZE; i++) {
+        buffer[i] = (uint8_t)(i * 31);
+    }
+
+    printf("\n=== FILE SYSTEM ON A 256 MiB DEVICE (%u x 4 MiB files) ===\n", IMAGE_FILES);
+    printf("%-24s %16s %16s %16s\n", "Device", "Write+sync MiB/s", "Read MiB/s", "4 KiB reads/s");
+    printf("%-24s %16s %16s %16s\n", "------------------------", "----------------",
+           "----------------", "----------------");
+
+    uint8_t* memory = malloc(IMAGE_SIZE);
+    if (!memory) {
+        fail("malloc");
+    }
+    memory_block_device_t mem;
+    memory_block_device_init(&mem, memory, IMAGE_SIZE);
+    run("memory", &mem.device);
+    free(memory);
+
+    const char* path = getenv("BENCH_IMAGE");
+    if (!path) {
+        path = "build/hosted/bench_fs.img";
+    }
+    file_block_device_t image;
+    if (file_block_device_open(&image, path, IMAGE_SIZE / BLOCK_SIZE, true) != FS_SUCCESS) {
+        fail("image open");
+    }
+    run("image file (pread/pwrite)", &image.device);
+    file_block_device_close(&image);
+    unlink(path);
+    return 0;
+}
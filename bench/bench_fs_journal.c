@@ -0,0 +1,245 @@
+/* bench_fs_journal.c - Crash injection and group commit for the metadata journal
+   The crash test runs a fixed workload of creates, appends and deletes over
+   an image through a device that stops writing after a given number of
+   blocks, for many such cut-off points. After each crash the image is
+   mounted (replaying the journal), every file is read back, files left
+   alone since the last fs_sync must match what was synced, and the image is
+   unmounted and checked with fsck.s00k. Any failure exits non-zero.
+   The second part compares committing after every operation with group
+   commit. Set BENCH_IMAGE to place the image somewhere other than the
+   build directory. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "file_system.h"
+
+#define CRASH_IMAGE_MIB   8
+#define CRASH_FILES       48
+#define CRASH_OPS         400
+#define CRASH_SYNC_EVERY  16
+#define CRASH_POINTS      96
+#define CRASH_MAX_SIZE    (24 * 1024)
+
+#define GROUP_OPS         1000   /* the 8 MiB image has 1024 inodes */
+#define GROUP_FILE_SIZE   1024
+
+typedef struct {
+    bool exists;
+    uint32_t size;
+} file_state_t;
+
+static FileSystem fs;
+static const char* image_path;
+static file_state_t current[CRASH_FILES];
+static file_state_t synced[CRASH_FILES];
+static bool touched[CRASH_FILES];     /* Changed since the last completed fs_sync */
+static uint8_t buffer[CRASH_MAX_SIZE];
+static uint8_t expected[CRASH_MAX_SIZE];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_journal: %s failed\n", what);
+    exit(1);
+}
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/* Byte at offset of file; independent of how the file was written, so any
+   size a file is left at after a crash has exactly one valid content */
+static void file_bytes(uint32_t file, uint32_t offset, uint8_t* out, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        out[i] = (uint8_t)((offset + i) * 7 + file * 13 + ((offset + i) >> 9));
+    }
+}
+
+static void file_name(uint32_t file, char* name) {
+    snprintf(name, MAX_FILENAME_LENGTH, "f%02u", file);
+}
+
+/* The workload, stopping early once the device has crashed */
+static void run_workload(bench_crash_device_t* crash) {
+    memset(current, 0, sizeof(current));
+    memset(synced, 0, sizeof(synced));
+    memset(touched, 0, sizeof(touched));
+    int32_t dir = fs_create_directory(&fs, "data", 0);
+    if (dir < 0 || fs_sync(&fs) != FS_SUCCESS) {
+        return;
+    }
+
+    uint32_t state = 5;
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t op = 0; op < CRASH_OPS && !crash->crashed; op++) {
+        uint32_t file = next_random(&state) % CRASH_FILES;
+        file_name(file, name);
+        file_state_t* f = &current[file];
+        if (f->exists && next_random(&state) % 4 == 0) {
+            if (fs_delete(&fs, (uint32_t)fs_find_file(&fs, name, (uint32_t)dir)) != FS_SUCCESS) {
+                return;
+            }
+            f->exists = false;
+            f->size = 0;
+        } else {
+            int32_t index = f->exists ? fs_find_file(&fs, name, (uint32_t)dir)
+                                      : fs_create_file(&fs, name, (uint32_t)dir);
+            uint32_t grow = 1 + next_random(&state) % 6000;
+            if (f->size + grow > CRASH_MAX_SIZE) {
+                grow = CRASH_MAX_SIZE - f->size;
+            }
+            f->exists = true;
+            file_bytes(file, f->size, buffer, grow);
+            if (index < 0 ||
+                (grow && fs_write_file(&fs, (uint32_t)index, buffer, grow, f->size) != (int32_t)grow)) {
+                return;
+            }
+            f->size += grow;
+        }
+        touched[file] = true;
+
+        if (op % CRASH_SYNC_EVERY == CRASH_SYNC_EVERY - 1) {
+            if (fs_sync(&fs) != FS_SUCCESS || crash->crashed) {
+                return;   /* a sync cut short by the crash promises nothing */
+            }
+            memcpy(synced, current, sizeof(synced));
+            memset(touched, 0, sizeof(touched));
+        }
+    }
+}
+
+/* Mount the crashed image and check what survived */
+static void verify(block_device_t* device, uint64_t budget) {
+    if (fs_mount(&fs, device) != FS_SUCCESS) {
+        fprintf(stderr, "bench_fs_journal: mount after crash at block %llu failed\n",
+                (unsigned long long)budget);
+        exit(1);
+    }
+    int32_t dir = fs_find_file(&fs, "data", 0);
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t file = 0; dir >= 0 && file < CRASH_FILES; file++) {
+        file_name(file, name);
+        int32_t index = fs_find_file(&fs, name, (uint32_t)dir);
+        File info;
+        bool present = index >= 0 && fs_get_file_info(&fs, (uint32_t)index, &info) == FS_SUCCESS;
+        if (!touched[file] && (present != synced[file].exists || (present && info.size != synced[file].size))) {
+            fprintf(stderr, "bench_fs_journal: crash at block %llu lost synced file %s\n",
+                    (unsigned long long)budget, name);
+            exit(1);
+        }
+        if (!present) {
+            continue;
+        }
+        file_bytes(file, 0, expected, info.size);
+        if (fs_read_file(&fs, (uint32_t)index, buffer, info.size, 0) != (int32_t)info.size ||
+            memcmp(buffer, expected, info.size) != 0) {
+            fprintf(stderr, "bench_fs_journal: crash at block %llu left %s with wrong contents\n",
+                    (unsigned long long)budget, name);
+            exit(1);
+        }
+    }
+    if (fs_unmount(&fs) != FS_SUCCESS) {
+        fail("unmount after recovery");
+    }
+
+    char command[512];
+    snprintf(command, sizeof(command), "./build/hosted/fsck.s00k %s > /dev/null", image_path);
+    if (system(command) != 0) {
+        fprintf(stderr, "bench_fs_journal: fsck found errors after a crash at block %llu\n",
+                (unsigned long long)budget);
+        exit(1);
+    }
+}
+
+/* One workload run with the device failing after budget blocks; returns the blocks written */
+static uint64_t crash_run(file_block_device_t* image, uint64_t budget) {
+    if (fs_mkfs(&image->device, 0) != FS_SUCCESS) {
+        fail("mkfs");
+    }
+    bench_crash_device_t crash;
+    bench_crash_device_init(&crash, &image->device, budget);
+    if (fs_mount(&fs, &crash.device) != FS_SUCCESS) {
+        fail("mount");
+    }
+    run_workload(&crash);
+    fs_destroy(&fs);   /* after a crash nothing it writes reaches the image */
+    if (crash.crashed) {
+        verify(&image->device, budget);
+    }
+    return crash.blocks_written;
+}
+
+/* Small-file creates and writes, syncing after every sync_every operations */
+static void group_run(const char* name, file_block_device_t* image, uint32_t sync_every) {
+    if (fs_mkfs(&image->device, 0) != FS_SUCCESS) {
+        fail("mkfs");
+    }
+    bench_crash_device_t counter;
+    bench_crash_device_init(&counter, &image->device, UINT64_MAX);
+    if (fs_mount(&fs, &counter.device) != FS_SUCCESS) {
+        fail("mount");
+    }
+    uint64_t flushes = counter.flushes;
+    uint64_t written = counter.blocks_written;
+    char file[MAX_FILENAME_LENGTH];
+    file_bytes(0, 0, buffer, GROUP_FILE_SIZE);
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < GROUP_OPS; i++) {
+        snprintf(file, sizeof(file), "g%05u", i);
+        int32_t index = fs_create_file(&fs, file, 0);
+        if (index < 0 || fs_write_file(&fs, (uint32_t)index, buffer, GROUP_FILE_SIZE, 0) != GROUP_FILE_SIZE) {
+            fail("group write");
+        }
+        if ((i + 1) % sync_every == 0 && fs_sync(&fs) != FS_SUCCESS) {
+            fail("sync");
+        }
+    }
+    if (fs_sync(&fs) != FS_SUCCESS) {
+        fail("sync");
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    printf("%-32s %12.0f %12.2f %12.1f %12llu\n", name, (double)GROUP_OPS * 1e9 / (double)elapsed,
+           (double)(counter.flushes - flushes) / GROUP_OPS,
+           (double)(counter.blocks_written - written) / GROUP_OPS,
+           (unsigned long long)fs.journal.stats.commits);
+    fs_destroy(&fs);
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    image_path = getenv("BENCH_IMAGE");
+    if (!image_path) {
+        image_path = "build/hosted/bench_fs_journal.img";
+    }
+    file_block_device_t image;
+    if (file_block_device_open(&image, image_path, CRASH_IMAGE_MIB * (1024 * 1024 / BLOCK_SIZE), true) !=
+        FS_SUCCESS) {
+        fail("image open");
+    }
+
+    /* A run without a crash gives the range of cut-off points */
+    uint64_t total = crash_run(&image, UINT64_MAX);
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < CRASH_POINTS; i++) {
+        crash_run(&image, total * i / CRASH_POINTS + i % 7);
+    }
+    printf("\n=== METADATA JOURNAL: CRASH INJECTION ===\n");
+    printf("%u crash points over %llu block writes (%u operations): all recovered, fsck clean (%.1f s)\n",
+           CRASH_POINTS, (unsigned long long)total, CRASH_OPS, (double)(bench_now_ns() - start) / 1e9);
+
+    printf("\n=== METADATA JOURNAL: GROUP COMMIT (%u creates + %u B writes) ===\n", GROUP_OPS, GROUP_FILE_SIZE);
+    printf("%-32s %12s %12s %12s %12s\n", "Commit policy", "Ops/s", "Flushes/op", "Blocks/op", "Commits");
+    printf("%-32s %12s %12s %12s %12s\n", "--------------------------------", "------------",
+           "------------", "------------", "------------");
+    group_run("fs_sync after every operation", &image, 1);
+    group_run("group commit", &image, GROUP_OPS);
+
+    file_block_device_close(&image);
+    unlink(image_path);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* bench_fs_map.c - Zero-copy fs_map_file against copying fs_read_file
+   Both sides consume a whole file by checksumming it, the way a loader or
+   `cat` only looks at the data: fs_read_file copies it into a buffer first,
+   fs_map_file hands out spans into the block cache. The file system runs
+   over the RAM device, so the 1 MiB file (larger than the cache) measures
+   the copy on top of cache misses that both sides pay. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include "file_system.h"
+
+#define MAP_LARGEST      (1024 * 1024)
+#define MAP_TOTAL_BYTES  (64u * 1024 * 1024)   /* consumed per row */
+#define MAP_SPANS        64
+
+static FileSystem fs;
+static uint8_t data_area[8 * 1024 * 1024];
+static uint8_t buffer[MAP_LARGEST];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_map: %s failed\n", what);
+    exit(1);
+}
+
+/* A word-wise checksum, kept out of line so both sides consume the data
+   with the same code */
+static __attribute__((noinline)) uint64_t sum_words(const uint8_t* data, uint32_t length) {
+    uint64_t sum = 0;
+    uint32_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        sum += word;
+    }
+    for (; i < length; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+static uint64_t consume_read(int32_t file, uint32_t size) {
+    if (fs_read_file(&fs, (uint32_t)file, buffer, size, 0) != (int32_t)size) {
+        fail("read");
+    }
+    return sum_words(buffer, size);
+}
+
+static uint64_t consume_map(int32_t file, uint32_t size) {
+    fs_span_t spans[MAP_SPANS];
+    uint64_t sum = 0;
+    for (uint32_t offset = 0; offset < size;) {
+        int32_t count = fs_map_file(&fs, (uint32_t)file, spans, MAP_SPANS, size - offset, offset);
+        if (count <= 0) {
+            fail("map");
+        }
+        for (int32_t i = 0; i < count; i++) {
+            sum += sum_words(spans[i].data, spans[i].length);
+            offset += spans[i].length;
+        }
+        fs_unmap_file(&fs, spans, (uint32_t)count);
+    }
+    return sum;
+}
+
+static void run(const char* name, uint32_t size) {
+    int32_t file = fs_create_file(&fs, name, 0);
+    for (uint32_t i = 0; i < size; i++) {
+        buffer[i] = (uint8_t)(i * 31 + (i >> 9));
+    }
+    if (file < 0 || fs_write_file(&fs, (uint32_t)file, buffer, size, 0) != (int32_t)size) {
+        fail("populate");
+    }
+    uint64_t expected = sum_words(buffer, size);
+    uint32_t rounds = MAP_TOTAL_BYTES / size;
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < rounds; i++) {
+        if (consume_read(file, size) != expected) {
+            fail("read check");
+        }
+    }
+    double read_ns = (double)(bench_now_ns() - start) / rounds;
+
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < rounds; i++) {
+        if (consume_map(file, size) != expected) {
+            fail("map check");
+        }
+    }
+    double map_ns = (double)(bench_now_ns() - start) / rounds;
+    bench_print_row(name, read_ns, map_ns);
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    if (fs_init(&fs, data_area, sizeof(data_area)) != FS_SUCCESS) {
+        fail("fs_init");
+    }
+    bench_print_header("ZERO-COPY READ (fs_read_file vs fs_map_file, per file)");
+    run("4 KiB file", 4 * 1024);
+    run("64 KiB file", 64 * 1024);
+    run("1 MiB file", MAP_LARGEST);
+    fs_destroy(&fs);
+    return 0;
+}
@@ -0,0 +1,127 @@
+/* bench_fs_mount.c - Mount time against image size
+   A small and a large (sparse) image hold the same few files. After a clean
+   unmount, mount reads only the bitmap and inodes below the high-water
+   marks, so both mount in about the same time. The crash rows grow a
+   file, sync and drop everything the cache would have written home, so
+   mount first replays that transaction from the journal, which costs a
+   few more blocks instead of a scan of the whole bitmap and inode table.
+   Set BENCH_IMAGE to place the image somewhere other than the build
+   directory. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include "file_system.h"
+
+#define MOUNT_FILES      100
+#define MOUNT_FILE_SIZE  8192
+#define MOUNT_ROUNDS     20
+
+static FileSystem fs;
+static uint8_t buffer[MOUNT_FILE_SIZE];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_mount: %s failed\n", what);
+    exit(1);
+}
+
+/* Grow one file and sync, then crash before the cache writes the
+   committed metadata home, leaving the transaction in the journal */
+static void crash_after_sync(block_device_t* device, uint32_t round) {
+    bench_crash_device_t crash;
+    bench_crash_device_init(&crash, device, UINT64_MAX);
+    if (fs_mount(&fs, &crash.device) != FS_SUCCESS) {
+        fail("mount");
+    }
+    char name[MAX_FILENAME_LENGTH];
+    snprintf(name, sizeof(name), "file%03u", round % MOUNT_FILES);
+    int32_t file = fs_find_file(&fs, name, 0);
+    File info;
+    if (file < 0 || fs_get_file_info(&fs, (uint32_t)file, &info) != FS_SUCCESS ||
+        fs_write_file(&fs, (uint32_t)file, buffer, BLOCK_SIZE, info.size) != BLOCK_SIZE ||
+        fs_sync(&fs) != FS_SUCCESS) {
+        fail("append");
+    }
+    crash.crashed = true;
+    fs_destroy(&fs);
+}
+
+/* Average time of fs_mount and the blocks it reads */
+static void run(const char* name, block_device_t* device, bool clean) {
+    uint64_t total_ns = 0;
+    uint64_t reads = 0;
+    for (uint32_t i = 0; i < MOUNT_ROUNDS; i++) {
+        if (!clean) {
+            crash_after_sync(device, i);
+        }
+        uint64_t start = bench_now_ns();
+        if (fs_mount(&fs, device) != FS_SUCCESS) {
+            fail("mount");
+        }
+        total_ns += bench_now_ns() - start;
+        /* Plus the superblock (read again after a replay) and the journal */
+        reads += fs.cache.stats.device_reads + 1 + fs.journal.stats.recovery_reads;
+        if (!clean && fs.journal.stats.replayed_blocks == 0) {
+            fail("replay");
+        }
+        if (!clean) {
+            reads++;
+        }
+        if (fs_unmount(&fs) != FS_SUCCESS) {
+            fail("unmount");
+        }
+    }
+    printf("%-38s %14.3f %14llu\n", name, (double)total_ns / MOUNT_ROUNDS / 1e6,
+           (unsigned long long)(reads / MOUNT_ROUNDS));
+}
+
+/* Format an image of size_mib MiB and fill it with MOUNT_FILES files */
+static void prepare(file_block_device_t* image, const char* path, uint32_t size_mib) {
+    if (file_block_device_open(image, path, size_mib * (1024 * 1024 / BLOCK_SIZE), true) != FS_SUCCESS ||
+        fs_mkfs(&image->device, 0) != FS_SUCCESS || fs_mount(&fs, &image->device) != FS_SUCCESS) {
+        fail("mkfs");
+    }
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t i = 0; i < MOUNT_FILES; i++) {
+        snprintf(name, sizeof(name), "file%03u", i);
+        int32_t file = fs_create_file(&fs, name, 0);
+        if (file < 0 || fs_write_file(&fs, (uint32_t)file, buffer, MOUNT_FILE_SIZE, 0) != MOUNT_FILE_SIZE) {
+            fail("populate");
+        }
+    }
+    if (fs_unmount(&fs) != FS_SUCCESS) {
+        fail("unmount");
+    }
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    const char* path = getenv("BENCH_IMAGE");
+    if (!path) {
+        path = "build/hosted/bench_fs_mount.img";
+    }
+
+    printf("\n=== MOUNT TIME (%u files of %u KiB) ===\n", MOUNT_FILES, MOUNT_FILE_SIZE / 1024);
+    printf("%-38s %14s %14s\n", "Image", "Mount (ms)", "Blocks read");
+    printf("%-38s %14s %14s\n", "--------------------------------------", "--------------", "--------------");
+
+    static const struct {
+        uint32_t size_mib;
+        const char* clean_name;
+        const char* dirty_name;
+    } images[] = {
+        { 16, "16 MiB, clean", "16 MiB, after crash (replay)" },
+        { 1024, "1 GiB sparse, clean", "1 GiB sparse, after crash (replay)" },
+    };
+    for (uint32_t i = 0; i < sizeof(images) / sizeof(images[0]); i++) {
+        file_block_device_t image;
+        prepare(&image, path, images[i].size_mib);
+        run(images[i].clean_name, &image.device, true);
+        run(images[i].dirty_name, &image.device, false);
+        file_block_device_close(&image);
+        unlink(path);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/* bench_fs_path.c - Path resolution through the dentry cache
+   Deep paths (eight directories) are resolved once by walking them with
+   fs_find_file per component, as callers had to before, and once with
+   fs_lookup_path, whose components hit the dentry cache. Misses (a missing
+   last component) are cached as well. Between lookups files are created and
+   deleted in the deepest directories, so the cache is invalidated the way a
+   busy tree would invalidate it. The file system runs over the RAM device. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include "file_system.h"
+
+#define PATH_TREES     8
+#define PATH_DEPTH     8
+#define PATH_LOOKUPS   262144
+#define PATH_CHURN     64      /* lookups between a create and delete */
+
+static FileSystem fs;
+static uint8_t data_area[8 * 1024 * 1024];
+static char paths[PATH_TREES][PATH_DEPTH * MAX_FILENAME_LENGTH];
+static char missing[PATH_TREES][PATH_DEPTH * MAX_FILENAME_LENGTH];
+static int32_t leaves[PATH_TREES];
+static int32_t deepest[PATH_TREES];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_path: %s failed\n", what);
+    exit(1);
+}
+
+/* What a caller without fs_lookup_path does: split and look up each name */
+static int32_t walk_components(const char* path) {
+    char name[MAX_FILENAME_LENGTH];
+    int32_t current = 0;
+    while (*path) {
+        while (*path == '/') {
+            path++;
+        }
+        size_t length = strcspn(path, "/");
+        if (length == 0) {
+            break;
+        }
+        memcpy(name, path, length);
+        name[length] = '\0';
+        path += length;
+        current = fs_find_file(&fs, name, (uint32_t)current);
+        if (current < 0) {
+            return current;
+        }
+    }
+    return current;
+}
+
+/* Create and delete a scratch file in one of the deep directories */
+static void churn(uint32_t i) {
+    uint32_t tree = (i / PATH_CHURN) % PATH_TREES;
+    int32_t scratch = fs_create_file(&fs, "scratch", (uint32_t)deepest[tree]);
+    if (scratch < 0 || fs_delete(&fs, (uint32_t)scratch) != FS_SUCCESS) {
+        fail("churn");
+    }
+}
+
+static double run(char (*set)[PATH_DEPTH * MAX_FILENAME_LENGTH], bool cached, bool hit) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < PATH_LOOKUPS; i++) {
+        uint32_t tree = i % PATH_TREES;
+        int32_t found = cached ? fs_lookup_path(&fs, set[tree], 0) : walk_components(set[tree]);
+        if (hit ? found != leaves[tree] : found >= 0) {
+            fail("lookup");
+        }
+        if (i % PATH_CHURN == 0) {
+            churn(i);
+        }
+    }
+    return (double)(bench_now_ns() - start) / PATH_LOOKUPS;
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    if (fs_init(&fs, data_area, sizeof(data_area)) != FS_SUCCESS) {
+        fail("fs_init");
+    }
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t t = 0; t < PATH_TREES; t++) {
+        int32_t dir = 0;
+        char* end = paths[t];
+        for (uint32_t d = 0; d < PATH_DEPTH; d++) {
+            snprintf(name, sizeof(name), "tree%u_level%u", t, d);
+            dir = fs_create_directory(&fs, name, (uint32_t)dir);
+            if (dir < 0) {
+                fail("mkdir");
+            }
+            end += sprintf(end, "/%s", name);
+        }
+        deepest[t] = dir;
+        leaves[t] = fs_create_file(&fs, "leaf", (uint32_t)dir);
+        if (leaves[t] < 0) {
+            fail("create");
+        }
+        sprintf(missing[t], "%s/absent", paths[t]);
+        strcat(paths[t], "/leaf");
+    }
+
+    bench_print_header("PATH LOOKUP (8 directories deep, ns per path)");
+    double walk_ns = run(paths, false, true);
+    double lookup_ns = run(paths, true, true);
+    bench_print_row("hit, fs_find_file walk vs fs_lookup_path", walk_ns, lookup_ns);
+    walk_ns = run(missing, false, false);
+    lookup_ns = run(missing, true, false);
+    bench_print_row("miss, fs_find_file walk vs fs_lookup_path", walk_ns, lookup_ns);
+    uint64_t lookups = fs.dcache_hits + fs.dcache_misses;
+    printf("  dentry cache: %llu hits, %llu misses (%.1f%% hit rate)\n", (unsigned long long)fs.dcache_hits,
+           (unsigned long long)fs.dcache_misses, lookups ? 100.0 * (double)fs.dcache_hits / (double)lookups : 0.0);
+    fs_destroy(&fs);
+    return 0;
+}
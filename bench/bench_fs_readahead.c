@@ -0,0 +1,208 @@
+/* bench_fs_readahead.c - Sequential read-ahead against block-at-a-time reads
+   A 4 MiB file, 32 times the block cache, is read front to back and at
+   random in 4 KiB pieces with read-ahead off (fs_set_readahead(fs, 0)) and
+   on, over three devices: RAM, a modelled slow store that charges a fixed
+   latency per request plus a per-block transfer time and serves prefetch
+   hints in the background, and a disk image file (set BENCH_IMAGE to place
+   it). Window sizes and read-ahead hits come from the profiler. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "file_system.h"
+#include "performance_profiler.h"
+
+#define RA_DEVICE_SIZE     (16u * 1024 * 1024)
+#define RA_FILE_SIZE       (4u * 1024 * 1024)
+#define RA_READ_SIZE       4096
+#define RA_ROUNDS          4
+#define RA_RANDOM_READS    1024
+#define SLOW_LATENCY_NS    20000    /* per device request */
+#define SLOW_BLOCK_NS      100      /* per block transferred */
+#define SLOW_PENDING       8        /* prefetches the slow store tracks */
+
+/* Memory device behind a request latency; prefetched runs become readable
+   without it once their background transfer would have finished */
+typedef struct {
+    uint32_t block;
+    uint32_t count;
+    uint64_t ready_ns;
+} slow_pending_t;
+
+typedef struct {
+    block_device_t device;
+    memory_block_device_t mem;
+    slow_pending_t pending[SLOW_PENDING];
+    uint32_t next_pending;
+    uint64_t busy_until_ns;
+} slow_device_t;
+
+static FileSystem fs;
+static slow_device_t slow;
+static uint8_t buffer[RA_READ_SIZE];
+static uint8_t contents[RA_FILE_SIZE];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_readahead: %s failed\n", what);
+    exit(1);
+}
+
+static void wait_until(uint64_t until) {
+    while (bench_now_ns() < until) {
+    }
+}
+
+/* Charge one request for count blocks from block */
+static void slow_request(uint32_t block, uint32_t count) {
+    for (uint32_t i = 0; i < SLOW_PENDING; i++) {
+        slow_pending_t* run = &slow.pending[i];
+        if (block >= run->block && block - run->block + count <= run->count) {
+            wait_until(run->ready_ns);
+            return;
+        }
+    }
+    wait_until(bench_now_ns() + SLOW_LATENCY_NS + (uint64_t)count * SLOW_BLOCK_NS);
+}
+
+static int32_t slow_read_blocks(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* data) {
+    (void)dev;
+    slow_request(block, count);
+    return block_device_read(&slow.mem.device, block, count, data);
+}
+
+static int32_t slow_write_blocks(block_device_t* dev, uint32_t block, uint32_t count, const uint8_t* data) {
+    (void)dev;
+    wait_until(bench_now_ns() + SLOW_LATENCY_NS + (uint64_t)count * SLOW_BLOCK_NS);
+    return block_device_write(&slow.mem.device, block, count, data);
+}
+
+static int32_t slow_flush(block_device_t* dev) {
+    (void)dev;
+    return block_device_flush(&slow.mem.device);
+}
+
+/* A batch is one queued request; a run that was prefetched costs nothing extra */
+static int32_t slow_read_batch(block_device_t* dev, const block_io_t* segments, uint32_t count) {
+    (void)dev;
+    uint32_t first = segments[0].block;
+    uint32_t last = segments[count - 1].block + segments[count - 1].count;
+    slow_request(first, last - first);
+    return block_device_read_batch(&slow.mem.device, segments, count);
+}
+
+static int32_t slow_prefetch(block_device_t* dev, uint32_t block, uint32_t count) {
+    (void)dev;
+    uint64_t now = bench_now_ns();
+    uint64_t start = slow.busy_until_ns > now ? slow.busy_until_ns : now;
+    slow_pending_t* run = &slow.pending[slow.next_pending++ % SLOW_PENDING];
+    run->block = block;
+    run->count = count;
+    run->ready_ns = start + SLOW_LATENCY_NS + (uint64_t)count * SLOW_BLOCK_NS;
+    slow.busy_until_ns = run->ready_ns;
+    return 0;
+}
+
+static const block_device_ops_t slow_ops = {
+    slow_read_blocks, slow_write_blocks, slow_flush, slow_read_batch, NULL, slow_prefetch,
+};
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/* ns per 4 KiB read of file with read-ahead windows up to max_blocks */
+static double sequential(int32_t file, uint32_t max_blocks) {
+    fs_set_readahead(&fs, max_blocks);
+    uint64_t start = bench_now_ns();
+    for (uint32_t round = 0; round < RA_ROUNDS; round++) {
+        for (uint32_t offset = 0; offset < RA_FILE_SIZE; offset += RA_READ_SIZE) {
+            if (fs_read_file(&fs, (uint32_t)file, buffer, RA_READ_SIZE, offset) != RA_READ_SIZE) {
+                fail("sequential read");
+            }
+        }
+    }
+    return (double)(bench_now_ns() - start) / (RA_ROUNDS * (RA_FILE_SIZE / RA_READ_SIZE));
+}
+
+static double random_reads(int32_t file, uint32_t max_blocks) {
+    fs_set_readahead(&fs, max_blocks);
+    uint32_t state = 7;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < RA_RANDOM_READS; i++) {
+        uint32_t offset = next_random(&state) % (RA_FILE_SIZE / RA_READ_SIZE) * RA_READ_SIZE;
+        if (fs_read_file(&fs, (uint32_t)file, buffer, RA_READ_SIZE, offset) != RA_READ_SIZE) {
+            fail("random read");
+        }
+    }
+    return (double)(bench_now_ns() - start) / RA_RANDOM_READS;
+}
+
+static void run(const char* name, block_device_t* device) {
+    if (fs_init_device(&fs, device) != FS_SUCCESS) {
+        fail("fs_init_device");
+    }
+    int32_t file = fs_create_file(&fs, "stream", 0);
+    if (file < 0 || fs_write_file(&fs, (uint32_t)file, contents, RA_FILE_SIZE, 0) != (int32_t)RA_FILE_SIZE ||
+        fs_sync(&fs) != FS_SUCCESS) {
+        fail("populate");
+    }
+
+    char row[64];
+    profiler_cache_stats_t before, after;
+    profiler_get_cache_stats(&before);
+    double off_ns = sequential(file, 0);
+    double on_ns = sequential(file, FS_READAHEAD_MAX);
+    profiler_get_cache_stats(&after);
+    snprintf(row, sizeof(row), "%s, sequential", name);
+    bench_print_row(row, off_ns, on_ns);
+    uint64_t ahead = after.readahead_blocks - before.readahead_blocks;
+    uint64_t used = after.readahead_hits - before.readahead_hits;
+
+    off_ns = random_reads(file, 0);
+    on_ns = random_reads(file, FS_READAHEAD_MAX);
+    snprintf(row, sizeof(row), "%s, random", name);
+    bench_print_row(row, off_ns, on_ns);
+    printf("  read-ahead: window up to %u blocks, %llu of %llu blocks used\n", after.readahead_window_max,
+           (unsigned long long)used, (unsigned long long)ahead);
+    fs_destroy(&fs);
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    profiler_init();
+    for (uint32_t i = 0; i < RA_FILE_SIZE; i++) {
+        contents[i] = (uint8_t)(i * 31 + (i >> 9));
+    }
+    uint8_t* memory = malloc(RA_DEVICE_SIZE);
+    if (!memory) {
+        fail("malloc");
+    }
+
+    bench_print_header("READ-AHEAD (4 MiB file, 4 KiB reads, ns per read)");
+    memory_block_device_t mem;
+    memory_block_device_init(&mem, memory, RA_DEVICE_SIZE);
+    run("RAM", &mem.device);
+
+    memory_block_device_init(&slow.mem, memory, RA_DEVICE_SIZE);
+    slow.device.ops = &slow_ops;
+    slow.device.block_count = slow.mem.device.block_count;
+    run("slow store", &slow.device);
+    free(memory);
+
+    const char* path = getenv("BENCH_IMAGE");
+    if (!path) {
+        path = "build/hosted/bench_fs_readahead.img";
+    }
+    file_block_device_t image;
+    if (file_block_device_open(&image, path, RA_DEVICE_SIZE / BLOCK_SIZE, true) != FS_SUCCESS) {
+        fail("image open");
+    }
+    run("image file", &image.device);
+    file_block_device_close(&image);
+    unlink(path);
+    return 0;
+}
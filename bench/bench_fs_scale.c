@@ -0,0 +1,105 @@
+/* bench_fs_scale.c - Lookup and I/O throughput at tens of thousands of entries
+   and MiB-sized files. Files past the direct blocks are reached through the
+   single and double indirect blocks. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "file_system.h"
+
+#define SCALE_ENTRIES   20000
+#define SCALE_LOOKUPS   200000
+#define SCALE_IO_ROUNDS 20
+#define SCALE_INODES    32768
+
+static FileSystem fs;
+static memory_block_device_t device;
+static uint8_t data_area[24 * 1024 * 1024];
+static uint8_t buffer[8 * 1024 * 1024];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_scale: %s failed\n", what);
+    exit(1);
+}
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/* Random lookups among SCALE_ENTRIES siblings */
+static double run_lookup(void) {
+    char name[MAX_FILENAME_LENGTH];
+    uint32_t state = 7;
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < SCALE_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "entry%05u", next_random(&state) % SCALE_ENTRIES);
+        if (fs_find_file(&fs, name, 0) < 0) {
+            fail("lookup");
+        }
+    }
+    return (double)(bench_now_ns() - start) / SCALE_LOOKUPS;
+}
+
+/* MiB/s for whole-file writes or reads of the given size */
+static double run_io(uint32_t size, int write) {
+    int32_t file = fs_find_file(&fs, "big", 0);
+    if (file < 0) {
+        file = fs_create_file(&fs, "big", 0);
+    }
+    if (file < 0) {
+        fail("create");
+    }
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < SCALE_IO_ROUNDS; i++) {
+        int32_t done = write ? fs_write_file(&fs, (uint32_t)file, buffer, size, 0)
+                             : fs_read_file(&fs, (uint32_t)file, buffer, size, 0);
+        if (done != (int32_t)size) {
+            fail(write ? "write" : "read");
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    return (double)size * SCALE_IO_ROUNDS / (1024.0 * 1024.0) * 1e9 / (double)elapsed;
+}
+
+int main(void) {
+    memory_block_device_init(&device, data_area, sizeof(data_area));
+    if (bench_setup() != 0 || fs_mkfs(&device.device, SCALE_INODES) != FS_SUCCESS ||
+        fs_mount(&fs, &device.device) != FS_SUCCESS) {
+        return 1;
+    }
+
+    char name[MAX_FILENAME_LENGTH];
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < SCALE_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "entry%05u", i);
+        if (fs_create_file(&fs, name, 0) < 0) {
+            fail("populate");
+        }
+    }
+    double create_ns = (double)(bench_now_ns() - start) / SCALE_ENTRIES;
+
+    bench_print_latency_header("FILE SYSTEM AT SCALE (per operation)");
+    bench_print_latency("create among 20000 siblings", create_ns);
+    bench_print_latency("random lookup among 20000 siblings", run_lookup());
+
+    printf("\n%-40s %15s %15s\n", "File size", "Write (MiB/s)", "Read (MiB/s)");
+    printf("%-40s %15s %15s\n", "----------------------------------------",
+           "---------------", "---------------");
+    static const struct {
+        const char* name;
+        uint32_t size;
+    } sizes[] = {
+        { "4 KiB (direct)", 4u << 10 },
+        { "64 KiB (single indirect)", 64u << 10 },
+        { "1 MiB (double indirect)", 1u << 20 },
+        { "8 MiB (double indirect)", 8u << 20 },
+    };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        double write_rate = run_io(sizes[i].size, 1);
+        double read_rate = run_io(sizes[i].size, 0);
+        printf("%-40s %15.1f %15.1f\n", sizes[i].name, write_rate, read_rate);
+    }
+
+    fs_destroy(&fs);
+    return 0;
+}
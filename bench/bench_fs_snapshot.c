@@ -0,0 +1,138 @@
+/* bench_fs_snapshot.c - Copy-on-write snapshots against copying the tree
+   1024 files in 32 directories are backed up twice: once by reading every
+   file and writing it into a second tree, as a backup without snapshots
+   would, and once with fs_snapshot, which copies the entries and shares
+   the blocks. The tree is populated with 8 KiB and then 32 KiB files, so
+   the copy grows with the data while the snapshot stays put. Afterwards
+   overwrites of blocks still shared with a snapshot (each copied first)
+   are timed against overwrites of blocks the file already owns. The file
+   system runs over the RAM device. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include "file_system.h"
+
+#define SNAP_DEVICE_SIZE   (96u * 1024 * 1024)
+#define SNAP_DIRS          32
+#define SNAP_FILES         1024
+#define SNAP_ROUNDS        4        /* snapshots timed per tree */
+#define SNAP_WRITE         512
+
+static FileSystem fs;
+static int32_t files[SNAP_FILES];
+static uint8_t contents[32 * 1024];
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_snapshot: %s failed\n", what);
+    exit(1);
+}
+
+static void populate(uint8_t* memory, uint32_t file_size) {
+    if (fs_init(&fs, memory, SNAP_DEVICE_SIZE) != FS_SUCCESS) {
+        fail("fs_init");
+    }
+    char name[MAX_FILENAME_LENGTH];
+    int32_t dirs[SNAP_DIRS];
+    for (uint32_t d = 0; d < SNAP_DIRS; d++) {
+        snprintf(name, sizeof(name), "dir%u", d);
+        dirs[d] = fs_create_directory(&fs, name, 0);
+        if (dirs[d] < 0) {
+            fail("mkdir");
+        }
+    }
+    for (uint32_t i = 0; i < SNAP_FILES; i++) {
+        snprintf(name, sizeof(name), "file%u", i);
+        files[i] = fs_create_file(&fs, name, (uint32_t)dirs[i % SNAP_DIRS]);
+        if (files[i] < 0 || fs_write_file(&fs, (uint32_t)files[i], contents, file_size, 0) != (int32_t)file_size) {
+            fail("populate");
+        }
+    }
+    if (fs_sync(&fs) != FS_SUCCESS) {
+        fail("sync");
+    }
+}
+
+/* ns to copy every file into a parallel tree under one new directory */
+static double copy_tree(uint32_t file_size) {
+    static uint8_t buffer[sizeof(contents)];
+    char name[MAX_FILENAME_LENGTH];
+    int32_t dirs[SNAP_DIRS];
+    uint64_t start = bench_now_ns();
+    int32_t backup = fs_create_directory(&fs, "backup", 0);
+    for (uint32_t d = 0; d < SNAP_DIRS && backup >= 0; d++) {
+        snprintf(name, sizeof(name), "dir%u", d);
+        dirs[d] = fs_create_directory(&fs, name, (uint32_t)backup);
+        if (dirs[d] < 0) {
+            fail("backup mkdir");
+        }
+    }
+    for (uint32_t i = 0; i < SNAP_FILES; i++) {
+        snprintf(name, sizeof(name), "file%u", i);
+        int32_t copy = fs_create_file(&fs, name, (uint32_t)dirs[i % SNAP_DIRS]);
+        if (copy < 0 || fs_read_file(&fs, (uint32_t)files[i], buffer, file_size, 0) != (int32_t)file_size ||
+            fs_write_file(&fs, (uint32_t)copy, buffer, file_size, 0) != (int32_t)file_size) {
+            fail("copy");
+        }
+    }
+    if (backup < 0 || fs_sync(&fs) != FS_SUCCESS) {
+        fail("copy");
+    }
+    return (double)(bench_now_ns() - start);
+}
+
+static double snapshot_tree(void) {
+    char name[MAX_FILENAME_LENGTH];
+    uint64_t start = bench_now_ns();
+    for (uint32_t round = 0; round < SNAP_ROUNDS; round++) {
+        snprintf(name, sizeof(name), "snapshot%u", round);
+        if (fs_snapshot(&fs, name) < 0 || fs_sync(&fs) != FS_SUCCESS) {
+            fail("fs_snapshot");
+        }
+    }
+    return (double)(bench_now_ns() - start) / SNAP_ROUNDS;
+}
+
+/* ns per SNAP_WRITE byte overwrite at the start of each file */
+static double overwrite(void) {
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < SNAP_FILES; i++) {
+        if (fs_write_file(&fs, (uint32_t)files[i], contents, SNAP_WRITE, (i % 16) * SNAP_WRITE) != SNAP_WRITE) {
+            fail("overwrite");
+        }
+    }
+    return (double)(bench_now_ns() - start) / SNAP_FILES;
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (uint8_t)(i * 7 + (i >> 9));
+    }
+    uint8_t* memory = malloc(SNAP_DEVICE_SIZE);
+    if (!memory) {
+        fail("malloc");
+    }
+
+    bench_print_header("SNAPSHOTS (1024 files, 32 dirs, ns per backup)");
+    double shared_ns = 0.0, private_ns = 0.0;
+    for (uint32_t file_size = 8 * 1024; file_size <= sizeof(contents); file_size *= 4) {
+        char row[64];
+        populate(memory, file_size);
+        double copy_ns = copy_tree(file_size);
+        double snapshot_ns = snapshot_tree();
+        snprintf(row, sizeof(row), "%u MiB, copy vs fs_snapshot", file_size * SNAP_FILES / (1024 * 1024));
+        bench_print_row(row, copy_ns, snapshot_ns);
+        shared_ns = overwrite();
+        private_ns = overwrite();
+        fs_destroy(&fs);
+    }
+
+    bench_print_latency_header("OVERWRITES AFTER A SNAPSHOT (512 B)");
+    bench_print_latency("shared block (copied first)", shared_ns);
+    bench_print_latency("block the file owns", private_ns);
+    free(memory);
+    return 0;
+}
@@ -0,0 +1,269 @@
+/* bench_fs_threads.c - File system throughput as threads are added
+   Each thread works in a directory of its own: 512 B overwrites and reads
+   of its files (checked against a copy it keeps), path lookups, and every
+   so often a file created and deleted, while all threads also read one
+   shared file. The workload runs once with every call behind one global
+   mutex, as callers had to serialize the file system before, and once
+   relying on its own locks. Contents are checked after every run. The
+   file system runs over the RAM device.
+
+   Last, every thread grows a file of its own with 1 MiB writes. Each write
+   logs more than a transaction holds, so it has to commit partway through
+   while the others are inside their writes too; no transaction may
+   outgrow the journal. */
+
+#include "bench.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_system.h"
+
+#define THREADS_MAX      8
+#define THREADS_OPS      65536    /* operations per thread */
+#define THREADS_FILES    4        /* files per thread */
+#define THREADS_FILE     (16 * 1024)
+#define THREADS_SHARED   (64 * 1024)
+#define THREADS_IO       512
+#define THREADS_CHURN    64       /* operations between a create and delete */
+#define GROW_WRITE       (1024 * 1024)
+#define GROW_WRITES      2
+
+typedef struct {
+    uint32_t id;
+    int32_t dir;
+    int32_t files[THREADS_FILES];
+    char paths[THREADS_FILES][64];
+    uint8_t mirror[THREADS_FILES][THREADS_FILE];
+} worker_t;
+
+static FileSystem fs;
+static uint8_t data_area[32 * 1024 * 1024];
+static worker_t workers[THREADS_MAX];
+static int32_t shared_file;
+static uint8_t shared_contents[THREADS_SHARED];
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start_barrier;
+static bool use_global_lock;
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_fs_threads: %s failed\n", what);
+    exit(1);
+}
+
+static void lock(void) {
+    if (use_global_lock) {
+        pthread_mutex_lock(&global_lock);
+    }
+}
+
+static void unlock(void) {
+    if (use_global_lock) {
+        pthread_mutex_unlock(&global_lock);
+    }
+}
+
+static void* work(void* arg) {
+    worker_t* worker = arg;
+    uint8_t buffer[THREADS_IO];
+    uint32_t seed = worker->id * 2654435761u + 1;
+    pthread_barrier_wait(&start_barrier);
+
+    for (uint32_t op = 0; op < THREADS_OPS; op++) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t f = (seed >> 8) % THREADS_FILES;
+        uint32_t offset = ((seed >> 12) % (THREADS_FILE / THREADS_IO)) * THREADS_IO;
+        int32_t result;
+        switch (op % 4) {
+        case 0:     /* overwrite */
+            memset(worker->mirror[f] + offset, (int)(seed >> 24), THREADS_IO);
+            lock();
+            result = fs_write_file(&fs, (uint32_t)worker->files[f], worker->mirror[f] + offset, THREADS_IO, offset);
+            unlock();
+            if (result != THREADS_IO) {
+                fail("write");
+            }
+            break;
+        case 1:     /* read back */
+            lock();
+            result = fs_read_file(&fs, (uint32_t)worker->files[f], buffer, THREADS_IO, offset);
+            unlock();
+            if (result != THREADS_IO || memcmp(buffer, worker->mirror[f] + offset, THREADS_IO) != 0) {
+                fail("read");
+            }
+            break;
+        case 2:     /* path lookup */
+            lock();
+            result = fs_lookup_path(&fs, worker->paths[f], 0);
+            unlock();
+            if (result != worker->files[f]) {
+                fail("lookup");
+            }
+            break;
+        default:    /* read of the shared file */
+            offset = ((seed >> 12) % (THREADS_SHARED / THREADS_IO)) * THREADS_IO;
+            lock();
+            result = fs_read_file(&fs, (uint32_t)shared_file, buffer, THREADS_IO, offset);
+            unlock();
+            if (result != THREADS_IO || memcmp(buffer, shared_contents + offset, THREADS_IO) != 0) {
+                fail("shared read");
+            }
+            break;
+        }
+        if (op % THREADS_CHURN == 0) {
+            lock();
+            int32_t scratch = fs_create_file(&fs, "scratch", (uint32_t)worker->dir);
+            result = scratch < 0 ? scratch : fs_delete(&fs, (uint32_t)scratch);
+            unlock();
+            if (result != FS_SUCCESS) {
+                fail("churn");
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Thousands of operations per second across all threads */
+static double run(uint32_t threads, bool global) {
+    pthread_t tids[THREADS_MAX];
+    use_global_lock = global;
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (uint32_t t = 0; t < threads; t++) {
+        pthread_create(&tids[t], NULL, work, &workers[t]);
+    }
+
+    uint64_t start = bench_now_ns();
+    pthread_barrier_wait(&start_barrier);
+    for (uint32_t t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    pthread_barrier_destroy(&start_barrier);
+    return (double)threads * THREADS_OPS * 1000000.0 / (double)elapsed;
+}
+
+/* Append GROW_WRITES writes to the thread's file, each filled with its id */
+static int32_t grow_files[THREADS_MAX];
+
+static void* grow(void* arg) {
+    worker_t* worker = arg;
+    uint8_t* chunk = malloc(GROW_WRITE);
+    if (!chunk) {
+        fail("malloc");
+    }
+    memset(chunk, (int)(worker->id + 1), GROW_WRITE);
+    pthread_barrier_wait(&start_barrier);
+    for (uint32_t i = 0; i < GROW_WRITES; i++) {
+        if (fs_write_file(&fs, (uint32_t)grow_files[worker->id], chunk, GROW_WRITE, i * GROW_WRITE) != GROW_WRITE) {
+            fail("grow");
+        }
+    }
+    free(chunk);
+    return NULL;
+}
+
+static void check_growth(void) {
+    pthread_t tids[THREADS_MAX];
+    char name[MAX_FILENAME_LENGTH];
+    uint64_t overflows = fs.journal.stats.overflows;
+    pthread_barrier_init(&start_barrier, NULL, THREADS_MAX);
+    for (uint32_t t = 0; t < THREADS_MAX; t++) {
+        snprintf(name, sizeof(name), "grow%u", t);
+        grow_files[t] = fs_create_file(&fs, name, (uint32_t)workers[t].dir);
+        if (grow_files[t] < 0) {
+            fail("create grow");
+        }
+    }
+    for (uint32_t t = 0; t < THREADS_MAX; t++) {
+        pthread_create(&tids[t], NULL, grow, &workers[t]);
+    }
+    for (uint32_t t = 0; t < THREADS_MAX; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+    if (fs.journal.stats.overflows != overflows) {
+        fail("commit during concurrent writes");
+    }
+
+    static uint8_t buffer[GROW_WRITE];
+    for (uint32_t t = 0; t < THREADS_MAX; t++) {
+        for (uint32_t i = 0; i < GROW_WRITES; i++) {
+            if (fs_read_file(&fs, (uint32_t)grow_files[t], buffer, GROW_WRITE, i * GROW_WRITE) != GROW_WRITE) {
+                fail("grow read");
+            }
+            for (uint32_t b = 0; b < GROW_WRITE; b++) {
+                if (buffer[b] != (uint8_t)(t + 1)) {
+                    fail("grow contents");
+                }
+            }
+        }
+    }
+    printf("%u threads wrote %u MiB each with no transaction outgrowing the journal\n", THREADS_MAX,
+           GROW_WRITES * GROW_WRITE / (1024 * 1024));
+}
+
+/* Every file still holds what its thread last wrote */
+static void verify(void) {
+    static uint8_t buffer[THREADS_FILE];
+    if (fs_sync(&fs) != FS_SUCCESS) {
+        fail("sync");
+    }
+    for (uint32_t t = 0; t < THREADS_MAX; t++) {
+        for (uint32_t f = 0; f < THREADS_FILES; f++) {
+            if (fs_read_file(&fs, (uint32_t)workers[t].files[f], buffer, THREADS_FILE, 0) != THREADS_FILE ||
+                memcmp(buffer, workers[t].mirror[f], THREADS_FILE) != 0) {
+                fail("verify");
+            }
+        }
+    }
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    if (fs_init(&fs, data_area, sizeof(data_area)) != FS_SUCCESS) {
+        fail("fs_init");
+    }
+    for (uint32_t i = 0; i < THREADS_SHARED; i++) {
+        shared_contents[i] = (uint8_t)(i * 13 + (i >> 9));
+    }
+    shared_file = fs_create_file(&fs, "shared", 0);
+    if (shared_file < 0 || fs_write_file(&fs, (uint32_t)shared_file, shared_contents, THREADS_SHARED, 0) !=
+                               THREADS_SHARED) {
+        fail("create shared");
+    }
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t t = 0; t < THREADS_MAX; t++) {
+        worker_t* worker = &workers[t];
+        worker->id = t;
+        snprintf(name, sizeof(name), "thread%u", t);
+        worker->dir = fs_create_directory(&fs, name, 0);
+        if (worker->dir < 0) {
+            fail("mkdir");
+        }
+        for (uint32_t f = 0; f < THREADS_FILES; f++) {
+            snprintf(name, sizeof(name), "file%u", f);
+            snprintf(worker->paths[f], sizeof(worker->paths[f]), "/thread%u/file%u", t, f);
+            memset(worker->mirror[f], (int)(t * THREADS_FILES + f), THREADS_FILE);
+            worker->files[f] = fs_create_file(&fs, name, (uint32_t)worker->dir);
+            if (worker->files[f] < 0 || fs_write_file(&fs, (uint32_t)worker->files[f], worker->mirror[f],
+                                                      THREADS_FILE, 0) != THREADS_FILE) {
+                fail("create");
+            }
+        }
+    }
+
+    printf("\n=== CONCURRENT FILE SYSTEM CALLS (K ops/s) ===\n");
+    printf("%-10s %15s %15s %10s\n", "Threads", "Global lock", "Fine-grained", "Speedup");
+    printf("%-10s %15s %15s %10s\n", "----------", "---------------", "---------------", "----------");
+    for (uint32_t threads = 1; threads <= THREADS_MAX; threads *= 2) {
+        double global = run(threads, true);
+        verify();
+        double fine = run(threads, false);
+        verify();
+        printf("%-10u %15.1f %15.1f %9.2fx\n", threads, global, fine, fine / global);
+    }
+    check_growth();
+    fs_destroy(&fs);
+    return 0;
+}
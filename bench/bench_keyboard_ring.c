@@ -0,0 +1,179 @@
+/* bench_keyboard_ring.c - Lock-free SPSC ring behind keyboard input
+   In the kernel the IRQ 1 handler pushes scancodes into spsc_ring_t and
+   read_char pops them. Here a producer thread stands in for the interrupt
+   and a consumer thread for the reader: 16M bytes cross the ring and the
+   consumer checks that every one arrives once, in order. The same traffic
+   through a ring guarded by a mutex gives the baseline. A full ring must
+   refuse pushes and count them without disturbing unread bytes.
+
+   Last, the CPU a reader burns while waiting: keys arrive 50 ms apart, as
+   typing does, and the reader either polls for them, as read_char_timeout
+   did before IRQ 1 drove input, or sleeps until the producer wakes it, the
+   stand-in for hlt and the keyboard interrupt. Its thread CPU time over
+   the wall time is the idle cost at a prompt. */
+
+#include "bench.h"
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <time.h>
+#include "spsc_ring.h"
+
+#define RING_BYTES (16u * 1024 * 1024)
+#define IDLE_KEYS  20
+#define IDLE_GAP_NS 50000000L   /* between keys */
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_keyboard_ring: %s failed\n", what);
+    exit(1);
+}
+
+/* Baseline: the same ring with every push and pop under one mutex */
+typedef struct {
+    uint8_t data[SPSC_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    pthread_mutex_t lock;
+} locked_ring_t;
+
+static bool locked_ring_push(locked_ring_t* ring, uint8_t byte) {
+    pthread_mutex_lock(&ring->lock);
+    bool room = ring->head - ring->tail != SPSC_RING_SIZE;
+    if (room) {
+        ring->data[ring->head++ & (SPSC_RING_SIZE - 1)] = byte;
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return room;
+}
+
+static bool locked_ring_pop(locked_ring_t* ring, uint8_t* byte) {
+    pthread_mutex_lock(&ring->lock);
+    bool any = ring->head != ring->tail;
+    if (any) {
+        *byte = ring->data[ring->tail++ & (SPSC_RING_SIZE - 1)];
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return any;
+}
+
+static spsc_ring_t spsc;
+static locked_ring_t locked = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* A full or empty ring yields, so both sides progress on one CPU */
+static void* spsc_producer(void* arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < RING_BYTES; i++) {
+        while (!spsc_ring_push(&spsc, (uint8_t)(i * 7))) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void* locked_producer(void* arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < RING_BYTES; i++) {
+        while (!locked_ring_push(&locked, (uint8_t)(i * 7))) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* ns per byte moved from producer to consumer */
+static double run(bool lock_free) {
+    pthread_t producer;
+    uint64_t start = bench_now_ns();
+    if (pthread_create(&producer, NULL, lock_free ? spsc_producer : locked_producer, NULL) != 0) {
+        fail("pthread_create");
+    }
+    for (uint32_t i = 0; i < RING_BYTES; i++) {
+        uint8_t byte;
+        while (!(lock_free ? spsc_ring_pop(&spsc, &byte) : locked_ring_pop(&locked, &byte))) {
+            sched_yield();
+        }
+        if (byte != (uint8_t)(i * 7)) {
+            fprintf(stderr, "byte %u: got %u, expected %u\n", i, byte, (uint8_t)(i * 7));
+            fail(lock_free ? "spsc order" : "locked order");
+        }
+    }
+    pthread_join(producer, NULL);
+    return (double)(bench_now_ns() - start) / RING_BYTES;
+}
+
+/* Keys at typing speed; wake stands in for the interrupt ending hlt */
+static spsc_ring_t typed;
+static sem_t wake;
+
+static void* typist(void* arg) {
+    (void)arg;
+    struct timespec gap = { 0, IDLE_GAP_NS };
+    for (uint32_t i = 0; i < IDLE_KEYS; i++) {
+        nanosleep(&gap, NULL);
+        spsc_ring_push(&typed, (uint8_t)i);
+        sem_post(&wake);
+    }
+    return NULL;
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Percent of one CPU the reader uses while waiting for IDLE_KEYS keys */
+static double idle_cpu(bool sleeping) {
+    pthread_t producer;
+    sem_init(&wake, 0, 0);
+    uint64_t start = bench_now_ns();
+    uint64_t cpu_start = thread_cpu_ns();
+    if (pthread_create(&producer, NULL, typist, NULL) != 0) {
+        fail("pthread_create");
+    }
+    for (uint32_t i = 0; i < IDLE_KEYS; i++) {
+        uint8_t byte;
+        while (!spsc_ring_pop(&typed, &byte)) {
+            if (sleeping) {
+                sem_wait(&wake);
+            }
+        }
+        if (byte != (uint8_t)i) {
+            fail("typed order");
+        }
+    }
+    double percent = 100.0 * (double)(thread_cpu_ns() - cpu_start) / (double)(bench_now_ns() - start);
+    pthread_join(producer, NULL);
+    sem_destroy(&wake);
+    return percent;
+}
+
+int main(void) {
+    /* Overflow: the ring keeps the first SPSC_RING_SIZE bytes */
+    spsc_ring_t ring = { .head = UINT32_MAX - 10, .tail = UINT32_MAX - 10 };
+    for (uint32_t i = 0; i < SPSC_RING_SIZE + 5; i++) {
+        if (spsc_ring_push(&ring, (uint8_t)i) != (i < SPSC_RING_SIZE)) {
+            fail("push while full");
+        }
+    }
+    for (uint32_t i = 0; i < SPSC_RING_SIZE; i++) {
+        uint8_t byte;
+        if (!spsc_ring_pop(&ring, &byte) || byte != (uint8_t)i) {
+            fail("pop across index wrap");
+        }
+    }
+    if (!spsc_ring_empty(&ring) || ring.dropped != 5) {
+        fail("dropped count");
+    }
+
+    bench_print_header("KEYBOARD RING, PRODUCER TO CONSUMER (ns per byte)");
+    bench_print_row("16M bytes, mutex vs lock-free", run(false), run(true));
+    printf("All %u bytes arrived in order through both rings\n", RING_BYTES);
+
+    double polled = idle_cpu(false);
+    double sleeping = idle_cpu(true);
+    printf("\nReader CPU while waiting for %u keys %ld ms apart: polling %.1f%%, sleeping %.2f%%\n", IDLE_KEYS,
+           IDLE_GAP_NS / 1000000, polled, sleeping);
+    return 0;
+}
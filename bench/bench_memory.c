@@ -0,0 +1,66 @@
+/* bench_memory.c - Page allocator latency on the real allocator */
+
+#include "bench.h"
+#include <stdlib.h>
+
+#define BENCH_ROUNDS  20000
+#define BENCH_BATCH   16
+
+static void* blocks[BENCH_BATCH];
+
+/* allocate_memory + free_memory of one size, BENCH_BATCH blocks live at a time */
+static double run_blocks(size_t size) {
+    uint64_t start = bench_now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            blocks[i] = allocate_memory(size);
+            if (!blocks[i]) {
+                fprintf(stderr, "allocate_memory(%zu) failed\n", size);
+                exit(1);
+            }
+        }
+        for (int i = BENCH_BATCH - 1; i >= 0; i--) {
+            free_memory(blocks[i]);
+        }
+    }
+    return (double)(bench_now_ns() - start) / (BENCH_ROUNDS * BENCH_BATCH);
+}
+
+/* allocate_pages + free_pages of an odd-sized run */
+static double run_pages(size_t count, size_t alignment) {
+    uint64_t start = bench_now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            blocks[i] = allocate_pages(count, alignment);
+            if (!blocks[i]) {
+                fprintf(stderr, "allocate_pages(%zu) failed\n", count);
+                exit(1);
+            }
+        }
+        for (int i = BENCH_BATCH - 1; i >= 0; i--) {
+            free_pages(blocks[i], count);
+        }
+    }
+    return (double)(bench_now_ns() - start) / (BENCH_ROUNDS * BENCH_BATCH);
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    uint32_t free_at_start = memory_free_pages();
+
+    bench_print_latency_header("PAGE ALLOCATOR (alloc+free)");
+    bench_print_latency("allocate_memory 4 KiB", run_blocks(4096));
+    bench_print_latency("allocate_memory 64 KiB", run_blocks(64 * 1024));
+    bench_print_latency("allocate_memory 128 KiB", run_blocks(128 * 1024));
+    bench_print_latency("allocate_pages 3 pages", run_pages(3, 0));
+    bench_print_latency("allocate_pages 37 pages, 64 KiB aligned", run_pages(37, 64 * 1024));
+
+    memory_drain_cpu_caches();
+    if (memory_free_pages() != free_at_start) {
+        fprintf(stderr, "leaked %u pages\n", free_at_start - memory_free_pages());
+        return 1;
+    }
+    return 0;
+}
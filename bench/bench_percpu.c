@@ -0,0 +1,83 @@
+/* bench_percpu.c - Single-page alloc/free throughput with and without per-CPU caches
+   Each thread plays one CPU and churns a small working set of pages. */
+
+#include "bench.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include "scalability.h"
+
+#define BENCH_ITERATIONS  200000
+#define BENCH_WORKING_SET 8
+
+static __thread int bench_cpu = 0;
+static pthread_barrier_t start_barrier;
+
+static int bench_cpu_id(void) {
+    return bench_cpu;
+}
+
+static void* churn(void* arg) {
+    void* pages[BENCH_WORKING_SET];
+    bench_cpu = (int)(intptr_t)arg;
+    pthread_barrier_wait(&start_barrier);
+
+    for (int i = 0; i < BENCH_ITERATIONS / BENCH_WORKING_SET; i++) {
+        for (int p = 0; p < BENCH_WORKING_SET; p++) {
+            pages[p] = allocate_memory(PAGE_SIZE);
+            if (!pages[p]) {
+                fprintf(stderr, "cpu %d: out of pages\n", bench_cpu);
+                exit(1);
+            }
+        }
+        for (int p = BENCH_WORKING_SET - 1; p >= 0; p--) {
+            free_memory(pages[p]);
+        }
+    }
+    return NULL;
+}
+
+/* Millions of alloc+free pairs per second across all threads */
+static double run(int threads) {
+    pthread_t tids[SC_MAX_CPUS];
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)threads + 1);
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&tids[t], NULL, churn, (void*)(intptr_t)t);
+    }
+
+    uint64_t start = bench_now_ns();
+    pthread_barrier_wait(&start_barrier);
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    pthread_barrier_destroy(&start_barrier);
+
+    memory_drain_cpu_caches();
+    return (double)threads * BENCH_ITERATIONS * 1000.0 / (double)elapsed;
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    memory_set_cpu_resolver(bench_cpu_id);
+    uint32_t free_at_start = memory_free_pages();
+
+    printf("\n=== PER-CPU PAGE CACHES (M alloc+free pairs/s) ===\n");
+    printf("%-10s %15s %15s %10s\n", "Threads", "Shared lock", "Per-CPU", "Speedup");
+    printf("%-10s %15s %15s %10s\n", "----------", "---------------", "---------------", "----------");
+
+    for (int threads = 1; threads <= SC_MAX_CPUS; threads *= 2) {
+        memory_set_cpu_caches(false);
+        double shared = run(threads);
+        memory_set_cpu_caches(true);
+        double percpu = run(threads);
+        printf("%-10d %15.2f %15.2f %9.2fx\n", threads, shared, percpu, percpu / shared);
+    }
+
+    if (memory_free_pages() != free_at_start) {
+        fprintf(stderr, "leaked %u pages\n", free_at_start - memory_free_pages());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+/* bench_slab.c - Slab cache allocator vs. the first-fit small allocation pool
+   First, slab pages belong to the kernel: objects one user allocates from
+   the size classes must go back, pages and all, when another user frees
+   them. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "slab.h"
+
+/* provided by memory_management_optimized.c */
+extern void* optimized_allocate_small_memory(size_t size);
+extern void optimized_free_small_memory(void* ptr);
+
+#define BENCH_ROUNDS   2000
+#define BENCH_OBJECTS  128
+
+static void* objects[BENCH_OBJECTS];
+static uint32_t free_order[BENCH_OBJECTS];
+
+/* Fixed pseudo-random free order so both allocators see the same pattern */
+static void shuffle_free_order(void) {
+    uint32_t state = 12345;
+    for (uint32_t i = 0; i < BENCH_OBJECTS; i++) {
+        free_order[i] = i;
+    }
+    for (uint32_t i = BENCH_OBJECTS - 1; i > 0; i--) {
+        state = state * 1103515245u + 12345u;
+        uint32_t j = (state >> 16) % (i + 1);
+        uint32_t tmp = free_order[i];
+        free_order[i] = free_order[j];
+        free_order[j] = tmp;
+    }
+}
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_slab: %s failed\n", what);
+    exit(1);
+}
+
+/* Three 2048-byte objects take a slab page each, 8 KiB takes two pages */
+static void check_kernel_pages(void) {
+    uint32_t free_at_start = memory_free_pages();
+    void* small[3];
+    for (int i = 0; i < 3; i++) {
+        small[i] = kmem_alloc(2048);
+        if (!small[i] || (uintptr_t)small[i] % KMEM_CACHE_LINE_SIZE != 0) {
+            fail("kmem_alloc(2048)");
+        }
+    }
+    void* large = kmem_alloc(8192);
+    if (!large || memory_free_pages() != free_at_start - 5) {
+        fail("kmem_alloc(8192)");
+    }
+
+    if (!security_create_user("slabguest", "guest123", PRIVILEGE_USER) ||
+        !security_authenticate_user("slabguest", "guest123")) {
+        fail("switching user");
+    }
+    for (int i = 0; i < 3; i++) {
+        kmem_free(small[i]);
+    }
+    kmem_free(large);
+    /* One empty slab stays cached */
+    if (memory_free_pages() != free_at_start - 1) {
+        fprintf(stderr, "%u pages still out after another user freed them\n", free_at_start - memory_free_pages());
+        fail("free by another user");
+    }
+    if (!security_authenticate_user("admin", "admin123")) {
+        fail("switching back");
+    }
+}
+
+static double run_pool(size_t size) {
+    uint64_t start = bench_now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < BENCH_OBJECTS; i++) {
+            objects[i] = optimized_allocate_small_memory(size);
+            if (!objects[i]) {
+                fprintf(stderr, "pool exhausted at object %u\n", i);
+                exit(1);
+            }
+        }
+        for (uint32_t i = 0; i < BENCH_OBJECTS; i++) {
+            optimized_free_small_memory(objects[free_order[i]]);
+        }
+    }
+    return (double)(bench_now_ns() - start) / (BENCH_ROUNDS * BENCH_OBJECTS);
+}
+
+static double run_cache(kmem_cache_t* cache) {
+    uint64_t start = bench_now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < BENCH_OBJECTS; i++) {
+            objects[i] = kmem_cache_alloc(cache);
+            if (!objects[i] || ((uintptr_t)objects[i] % KMEM_CACHE_LINE_SIZE) != 0) {
+                fprintf(stderr, "slab allocation failed or misaligned\n");
+                exit(1);
+            }
+        }
+        for (uint32_t i = 0; i < BENCH_OBJECTS; i++) {
+            kmem_cache_free(cache, objects[free_order[i]]);
+        }
+    }
+    return (double)(bench_now_ns() - start) / (BENCH_ROUNDS * BENCH_OBJECTS);
+}
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    kmem_init();
+    check_kernel_pages();
+    shuffle_free_order();
+
+    bench_print_header("SLAB ALLOCATOR (ns per alloc+free)");
+
+    static const size_t sizes[] = { 32, 64 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        kmem_cache_t* cache = kmem_cache_create("bench", sizes[s], 0, KMEM_FLAG_HWALIGN, NULL);
+        if (!cache) {
+            fprintf(stderr, "kmem_cache_create failed\n");
+            return 1;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "%zu-byte objects x%d", sizes[s], BENCH_OBJECTS);
+        bench_print_row(name, run_pool(sizes[s]), run_cache(cache));
+        kmem_cache_destroy(cache);
+    }
+    return 0;
+}
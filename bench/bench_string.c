@@ -0,0 +1,177 @@
+/* bench_string.c - memcpy, memset, strlen and strcmp versions by size
+   Every version in string_variants that this CPU runs (byte loops, words,
+   SSE2, AVX2, rep movsb/stosb) is timed from 8 B to 64 KiB, once with
+   16-byte aligned buffers and once with buffers one and three bytes off.
+   Strings are compared against an identical copy, so strcmp reads both to
+   the end. Before timing, each version is checked against the byte loops
+   on every small size and alignment, with strings that end just before an
+   unmapped page, so a read past the terminator would fault. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "string_ops.h"
+
+#define STRING_MAX       (64 * 1024)
+#define STRING_BYTES     (16u * 1024 * 1024)    /* bytes moved per timing */
+#define STRING_CHECK_MAX 300
+#define PAGE             4096
+
+static const uint32_t sizes[] = { 8, 64, 512, 4096, 32768, 65536 };
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint8_t source_area[STRING_MAX + 64] __attribute__((aligned(64)));
+static uint8_t dest_area[STRING_MAX + 64] __attribute__((aligned(64)));
+static volatile size_t sink;
+
+enum { COPY, FILL, LENGTH, COMPARE };
+static const char* const titles[] = { "MEMCPY", "MEMSET", "STRLEN", "STRCMP" };
+
+static void fail(const char* variant, const char* what, uint32_t size, uint32_t offset) {
+    fprintf(stderr, "bench_string: %s %s failed (size %u, offset %u)\n", variant, what, size, offset);
+    exit(1);
+}
+
+static bool available(const string_variant_t* variant) {
+    return (variant->features & string_cpu_features()) == variant->features;
+}
+
+/* Copies and fills, with canaries on both sides */
+static void check_memory(const string_variant_t* variant) {
+    static uint8_t src[STRING_CHECK_MAX + 64], dst[STRING_CHECK_MAX + 64], want[STRING_CHECK_MAX + 64];
+    for (uint32_t i = 0; i < sizeof(src); i++) {
+        src[i] = (uint8_t)(i * 7 + 1);
+    }
+    for (uint32_t size = 0; size <= STRING_CHECK_MAX; size++) {
+        for (uint32_t offset = 0; offset < 32; offset++) {
+            memset(dst, 0xAA, sizeof(dst));
+            memset(want, 0xAA, sizeof(want));
+            memcpy(want + offset, src + (offset * 5) % 32, size);
+            variant->copy(dst + offset, src + (offset * 5) % 32, size);
+            if (memcmp(dst, want, sizeof(dst)) != 0) {
+                fail(variant->name, "memcpy", size, offset);
+            }
+            memset(want + offset, 0x5C, size);
+            if (variant->fill(dst + offset, 0x15C, size) != dst + offset || memcmp(dst, want, sizeof(dst)) != 0) {
+                fail(variant->name, "memset", size, offset);
+            }
+        }
+    }
+}
+
+/* Strings ending at every offset before two guard pages */
+static void check_strings(const string_variant_t* variant, uint8_t* a_end, uint8_t* b_end) {
+    for (uint32_t length = 0; length <= STRING_CHECK_MAX; length++) {
+        for (uint32_t gap = 0; gap < 64; gap++) {
+            char* a = (char*)a_end - gap - length - 1;
+            char* b = (char*)b_end - (gap * 3) % 64 - length - 1;
+            for (uint32_t i = 0; i < length; i++) {
+                a[i] = b[i] = (char)('a' + (i * 13 + length) % 26);
+            }
+            a[length] = b[length] = '\0';
+            if (variant->length(a) != length || variant->length(b) != length) {
+                fail(variant->name, "strlen", length, gap);
+            }
+            if (variant->compare(a, b) != 0) {
+                fail(variant->name, "strcmp equal", length, gap);
+            }
+            for (uint32_t at = length > 3 ? length - 3 : 0; at < length; at++) {
+                b[at]++;
+                if (variant->compare(a, b) >= 0 || variant->compare(b, a) <= 0) {
+                    fail(variant->name, "strcmp order", length, gap);
+                }
+                b[at] = (char)0xE0;    /* above every letter when compared unsigned */
+                if (variant->compare(a, b) >= 0) {
+                    fail(variant->name, "strcmp unsigned", length, gap);
+                }
+                b[at] = a[at];
+            }
+        }
+    }
+}
+
+/* ns per call of one function of a variant on size bytes */
+static double run(const string_variant_t* variant, int function, uint32_t size, bool aligned) {
+    uint8_t* src = source_area + (aligned ? 0 : 1);
+    uint8_t* dst = dest_area + (aligned ? 0 : 3);
+    if (function == LENGTH || function == COMPARE) {
+        memset(src, 'x', size - 1);
+        memset(dst, 'x', size - 1);
+        src[size - 1] = dst[size - 1] = '\0';
+    }
+    uint32_t iterations = STRING_BYTES / size;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        switch (function) {
+        case COPY:
+            variant->copy(dst, src, size);
+            break;
+        case FILL:
+            variant->fill(dst, (int)i, size);
+            break;
+        case LENGTH:
+            sink += variant->length((const char*)src);
+            break;
+        default:
+            sink += (size_t)variant->compare((const char*)src, (const char*)dst);
+            break;
+        }
+    }
+    return (double)(bench_now_ns() - start) / iterations;
+}
+
+int main(void) {
+    uint32_t features = string_init();
+    uint8_t* guarded = mmap(NULL, 4 * PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (guarded == MAP_FAILED || mprotect(guarded + PAGE, PAGE, PROT_NONE) != 0 ||
+        mprotect(guarded + 3 * PAGE, PAGE, PROT_NONE) != 0) {
+        fail("bench", "mmap", 0, 0);
+    }
+    for (uint32_t v = 0; v < STRING_VARIANT_COUNT; v++) {
+        const string_variant_t* variant = &string_variants[v];
+        if (!available(variant)) {
+            continue;
+        }
+        check_memory(variant);
+        if (variant->length) {
+            check_strings(variant, guarded + PAGE, guarded + 3 * PAGE);
+        }
+    }
+    munmap(guarded, 4 * PAGE);
+
+    printf("\nCPU: %s%s%s; selected %s%s\n", features & STRING_CPU_SSE2 ? "SSE2 " : "",
+           features & STRING_CPU_AVX2 ? "AVX2 " : "", features & STRING_CPU_ERMS ? "ERMS" : "",
+           features & STRING_CPU_AVX2 ? "avx2" : features & STRING_CPU_SSE2 ? "sse2" : "words",
+           features & STRING_CPU_ERMS ? ", rep movsb/stosb from 2048 B" : "");
+    for (int function = COPY; function <= COMPARE; function++) {
+        printf("\n=== %s (ns per call) ===\n%-10s", titles[function], "Size");
+        for (uint32_t v = 0; v < STRING_VARIANT_COUNT; v++) {
+            printf(" %9s", string_variants[v].name);
+        }
+        printf("\n----------");
+        for (uint32_t v = 0; v < STRING_VARIANT_COUNT; v++) {
+            printf(" ---------");
+        }
+        printf("\n");
+        for (uint32_t s = 0; s < SIZE_COUNT; s++) {
+            for (int aligned = 1; aligned >= 0; aligned--) {
+                char label[16];
+                snprintf(label, sizeof(label), "%u%s", sizes[s], aligned ? "" : " +1/+3");
+                printf("%-10s", label);
+                for (uint32_t v = 0; v < STRING_VARIANT_COUNT; v++) {
+                    const string_variant_t* variant = &string_variants[v];
+                    bool has = function == LENGTH ? variant->length != NULL :
+                               function == COMPARE ? variant->compare != NULL : true;
+                    if (has && available(variant)) {
+                        printf(" %9.1f", run(variant, function, sizes[s], aligned));
+                    } else {
+                        printf(" %9s", "-");
+                    }
+                }
+                printf("\n");
+            }
+        }
+    }
+    return 0;
+}
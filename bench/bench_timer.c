@@ -0,0 +1,202 @@
+/* bench_timer.c - Timer wheel and TSC-to-nanosecond conversion
+   Thousands of timers with delays from 0 to 5 s are armed, some are
+   cancelled, and the clock is advanced tick by tick: each must fire on
+   exactly the tick it was due and the cancelled ones never. Then the
+   wheel is timed against a sorted list of timers (what a single queue of
+   deadlines costs) with 64 to 16384 timers pending, each re-armed when
+   it fires. Last, the TSC rate is measured against the host clock the way
+   timer_init measures it against the PIT, and intervals converted with
+   timer_cycles_to_ns must agree with the host clock. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include "timer.h"
+
+#define TIMER_CHECK_COUNT 4096
+#define TIMER_MAX_DELAY   1000
+#define TIMER_OPS         (1u << 20)
+
+static const uint32_t pending_counts[] = { 64, 1024, 16384 };
+
+static uint32_t seed = 12345;
+static uint32_t next_random(void) {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static void fail(const char* what) {
+    fprintf(stderr, "bench_timer: %s failed\n", what);
+    exit(1);
+}
+
+/* Correctness: every timer records the tick it fired on */
+static timer_event_t check_events[TIMER_CHECK_COUNT];
+static uint64_t due[TIMER_CHECK_COUNT];
+static uint64_t fired_at[TIMER_CHECK_COUNT];
+
+static void record_fire(void* arg) {
+    fired_at[(timer_event_t*)arg - check_events] = timer_ticks();
+}
+
+static void check_wheel(void) {
+    for (uint32_t i = 0; i < TIMER_CHECK_COUNT; i++) {
+        uint32_t delay = i < 16 ? i : next_random() % 5000;
+        due[i] = timer_ticks() + delay + 1;
+        fired_at[i] = 0;
+        timer_add(&check_events[i], delay, record_fire, &check_events[i]);
+        if (i % 3 == 0) {
+            timer_tick();   /* arm some from later ticks */
+        }
+    }
+    for (uint32_t i = 0; i < TIMER_CHECK_COUNT; i += 7) {
+        if (timer_cancel(&check_events[i]) != (due[i] > timer_ticks())) {
+            fail("cancel");
+        }
+        if (due[i] > timer_ticks()) {
+            due[i] = 0;
+        }
+    }
+    for (uint32_t t = 0; t < 6000; t++) {
+        timer_tick();
+    }
+    for (uint32_t i = 0; i < TIMER_CHECK_COUNT; i++) {
+        if (fired_at[i] != due[i]) {
+            fprintf(stderr, "timer %u fired on tick %llu, due %llu\n", i, (unsigned long long)fired_at[i],
+                    (unsigned long long)due[i]);
+            fail("expiry tick");
+        }
+        if (timer_cancel(&check_events[i])) {
+            fail("cancel after expiry");
+        }
+    }
+}
+
+/* Baseline: one list kept sorted by deadline; a tick pops from its head */
+typedef struct list_timer {
+    struct list_timer* next;
+    uint64_t expires;
+} list_timer_t;
+
+static list_timer_t* sorted_head;
+static uint64_t list_now;
+
+static void list_add(list_timer_t* timer, uint32_t delay) {
+    timer->expires = list_now + delay + 1;
+    list_timer_t** link = &sorted_head;
+    while (*link && (*link)->expires <= timer->expires) {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    *link = timer;
+}
+
+static double run_list(uint32_t pending) {
+    list_timer_t* timers = calloc(pending, sizeof(list_timer_t));
+    sorted_head = NULL;
+    seed = 777;
+    for (uint32_t i = 0; i < pending; i++) {
+        list_add(&timers[i], next_random() % TIMER_MAX_DELAY);
+    }
+    uint32_t operations = 0;
+    uint64_t start = bench_now_ns();
+    while (operations < TIMER_OPS) {
+        list_now++;
+        while (sorted_head && sorted_head->expires <= list_now) {
+            list_timer_t* timer = sorted_head;
+            sorted_head = timer->next;
+            list_add(timer, next_random() % TIMER_MAX_DELAY);
+            operations++;
+        }
+    }
+    double ns = (double)(bench_now_ns() - start) / operations;
+    free(timers);
+    return ns;
+}
+
+/* The wheel on the same workload: each timer re-arms itself */
+static timer_event_t* wheel_events;
+static uint32_t wheel_operations;
+
+static void rearm(void* arg) {
+    timer_add((timer_event_t*)arg, next_random() % TIMER_MAX_DELAY, rearm, arg);
+    wheel_operations++;
+}
+
+static double run_wheel(uint32_t pending) {
+    wheel_events = calloc(pending, sizeof(timer_event_t));
+    seed = 777;
+    for (uint32_t i = 0; i < pending; i++) {
+        timer_add(&wheel_events[i], next_random() % TIMER_MAX_DELAY, rearm, &wheel_events[i]);
+    }
+    wheel_operations = 0;
+    uint64_t start = bench_now_ns();
+    while (wheel_operations < TIMER_OPS) {
+        timer_tick();
+    }
+    double ns = (double)(bench_now_ns() - start) / wheel_operations;
+    for (uint32_t i = 0; i < pending; i++) {
+        timer_cancel(&wheel_events[i]);
+    }
+    free(wheel_events);
+    return ns;
+}
+
+/* TSC cycles across a host-clock interval */
+static uint64_t cycles_over(uint64_t interval_ns, uint64_t* measured_ns) {
+    uint64_t start_ns = bench_now_ns();
+    uint64_t start = timer_read_tsc();
+    while (bench_now_ns() - start_ns < interval_ns) {
+    }
+    uint64_t cycles = timer_read_tsc() - start;
+    *measured_ns = bench_now_ns() - start_ns;
+    return cycles;
+}
+
+static volatile uint64_t sink;
+
+int main(void) {
+    check_wheel();
+
+    bench_print_header("TIMERS, ARM AND EXPIRE (ns per timer)");
+    for (uint32_t p = 0; p < sizeof(pending_counts) / sizeof(pending_counts[0]); p++) {
+        char row[64];
+        snprintf(row, sizeof(row), "%u pending, sorted list vs wheel", pending_counts[p]);
+        bench_print_row(row, run_list(pending_counts[p]), run_wheel(pending_counts[p]));
+    }
+
+    uint64_t calibrate_ns;
+    uint64_t cycles = cycles_over(50000000ull, &calibrate_ns);
+    timer_set_tsc_khz((uint32_t)(cycles * 1000000ull / calibrate_ns));
+    printf("\nTSC: %u kHz\n", timer_tsc_khz());
+    for (int i = 0; i < 3; i++) {
+        uint64_t host_ns;
+        uint64_t tsc_ns = timer_cycles_to_ns(cycles_over(200000000ull, &host_ns));
+        double error = 100.0 * ((double)tsc_ns - (double)host_ns) / (double)host_ns;
+        printf("  %llu ns by the host clock, %llu ns by the TSC (%+.3f%%)\n", (unsigned long long)host_ns,
+               (unsigned long long)tsc_ns, error);
+        if (error > 1.0 || error < -1.0) {
+            fail("TSC conversion");
+        }
+    }
+    /* Fixed point against exact arithmetic across the TSC's range */
+    for (uint64_t c = 1; c < (1ull << 62); c = c * 3 + 1) {
+        double exact = (double)c * 1e6 / timer_tsc_khz();
+        if ((double)timer_cycles_to_ns(c) > exact + 1.0 || (double)timer_cycles_to_ns(c) < exact * (1 - 1e-6) - 1.0) {
+            fail("fixed-point conversion");
+        }
+    }
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < TIMER_OPS; i++) {
+        sink += (sink + i) * 1000000ull / timer_tsc_khz();
+    }
+    double divide_ns = (double)(bench_now_ns() - start) / TIMER_OPS;
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < TIMER_OPS; i++) {
+        sink += timer_cycles_to_ns(sink + i);
+    }
+    double multiply_ns = (double)(bench_now_ns() - start) / TIMER_OPS;
+    bench_print_header("CYCLES TO NANOSECONDS (ns per call)");
+    bench_print_row("64-bit divide vs fixed-point multiply", divide_ns, multiply_ns);
+    return 0;
+}
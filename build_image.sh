@@ -22,8 +22,15 @@ fi
 echo "[2/6] Compiling kernel sources..."
 gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/kernel.c -o "$BUILD_DIR/kernel.o"
 gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/memory_management.c -o "$BUILD_DIR/memory_management.o"
+gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/slab.c -o "$BUILD_DIR/slab.o"
 gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/io.c -o "$BUILD_DIR/io.o"
+gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/interrupts.c -o "$BUILD_DIR/interrupts.o"
+gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/timer.c -o "$BUILD_DIR/timer.o"
 gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/file_system.c -o "$BUILD_DIR/file_system.o"
+gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/block_cache.c -o "$BUILD_DIR/block_cache.o"
+gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/block_device.c -o "$BUILD_DIR/block_device.o"
+gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/journal.c -o "$BUILD_DIR/journal.o"
+gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/performance_profiler.c -o "$BUILD_DIR/performance_profiler.o"
 gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/string.c -o "$BUILD_DIR/string.o"
 gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/paging.c -o "$BUILD_DIR/paging.o"
 gcc -m32 -ffreestanding -O2 -Wall -Wextra -std=c99 -Isrc -c src/security_stubs.c -o "$BUILD_DIR/security_stubs.o"
@@ -33,9 +40,10 @@ nasm -f elf32 src/kernel.asm -o "$BUILD_DIR/kernel_asm.o"
 
 echo "[4/6] Linking kernel..."
 ld -m elf_i386 -T src/linker.ld -nostdlib -o "$BUILD_DIR/kernel.elf" \
-    "$BUILD_DIR/kernel.o" "$BUILD_DIR/memory_management.o" "$BUILD_DIR/io.o" \
-    "$BUILD_DIR/file_system.o" "$BUILD_DIR/string.o" "$BUILD_DIR/paging.o" \
-    "$BUILD_DIR/security_stubs.o" "$BUILD_DIR/kernel_asm.o"
+    "$BUILD_DIR/kernel.o" "$BUILD_DIR/memory_management.o" "$BUILD_DIR/slab.o" "$BUILD_DIR/io.o" \
+    "$BUILD_DIR/interrupts.o" "$BUILD_DIR/timer.o" "$BUILD_DIR/file_system.o" "$BUILD_DIR/block_cache.o" \
+    "$BUILD_DIR/block_device.o" "$BUILD_DIR/journal.o" "$BUILD_DIR/performance_profiler.o" "$BUILD_DIR/string.o" \
+    "$BUILD_DIR/paging.o" "$BUILD_DIR/security_stubs.o" "$BUILD_DIR/kernel_asm.o"
 
 echo "[5/6] Converting to flat binary..."
 objcopy -O binary "$BUILD_DIR/kernel.elf" "$BUILD_DIR/kernel_flat.bin"
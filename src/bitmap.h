@@ -0,0 +1,218 @@
+/* bitmap.h - Three-level hierarchical bitmap for free-frame searches
+   Level 0 holds one bit per item (set = in use) in 64-bit words. Level 1 has
+   one bit per level-0 word, set when that word is full, and level 2 has one
+   bit per level-1 word, set when all of its 64 words are full. A search reads
+   at most a few top words and then one word per level, so finding a clear bit
+   costs the same at 16 MiB as at 4 GiB of physical memory.
+   Storage is supplied by the caller so the bitmap can live in static arrays. */
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HBITMAP_NONE  0xFFFFFFFFu
+
+/* Words needed at each level for a bitmap of the given number of bits */
+#define HBITMAP_WORDS(bits)          (((bits) + 63) / 64)
+#define HBITMAP_SUMMARY_WORDS(bits)  ((HBITMAP_WORDS(bits) + 63) / 64)
+#define HBITMAP_TOP_WORDS(bits)      ((HBITMAP_SUMMARY_WORDS(bits) + 63) / 64)
+
+typedef struct {
+    uint64_t* words;         /* level 0: bit set = item in use */
+    uint64_t* summary;       /* level 1: bit set = level-0 word is full */
+    uint64_t* top;           /* level 2: bit set = level-1 word is full */
+    uint32_t bits;
+    uint32_t word_count;
+    uint32_t summary_count;
+    uint32_t top_count;
+} hbitmap_t;
+
+#define HBITMAP_FULL  (~(uint64_t)0)
+
+/* Bits at and above position shift within a word (shift may be 64) */
+static inline uint64_t hbitmap_mask_from(uint32_t shift) {
+    return shift >= 64 ? 0 : HBITMAP_FULL << shift;
+}
+
+/* Propagate the fullness of level-0 word w to the upper levels */
+static inline void hbitmap_update_word(hbitmap_t* bm, uint32_t w) {
+    uint32_t s = w >> 6;
+    uint32_t t = s >> 6;
+    if (bm->words[w] == HBITMAP_FULL) {
+        bm->summary[s] |= (uint64_t)1 << (w & 63);
+        if (bm->summary[s] == HBITMAP_FULL) {
+            bm->top[t] |= (uint64_t)1 << (s & 63);
+        }
+    } else {
+        bm->summary[s] &= ~((uint64_t)1 << (w & 63));
+        bm->top[t] &= ~((uint64_t)1 << (s & 63));
+    }
+}
+
+/* Clear every bit; padding past bits is marked in use so searches never return it */
+static inline void hbitmap_init(hbitmap_t* bm, uint64_t* words, uint64_t* summary,
+                                uint64_t* top, uint32_t bits) {
+    bm->words = words;
+    bm->summary = summary;
+    bm->top = top;
+    bm->bits = bits;
+    bm->word_count = HBITMAP_WORDS(bits);
+    bm->summary_count = HBITMAP_SUMMARY_WORDS(bits);
+    bm->top_count = HBITMAP_TOP_WORDS(bits);
+
+    for (uint32_t i = 0; i < bm->word_count; i++) {
+        words[i] = 0;
+    }
+    for (uint32_t i = 0; i < bm->summary_count; i++) {
+        summary[i] = 0;
+    }
+    for (uint32_t i = 0; i < bm->top_count; i++) {
+        top[i] = 0;
+    }
+
+    if (bits & 63) {
+        words[bm->word_count - 1] = hbitmap_mask_from(bits & 63);
+    }
+    if (bm->word_count & 63) {
+        summary[bm->summary_count - 1] = hbitmap_mask_from(bm->word_count & 63);
+    }
+    if (bm->summary_count & 63) {
+        top[bm->top_count - 1] = hbitmap_mask_from(bm->summary_count & 63);
+    }
+}
+
+/* Replace level-0 word w, e.g. from a saved copy; padding bits stay set */
+static inline void hbitmap_load_word(hbitmap_t* bm, uint32_t w, uint64_t value) {
+    if (w == bm->word_count - 1 && (bm->bits & 63)) {
+        value |= hbitmap_mask_from(bm->bits & 63);
+    }
+    bm->words[w] = value;
+    hbitmap_update_word(bm, w);
+}
+
+static inline bool hbitmap_test(const hbitmap_t* bm, uint32_t bit) {
+    return (bm->words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+static inline void hbitmap_set(hbitmap_t* bm, uint32_t bit) {
+    uint32_t w = bit >> 6;
+    bm->words[w] |= (uint64_t)1 << (bit & 63);
+    if (bm->words[w] == HBITMAP_FULL) {
+        hbitmap_update_word(bm, w);
+    }
+}
+
+static inline void hbitmap_clear(hbitmap_t* bm, uint32_t bit) {
+    uint32_t w = bit >> 6;
+    bool was_full = bm->words[w] == HBITMAP_FULL;
+    bm->words[w] &= ~((uint64_t)1 << (bit & 63));
+    if (was_full) {
+        hbitmap_update_word(bm, w);
+    }
+}
+
+/* Set or clear [start, start + count) a word at a time */
+static inline void hbitmap_assign_range(hbitmap_t* bm, uint32_t start, uint32_t count, bool value) {
+    uint32_t end = start + count;
+    while (start < end) {
+        uint32_t w = start >> 6;
+        uint32_t span = 64 - (start & 63);
+        if (span > end - start) {
+            span = end - start;
+        }
+        uint64_t mask = (span == 64 ? HBITMAP_FULL : (((uint64_t)1 << span) - 1)) << (start & 63);
+        if (value) {
+            bm->words[w] |= mask;
+        } else {
+            bm->words[w] &= ~mask;
+        }
+        hbitmap_update_word(bm, w);
+        start += span;
+    }
+}
+
+static inline void hbitmap_set_range(hbitmap_t* bm, uint32_t start, uint32_t count) {
+    hbitmap_assign_range(bm, start, count, true);
+}
+
+static inline void hbitmap_clear_range(hbitmap_t* bm, uint32_t start, uint32_t count) {
+    hbitmap_assign_range(bm, start, count, false);
+}
+
+/* First clear bit at or after start, or HBITMAP_NONE */
+static inline uint32_t hbitmap_find_zero(const hbitmap_t* bm, uint32_t start) {
+    if (start >= bm->bits) {
+        return HBITMAP_NONE;
+    }
+
+    /* Rest of the starting word */
+    uint32_t w = start >> 6;
+    uint64_t open = ~bm->words[w] & hbitmap_mask_from(start & 63);
+    if (open) {
+        return (w << 6) + (uint32_t)__builtin_ctzll(open);
+    }
+
+    /* Later non-full words under the same summary word */
+    uint32_t s = w >> 6;
+    open = ~bm->summary[s] & hbitmap_mask_from((w & 63) + 1);
+    if (!open) {
+        /* Later summary words with room, found through the top level */
+        uint32_t t = s >> 6;
+        uint64_t top_open = ~bm->top[t] & hbitmap_mask_from((s & 63) + 1);
+        while (!top_open) {
+            if (++t >= bm->top_count) {
+                return HBITMAP_NONE;
+            }
+            top_open = ~bm->top[t];
+        }
+        s = (t << 6) + (uint32_t)__builtin_ctzll(top_open);
+        open = ~bm->summary[s];
+    }
+
+    w = (s << 6) + (uint32_t)__builtin_ctzll(open);
+    return (w << 6) + (uint32_t)__builtin_ctzll(~bm->words[w]);
+}
+
+/* First set bit in [start, limit), or limit when the range is clear */
+static inline uint32_t hbitmap_find_set(const hbitmap_t* bm, uint32_t start, uint32_t limit) {
+    while (start < limit) {
+        uint32_t w = start >> 6;
+        uint64_t busy = bm->words[w] & hbitmap_mask_from(start & 63);
+        if (busy) {
+            uint32_t bit = (w << 6) + (uint32_t)__builtin_ctzll(busy);
+            return bit < limit ? bit : limit;
+        }
+        start = (w + 1) << 6;
+    }
+    return limit;
+}
+
+/* First run of count clear bits starting on a multiple of align (a power of
+   two), or HBITMAP_NONE. Full stretches are skipped through the summary
+   levels and each candidate run is checked a word at a time. */
+static inline uint32_t hbitmap_find_zero_run(const hbitmap_t* bm, uint32_t count, uint32_t align) {
+    if (count == 0 || count > bm->bits) {
+        return HBITMAP_NONE;
+    }
+
+    uint32_t candidate = 0;
+    for (;;) {
+        candidate = hbitmap_find_zero(bm, candidate);
+        if (candidate == HBITMAP_NONE) {
+            return HBITMAP_NONE;
+        }
+        candidate = (candidate + align - 1) & ~(align - 1);
+        if (candidate > bm->bits - count) {
+            return HBITMAP_NONE;
+        }
+        uint32_t busy = hbitmap_find_set(bm, candidate, candidate + count);
+        if (busy == candidate + count) {
+            return candidate;
+        }
+        candidate = busy + 1;
+    }
+}
+
+#endif /* BITMAP_H */
@@ -0,0 +1,593 @@
+/* block_cache.c - Write-back buffer cache over a block device
+   Buffers are hashed by block number into power-of-two buckets. Eviction
+   follows a CLOCK hand that skips pinned buffers and gives referenced ones
+   a second chance. When the hand lands on a dirty victim, up to
+   BLOCK_CACHE_WRITEBACK_BATCH dirty buffers from that point on are written
+   back as one vectored device request in block order, which drivers can
+   merge into a few large transfers instead of one write per eviction.
+   Held buffers are skipped by both, like pinned ones. Read-ahead claims its
+   buffers the same way and fills them with one sorted read batch; they are
+   left unreferenced, so the hand takes them first if they go unused.
+   One lock covers the whole cache. It is held for lookups, pin counts and
+   the device requests they need, never for a caller's copy into or out of a
+   buffer, so it stays short on hits. Write-back may catch a buffer while
+   its pinned holder is still changing it; release marks it dirty again, so
+   the finished contents are written later. */
+
+#include "block_cache.h"
+#include "error_codes.h"
+#include "memory_management.h"
+#include "performance_profiler.h"
+#include <string.h>
+
+static inline uint32_t bucket_of(const block_cache_t* cache, uint32_t block) {
+    return block & cache->bucket_mask;   /* sequential blocks land in distinct buckets */
+}
+
+static cache_buffer_t* lookup(block_cache_t* cache, uint32_t block) {
+    uint32_t index = cache->buckets[bucket_of(cache, block)];
+    while (index != BLOCK_CACHE_NONE) {
+        cache_buffer_t* buffer = &cache->buffers[index];
+        if (buffer->block == block) {
+            return buffer;
+        }
+        index = buffer->hash_next;
+    }
+    return NULL;
+}
+
+static void hash_insert(block_cache_t* cache, cache_buffer_t* buffer) {
+    uint32_t* head = &cache->buckets[bucket_of(cache, buffer->block)];
+    buffer->hash_next = *head;
+    *head = (uint32_t)(buffer - cache->buffers);
+}
+
+static void hash_remove(block_cache_t* cache, cache_buffer_t* buffer) {
+    uint32_t index = (uint32_t)(buffer - cache->buffers);
+    uint32_t* link = &cache->buckets[bucket_of(cache, buffer->block)];
+    while (*link != BLOCK_CACHE_NONE) {
+        if (*link == index) {
+            *link = buffer->hash_next;
+            return;
+        }
+        link = &cache->buffers[*link].hash_next;
+    }
+}
+
+/* Drop a buffer's contents; dirty data is lost */
+static void invalidate(block_cache_t* cache, cache_buffer_t* buffer) {
+    if (buffer->flags & BLOCK_CACHE_DIRTY) {
+        cache->dirty_count--;
+    }
+    if (buffer->flags & BLOCK_CACHE_HELD) {
+        cache->held_count--;
+    }
+    hash_remove(cache, buffer);
+    buffer->flags = 0;
+}
+
+/* Write up to BLOCK_CACHE_WRITEBACK_BATCH dirty buffers back, lowest block
+   first. The search starts at buffer index first, so the buffers the clock
+   hand reaches next are the ones cleaned. */
+static int32_t write_back(block_cache_t* cache, uint32_t first) {
+    cache_buffer_t* batch[BLOCK_CACHE_WRITEBACK_BATCH];
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < cache->buffer_count && count < BLOCK_CACHE_WRITEBACK_BATCH; i++) {
+        uint32_t index = first + i < cache->buffer_count ? first + i : first + i - cache->buffer_count;
+        cache_buffer_t* buffer = &cache->buffers[index];
+        if ((buffer->flags & (BLOCK_CACHE_DIRTY | BLOCK_CACHE_HELD)) != BLOCK_CACHE_DIRTY) {
+            continue;
+        }
+        uint32_t slot = count++;
+        while (slot > 0 && batch[slot - 1]->block > buffer->block) {
+            batch[slot] = batch[slot - 1];
+            slot--;
+        }
+        batch[slot] = buffer;
+    }
+    if (count == 0) {
+        return ERR_SUCCESS;
+    }
+
+    block_io_t segments[BLOCK_CACHE_WRITEBACK_BATCH];
+    for (uint32_t i = 0; i < count; i++) {
+        segments[i].block = batch[i]->block;
+        segments[i].count = 1;
+        segments[i].buffer = batch[i]->data;
+    }
+
+    uint64_t start = profiler_get_current_time_ns();
+    int32_t result = block_device_write_batch(cache->device, segments, count);
+    profiler_record_cache_writeback_batch();
+    if (result != ERR_SUCCESS) {
+        return result;   /* the whole batch stays dirty */
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        batch[i]->flags &= (uint8_t)~BLOCK_CACHE_DIRTY;
+    }
+    cache->dirty_count -= count;
+    cache->stats.device_writes += count;
+    profiler_record_cache_transfer(1, count, profiler_get_current_time_ns() - start);
+    return ERR_SUCCESS;
+}
+
+/* Advance the clock hand to an unpinned, unreferenced buffer and make it clean */
+static cache_buffer_t* find_victim(block_cache_t* cache) {
+    /* Two sweeps clear every reference bit, so a third finds a victim if any buffer is unpinned */
+    for (uint32_t scanned = 0; scanned <= 2 * cache->buffer_count; scanned++) {
+        uint32_t index = cache->clock_hand;
+        cache->clock_hand = index + 1 < cache->buffer_count ? index + 1 : 0;
+
+        cache_buffer_t* buffer = &cache->buffers[index];
+        if (buffer->pins || (buffer->flags & BLOCK_CACHE_HELD)) {
+            continue;
+        }
+        if (buffer->flags & BLOCK_CACHE_REFERENCED) {
+            buffer->flags &= (uint8_t)~BLOCK_CACHE_REFERENCED;
+            continue;
+        }
+        if ((buffer->flags & BLOCK_CACHE_DIRTY) && write_back(cache, index) != ERR_SUCCESS) {
+            return NULL;
+        }
+        return buffer;
+    }
+    return NULL;
+}
+
+/* Set up a cache of buffer_count blocks */
+int32_t block_cache_init(block_cache_t* cache, block_device_t* device, uint32_t buffer_count) {
+    if (!cache || !device || !device->ops) {
+        return ERR_NULL_POINTER;
+    }
+    if (buffer_count == 0) {
+        return ERR_INVALID_PARAMETER;
+    }
+
+    uint32_t bucket_count = 1;
+    while (bucket_count < buffer_count) {
+        bucket_count <<= 1;
+    }
+
+    memset(cache, 0, sizeof(block_cache_t));
+    cache->device = device;
+    cache->buffer_count = buffer_count;
+    cache->bucket_mask = bucket_count - 1;
+    cache->buffers = (cache_buffer_t*)allocate_memory(buffer_count * sizeof(cache_buffer_t));
+    cache->memory = (uint8_t*)allocate_memory((size_t)buffer_count * BLOCK_DEVICE_BLOCK_SIZE);
+    cache->buckets = (uint32_t*)allocate_memory(bucket_count * sizeof(uint32_t));
+    if (!cache->buffers || !cache->memory || !cache->buckets) {
+        block_cache_destroy(cache);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        cache->buffers[i].data = cache->memory + (size_t)i * BLOCK_DEVICE_BLOCK_SIZE;
+        cache->buffers[i].block = BLOCK_CACHE_NONE;
+        cache->buffers[i].hash_next = BLOCK_CACHE_NONE;
+        cache->buffers[i].pins = 0;
+        cache->buffers[i].flags = 0;
+    }
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        cache->buckets[b] = BLOCK_CACHE_NONE;
+    }
+    return ERR_SUCCESS;
+}
+
+/* Release the cache memory */
+void block_cache_destroy(block_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+    if (cache->buffers) {
+        free_memory(cache->buffers);
+    }
+    if (cache->memory) {
+        free_memory(cache->memory);
+    }
+    if (cache->buckets) {
+        free_memory(cache->buckets);
+    }
+    cache->buffers = NULL;
+    cache->memory = NULL;
+    cache->buckets = NULL;
+    cache->buffer_count = 0;
+    cache->dirty_count = 0;
+    cache->held_count = 0;
+}
+
+/* Pin a buffer found by lookup; the lock is held */
+static void pin_hit(block_cache_t* cache, cache_buffer_t* buffer) {
+    cache->stats.hits++;
+    profiler_record_cache_access(1);
+    if (buffer->flags & BLOCK_CACHE_READAHEAD) {
+        buffer->flags &= (uint8_t)~BLOCK_CACHE_READAHEAD;
+        cache->stats.readahead_hits++;
+        profiler_record_readahead_hit();
+    }
+    buffer->pins++;
+    buffer->flags |= BLOCK_CACHE_REFERENCED;
+}
+
+/* Take a victim for block after a miss, without reading it; the lock is held */
+static cache_buffer_t* claim_buffer(block_cache_t* cache) {
+    cache->stats.misses++;
+    profiler_record_cache_access(0);
+    cache_buffer_t* buffer = find_victim(cache);
+    if (buffer && (buffer->flags & BLOCK_CACHE_VALID)) {
+        invalidate(cache, buffer);
+    }
+    return buffer;
+}
+
+/* Pin the buffer for block, loading it on a miss when fill is set; the lock is held */
+static cache_buffer_t* pin_block(block_cache_t* cache, uint32_t block, bool fill) {
+    cache_buffer_t* buffer = lookup(cache, block);
+    if (buffer) {
+        pin_hit(cache, buffer);
+        return buffer;
+    }
+
+    buffer = claim_buffer(cache);
+    if (!buffer) {
+        return NULL;
+    }
+
+    if (fill) {
+        uint64_t start = profiler_get_current_time_ns();
+        if (block_device_read(cache->device, block, 1, buffer->data) != ERR_SUCCESS) {
+            return NULL;
+        }
+        cache->stats.device_reads++;
+        profiler_record_cache_transfer(0, 1, profiler_get_current_time_ns() - start);
+    }
+
+    buffer->block = block;
+    buffer->flags = BLOCK_CACHE_VALID | BLOCK_CACHE_REFERENCED;
+    buffer->pins = 1;
+    hash_insert(cache, buffer);
+    return buffer;
+}
+
+/* Pin the buffer for block */
+cache_buffer_t* block_cache_get(block_cache_t* cache, uint32_t block, bool fill) {
+    if (!cache || block >= cache->device->block_count) {
+        return NULL;
+    }
+    sc_lock_acquire(&cache->lock);
+    cache_buffer_t* buffer = pin_block(cache, block, fill);
+    sc_lock_release(&cache->lock);
+    return buffer;
+}
+
+/* Pin the buffers for several blocks under one lock acquisition */
+int32_t block_cache_get_batch(block_cache_t* cache, const uint32_t* blocks, uint32_t count,
+                              cache_buffer_t** buffers) {
+    if (!cache || !blocks || !buffers) {
+        return ERR_NULL_POINTER;
+    }
+    if (count > BLOCK_DEVICE_MAX_BATCH) {
+        count = BLOCK_DEVICE_MAX_BATCH;
+    }
+
+    /* Hits are pinned as they are found; misses get a buffer each, pinned
+       and hashed at once, and are read together in block order */
+    cache_buffer_t* missed[BLOCK_DEVICE_MAX_BATCH];
+    uint32_t misses = 0;
+    uint32_t pinned = 0;
+    sc_lock_acquire(&cache->lock);
+    for (; pinned < count && blocks[pinned] < cache->device->block_count; pinned++) {
+        cache_buffer_t* buffer = lookup(cache, blocks[pinned]);
+        if (buffer) {
+            pin_hit(cache, buffer);
+        } else {
+            buffer = claim_buffer(cache);
+            if (!buffer) {
+                break;
+            }
+            buffer->block = blocks[pinned];
+            buffer->flags = BLOCK_CACHE_VALID | BLOCK_CACHE_REFERENCED;
+            buffer->pins = 1;
+            hash_insert(cache, buffer);
+
+            uint32_t slot = misses++;
+            while (slot > 0 && missed[slot - 1]->block > buffer->block) {
+                missed[slot] = missed[slot - 1];
+                slot--;
+            }
+            missed[slot] = buffer;
+        }
+        buffers[pinned] = buffer;
+    }
+
+    if (misses > 0) {
+        block_io_t segments[BLOCK_DEVICE_MAX_BATCH];
+        for (uint32_t i = 0; i < misses; i++) {
+            segments[i].block = missed[i]->block;
+            segments[i].count = 1;
+            segments[i].buffer = missed[i]->data;
+        }
+        uint64_t start = profiler_get_current_time_ns();
+        int32_t result = block_device_read_batch(cache->device, segments, misses);
+        if (result != ERR_SUCCESS) {
+            for (uint32_t i = 0; i < pinned; i++) {
+                buffers[i]->pins--;
+            }
+            for (uint32_t i = 0; i < misses; i++) {
+                invalidate(cache, missed[i]);
+            }
+            sc_lock_release(&cache->lock);
+            return result;
+        }
+        cache->stats.device_reads += misses;
+        profiler_record_cache_transfer(0, misses, profiler_get_current_time_ns() - start);
+    }
+    sc_lock_release(&cache->lock);
+    return (int32_t)pinned;
+}
+
+/* Unpin a buffer, marking it dirty if it was modified */
+void block_cache_release(block_cache_t* cache, cache_buffer_t* buffer, bool dirty) {
+    if (!cache || !buffer) {
+        return;
+    }
+    sc_lock_acquire(&cache->lock);
+    if (dirty && !(buffer->flags & BLOCK_CACHE_DIRTY)) {
+        buffer->flags |= BLOCK_CACHE_DIRTY;
+        cache->dirty_count++;
+    }
+    if (buffer->pins) {
+        buffer->pins--;
+    }
+    sc_lock_release(&cache->lock);
+}
+
+/* Unpin the buffer holding data */
+void block_cache_unpin(block_cache_t* cache, const uint8_t* data) {
+    if (!cache || !data || data < cache->memory) {
+        return;
+    }
+    size_t index = (size_t)(data - cache->memory) / BLOCK_DEVICE_BLOCK_SIZE;
+    if (index < cache->buffer_count) {
+        block_cache_release(cache, &cache->buffers[index], false);
+    }
+}
+
+/* Copy part of a block out of the cache */
+int32_t block_cache_read(block_cache_t* cache, uint32_t block, uint32_t offset, void* buffer, uint32_t size) {
+    if (!cache || !buffer) {
+        return ERR_NULL_POINTER;
+    }
+    if (offset > BLOCK_DEVICE_BLOCK_SIZE || size > BLOCK_DEVICE_BLOCK_SIZE - offset) {
+        return ERR_INVALID_PARAMETER;
+    }
+    cache_buffer_t* cached = block_cache_get(cache, block, true);
+    if (!cached) {
+        return ERR_IO_DEVICE_ERROR;
+    }
+    memcpy(buffer, cached->data + offset, size);
+    block_cache_release(cache, cached, false);
+    return ERR_SUCCESS;
+}
+
+/* Copy part of a block into the cache; whole-block writes skip the device read */
+int32_t block_cache_write(block_cache_t* cache, uint32_t block, uint32_t offset, const void* data, uint32_t size) {
+    if (!cache || !data) {
+        return ERR_NULL_POINTER;
+    }
+    if (offset > BLOCK_DEVICE_BLOCK_SIZE || size > BLOCK_DEVICE_BLOCK_SIZE - offset) {
+        return ERR_INVALID_PARAMETER;
+    }
+    cache_buffer_t* cached = block_cache_get(cache, block, size != BLOCK_DEVICE_BLOCK_SIZE);
+    if (!cached) {
+        return ERR_IO_DEVICE_ERROR;
+    }
+    memcpy(cached->data + offset, data, size);
+    block_cache_release(cache, cached, true);
+    return ERR_SUCCESS;
+}
+
+/* Read blocks ahead of use in one batch; the lock is held */
+static int32_t prefetch_blocks(block_cache_t* cache, const uint32_t* blocks, uint32_t count) {
+    /* Claim a buffer for every uncached block, pinned until the read is in,
+       keeping the batch in block order */
+    cache_buffer_t* batch[BLOCK_DEVICE_MAX_BATCH];
+    uint32_t claimed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (blocks[i] >= cache->device->block_count || lookup(cache, blocks[i])) {
+            continue;
+        }
+        cache_buffer_t* buffer = find_victim(cache);
+        if (!buffer) {
+            break;
+        }
+        if (buffer->flags & BLOCK_CACHE_VALID) {
+            invalidate(cache, buffer);
+        }
+        buffer->block = blocks[i];
+        /* Referenced, or the clock takes it ahead of blocks already used */
+        buffer->flags = BLOCK_CACHE_VALID | BLOCK_CACHE_READAHEAD | BLOCK_CACHE_REFERENCED;
+        buffer->pins = 1;
+        hash_insert(cache, buffer);
+
+        uint32_t slot = claimed++;
+        while (slot > 0 && batch[slot - 1]->block > buffer->block) {
+            batch[slot] = batch[slot - 1];
+            slot--;
+        }
+        batch[slot] = buffer;
+    }
+    if (claimed == 0) {
+        return 0;
+    }
+
+    block_io_t segments[BLOCK_DEVICE_MAX_BATCH];
+    for (uint32_t i = 0; i < claimed; i++) {
+        segments[i].block = batch[i]->block;
+        segments[i].count = 1;
+        segments[i].buffer = batch[i]->data;
+    }
+    uint64_t start = profiler_get_current_time_ns();
+    int32_t result = block_device_read_batch(cache->device, segments, claimed);
+    for (uint32_t i = 0; i < claimed; i++) {
+        batch[i]->pins = 0;
+        if (result != ERR_SUCCESS) {
+            invalidate(cache, batch[i]);
+        }
+    }
+    if (result != ERR_SUCCESS) {
+        return result;
+    }
+    cache->stats.device_reads += claimed;
+    cache->stats.readahead_blocks += claimed;
+    profiler_record_cache_transfer(0, claimed, profiler_get_current_time_ns() - start);
+    return (int32_t)claimed;
+}
+
+/* Read blocks ahead of use */
+int32_t block_cache_prefetch(block_cache_t* cache, const uint32_t* blocks, uint32_t count) {
+    if (!cache || !blocks) {
+        return ERR_NULL_POINTER;
+    }
+    if (count > BLOCK_DEVICE_MAX_BATCH) {
+        count = BLOCK_DEVICE_MAX_BATCH;
+    }
+    sc_lock_acquire(&cache->lock);
+    int32_t result = prefetch_blocks(cache, blocks, count);
+    sc_lock_release(&cache->lock);
+    return result;
+}
+
+/* Hint blocks to the device */
+void block_cache_hint(block_cache_t* cache, const uint32_t* blocks, uint32_t count) {
+    if (!cache || !blocks) {
+        return;
+    }
+    uint32_t start = 0, length = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (blocks[i] >= cache->device->block_count) {
+            continue;
+        }
+        if (length && blocks[i] == start + length) {
+            length++;
+            continue;
+        }
+        if (length) {
+            block_device_prefetch(cache->device, start, length);
+        }
+        start = blocks[i];
+        length = 1;
+    }
+    if (length) {
+        block_device_prefetch(cache->device, start, length);
+    }
+}
+
+/* Write one dirty buffer back now; the lock is held */
+static int32_t write_buffer(block_cache_t* cache, cache_buffer_t* buffer) {
+    uint64_t start = profiler_get_current_time_ns();
+    int32_t result = block_device_write(cache->device, buffer->block, 1, buffer->data);
+    if (result != ERR_SUCCESS) {
+        return result;
+    }
+    buffer->flags &= (uint8_t)~BLOCK_CACHE_DIRTY;
+    cache->dirty_count--;
+    cache->stats.device_writes++;
+    profiler_record_cache_transfer(1, 1, profiler_get_current_time_ns() - start);
+    return ERR_SUCCESS;
+}
+
+/* Write one buffer back now */
+int32_t block_cache_clean(block_cache_t* cache, cache_buffer_t* buffer) {
+    if (!cache || !buffer) {
+        return ERR_NULL_POINTER;
+    }
+    int32_t result = ERR_SUCCESS;
+    sc_lock_acquire(&cache->lock);
+    if ((buffer->flags & (BLOCK_CACHE_DIRTY | BLOCK_CACHE_HELD)) == BLOCK_CACHE_DIRTY) {
+        result = write_buffer(cache, buffer);
+    }
+    sc_lock_release(&cache->lock);
+    return result;
+}
+
+/* Mark a buffer as held */
+void block_cache_hold(block_cache_t* cache, cache_buffer_t* buffer) {
+    if (!cache || !buffer) {
+        return;
+    }
+    sc_lock_acquire(&cache->lock);
+    if (!(buffer->flags & BLOCK_CACHE_HELD)) {
+        buffer->flags |= BLOCK_CACHE_HELD;
+        cache->held_count++;
+    }
+    sc_lock_release(&cache->lock);
+}
+
+/* Whether a buffer is held */
+bool block_cache_held(block_cache_t* cache, cache_buffer_t* buffer) {
+    if (!cache || !buffer) {
+        return false;
+    }
+    sc_lock_acquire(&cache->lock);
+    bool held = (buffer->flags & BLOCK_CACHE_HELD) != 0;
+    sc_lock_release(&cache->lock);
+    return held;
+}
+
+/* Let every held buffer be written back again */
+void block_cache_release_held(block_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+    sc_lock_acquire(&cache->lock);
+    if (cache->held_count) {
+        for (uint32_t i = 0; i < cache->buffer_count; i++) {
+            cache->buffers[i].flags &= (uint8_t)~BLOCK_CACHE_HELD;
+        }
+        cache->held_count = 0;
+    }
+    sc_lock_release(&cache->lock);
+}
+
+/* Write every dirty buffer that is not held back, then flush the device */
+int32_t block_cache_flush(block_cache_t* cache) {
+    if (!cache) {
+        return ERR_NULL_POINTER;
+    }
+    int32_t result = ERR_SUCCESS;
+    sc_lock_acquire(&cache->lock);
+    while (result == ERR_SUCCESS && cache->dirty_count > cache->held_count) {
+        result = write_back(cache, 0);
+    }
+    if (result == ERR_SUCCESS) {
+        result = block_device_flush(cache->device);
+    }
+    sc_lock_release(&cache->lock);
+    return result;
+}
+
+/* Forget cached copies of freed blocks */
+void block_cache_discard(block_cache_t* cache, uint32_t start, uint32_t count) {
+    if (!cache || count == 0) {
+        return;
+    }
+    sc_lock_acquire(&cache->lock);
+    if (count < cache->buffer_count) {
+        for (uint32_t block = start; block - start < count; block++) {
+            cache_buffer_t* buffer = lookup(cache, block);
+            if (buffer && !buffer->pins) {
+                invalidate(cache, buffer);
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < cache->buffer_count; i++) {
+            cache_buffer_t* buffer = &cache->buffers[i];
+            if ((buffer->flags & BLOCK_CACHE_VALID) && !buffer->pins &&
+                buffer->block - start < count) {
+                invalidate(cache, buffer);
+            }
+        }
+    }
+    sc_lock_release(&cache->lock);
+}
@@ -0,0 +1,122 @@
+/* block_cache.h - Write-back buffer cache between the file system and a block device
+   Cached blocks are found through a hash of the block number and evicted with
+   the CLOCK algorithm. Writes only dirty the cached copy; dirty buffers reach
+   the device in block-sorted batches when they are evicted or on a flush.
+   A journal can hold dirty buffers, keeping them off the device until the
+   transaction that logs them has committed. Blocks can also be read ahead
+   of use, many in one device request.
+   Threads can share a cache: every call takes the cache lock, holding it
+   through any device request it makes, while callers copy into and out of
+   pinned buffers without it. Keeping two threads off the same bytes of a
+   buffer is up to the caller. */
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "block_device.h"
+#include "spinlock.h"
+
+#define BLOCK_CACHE_NONE            0xFFFFFFFFu
+#define BLOCK_CACHE_WRITEBACK_BATCH 32      /* Dirty buffers per write-back request (<= BLOCK_DEVICE_MAX_BATCH) */
+
+/* Buffer flags */
+#define BLOCK_CACHE_VALID       0x01    /* Holds the contents of block */
+#define BLOCK_CACHE_DIRTY       0x02    /* Newer than the device copy */
+#define BLOCK_CACHE_REFERENCED  0x04    /* Used since the clock hand last passed */
+#define BLOCK_CACHE_HELD        0x08    /* Dirty, but not to be written back or evicted yet */
+#define BLOCK_CACHE_READAHEAD   0x10    /* Read ahead and not looked up since */
+
+typedef struct {
+    uint8_t* data;
+    uint32_t block;
+    uint32_t hash_next;     /* Next buffer in the same bucket */
+    uint16_t pins;          /* Holders between get and release; never evicted while set */
+    uint8_t flags;
+} cache_buffer_t;
+
+/* Counters for this cache; the profiler keeps the totals over all caches */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t device_reads;
+    uint64_t device_writes;
+    uint64_t readahead_blocks;  /* Blocks read ahead of use */
+    uint64_t readahead_hits;    /* Of those, blocks looked up before eviction */
+} block_cache_stats_t;
+
+typedef struct {
+    block_device_t* device;
+    cache_buffer_t* buffers;
+    uint8_t* memory;            /* buffer_count blocks of buffer data */
+    uint32_t buffer_count;
+    uint32_t* buckets;
+    uint32_t bucket_mask;
+    uint32_t clock_hand;
+    uint32_t dirty_count;
+    uint32_t held_count;        /* Dirty buffers with BLOCK_CACHE_HELD */
+    block_cache_stats_t stats;
+    sc_lock_t lock;             /* Everything above except buffer data */
+} block_cache_t;
+
+/* Set up a cache of buffer_count blocks in front of device */
+int32_t block_cache_init(block_cache_t* cache, block_device_t* device, uint32_t buffer_count);
+
+/* Release the cache memory; dirty buffers are dropped, so flush first */
+void block_cache_destroy(block_cache_t* cache);
+
+/* Pin the buffer for block, reading it from the device when fill is set and
+   it is not cached. Without fill the contents are undefined on a miss (for
+   callers about to overwrite the whole block). NULL on device error or when
+   every buffer is pinned. */
+cache_buffer_t* block_cache_get(block_cache_t* cache, uint32_t block, bool fill);
+
+/* Pin the buffers for blocks (at most BLOCK_DEVICE_MAX_BATCH) into
+   buffers, in order, as block_cache_get with fill would one by one, but
+   under one lock acquisition and with the uncached blocks read in one
+   batched device request. Returns how many were pinned, fewer when every
+   buffer is pinned, or an error with none pinned. */
+int32_t block_cache_get_batch(block_cache_t* cache, const uint32_t* blocks, uint32_t count,
+                              cache_buffer_t** buffers);
+
+/* Unpin a buffer from block_cache_get, marking it dirty if it was modified */
+void block_cache_release(block_cache_t* cache, cache_buffer_t* buffer, bool dirty);
+
+/* Unpin the buffer that data, a pointer into a pinned buffer's block, lies
+   in (for callers that kept only the pointer) */
+void block_cache_unpin(block_cache_t* cache, const uint8_t* data);
+
+/* Copy part of a block out of / into the cache */
+int32_t block_cache_read(block_cache_t* cache, uint32_t block, uint32_t offset, void* buffer, uint32_t size);
+int32_t block_cache_write(block_cache_t* cache, uint32_t block, uint32_t offset, const void* data, uint32_t size);
+
+/* Read the blocks among blocks (any order, at most BLOCK_DEVICE_MAX_BATCH)
+   that are not cached with one batched device request, into buffers that
+   are evicted first if never used. Returns the number of blocks read. */
+int32_t block_cache_prefetch(block_cache_t* cache, const uint32_t* blocks, uint32_t count);
+
+/* Pass blocks on to the device as prefetch hints, one per contiguous run;
+   nothing is read into the cache */
+void block_cache_hint(block_cache_t* cache, const uint32_t* blocks, uint32_t count);
+
+/* Write one dirty buffer that is not held back right away */
+int32_t block_cache_clean(block_cache_t* cache, cache_buffer_t* buffer);
+
+/* Mark a buffer, which must be dirty or about to be released dirty, as held */
+void block_cache_hold(block_cache_t* cache, cache_buffer_t* buffer);
+
+/* Whether a pinned buffer is held */
+bool block_cache_held(block_cache_t* cache, cache_buffer_t* buffer);
+
+/* Let every held buffer be written back again */
+void block_cache_release_held(block_cache_t* cache);
+
+/* Write every dirty buffer that is not held back, then flush the device */
+int32_t block_cache_flush(block_cache_t* cache);
+
+/* Forget cached copies of blocks that were freed, without writing them back
+   (held ones included) */
+void block_cache_discard(block_cache_t* cache, uint32_t start, uint32_t count);
+
+#endif /* BLOCK_CACHE_H */
@@ -0,0 +1,152 @@
+/* block_device.c - Block device wrappers and the memory driver
+   The wrappers validate requests before they reach a driver and emulate the
+   batch operations for drivers that only move one run at a time. The memory
+   driver serves blocks straight out of a RAM area; it is what fs_init() uses
+   for the classic in-memory file system. */
+
+#include "block_device.h"
+#include "error_codes.h"
+#include "performance_profiler.h"
+#include <string.h>
+
+/* Segment lies inside the device */
+static inline bool in_range(const block_device_t* dev, uint32_t block, uint32_t count) {
+    return block < dev->block_count && count <= dev->block_count - block;
+}
+
+/* Bounds-checked single-run read */
+int32_t block_device_read(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* buffer) {
+    if (!dev || !buffer) {
+        return ERR_NULL_POINTER;
+    }
+    if (!in_range(dev, block, count)) {
+        return ERR_INVALID_PARAMETER;
+    }
+    return count ? dev->ops->read_blocks(dev, block, count, buffer) : ERR_SUCCESS;
+}
+
+/* Bounds-checked single-run write */
+int32_t block_device_write(block_device_t* dev, uint32_t block, uint32_t count, const uint8_t* buffer) {
+    if (!dev || !buffer) {
+        return ERR_NULL_POINTER;
+    }
+    if (!in_range(dev, block, count)) {
+        return ERR_INVALID_PARAMETER;
+    }
+    return count ? dev->ops->write_blocks(dev, block, count, buffer) : ERR_SUCCESS;
+}
+
+/* Validate every segment of a batch */
+static int32_t check_batch(const block_device_t* dev, const block_io_t* segments, uint32_t count) {
+    if (!dev || (!segments && count)) {
+        return ERR_NULL_POINTER;
+    }
+    if (count > BLOCK_DEVICE_MAX_BATCH) {
+        return ERR_INVALID_PARAMETER;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!segments[i].buffer) {
+            return ERR_NULL_POINTER;
+        }
+        if (!in_range(dev, segments[i].block, segments[i].count)) {
+            return ERR_INVALID_PARAMETER;
+        }
+    }
+    return ERR_SUCCESS;
+}
+
+/* Vectored read, one driver call when the driver supports batches */
+int32_t block_device_read_batch(block_device_t* dev, const block_io_t* segments, uint32_t count) {
+    int32_t result = check_batch(dev, segments, count);
+    if (result != ERR_SUCCESS || count == 0) {
+        return result;
+    }
+    if (dev->ops->read_batch) {
+        return dev->ops->read_batch(dev, segments, count);
+    }
+    for (uint32_t i = 0; i < count && result == ERR_SUCCESS; i++) {
+        result = dev->ops->read_blocks(dev, segments[i].block, segments[i].count, segments[i].buffer);
+    }
+    return result;
+}
+
+/* Vectored write, one driver call when the driver supports batches */
+int32_t block_device_write_batch(block_device_t* dev, const block_io_t* segments, uint32_t count) {
+    int32_t result = check_batch(dev, segments, count);
+    if (result != ERR_SUCCESS || count == 0) {
+        return result;
+    }
+    if (dev->ops->write_batch) {
+        return dev->ops->write_batch(dev, segments, count);
+    }
+    for (uint32_t i = 0; i < count && result == ERR_SUCCESS; i++) {
+        result = dev->ops->write_blocks(dev, segments[i].block, segments[i].count, segments[i].buffer);
+    }
+    return result;
+}
+
+/* Make completed writes durable */
+int32_t block_device_flush(block_device_t* dev) {
+    if (!dev) {
+        return ERR_NULL_POINTER;
+    }
+    return dev->ops->flush(dev);
+}
+
+/* Hint upcoming reads */
+int32_t block_device_prefetch(block_device_t* dev, uint32_t block, uint32_t count) {
+    if (!dev) {
+        return ERR_NULL_POINTER;
+    }
+    if (!in_range(dev, block, count)) {
+        return ERR_INVALID_PARAMETER;
+    }
+    return count && dev->ops->prefetch ? dev->ops->prefetch(dev, block, count) : ERR_SUCCESS;
+}
+
+static int32_t memory_read_blocks(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* buffer) {
+    memory_block_device_t* mem = (memory_block_device_t*)dev;
+    memcpy(buffer, mem->memory + (size_t)block * BLOCK_DEVICE_BLOCK_SIZE,
+           (size_t)count * BLOCK_DEVICE_BLOCK_SIZE);
+    return ERR_SUCCESS;
+}
+
+static int32_t memory_write_blocks(block_device_t* dev, uint32_t block, uint32_t count, const uint8_t* buffer) {
+    memory_block_device_t* mem = (memory_block_device_t*)dev;
+    memcpy(mem->memory + (size_t)block * BLOCK_DEVICE_BLOCK_SIZE, buffer,
+           (size_t)count * BLOCK_DEVICE_BLOCK_SIZE);
+    return ERR_SUCCESS;
+}
+
+static int32_t memory_flush(block_device_t* dev) {
+    (void)dev;
+    return ERR_SUCCESS;   /* RAM is as durable as it gets */
+}
+
+/* Pull the start of each block toward the CPU caches; the copy that follows
+   streams the rest */
+static int32_t memory_prefetch(block_device_t* dev, uint32_t block, uint32_t count) {
+    memory_block_device_t* mem = (memory_block_device_t*)dev;
+    const uint8_t* data = mem->memory + (size_t)block * BLOCK_DEVICE_BLOCK_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        PREFETCH(data + (size_t)i * BLOCK_DEVICE_BLOCK_SIZE);
+    }
+    return ERR_SUCCESS;
+}
+
+/* Batches gain nothing over a memcpy per segment, so the wrappers emulate them */
+static const block_device_ops_t memory_ops = {
+    memory_read_blocks,
+    memory_write_blocks,
+    memory_flush,
+    NULL,
+    NULL,
+    memory_prefetch,
+};
+
+/* Initialize a memory device */
+void memory_block_device_init(memory_block_device_t* mem, uint8_t* memory, uint32_t memory_size) {
+    mem->device.ops = &memory_ops;
+    mem->device.block_count = memory ? memory_size / BLOCK_DEVICE_BLOCK_SIZE : 0;
+    mem->memory = memory;
+}
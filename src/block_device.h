@@ -0,0 +1,83 @@
+/* block_device.h - Block device interface used by the file system
+   A device is a table of operations plus its size in blocks; drivers embed
+   block_device_t as the first member of their own state. Transfers are whole
+   BLOCK_DEVICE_BLOCK_SIZE blocks. Operations return 0 on success or a
+   negative error code. Callers go through the block_device_* wrappers, which
+   check bounds and fall back to single transfers for drivers without batch
+   operations. A driver whose reads are slow can take prefetch hints and
+   start fetching blocks in the background, so a read that follows waits
+   less or not at all. */
+
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BLOCK_DEVICE_BLOCK_SIZE 512
+#define BLOCK_DEVICE_MAX_BATCH  64      /* Segments per batch call */
+
+typedef struct block_device block_device_t;
+
+/* One segment of a batch: count blocks from block, to or from buffer */
+typedef struct {
+    uint32_t block;
+    uint32_t count;
+    uint8_t* buffer;
+} block_io_t;
+
+/* Driver operations; the batch entries may be NULL */
+typedef struct {
+    int32_t (*read_blocks)(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* buffer);
+    int32_t (*write_blocks)(block_device_t* dev, uint32_t block, uint32_t count, const uint8_t* buffer);
+    int32_t (*flush)(block_device_t* dev);   /* Make completed writes durable */
+    /* Vectored variants: segments in ascending block order, so a driver can
+       merge adjacent ones into a single device request */
+    int32_t (*read_batch)(block_device_t* dev, const block_io_t* segments, uint32_t count);
+    int32_t (*write_batch)(block_device_t* dev, const block_io_t* segments, uint32_t count);
+    /* Start fetching blocks that will be read soon and return without
+       waiting; may be NULL */
+    int32_t (*prefetch)(block_device_t* dev, uint32_t block, uint32_t count);
+} block_device_ops_t;
+
+struct block_device {
+    const block_device_ops_t* ops;
+    uint32_t block_count;
+};
+
+/* Bounds-checked transfers */
+int32_t block_device_read(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* buffer);
+int32_t block_device_write(block_device_t* dev, uint32_t block, uint32_t count, const uint8_t* buffer);
+int32_t block_device_read_batch(block_device_t* dev, const block_io_t* segments, uint32_t count);
+int32_t block_device_write_batch(block_device_t* dev, const block_io_t* segments, uint32_t count);
+int32_t block_device_flush(block_device_t* dev);
+
+/* Hint that count blocks from block will be read soon; a no-op for drivers
+   without prefetch */
+int32_t block_device_prefetch(block_device_t* dev, uint32_t block, uint32_t count);
+
+/* RAM-backed device over a caller-owned memory area */
+typedef struct {
+    block_device_t device;
+    uint8_t* memory;
+} memory_block_device_t;
+
+/* Initialize a memory device; trailing bytes short of a block are unused */
+void memory_block_device_init(memory_block_device_t* mem, uint8_t* memory, uint32_t memory_size);
+
+#ifdef S00K_HOSTED
+/* Device backed by a disk image file (hosted builds only) */
+typedef struct {
+    block_device_t device;
+    int fd;
+} file_block_device_t;
+
+/* Open an image file. With create set the file is created or resized to
+   block_count blocks; otherwise block_count 0 takes the size of the file. */
+int32_t file_block_device_open(file_block_device_t* file, const char* path, uint32_t block_count, bool create);
+
+/* Close the image; does not flush */
+void file_block_device_close(file_block_device_t* file);
+#endif
+
+#endif /* BLOCK_DEVICE_H */
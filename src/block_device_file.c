@@ -0,0 +1,168 @@
+/* block_device_file.c - Block device backed by a disk image file
+   Hosted builds only. Transfers use pread/pwrite at block offsets; batches
+   merge segments that continue one another into a single preadv/pwritev, so
+   a sorted write-back of scattered cache buffers costs one system call per
+   contiguous run rather than one per block. Flush is fdatasync. Prefetch
+   hints become posix_fadvise(WILLNEED), which has the host start reading
+   the range in the background. */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "block_device.h"
+#include "error_codes.h"
+
+#ifndef S00K_HOSTED
+#error "block_device_file.c is only part of the hosted build (define S00K_HOSTED)"
+#endif
+
+static inline off_t block_offset(uint32_t block) {
+    return (off_t)block * BLOCK_DEVICE_BLOCK_SIZE;
+}
+
+/* Move every byte described by iov, resuming after short transfers */
+static int32_t transfer(int fd, struct iovec* iov, int iov_count, off_t offset, bool write) {
+    while (iov_count > 0) {
+        ssize_t done = write ? pwritev(fd, iov, iov_count, offset) : preadv(fd, iov, iov_count, offset);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return ERR_IO_DEVICE_ERROR;   /* error, or end of file on a read */
+        }
+        offset += done;
+        while (iov_count > 0 && (size_t)done >= iov->iov_len) {
+            done -= (ssize_t)iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + done;
+            iov->iov_len -= (size_t)done;
+        }
+    }
+    return ERR_SUCCESS;
+}
+
+static int32_t file_transfer_blocks(block_device_t* dev, uint32_t block, uint32_t count,
+                                    uint8_t* buffer, bool write) {
+    file_block_device_t* file = (file_block_device_t*)dev;
+    struct iovec iov = { buffer, (size_t)count * BLOCK_DEVICE_BLOCK_SIZE };
+    return transfer(file->fd, &iov, 1, block_offset(block), write);
+}
+
+static int32_t file_read_blocks(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* buffer) {
+    return file_transfer_blocks(dev, block, count, buffer, false);
+}
+
+static int32_t file_write_blocks(block_device_t* dev, uint32_t block, uint32_t count, const uint8_t* buffer) {
+    return file_transfer_blocks(dev, block, count, (uint8_t*)buffer, true);
+}
+
+/* One vectored call per run of adjacent segments */
+static int32_t file_transfer_batch(block_device_t* dev, const block_io_t* segments, uint32_t count, bool write) {
+    file_block_device_t* file = (file_block_device_t*)dev;
+    struct iovec iov[BLOCK_DEVICE_MAX_BATCH];
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t first = i;
+        uint32_t next_block = segments[i].block;
+        int iov_count = 0;
+        while (i < count && segments[i].block == next_block) {
+            iov[iov_count].iov_base = segments[i].buffer;
+            iov[iov_count].iov_len = (size_t)segments[i].count * BLOCK_DEVICE_BLOCK_SIZE;
+            iov_count++;
+            next_block += segments[i].count;
+            i++;
+        }
+        int32_t result = transfer(file->fd, iov, iov_count, block_offset(segments[first].block), write);
+        if (result != ERR_SUCCESS) {
+            return result;
+        }
+    }
+    return ERR_SUCCESS;
+}
+
+static int32_t file_read_batch(block_device_t* dev, const block_io_t* segments, uint32_t count) {
+    return file_transfer_batch(dev, segments, count, false);
+}
+
+static int32_t file_write_batch(block_device_t* dev, const block_io_t* segments, uint32_t count) {
+    return file_transfer_batch(dev, segments, count, true);
+}
+
+static int32_t file_flush(block_device_t* dev) {
+    file_block_device_t* file = (file_block_device_t*)dev;
+    return fdatasync(file->fd) == 0 ? ERR_SUCCESS : ERR_IO_DEVICE_ERROR;
+}
+
+static int32_t file_prefetch(block_device_t* dev, uint32_t block, uint32_t count) {
+    file_block_device_t* file = (file_block_device_t*)dev;
+    int result = posix_fadvise(file->fd, block_offset(block), (off_t)count * BLOCK_DEVICE_BLOCK_SIZE,
+                               POSIX_FADV_WILLNEED);
+    return result == 0 ? ERR_SUCCESS : ERR_IO_DEVICE_ERROR;
+}
+
+static const block_device_ops_t file_ops = {
+    file_read_blocks,
+    file_write_blocks,
+    file_flush,
+    file_read_batch,
+    file_write_batch,
+    file_prefetch,
+};
+
+/* Open an image file */
+int32_t file_block_device_open(file_block_device_t* file, const char* path, uint32_t block_count, bool create) {
+    if (!file || !path) {
+        return ERR_NULL_POINTER;
+    }
+    if (create && block_count == 0) {
+        return ERR_INVALID_PARAMETER;
+    }
+
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+        return ERR_IO_DEVICE_ERROR;
+    }
+    if (create) {
+        if (ftruncate(fd, block_offset(block_count)) != 0) {
+            close(fd);
+            return ERR_IO_DEVICE_ERROR;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return ERR_IO_DEVICE_ERROR;
+        }
+        uint64_t blocks = (uint64_t)st.st_size / BLOCK_DEVICE_BLOCK_SIZE;
+        if (block_count == 0) {
+            block_count = blocks > UINT32_MAX ? UINT32_MAX : (uint32_t)blocks;
+        }
+        if (block_count == 0 || block_count > blocks) {
+            close(fd);
+            return ERR_INVALID_PARAMETER;
+        }
+    }
+
+    file->device.ops = &file_ops;
+    file->device.block_count = block_count;
+    file->fd = fd;
+    return ERR_SUCCESS;
+}
+
+/* Close the image */
+void file_block_device_close(file_block_device_t* file) {
+    if (file && file->fd >= 0) {
+        close(file->fd);
+        file->fd = -1;
+        file->device.block_count = 0;
+    }
+}
@@ -42,6 +42,7 @@
 #define ERR_FILE_SYSTEM_FULL        -35
 #define ERR_OUT_OF_SPACE            -36
 #define ERR_FILE_SYSTEM_INIT_FAILED -37
+#define ERR_TOO_MANY_OPEN_FILES     -38
 
 /* Memory errors */
 #define ERR_INVALID_ADDRESS     -50
@@ -1,146 +1,2572 @@
 /* file_system.c - Basic file system implementation
-   In-memory hierarchical filesystem with fixed-size directory entries and
-   simple linear block allocation over a contiguous data area. Designed for
-   clarity over completeness; no on-disk persistence or fragmentation management. */
+   Hierarchical filesystem over a block device, with all block I/O going
+   through a write-back block cache. Entries live in page-sized chunks that
+   never move; a hash index over (parent, name) makes lookups O(1) and each
+   directory links its children so listing and emptiness checks only visit
+   the directory's own entries. Files map blocks through direct, single and
+   double indirect pointers. Blocks are tracked in a free-block bitmap and
+   handed out as extents: a growing file continues from its last block when
+   possible, otherwise the first free run long enough for the request is used.
+   The layout on the device is described in fs_format.h; every change to an
+   entry, the bitmap or a pointer block is written through the cache into
+   its home block and logged in the metadata journal (journal.h). Each
+   operation joins the running transaction and transactions commit as a
+   group, so after a crash an operation is either complete or absent, and
+   mount only replays the journal. Threads share the file system through
+   the locks described in file_system.h: I/O on different files only meets
+   in short allocator sections and the block cache. Designed for clarity
+   over completeness. */
 
 #include "file_system.h"
+#include "fs_format.h"
 #include "error_codes.h"
 #include "kernel.h"
+#include "memory_management.h"
+#include "performance_profiler.h"
 #include <string.h>
 
+#if MAX_FILENAME_LENGTH != FS_ONDISK_NAME_LENGTH || FS_DIRECT_BLOCKS != FS_ONDISK_DIRECT_BLOCKS
+#error "File and fs_inode_t disagree on the name or direct block array size"
+#endif
+
+static int32_t store_entry(FileSystem* fs, uint32_t index);
+static int32_t remove_entry(FileSystem* fs, uint32_t file_index);
+static int32_t delete_entry(FileSystem* fs, uint32_t file_index);
+static int32_t commit_transaction(FileSystem* fs);
+static int32_t make_journal_room(FileSystem* fs, uint32_t file_index);
+
+/* Entry index is in range and in use */
+static inline int entry_in_use(const FileSystem* fs, uint32_t index) {
+    return index < fs->entry_capacity && fs_entry(fs, index)->used;
+}
+
+/* FNV-1a over the name, seeded with the parent directory */
+static inline uint32_t entry_hash_seed(uint32_t parent_dir) {
+    return 2166136261u ^ parent_dir;
+}
+
+static inline uint32_t entry_hash_step(uint32_t hash, char c) {
+    return (hash ^ (uint8_t)c) * 16777619u;
+}
+
+static uint32_t entry_hash(uint32_t parent_dir, const char* name) {
+    uint32_t hash = entry_hash_seed(parent_dir);
+    while (*name) {
+        hash = entry_hash_step(hash, *name++);
+    }
+    return hash;
+}
+
+/* Append an entry to its parent's child list, except for the root */
+static void link_child(FileSystem* fs, uint32_t index) {
+    File* file = fs_entry(fs, index);
+    file->next_sibling = FS_NO_ENTRY;
+    file->prev_sibling = FS_NO_ENTRY;
+    if (index == file->parent_dir) {
+        return; /* the root is its own parent */
+    }
+    File* parent = fs_entry(fs, file->parent_dir);
+    file->prev_sibling = parent->last_child;
+    if (parent->last_child != FS_NO_ENTRY) {
+        fs_entry(fs, parent->last_child)->next_sibling = index;
+    } else {
+        parent->first_child = index;
+    }
+    parent->last_child = index;
+}
+
+/* Dentry cache set for a name hash; multiplying spreads names that differ
+   in a digit or two, which FNV leaves close together in the low bits */
+static inline fs_dentry_t* dentry_set(const FileSystem* fs, uint32_t hash) {
+    return &fs->dentries[((hash * 2654435761u) >> (32 - FS_DCACHE_SET_BITS)) * FS_DCACHE_WAYS];
+}
+
+/* Dentry holds the length bytes at name, which need not be terminated */
+static inline int dentry_matches(const fs_dentry_t* dentry, uint32_t parent_dir, const char* name,
+                                 uint32_t length) {
+    return dentry->parent == parent_dir && memcmp(dentry->name, name, length) == 0 &&
+           dentry->name[length] == '\0';
+}
+
+/* Drop the cached lookup of name in parent_dir, if any; every change to
+   what a name resolves to goes through here */
+static void dentry_forget(FileSystem* fs, uint32_t parent_dir, const char* name) {
+    if (fs->dentries) {
+        fs_dentry_t* set = dentry_set(fs, entry_hash(parent_dir, name));
+        uint32_t length = (uint32_t)strlen(name);
+        for (uint32_t way = 0; way < FS_DCACHE_WAYS; way++) {
+            if (dentry_matches(&set[way], parent_dir, name, length)) {
+                set[way].parent = FS_NO_ENTRY;
+            }
+        }
+    }
+}
+
+/* Link a new entry, which has no children yet, into the name index and its parent */
+static void index_insert(FileSystem* fs, uint32_t index) {
+    File* file = fs_entry(fs, index);
+    dentry_forget(fs, file->parent_dir, file->name);
+    uint32_t bucket = entry_hash(file->parent_dir, file->name) & fs->bucket_mask;
+    file->hash_next = fs->name_buckets[bucket];
+    fs->name_buckets[bucket] = index;
+    file->first_child = FS_NO_ENTRY;
+    file->last_child = FS_NO_ENTRY;
+    link_child(fs, index);
+}
+
+static void index_remove(FileSystem* fs, uint32_t index) {
+    File* file = fs_entry(fs, index);
+    dentry_forget(fs, file->parent_dir, file->name);
+    uint32_t* link = &fs->name_buckets[entry_hash(file->parent_dir, file->name) & fs->bucket_mask];
+    while (*link != index) {
+        link = &fs_entry(fs, *link)->hash_next;
+    }
+    *link = file->hash_next;
+
+    if (index == file->parent_dir) {
+        return;
+    }
+    File* parent = fs_entry(fs, file->parent_dir);
+    if (file->prev_sibling != FS_NO_ENTRY) {
+        fs_entry(fs, file->prev_sibling)->next_sibling = file->next_sibling;
+    } else {
+        parent->first_child = file->next_sibling;
+    }
+    if (file->next_sibling != FS_NO_ENTRY) {
+        fs_entry(fs, file->next_sibling)->prev_sibling = file->prev_sibling;
+    } else {
+        parent->last_child = file->prev_sibling;
+    }
+}
+
+/* Entry named name inside parent_dir, or FS_NO_ENTRY */
+static uint32_t index_lookup_hashed(const FileSystem* fs, uint32_t parent_dir, const char* name, uint32_t hash) {
+    uint32_t index = fs->name_buckets[hash & fs->bucket_mask];
+    while (index != FS_NO_ENTRY) {
+        const File* file = fs_entry(fs, index);
+        if (file->parent_dir == parent_dir && strcmp(file->name, name) == 0) {
+            return index;
+        }
+        index = file->hash_next;
+    }
+    return FS_NO_ENTRY;
+}
+
+static uint32_t index_lookup(const FileSystem* fs, uint32_t parent_dir, const char* name) {
+    return index_lookup_hashed(fs, parent_dir, name, entry_hash(parent_dir, name));
+}
+
+/* Visible entry named by the length bytes at name (shorter than
+   MAX_FILENAME_LENGTH, not terminated) inside parent_dir, or FS_NO_ENTRY,
+   through the dentry cache; hash is entry_hash of the name. Lookups share
+   the tree lock, so each set has a lock for its slots; changes to the tree
+   exclude lookups and forget entries without it. */
+static uint32_t dentry_lookup(FileSystem* fs, uint32_t parent_dir, const char* name, uint32_t length,
+                              uint32_t hash) {
+    fs_dentry_t* set = fs->dentries ? dentry_set(fs, hash) : NULL;
+    sc_lock_t* lock = set ? &fs->dcache_locks[(set - fs->dentries) / FS_DCACHE_WAYS] : NULL;
+    if (lock) {
+        sc_lock_acquire(lock);
+    }
+    for (uint32_t way = 0; set && way < FS_DCACHE_WAYS; way++) {
+        if (dentry_matches(&set[way], parent_dir, name, length)) {
+            /* Keep the set in recently used order */
+            fs_dentry_t hit = set[way];
+            memmove(&set[1], &set[0], way * sizeof(fs_dentry_t));
+            set[0] = hit;
+            fs->dcache_hits++;
+            sc_lock_release(lock);
+            return hit.index;
+        }
+    }
+    fs->dcache_misses++;
+
+    char terminated[MAX_FILENAME_LENGTH];
+    memcpy(terminated, name, length);
+    terminated[length] = '\0';
+    uint32_t index = index_lookup_hashed(fs, parent_dir, terminated, hash);
+    if (index != FS_NO_ENTRY && fs_entry(fs, index)->unlinked) {
+        index = FS_NO_ENTRY;
+    }
+    if (set) {
+        /* Replace the least recently used slot */
+        memmove(&set[1], &set[0], (FS_DCACHE_WAYS - 1) * sizeof(fs_dentry_t));
+        set[0].parent = parent_dir;
+        set[0].index = index;
+        memcpy(set[0].name, terminated, length + 1);
+        sc_lock_release(lock);
+    }
+    return index;
+}
+
+/* Bytes the page allocator actually hands out for a request (power-of-two pages) */
+static size_t page_block_size(size_t bytes) {
+    size_t block = PAGE_SIZE;
+    while (block < bytes) {
+        block <<= 1;
+    }
+    return block;
+}
+
+/* Add one page of entries, pushing them on the free list lowest index first.
+   Existing chunks never move, so entry pointers stay valid across growth. */
+static int32_t add_entry_chunk(FileSystem* fs) {
+    if (fs->entry_capacity >= fs->inode_count) {
+        return ERR_FILE_SYSTEM_FULL;   /* the inode table is full */
+    }
+    if (fs->chunk_count == fs->chunk_slots) {
+        size_t bytes = page_block_size((fs->chunk_slots ? fs->chunk_slots * 2 : 1) * sizeof(File*));
+        if (bytes > MAX_ALLOCATION_SIZE) {
+            return ERR_FILE_SYSTEM_FULL;
+        }
+        File** chunks = (File**)allocate_memory(bytes);
+        if (!chunks) {
+            return ERR_OUT_OF_MEMORY;
+        }
+        if (fs->entry_chunks) {
+            memcpy(chunks, fs->entry_chunks, fs->chunk_count * sizeof(File*));
+            free_memory(fs->entry_chunks);
+        }
+        fs->entry_chunks = chunks;
+        fs->chunk_slots = (uint32_t)(bytes / sizeof(File*));
+    }
+
+    File* chunk = (File*)allocate_memory(FS_ENTRY_CHUNK_SIZE);
+    if (!chunk) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    fs->entry_chunks[fs->chunk_count++] = chunk;
+
+    uint32_t first = fs->entry_capacity;
+    fs->entry_capacity += FS_ENTRIES_PER_CHUNK;
+    for (uint32_t i = fs->entry_capacity; i-- > first;) {
+        File* file = fs_entry(fs, i);
+        memset(file, 0, sizeof(File));
+        if (i < fs->inode_count) {
+            file->hash_next = fs->free_entry;
+            fs->free_entry = i;
+        }
+    }
+    return ERR_SUCCESS;
+}
+
+/* Replace the name index with one of bucket_count buckets (a power of two) */
+static int32_t resize_name_index(FileSystem* fs, uint32_t bucket_count) {
+    size_t bytes = page_block_size(bucket_count * sizeof(uint32_t));
+    if (bytes > MAX_ALLOCATION_SIZE) {
+        return ERR_FILE_SYSTEM_FULL;
+    }
+    uint32_t* heads = (uint32_t*)allocate_memory(bytes);
+    if (!heads) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    if (fs->name_buckets) {
+        free_memory(fs->name_buckets);
+    }
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        heads[b] = FS_NO_ENTRY;
+    }
+    fs->name_buckets = heads;
+    fs->bucket_mask = bucket_count - 1;
+
+    for (uint32_t i = 0; i < fs->entry_capacity; i++) {
+        File* file = fs_entry(fs, i);
+        if (file->used) {
+            uint32_t bucket = entry_hash(file->parent_dir, file->name) & fs->bucket_mask;
+            file->hash_next = heads[bucket];
+            heads[bucket] = i;
+        }
+    }
+    return ERR_SUCCESS;
+}
+
+/* Put every unused entry that has an inode on the free list, lowest index first */
+static void rebuild_free_list(FileSystem* fs) {
+    fs->free_entry = FS_NO_ENTRY;
+    uint32_t limit = fs->entry_capacity < fs->inode_count ? fs->entry_capacity : fs->inode_count;
+    for (uint32_t i = limit; i-- > 0;) {
+        File* file = fs_entry(fs, i);
+        if (!file->used) {
+            file->hash_next = fs->free_entry;
+            fs->free_entry = i;
+        }
+    }
+}
+
 /* Helper function to find a free file entry */
 static int find_free_entry(FileSystem* fs) {
-    /* Scan the fixed-size table for an unused entry; returns index or -1. */
-    for (uint32_t i = 0; i < MAX_FILES_PER_DIR * 2; i++) {
-        if (!fs->files[i].used) {
-            return i;
+    /* Pop the unused list, adding a chunk when it runs dry; returns index or -1. */
+    if (fs->free_entry == FS_NO_ENTRY && add_entry_chunk(fs) != ERR_SUCCESS) {
+        return -1;
+    }
+    
+    /* Keep the name index at no more than one entry per bucket on average;
+       if it cannot grow, chains just get longer */
+    if (fs->file_count + 1 > fs->bucket_mask + 1) {
+        resize_name_index(fs, (fs->bucket_mask + 1) * 2);
+    }
+    
+    uint32_t index = fs->free_entry;
+    fs->free_entry = fs_entry(fs, index)->hash_next;
+    return (int)index;
+}
+
+/* Bytes of memory for the bitmap and its summary levels */
+static size_t block_map_bytes(uint32_t total_blocks) {
+    return (HBITMAP_WORDS(total_blocks) + HBITMAP_SUMMARY_WORDS(total_blocks) +
+            HBITMAP_TOP_WORDS(total_blocks)) * sizeof(uint64_t);
+}
+
+/* Copy data into a metadata block through the cache and log the block */
+static int32_t meta_write(FileSystem* fs, uint32_t block, uint32_t offset, const void* data, uint32_t size) {
+    cache_buffer_t* buffer = block_cache_get(&fs->cache, block, size != BLOCK_SIZE);
+    if (!buffer) {
+        return ERR_IO_DEVICE_ERROR;
+    }
+    int32_t result = journal_log(&fs->journal, &fs->cache, buffer);
+    if (result == ERR_SUCCESS) {
+        memcpy(buffer->data + offset, data, size);
+    }
+    block_cache_release(&fs->cache, buffer, result == ERR_SUCCESS);
+    return result;
+}
+
+/* Copy the bitmap words covering [start, start + count) to the bitmap blocks */
+static int32_t store_map_range(FileSystem* fs, uint32_t start, uint32_t count) {
+    const uint8_t* words = (const uint8_t*)fs->block_map_memory;
+    uint32_t offset = (start >> 6) * (uint32_t)sizeof(uint64_t);
+    uint32_t end = (((start + count - 1) >> 6) + 1) * (uint32_t)sizeof(uint64_t);
+    while (offset < end) {
+        uint32_t in_block = offset % BLOCK_SIZE;
+        uint32_t chunk = BLOCK_SIZE - in_block < end - offset ? BLOCK_SIZE - in_block : end - offset;
+        int32_t result = meta_write(fs, fs->bitmap_start + offset / BLOCK_SIZE, in_block, words + offset, chunk);
+        if (result != ERR_SUCCESS) {
+            return result;
+        }
+        offset += chunk;
+    }
+    return ERR_SUCCESS;
+}
+
+/* Claim one extent of at most max_count blocks. The run starting at hint is
+   preferred so files grow in place; otherwise the first free run that holds
+   all wanted blocks, and failing that the first free blocks found.
+   Returns the extent length (0 when full) and its first block in *start. */
+static uint32_t allocate_extent(FileSystem* fs, uint32_t hint, uint32_t wanted, uint32_t max_count,
+                                uint32_t* start) {
+    uint32_t first = HBITMAP_NONE;
+    if (hint < fs->total_blocks && !hbitmap_test(&fs->block_map, hint)) {
+        first = hint;
+    } else {
+        first = hbitmap_find_zero_run(&fs->block_map, wanted, 1);
+        if (first == HBITMAP_NONE) {
+            first = hbitmap_find_zero(&fs->block_map, 0);
+        }
+    }
+    if (first == HBITMAP_NONE) {
+        return 0;
+    }
+
+    uint32_t limit = max_count < fs->total_blocks - first ? first + max_count : fs->total_blocks;
+    uint32_t end = hbitmap_find_set(&fs->block_map, first, limit);
+    hbitmap_set_range(&fs->block_map, first, end - first);
+    if (store_map_range(fs, first, end - first) != ERR_SUCCESS) {
+        hbitmap_clear_range(&fs->block_map, first, end - first);
+        return 0;
+    }
+    fs->free_block_count -= end - first;
+    if (end > fs->block_high_water) {
+        fs->block_high_water = end;
+    }
+    *start = first;
+    return end - first;
+}
+
+/* Remember an extent freed in the running transaction, merging it with the
+   previous one when they touch; false when the list cannot grow */
+static bool defer_free(FileSystem* fs, uint32_t start, uint32_t length) {
+    uint32_t* last = fs->pending_count ? &fs->pending_frees[2 * (fs->pending_count - 1)] : NULL;
+    if (last && last[0] + last[1] == start) {
+        last[1] += length;
+        fs->pending_blocks += length;
+        return true;
+    }
+    if (fs->pending_count == fs->pending_slots) {
+        size_t bytes = page_block_size((fs->pending_slots ? fs->pending_slots * 2 : 1) * 2 * sizeof(uint32_t));
+        if (bytes > MAX_ALLOCATION_SIZE) {
+            return false;
+        }
+        uint32_t* extents = (uint32_t*)allocate_memory(bytes);
+        if (!extents) {
+            return false;
+        }
+        if (fs->pending_frees) {
+            memcpy(extents, fs->pending_frees, fs->pending_count * 2 * sizeof(uint32_t));
+            free_memory(fs->pending_frees);
+        }
+        fs->pending_frees = extents;
+        fs->pending_slots = (uint32_t)(bytes / (2 * sizeof(uint32_t)));
+    }
+    fs->pending_frees[2 * fs->pending_count] = start;
+    fs->pending_frees[2 * fs->pending_count + 1] = length;
+    fs->pending_count++;
+    fs->pending_blocks += length;
+    return true;
+}
+
+/* Return a run of blocks to the bitmap, dropping any cached or logged copies.
+   With the journal active the blocks stay allocated until the transaction
+   freeing them commits: reused earlier, they could receive data that a
+   crash would leave inside the file that still owns them. */
+static void release_blocks(FileSystem* fs, uint32_t start, uint32_t length) {
+    if (length && start >= fs->reserved_blocks && start + length <= fs->total_blocks) {
+        journal_forget(&fs->journal, start, length);
+        block_cache_discard(&fs->cache, start, length);
+        if (fs->journal.active && defer_free(fs, start, length)) {
+            store_map_range(fs, start, length);   /* logs the bitmap blocks the commit will change */
+            return;
+        }
+        hbitmap_clear_range(&fs->block_map, start, length);
+        fs->free_block_count += length;
+        store_map_range(fs, start, length);
+    }
+}
+
+/* Free a pointer block. A dirty copy that is not logged comes from a
+   committed transaction that recovery may still replay over its home, so it
+   is written there before the cache forgets it. */
+static void release_pointer_block(FileSystem* fs, uint32_t block) {
+    if (block && fs->journal.active) {
+        cache_buffer_t* buffer = block_cache_get(&fs->cache, block, true);
+        if (buffer) {
+            block_cache_clean(&fs->cache, buffer);
+            block_cache_release(&fs->cache, buffer, false);
+        }
+    }
+    release_blocks(fs, block, block ? 1 : 0);
+}
+
+/* Clear the bits of every deferred free; their bitmap blocks are already logged */
+static void apply_pending_frees(FileSystem* fs) {
+    for (uint32_t i = 0; i < fs->pending_count; i++) {
+        uint32_t start = fs->pending_frees[2 * i];
+        uint32_t length = fs->pending_frees[2 * i + 1];
+        hbitmap_clear_range(&fs->block_map, start, length);
+        store_map_range(fs, start, length);
+    }
+    fs->free_block_count += fs->pending_blocks;
+    fs->pending_count = 0;
+    fs->pending_blocks = 0;
+}
+
+/* References to a block beyond the first, as counted in the refcount table */
+static uint8_t block_refs(FileSystem* fs, uint32_t block) {
+    uint8_t refs = 0;
+    if (fs->shared_blocks &&
+        block_cache_read(&fs->cache, fs->refcount_start + block / BLOCK_SIZE, block % BLOCK_SIZE,
+                         &refs, sizeof(refs)) != ERR_SUCCESS) {
+        refs = 0;
+    }
+    return refs;
+}
+
+/* Add a reference to a block (delta 1) or drop one of its extra references (-1) */
+static int32_t adjust_refs(FileSystem* fs, uint32_t block, int32_t delta) {
+    uint32_t home = fs->refcount_start + block / BLOCK_SIZE;
+    uint8_t refs = 0;
+    int32_t result = block_cache_read(&fs->cache, home, block % BLOCK_SIZE, &refs, sizeof(refs));
+    if (result != ERR_SUCCESS) {
+        return result;
+    }
+    uint8_t updated = (uint8_t)(refs + delta);
+    result = meta_write(fs, home, block % BLOCK_SIZE, &updated, sizeof(updated));
+    if (result == ERR_SUCCESS && refs == 0) {
+        fs->shared_blocks++;
+    } else if (result == ERR_SUCCESS && updated == 0) {
+        fs->shared_blocks--;
+    }
+    return result;
+}
+
+/* Drop one reference to a block; true when it was the only one, so the
+   block is the caller's to free */
+static bool drop_ref(FileSystem* fs, uint32_t block) {
+    if (block_refs(fs, block) == 0) {
+        return true;
+    }
+    adjust_refs(fs, block, -1);
+    return false;
+}
+
+/* Fill a block with zeros without reading it from the device; pointer
+   blocks are metadata and get logged */
+static int32_t zero_block(FileSystem* fs, uint32_t block, bool metadata) {
+    cache_buffer_t* buffer = block_cache_get(&fs->cache, block, false);
+    if (!buffer) {
+        return ERR_IO_DEVICE_ERROR;
+    }
+    int32_t result = metadata ? journal_log(&fs->journal, &fs->cache, buffer) : ERR_SUCCESS;
+    if (result == ERR_SUCCESS) {
+        memset(buffer->data, 0, BLOCK_SIZE);
+    }
+    block_cache_release(&fs->cache, buffer, result == ERR_SUCCESS);
+    return result;
+}
+
+/* Pointer blocks a file of data_blocks data blocks needs */
+static uint32_t pointer_blocks(uint32_t data_blocks) {
+    uint32_t count = 0;
+    if (data_blocks > FS_DIRECT_BLOCKS) {
+        count++;
+    }
+    if (data_blocks > FS_DIRECT_BLOCKS + FS_POINTERS_PER_BLOCK) {
+        uint32_t doubly = data_blocks - FS_DIRECT_BLOCKS - FS_POINTERS_PER_BLOCK;
+        count += 1 + (doubly + FS_POINTERS_PER_BLOCK - 1) / FS_POINTERS_PER_BLOCK;
+    }
+    return count;
+}
+
+/* Pointer number index in pointer block table, or 0 if the table is absent or unreadable */
+static uint32_t read_pointer(FileSystem* fs, uint32_t table, uint32_t index) {
+    uint32_t value = 0;
+    if (table < fs->reserved_blocks || table >= fs->total_blocks ||
+        block_cache_read(&fs->cache, table, index * (uint32_t)sizeof(uint32_t),
+                         &value, sizeof(value)) != ERR_SUCCESS) {
+        return 0;
+    }
+    return value;
+}
+
+/* Give *ref a zeroed pointer block if it has none yet */
+static int32_t ensure_pointer_block(FileSystem* fs, uint32_t* ref) {
+    if (*ref != 0) {
+        return ERR_SUCCESS;
+    }
+    uint32_t block = 0;
+    if (allocate_extent(fs, fs->next_free_block, 1, 1, &block) == 0) {
+        return ERR_OUT_OF_SPACE;
+    }
+    int32_t result = zero_block(fs, block, true);
+    if (result != ERR_SUCCESS) {
+        release_blocks(fs, block, 1);
+        return result;
+    }
+    *ref = block;
+    return ERR_SUCCESS;
+}
+
+/* Physical block backing a file's logical block, or 0 if unmapped */
+static uint32_t fs_bmap(FileSystem* fs, const File* file, uint32_t logical) {
+    if (logical >= file->block_count) {
+        return 0;
+    }
+    if (logical < FS_DIRECT_BLOCKS) {
+        return file->blocks[logical];
+    }
+    logical -= FS_DIRECT_BLOCKS;
+    if (logical < FS_POINTERS_PER_BLOCK) {
+        return read_pointer(fs, file->indirect, logical);
+    }
+    logical -= FS_POINTERS_PER_BLOCK;
+    uint32_t table = read_pointer(fs, file->double_indirect, logical / FS_POINTERS_PER_BLOCK);
+    return read_pointer(fs, table, logical % FS_POINTERS_PER_BLOCK);
+}
+
+/* Physical blocks behind count logical blocks from logical, reading each
+   pointer block once; 0 past the end of the file */
+static void bmap_run(FileSystem* fs, const File* file, uint32_t logical, uint32_t count, uint32_t* blocks) {
+    while (count > 0) {
+        uint32_t n = 1;
+        if (logical >= file->block_count) {
+            blocks[0] = 0;
+        } else if (logical < FS_DIRECT_BLOCKS) {
+            blocks[0] = file->blocks[logical];
+        } else {
+            uint32_t table = file->indirect;
+            uint32_t index = logical - FS_DIRECT_BLOCKS;
+            if (index >= FS_POINTERS_PER_BLOCK) {
+                index -= FS_POINTERS_PER_BLOCK;
+                table = read_pointer(fs, file->double_indirect, index / FS_POINTERS_PER_BLOCK);
+                index %= FS_POINTERS_PER_BLOCK;
+            }
+            n = FS_POINTERS_PER_BLOCK - index;
+            if (n > count) {
+                n = count;
+            }
+            if (n > file->block_count - logical) {
+                n = file->block_count - logical;
+            }
+            if (table < fs->reserved_blocks || table >= fs->total_blocks ||
+                block_cache_read(&fs->cache, table, index * (uint32_t)sizeof(uint32_t), blocks,
+                                 n * (uint32_t)sizeof(uint32_t)) != ERR_SUCCESS) {
+                memset(blocks, 0, n * sizeof(uint32_t));
+            }
+        }
+        blocks += n;
+        logical += n;
+        count -= n;
+    }
+}
+
+/* Record physical as the block behind logical, adding pointer blocks on the way */
+static int32_t map_block(FileSystem* fs, File* file, uint32_t logical, uint32_t physical) {
+    if (logical < FS_DIRECT_BLOCKS) {
+        file->blocks[logical] = physical;
+        return ERR_SUCCESS;
+    }
+    logical -= FS_DIRECT_BLOCKS;
+
+    uint32_t table = 0;
+    int32_t result = ERR_SUCCESS;
+    if (logical < FS_POINTERS_PER_BLOCK) {
+        result = ensure_pointer_block(fs, &file->indirect);
+        table = file->indirect;
+    } else {
+        logical -= FS_POINTERS_PER_BLOCK;
+        uint32_t outer = logical / FS_POINTERS_PER_BLOCK;
+        logical %= FS_POINTERS_PER_BLOCK;
+        result = ensure_pointer_block(fs, &file->double_indirect);
+        if (result == ERR_SUCCESS) {
+            table = read_pointer(fs, file->double_indirect, outer);
+            if (table == 0) {
+                result = ensure_pointer_block(fs, &table);
+                if (result == ERR_SUCCESS) {
+                    result = meta_write(fs, file->double_indirect, outer * (uint32_t)sizeof(uint32_t),
+                                        &table, sizeof(table));
+                }
+            }
+        }
+    }
+    if (result != ERR_SUCCESS) {
+        return result;
+    }
+    return meta_write(fs, table, logical * (uint32_t)sizeof(uint32_t), &physical, sizeof(physical));
+}
+
+/* Helper function to allocate data blocks */
+static int allocate_blocks(FileSystem* fs, uint32_t file_index, uint32_t block_count) {
+    /* Extent allocation: each run continues from the file's last block when it
+       can. Pointer blocks are counted up front so a write never half-fails.
+       Extents are capped so a long write can commit between them, leaving a
+       file whose extra blocks lie past its size if it is cut short. */
+    File* file = fs_entry(fs, file_index);
+    uint32_t needed = block_count - file->block_count +
+                      pointer_blocks(block_count) - pointer_blocks(file->block_count);
+    if (needed > fs->free_block_count) {
+        return FS_ERROR_NO_SPACE;
+    }
+    
+    while (file->block_count < block_count) {
+        if (make_journal_room(fs, file_index) != ERR_SUCCESS) {
+            return FS_ERROR_NO_SPACE;
+        }
+        uint32_t logical = file->block_count;
+        uint32_t hint = logical ? fs_bmap(fs, file, logical - 1) + 1 : fs->next_free_block;
+        uint32_t wanted = block_count - logical;
+        uint32_t start = 0;
+        uint32_t length = allocate_extent(fs, hint, wanted,
+                                          wanted < FS_JOURNAL_EXTENT_BLOCKS ? wanted : FS_JOURNAL_EXTENT_BLOCKS,
+                                          &start);
+        if (length == 0) {
+            return FS_ERROR_NO_SPACE; /* free count and bitmap disagree */
+        }
+        fs->next_free_block = start + length;
+        for (uint32_t i = 0; i < length; i++) {
+            if (map_block(fs, file, logical + i, start + i) != ERR_SUCCESS) {
+                release_blocks(fs, start + i, length - i);
+                return FS_ERROR_NO_SPACE;
+            }
+            file->block_count = logical + i + 1;
+        }
+    }
+    return FS_SUCCESS;
+}
+
+/* Add block to the (start, length) run being freed, releasing the run
+   first if block does not extend it */
+static void release_in_run(FileSystem* fs, uint32_t* run, uint32_t block) {
+    if (run[1] && block == run[0] + run[1]) {
+        run[1]++;
+        return;
+    }
+    release_blocks(fs, run[0], run[1]);
+    run[0] = block;
+    run[1] = 1;
+}
+
+/* Drop a reference to a pointer block. The last one frees it and drops one
+   from every block it points to (further pointer blocks at depth 2); while
+   the block is shared, everything below it stays. */
+static void drop_table(FileSystem* fs, uint32_t* run, uint32_t table, int depth) {
+    uint32_t pointers[FS_POINTERS_PER_BLOCK];
+    if (table == 0 || !drop_ref(fs, table) ||
+        block_cache_read(&fs->cache, table, 0, pointers, sizeof(pointers)) != ERR_SUCCESS) {
+        return;
+    }
+    for (uint32_t i = 0; i < FS_POINTERS_PER_BLOCK; i++) {
+        if (pointers[i] == 0) {
+            continue;
+        }
+        if (depth == 2) {
+            drop_table(fs, run, pointers[i], 1);
+        } else if (drop_ref(fs, pointers[i])) {
+            release_in_run(fs, run, pointers[i]);
+        }
+    }
+    release_pointer_block(fs, table);
+}
+
+/* Helper function to free data blocks */
+static void free_blocks(FileSystem* fs, File* file) {
+    /* Release data blocks, clearing consecutive blocks as one range, then the
+       pointer blocks. With blocks shared by snapshots, each pointer drops a
+       reference instead and only blocks left without one are released. */
+    uint32_t run[2] = {0, 0};
+    if (fs->shared_blocks) {
+        for (uint32_t i = 0; i < file->block_count && i < FS_DIRECT_BLOCKS; i++) {
+            if (drop_ref(fs, file->blocks[i])) {
+                release_in_run(fs, run, file->blocks[i]);
+            }
+        }
+        drop_table(fs, run, file->indirect, 1);
+        drop_table(fs, run, file->double_indirect, 2);
+        release_blocks(fs, run[0], run[1]);
+    } else {
+        for (uint32_t logical = 0; logical < file->block_count; logical++) {
+            release_in_run(fs, run, fs_bmap(fs, file, logical));
+        }
+        release_blocks(fs, run[0], run[1]);
+
+        if (file->double_indirect) {
+            for (uint32_t i = 0; i < FS_POINTERS_PER_BLOCK; i++) {
+                uint32_t table = read_pointer(fs, file->double_indirect, i);
+                release_pointer_block(fs, table);
+            }
+            release_pointer_block(fs, file->double_indirect);
+        }
+        release_pointer_block(fs, file->indirect);
+    }
+
+    memset(file->blocks, 0, sizeof(file->blocks));
+    file->indirect = 0;
+    file->double_indirect = 0;
+    file->block_count = 0;
+}
+
+/* Copy an entry into its slot of the inode table (through the cache and journal) */
+static int32_t store_entry(FileSystem* fs, uint32_t index) {
+    const File* file = fs_entry(fs, index);
+    fs_inode_t inode;
+    memset(&inode, 0, sizeof(inode));
+    if (file->used) {
+        memcpy(inode.name, file->name, sizeof(inode.name));
+        inode.size = file->size;
+        inode.parent_dir = file->parent_dir;
+        memcpy(inode.blocks, file->blocks, sizeof(inode.blocks));
+        inode.indirect = file->indirect;
+        inode.double_indirect = file->double_indirect;
+        inode.block_count = file->block_count;
+        inode.type = file->type;
+        inode.used = 1;
+        inode.flags = file->flags;
+    }
+    if (index >= fs->inode_high_water) {
+        fs->inode_high_water = index + 1;
+    }
+    return meta_write(fs, fs->inode_start + index / FS_INODES_PER_BLOCK,
+                      (index % FS_INODES_PER_BLOCK) * FS_INODE_SIZE, &inode, sizeof(inode));
+}
+
+/* Fill entry index from a used inode, which must be sane */
+static int32_t load_entry(FileSystem* fs, uint32_t index, const fs_inode_t* inode) {
+    if (inode->name[0] == '\0' || inode->name[FS_ONDISK_NAME_LENGTH - 1] != '\0' ||
+        (inode->type != FILE_TYPE_FILE && inode->type != FILE_TYPE_DIRECTORY) ||
+        inode->parent_dir >= fs->inode_count || inode->block_count > MAX_BLOCKS_PER_FILE ||
+        inode->size > inode->block_count * BLOCK_SIZE) {
+        return ERR_FILE_CORRUPTED;
+    }
+
+    File* file = fs_entry(fs, index);
+    memcpy(file->name, inode->name, sizeof(file->name));
+    file->size = inode->size;
+    file->parent_dir = inode->parent_dir;
+    memcpy(file->blocks, inode->blocks, sizeof(file->blocks));
+    file->indirect = inode->indirect;
+    file->double_indirect = inode->double_indirect;
+    file->block_count = inode->block_count;
+    file->type = inode->type;
+    file->flags = inode->flags;
+    file->used = 1;
+    file->first_child = FS_NO_ENTRY;
+    file->last_child = FS_NO_ENTRY;
+    return ERR_SUCCESS;
+}
+
+/* Write the superblock for the mounted file system into the cache (and journal) */
+static int32_t store_superblock(FileSystem* fs, uint32_t state) {
+    fs_superblock_t super;
+    memset(&super, 0, sizeof(super));
+    super.magic = FS_MAGIC;
+    super.version = FS_VERSION;
+    super.block_size = BLOCK_SIZE;
+    super.total_blocks = fs->total_blocks;
+    super.bitmap_start = fs->bitmap_start;
+    super.bitmap_blocks = fs_bitmap_blocks(fs->total_blocks);
+    super.refcount_start = fs->refcount_start;
+    super.refcount_blocks = fs_refcount_blocks(fs->total_blocks);
+    super.inode_start = fs->inode_start;
+    super.inode_blocks = fs_inode_blocks(fs->inode_count);
+    super.inode_count = fs->inode_count;
+    super.data_start = fs->reserved_blocks;
+    super.free_blocks = fs->free_block_count;
+    super.inode_high_water = fs->inode_high_water;
+    super.block_high_water = fs->block_high_water;
+    super.state = state;
+    super.journal_start = fs->journal.start;
+    super.journal_blocks = fs->journal.blocks;
+    super.shared_blocks = fs->shared_blocks;
+    return meta_write(fs, FS_SUPERBLOCK, 0, &super, sizeof(super));
+}
+
+/* Commit the running transaction: clear the bits of blocks it freed, log the
+   superblock and write it to the journal. Without anything logged only the
+   cache is flushed. */
+static int32_t commit_transaction(FileSystem* fs) {
+    if (fs->journal.count == 0 && fs->pending_count == 0) {
+        return block_cache_flush(&fs->cache);
+    }
+    apply_pending_frees(fs);
+    int32_t result = store_superblock(fs, FS_STATE_DIRTY);
+    if (result == ERR_SUCCESS) {
+        result = journal_commit(&fs->journal, &fs->cache);
+    }
+    return result;
+}
+
+/* Commit with op_lock held exclusive, so no operation is halfway through
+   its metadata changes */
+static int32_t commit_exclusive(FileSystem* fs) {
+    sc_rwlock_write_lock(&fs->op_lock);
+    sc_lock_acquire(&fs->alloc_lock);
+    int32_t result = commit_transaction(fs);
+    sc_lock_release(&fs->alloc_lock);
+    sc_rwlock_write_unlock(&fs->op_lock);
+    return result;
+}
+
+/* Commit from inside a write, which holds op_lock shared and alloc_lock,
+   and has stored its changes so far. While other operations are inside
+   op_lock the write steps out of it: it drops both locks, commits once
+   they have finished, and takes the locks back. Anything another
+   operation may change meanwhile (free space, journal room) must be
+   checked again afterwards. */
+static int32_t commit_in_operation(FileSystem* fs) {
+    if (sc_rwlock_try_upgrade(&fs->op_lock)) {
+        int32_t result = commit_transaction(fs);
+        sc_rwlock_downgrade(&fs->op_lock);
+        return result;
+    }
+    sc_lock_release(&fs->alloc_lock);
+    sc_rwlock_read_unlock(&fs->op_lock);
+    int32_t result = commit_exclusive(fs);
+    sc_rwlock_read_lock(&fs->op_lock);
+    sc_lock_acquire(&fs->alloc_lock);
+    return result;
+}
+
+/* The running transaction is full enough for a group commit */
+static bool transaction_full(FileSystem* fs) {
+    uint32_t group = fs->journal.capacity / 2 < FS_JOURNAL_GROUP_BLOCKS ? fs->journal.capacity / 2
+                                                                        : FS_JOURNAL_GROUP_BLOCKS;
+    return fs->journal.active && (fs->journal.count >= group || fs->journal.overflow);
+}
+
+/* End of a modifying operation, which no longer holds op_lock: commit once
+   the transaction is full enough */
+static void end_operation(FileSystem* fs) {
+    sc_lock_acquire(&fs->alloc_lock);
+    bool full = transaction_full(fs);
+    sc_lock_release(&fs->alloc_lock);
+    if (!full) {
+        return;
+    }
+    sc_rwlock_write_lock(&fs->op_lock);
+    sc_lock_acquire(&fs->alloc_lock);
+    if (transaction_full(fs) && commit_transaction(fs) != ERR_SUCCESS) {
+        HANDLE_ERROR(ERR_IO_DEVICE_ERROR);
+    }
+    sc_lock_release(&fs->alloc_lock);
+    sc_rwlock_write_unlock(&fs->op_lock);
+}
+
+/* Superblock describes a layout that fits device */
+static bool superblock_valid(const fs_superblock_t* super, const block_device_t* device) {
+    if (super->magic != FS_MAGIC || super->version != FS_VERSION || super->block_size != BLOCK_SIZE ||
+        super->total_blocks != device->block_count || super->inode_count == 0 ||
+        super->inode_count >= FS_NO_ENTRY) {
+        return false;
+    }
+    return super->bitmap_start == FS_SUPERBLOCK + 1 &&
+           super->bitmap_blocks == fs_bitmap_blocks(super->total_blocks) &&
+           super->refcount_start == super->bitmap_start + super->bitmap_blocks &&
+           super->refcount_blocks == fs_refcount_blocks(super->total_blocks) &&
+           super->inode_start == super->refcount_start + super->refcount_blocks &&
+           super->inode_blocks == fs_inode_blocks(super->inode_count) &&
+           super->journal_start == super->inode_start + super->inode_blocks &&
+           super->journal_blocks >= FS_MIN_JOURNAL_BLOCKS &&
+           super->data_start == super->journal_start + super->journal_blocks &&
+           super->data_start < super->total_blocks &&
+           super->free_blocks <= super->total_blocks - super->data_start &&
+           super->inode_high_water >= 1 && super->inode_high_water <= super->inode_count &&
+           super->block_high_water >= super->data_start &&
+           super->block_high_water <= super->total_blocks &&
+           super->shared_blocks <= super->total_blocks - super->data_start &&
+           (super->state == FS_STATE_CLEAN || super->state == FS_STATE_DIRTY);
+}
+
+/* Population count without a libgcc call on 32-bit targets */
+static inline uint32_t bits_set(uint64_t word) {
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (uint32_t)((word * 0x0101010101010101ull) >> 56);
+}
+
+/* Load the saved bitmap words for blocks below limit; the rest stay clear */
+static int32_t load_block_map(FileSystem* fs, uint32_t limit) {
+    uint32_t total = fs->total_blocks;
+    uint64_t* words = fs->block_map_memory;
+    uint64_t* summary = words + HBITMAP_WORDS(total);
+    uint64_t* top = summary + HBITMAP_SUMMARY_WORDS(total);
+    hbitmap_init(&fs->block_map, words, summary, top, total);
+
+    uint32_t word_count = HBITMAP_WORDS(limit);
+    uint32_t words_per_block = BLOCK_SIZE / (uint32_t)sizeof(uint64_t);
+    uint32_t high_water = fs->reserved_blocks;
+    for (uint32_t w = 0; w < word_count; w += words_per_block) {
+        cache_buffer_t* buffer = block_cache_get(&fs->cache, fs->bitmap_start + w / words_per_block, true);
+        if (!buffer) {
+            return ERR_IO_DEVICE_ERROR;
+        }
+        const uint64_t* saved = (const uint64_t*)buffer->data;
+        for (uint32_t i = 0; i < words_per_block && w + i < word_count; i++) {
+            uint64_t value = saved[i];
+            if (w + i == HBITMAP_WORDS(total) - 1) {
+                value &= ~hbitmap_mask_from(total & 63);   /* padding is not saved state */
+            }
+            if (value) {
+                high_water = (w + i) * 64 + 64 - (uint32_t)__builtin_clzll(value);
+            }
+            hbitmap_load_word(&fs->block_map, w + i, value);
+        }
+        block_cache_release(&fs->cache, buffer, false);
+    }
+    hbitmap_set_range(&fs->block_map, 0, fs->reserved_blocks);
+
+    fs->free_block_count = 0;
+    for (uint32_t w = 0; w < word_count; w++) {
+        fs->free_block_count += 64 - bits_set(words[w]);
+    }
+    if (word_count < HBITMAP_WORDS(total)) {
+        fs->free_block_count += total - word_count * 64;   /* never used, so free */
+    }
+    fs->block_high_water = high_water;
+    fs->next_free_block = fs->reserved_blocks;
+    return ERR_SUCCESS;
+}
+
+/* Load inodes below limit and rebuild the name index and child lists. Entry
+   chunks are only added up to the highest inode in use. */
+static int32_t load_entries(FileSystem* fs, uint32_t limit) {
+    uint32_t high_water = 0;
+    for (uint32_t i = 0; i < limit; i += FS_INODES_PER_BLOCK) {
+        cache_buffer_t* buffer = block_cache_get(&fs->cache, fs->inode_start + i / FS_INODES_PER_BLOCK, true);
+        if (!buffer) {
+            return ERR_IO_DEVICE_ERROR;
+        }
+        const fs_inode_t* inodes = (const fs_inode_t*)buffer->data;
+        int32_t result = ERR_SUCCESS;
+        for (uint32_t j = 0; j < FS_INODES_PER_BLOCK && i + j < limit && result == ERR_SUCCESS; j++) {
+            if (!inodes[j].used) {
+                continue;
+            }
+            while (fs->entry_capacity <= i + j && result == ERR_SUCCESS) {
+                result = add_entry_chunk(fs);
+            }
+            if (result == ERR_SUCCESS) {
+                result = load_entry(fs, i + j, &inodes[j]);
+            }
+            fs->file_count++;
+            high_water = i + j + 1;
+        }
+        block_cache_release(&fs->cache, buffer, false);
+        if (result != ERR_SUCCESS) {
+            return result;
+        }
+    }
+
+    if (high_water == 0 || !fs_entry(fs, 0)->used || fs_entry(fs, 0)->type != FILE_TYPE_DIRECTORY ||
+        fs_entry(fs, 0)->parent_dir != 0) {
+        return ERR_FILE_CORRUPTED;   /* no usable root */
+    }
+
+    /* Hash every entry, then link children in index order, whatever order they were created in */
+    uint32_t buckets = FS_INITIAL_BUCKETS;
+    while (buckets < fs->file_count) {
+        buckets <<= 1;
+    }
+    int32_t result = resize_name_index(fs, buckets);
+    if (result != ERR_SUCCESS) {
+        return result;
+    }
+    for (uint32_t i = 1; i < high_water; i++) {
+        File* file = fs_entry(fs, i);
+        if (!file->used) {
+            continue;
+        }
+        if (file->parent_dir == i || file->parent_dir >= high_water ||
+            !fs_entry(fs, file->parent_dir)->used ||
+            fs_entry(fs, file->parent_dir)->type != FILE_TYPE_DIRECTORY ||
+            index_lookup(fs, file->parent_dir, file->name) != i) {
+            return ERR_FILE_CORRUPTED;   /* orphan, or a name used twice in one directory */
+        }
+        link_child(fs, i);
+    }
+    fs_entry(fs, 0)->next_sibling = FS_NO_ENTRY;
+    fs_entry(fs, 0)->prev_sibling = FS_NO_ENTRY;
+    rebuild_free_list(fs);
+    fs->inode_high_water = high_water;
+    return ERR_SUCCESS;
+}
+
+/* Free the in-memory state of a mounted file system without writing anything */
+static void release_state(FileSystem* fs) {
+    block_cache_destroy(&fs->cache);
+    journal_destroy(&fs->journal);
+    if (fs->pending_frees) {
+        free_memory(fs->pending_frees);
+    }
+    fs->pending_frees = NULL;
+    fs->pending_count = 0;
+    fs->pending_slots = 0;
+    fs->pending_blocks = 0;
+    if (fs->block_map_memory) {
+        free_memory(fs->block_map_memory);
+    }
+    fs->block_map_memory = NULL;
+    for (uint32_t c = 0; c < fs->chunk_count; c++) {
+        free_memory(fs->entry_chunks[c]);
+    }
+    if (fs->entry_chunks) {
+        free_memory(fs->entry_chunks);
+    }
+    if (fs->name_buckets) {
+        free_memory(fs->name_buckets);
+    }
+    if (fs->dentries) {
+        free_memory(fs->dentries);
+    }
+    fs->entry_chunks = NULL;
+    fs->chunk_count = 0;
+    fs->chunk_slots = 0;
+    fs->name_buckets = NULL;
+    fs->dentries = NULL;
+    fs->entry_capacity = 0;
+    fs->free_entry = FS_NO_ENTRY;
+    fs->bucket_mask = 0;
+    fs->file_count = 0;
+}
+
+/* Write count blocks of zeros from block start straight to the device */
+static int32_t zero_device_blocks(block_device_t* device, uint32_t start, uint32_t count) {
+    static const uint8_t zeros[BLOCK_SIZE];
+    block_io_t segments[BLOCK_DEVICE_MAX_BATCH];
+    while (count > 0) {
+        uint32_t batch = count < BLOCK_DEVICE_MAX_BATCH ? count : BLOCK_DEVICE_MAX_BATCH;
+        for (uint32_t i = 0; i < batch; i++) {
+            segments[i].block = start + i;
+            segments[i].count = 1;
+            segments[i].buffer = (uint8_t*)zeros;
+        }
+        int32_t result = block_device_write_batch(device, segments, batch);
+        if (result != ERR_SUCCESS) {
+            return result;
+        }
+        start += batch;
+        count -= batch;
+    }
+    return ERR_SUCCESS;
+}
+
+/* Write an empty file system (only the root directory) to device */
+int32_t fs_mkfs(block_device_t* device, uint32_t inode_count) {
+    /* Writes go straight to the device, so no file system state is needed. */
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!device || !device->ops) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    uint32_t total = device->block_count;
+    if (inode_count == 0) {
+        inode_count = total / FS_BLOCKS_PER_INODE > FS_MIN_INODES ? total / FS_BLOCKS_PER_INODE
+                                                                   : FS_MIN_INODES;
+    }
+    fs_superblock_t super;
+    memset(&super, 0, sizeof(super));
+    super.magic = FS_MAGIC;
+    super.version = FS_VERSION;
+    super.block_size = BLOCK_SIZE;
+    super.total_blocks = total;
+    super.bitmap_start = FS_SUPERBLOCK + 1;
+    super.bitmap_blocks = fs_bitmap_blocks(total);
+    super.refcount_start = super.bitmap_start + super.bitmap_blocks;
+    super.refcount_blocks = fs_refcount_blocks(total);
+    super.inode_start = super.refcount_start + super.refcount_blocks;
+    super.inode_blocks = fs_inode_blocks(inode_count);
+    super.inode_count = inode_count;
+    super.journal_start = super.inode_start + super.inode_blocks;
+    super.journal_blocks = fs_default_journal_blocks(total);
+    super.data_start = super.journal_start + super.journal_blocks;
+    if (inode_count >= FS_NO_ENTRY || super.data_start >= total) {
+        error_code = ERR_INVALID_PARAMETER;   /* no room left for data */
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    super.free_blocks = total - super.data_start;
+    super.inode_high_water = 1;
+    super.block_high_water = super.data_start;
+    super.state = FS_STATE_CLEAN;
+
+    /* Clear the bitmap, reference counts, inode table and journal, so every
+       bit, count and inode starts at zero and nothing left over from an earlier file system can be replayed */
+    error_code = zero_device_blocks(device, super.bitmap_start, super.data_start - super.bitmap_start);
+    if (error_code == ERR_SUCCESS) {
+        error_code = journal_format(device, super.journal_start, super.journal_blocks);
+    }
+
+    /* Mark the metadata blocks in use */
+    uint8_t block[BLOCK_SIZE];
+    for (uint32_t b = 0; error_code == ERR_SUCCESS && b * FS_BITS_PER_BLOCK < super.data_start; b++) {
+        uint32_t first = b * FS_BITS_PER_BLOCK;
+        uint32_t bits = super.data_start - first < FS_BITS_PER_BLOCK ? super.data_start - first
+                                                                     : FS_BITS_PER_BLOCK;
+        memset(block, 0, sizeof(block));
+        memset(block, 0xFF, bits / 8);
+        if (bits % 8) {
+            block[bits / 8] = (uint8_t)((1u << (bits % 8)) - 1);
+        }
+        error_code = block_device_write(device, super.bitmap_start + b, 1, block);
+    }
+
+    /* The root directory is inode 0 and its own parent */
+    if (error_code == ERR_SUCCESS) {
+        fs_inode_t* root = (fs_inode_t*)block;
+        memset(block, 0, sizeof(block));
+        strcpy(root->name, "/");
+        root->type = FILE_TYPE_DIRECTORY;
+        root->parent_dir = 0;
+        root->used = 1;
+        error_code = block_device_write(device, super.inode_start, 1, block);
+    }
+
+    /* The superblock goes last, so a partly written file system never looks valid */
+    if (error_code == ERR_SUCCESS) {
+        error_code = block_device_flush(device);
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = block_device_write(device, FS_SUPERBLOCK, 1, (const uint8_t*)&super);
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = block_device_flush(device);
+    }
+    if (error_code != ERR_SUCCESS) {
+        HANDLE_ERROR(error_code);
+    }
+    return error_code;
+}
+
+/* Mount the file system stored on device */
+int32_t fs_mount(FileSystem* fs, block_device_t* device) {
+    /* The journal brings the superblock, bitmap and inodes back to the last
+       commit, so the high-water marks always bound what has to be read. */
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !device || !device->ops) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Start from an empty entry table; the memory device is left alone */
+    fs->entry_chunks = NULL;
+    fs->chunk_count = 0;
+    fs->chunk_slots = 0;
+    fs->entry_capacity = 0;
+    fs->free_entry = FS_NO_ENTRY;
+    fs->name_buckets = NULL;
+    fs->bucket_mask = 0;
+    fs->file_count = 0;
+    fs->block_map_memory = NULL;
+    fs->dentries = NULL;
+    fs->dcache_hits = 0;
+    fs->dcache_misses = 0;
+    fs->readahead_max = FS_READAHEAD_MAX;
+    memset((void*)fs->dcache_locks, 0, sizeof(fs->dcache_locks));
+    fs->tree_lock = 0;
+    fs->op_lock = 0;
+    fs->alloc_lock = 0;
+    fs->pending_frees = NULL;
+    fs->pending_count = 0;
+    fs->pending_slots = 0;
+    fs->pending_blocks = 0;
+    memset(&fs->cache, 0, sizeof(fs->cache));
+    memset(&fs->journal, 0, sizeof(fs->journal));
+    for (uint32_t i = 0; i < FS_MAX_OPEN_FILES; i++) {
+        fs->handles[i].file_index = FS_NO_ENTRY;
+    }
+    fs->device = device;
+    
+    /* Replay before anything else is read; a replayed transaction carries the superblock */
+    fs_superblock_t super;
+    bool replayed = false;
+    error_code = block_device_read(device, FS_SUPERBLOCK, 1, (uint8_t*)&super);
+    if (error_code == ERR_SUCCESS && !superblock_valid(&super, device)) {
+        error_code = ERR_FILE_CORRUPTED;
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = journal_recover(&fs->journal, device, super.journal_start, super.journal_blocks, &replayed);
+    }
+    if (error_code == ERR_SUCCESS && replayed) {
+        error_code = block_device_read(device, FS_SUPERBLOCK, 1, (uint8_t*)&super);
+        if (error_code == ERR_SUCCESS && !superblock_valid(&super, device)) {
+            error_code = ERR_FILE_CORRUPTED;
+        }
+    }
+    if (error_code == ERR_SUCCESS && block_map_bytes(super.total_blocks) > MAX_ALLOCATION_SIZE) {
+        error_code = ERR_OUT_OF_MEMORY;
+    }
+    if (error_code != ERR_SUCCESS) {
+        journal_destroy(&fs->journal);
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    fs->total_blocks = super.total_blocks;
+    fs->bitmap_start = super.bitmap_start;
+    fs->refcount_start = super.refcount_start;
+    fs->inode_start = super.inode_start;
+    fs->inode_count = super.inode_count;
+    fs->reserved_blocks = super.data_start;
+    fs->shared_blocks = super.shared_blocks;
+
+    fs->block_map_memory = (uint64_t*)allocate_memory(block_map_bytes(fs->total_blocks));
+    error_code = fs->block_map_memory ? block_cache_init(&fs->cache, device, FS_CACHE_BUFFERS)
+                                      : ERR_OUT_OF_MEMORY;
+    if (error_code == ERR_SUCCESS) {
+        error_code = load_block_map(fs, super.block_high_water);
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = load_entries(fs, super.inode_high_water);
+    }
+    if (error_code == ERR_SUCCESS) {
+        /* Optional: without it lookups go to the name index */
+        fs->dentries = (fs_dentry_t*)allocate_memory(FS_DCACHE_SETS * FS_DCACHE_WAYS * sizeof(fs_dentry_t));
+        for (uint32_t i = 0; fs->dentries && i < FS_DCACHE_SETS * FS_DCACHE_WAYS; i++) {
+            fs->dentries[i].parent = FS_NO_ENTRY;
+        }
+    }
+    
+    /* Mark the file system in use until fs_unmount, then log from here on */
+    if (error_code == ERR_SUCCESS) {
+        error_code = store_superblock(fs, FS_STATE_DIRTY);
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = block_cache_flush(&fs->cache);
+    }
+    if (error_code != ERR_SUCCESS) {
+        release_state(fs);
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    fs->journal.active = true;
+    
+    return ERR_SUCCESS;
+}
+
+/* Write everything back, mark the file system clean and release it */
+int32_t fs_unmount(FileSystem* fs) {
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !fs->block_map_memory) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Handles left open close now, finishing any delete waiting for them */
+    for (int32_t handle = 0; handle < FS_MAX_OPEN_FILES; handle++) {
+        if (fs->handles[handle].file_index != FS_NO_ENTRY) {
+            fs_close(fs, handle);
+        }
+    }
+
+    /* The last transaction commits and everything reaches its home block
+       before the journal is emptied and the superblock says clean */
+    error_code = commit_transaction(fs);
+    fs->journal.active = false;
+    if (error_code == ERR_SUCCESS) {
+        error_code = block_cache_flush(&fs->cache);
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = journal_close(&fs->journal);
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = store_superblock(fs, FS_STATE_CLEAN);
+    }
+    if (error_code == ERR_SUCCESS) {
+        error_code = block_cache_flush(&fs->cache);
+    }
+    release_state(fs);
+    if (error_code != ERR_SUCCESS) {
+        HANDLE_ERROR(error_code);
+    }
+    return error_code;
+}
+
+/* Initialize the file system */
+int32_t fs_init(FileSystem* fs, uint8_t* data_memory, uint32_t memory_size) {
+    /* The classic in-memory file system: a memory device over the data area. */
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !data_memory || memory_size < BLOCK_SIZE) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    memory_block_device_init(&fs->memory_device, data_memory, memory_size);
+    return fs_init_device(fs, &fs->memory_device.device);
+}
+
+/* Initialize the file system over a block device */
+int32_t fs_init_device(FileSystem* fs, block_device_t* device) {
+    /* Format the device with the default inode count, then mount it. */
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !device || !device->ops) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    error_code = fs_mkfs(device, 0);
+    if (error_code == ERR_SUCCESS) {
+        error_code = fs_mount(fs, device);
+    }
+    if (error_code != ERR_SUCCESS) {
+        error_code = ERR_FILE_SYSTEM_INIT_FAILED;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    return ERR_SUCCESS;
+}
+
+/* Write cached data back and commit the running transaction */
+int32_t fs_sync(FileSystem* fs) {
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !fs->block_map_memory) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Once the commit block is on the device the transaction survives a
+       crash; its blocks reach their home locations with a later flush */
+    sc_rwlock_read_lock(&fs->tree_lock);
+    error_code = commit_exclusive(fs);
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    if (error_code != ERR_SUCCESS) {
+        HANDLE_ERROR(error_code);
+    }
+    return error_code;
+}
+
+/* Unmount, then release the cache, journal, bitmap, entry table and name index */
+void fs_destroy(FileSystem* fs) {
+    if (!fs) {
+        return;
+    }
+    if (fs->block_map_memory) {
+        fs_unmount(fs);
+    }
+    release_state(fs);
+}
+
+/* Limit read-ahead */
+int32_t fs_set_readahead(FileSystem* fs, uint32_t max_blocks) {
+    int32_t error_code = ERR_SUCCESS;
+    if (!fs) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    if (max_blocks > FS_READAHEAD_MAX) {
+        error_code = ERR_INVALID_PARAMETER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    sc_rwlock_write_lock(&fs->tree_lock);
+    fs->readahead_max = max_blocks;
+    sc_rwlock_write_unlock(&fs->tree_lock);
+    return ERR_SUCCESS;
+}
+
+/* Create a new file; the tree lock is held exclusive */
+static int32_t create_file(FileSystem* fs, const char* name, uint32_t parent_dir) {
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !name) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    if (strlen(name) >= MAX_FILENAME_LENGTH) {
+        error_code = ERR_FILE_NAME_TOO_LONG;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Validate parent directory exists */
+    if (parent_dir != 0) {  /* Root directory is always valid */
+        if (!entry_in_use(fs, parent_dir)) {
+            error_code = ERR_INVALID_DIRECTORY;
+            HANDLE_ERROR(error_code);
+            return error_code;
+        }
+        if (fs_entry(fs, parent_dir)->type != FILE_TYPE_DIRECTORY) {
+            error_code = ERR_NOT_A_DIRECTORY;
+            HANDLE_ERROR(error_code);
+            return error_code;
+        }
+        if (fs_entry(fs, parent_dir)->flags & FS_INODE_SNAPSHOT) {
+            error_code = ERR_PERMISSION_DENIED;
+            HANDLE_ERROR(error_code);
+            return error_code;
+        }
+    }
+    
+    /* Check if file already exists (a deleted file still open keeps its name) */
+    if (index_lookup(fs, parent_dir, name) != FS_NO_ENTRY) {
+        error_code = ERR_FILE_EXISTS;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Find free entry */
+    int entry_index = find_free_entry(fs);
+    if (entry_index < 0) {
+        error_code = ERR_FILE_SYSTEM_FULL;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Initialize file entry */
+    File* file = fs_entry(fs, entry_index);
+    memset(file, 0, sizeof(File));
+    strcpy(file->name, name);
+    file->type = FILE_TYPE_FILE;
+    file->size = 0;
+    file->block_count = 0;
+    file->parent_dir = parent_dir;
+    file->used = 1;
+    index_insert(fs, (uint32_t)entry_index);
+    fs->file_count++;
+    
+    if (store_entry(fs, (uint32_t)entry_index) != ERR_SUCCESS) {
+        delete_entry(fs, (uint32_t)entry_index);
+        error_code = ERR_IO_DEVICE_ERROR;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    end_operation(fs);
+    return entry_index;
+}
+
+/* Create a new directory; the tree lock is held exclusive */
+static int32_t create_directory(FileSystem* fs, const char* name, uint32_t parent_dir) {
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !name) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    if (strlen(name) >= MAX_FILENAME_LENGTH) {
+        error_code = ERR_FILE_NAME_TOO_LONG;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Validate parent directory exists */
+    if (parent_dir != 0) {  /* Root directory is always valid */
+        if (!entry_in_use(fs, parent_dir)) {
+            error_code = ERR_INVALID_DIRECTORY;
+            HANDLE_ERROR(error_code);
+            return error_code;
+        }
+        if (fs_entry(fs, parent_dir)->type != FILE_TYPE_DIRECTORY) {
+            error_code = ERR_NOT_A_DIRECTORY;
+            HANDLE_ERROR(error_code);
+            return error_code;
+        }
+        if (fs_entry(fs, parent_dir)->flags & FS_INODE_SNAPSHOT) {
+            error_code = ERR_PERMISSION_DENIED;
+            HANDLE_ERROR(error_code);
+            return error_code;
+        }
+    }
+    
+    /* Check if directory already exists */
+    if (index_lookup(fs, parent_dir, name) != FS_NO_ENTRY) {
+        error_code = ERR_FILE_EXISTS;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Find free entry */
+    int entry_index = find_free_entry(fs);
+    if (entry_index < 0) {
+        error_code = ERR_FILE_SYSTEM_FULL;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* Initialize directory entry */
+    File* dir = fs_entry(fs, entry_index);
+    memset(dir, 0, sizeof(File));
+    strcpy(dir->name, name);
+    dir->type = FILE_TYPE_DIRECTORY;
+    dir->size = 0;
+    dir->block_count = 0;
+    dir->parent_dir = parent_dir;
+    dir->used = 1;
+    index_insert(fs, (uint32_t)entry_index);
+    fs->file_count++;
+    
+    if (store_entry(fs, (uint32_t)entry_index) != ERR_SUCCESS) {
+        delete_entry(fs, (uint32_t)entry_index);
+        error_code = ERR_IO_DEVICE_ERROR;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    end_operation(fs);
+    return entry_index;
+}
+
+/* Create a new file */
+int32_t fs_create_file(FileSystem* fs, const char* name, uint32_t parent_dir) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
+    }
+    sc_rwlock_write_lock(&fs->tree_lock);
+    int32_t result = create_file(fs, name, parent_dir);
+    sc_rwlock_write_unlock(&fs->tree_lock);
+    return result;
+}
+
+/* Create a new directory */
+int32_t fs_create_directory(FileSystem* fs, const char* name, uint32_t parent_dir) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
+    }
+    sc_rwlock_write_lock(&fs->tree_lock);
+    int32_t result = create_directory(fs, name, parent_dir);
+    sc_rwlock_write_unlock(&fs->tree_lock);
+    return result;
+}
+
+/* The regular file at file_index, or NULL with *error_code set */
+static File* io_file(FileSystem* fs, uint32_t file_index, int32_t* error_code) {
+    if (!entry_in_use(fs, file_index)) {
+        *error_code = ERR_INVALID_FILE_HANDLE;
+    } else if (fs_entry(fs, file_index)->type != FILE_TYPE_FILE) {
+        *error_code = ERR_NOT_A_FILE;
+    } else {
+        return fs_entry(fs, file_index);
+    }
+    HANDLE_ERROR(*error_code);
+    return NULL;
+}
+
+/* fs_bmap through a handle's cached mapping, when there is a handle. Blocks
+   only gain a mapping while a file is open, so a cached one stays valid. */
+static uint32_t cursor_bmap(FileSystem* fs, const File* file, fs_handle_t* cursor, uint32_t logical) {
+    if (!cursor) {
+        return fs_bmap(fs, file, logical);
+    }
+    if (cursor->block_num == 0 || cursor->block_logical != logical) {
+        cursor->block_num = fs_bmap(fs, file, logical);
+        cursor->block_logical = logical;
+    }
+    return cursor->block_num;
+}
+
+/* Fetch blocks of file from block_index on before the copy loop reaches
+   them: a window of them while reads are sequential, otherwise the rest of
+   the read up to last_block. The window grows each time and the device is
+   told about the one after it, so slow stores can start on it early.
+   Only choosing the blocks happens under the file's read-ahead lock;
+   mapping and fetching them do not. */
+static void read_ahead(FileSystem* fs, File* file, uint32_t block_index, uint32_t last_block) {
+    uint32_t file_blocks = (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    sc_lock_acquire(&file->ra_lock);
+    uint32_t window = file->ra_window;
+    if (block_index + window / 2 < file->ra_ahead) {
+        sc_lock_release(&file->ra_lock);
+        return;   /* the window read last time is still far enough ahead */
+    }
+    uint32_t start = file->ra_ahead > block_index ? file->ra_ahead : block_index;
+    uint32_t count = window ? window : last_block + 1 - start;
+    if (count > fs->readahead_max) {
+        count = fs->readahead_max;
+    }
+    if (start >= file_blocks) {
+        sc_lock_release(&file->ra_lock);
+        return;
+    }
+    if (count > file_blocks - start) {
+        count = file_blocks - start;
+    }
+    file->ra_ahead = start + count;
+    uint32_t next = 0;
+    uint32_t next_count = 0;
+    if (window) {
+        if (window < fs->readahead_max) {
+            file->ra_window = (uint16_t)(window * 2 < fs->readahead_max ? window * 2 : fs->readahead_max);
+        }
+        next = file->ra_ahead;
+        next_count = file->ra_window < file_blocks - next ? file->ra_window : file_blocks - next;
+    }
+    sc_lock_release(&file->ra_lock);
+    if (count < 2 && !window) {
+        return;   /* a single block is read on demand */
+    }
+
+    uint32_t blocks[FS_READAHEAD_MAX];
+    bmap_run(fs, file, start, count, blocks);
+    int32_t read = block_cache_prefetch(&fs->cache, blocks, count);
+    if (!window) {
+        return;
+    }
+    profiler_record_readahead(read > 0 ? (uint32_t)read : 0, window);
+    bmap_run(fs, file, next, next_count, blocks);
+    block_cache_hint(&fs->cache, blocks, next_count);
+}
+
+/* Copy up to size bytes at offset out of a validated file; returns the
+   bytes read, short at the end of the file or on a device error */
+static int32_t read_range(FileSystem* fs, File* file, fs_handle_t* cursor, uint8_t* buffer, uint32_t size,
+                          uint32_t offset) {
+    if (offset >= file->size) {
+        return 0;  /* Nothing to read */
+    }
+    uint32_t read_size = size;
+    if (read_size > file->size - offset) {
+        read_size = file->size - offset;
+    }
+
+    /* A read that starts where the last one ended, or in its last block,
+       continues a sequential stream */
+    uint32_t first_block = offset / BLOCK_SIZE;
+    uint32_t last_block = (offset + read_size - 1) / BLOCK_SIZE;
+    sc_lock_acquire(&file->ra_lock);
+    if (first_block != file->ra_next && first_block + 1 != file->ra_next) {
+        file->ra_window = 0;
+        file->ra_ahead = first_block;
+    } else if (!file->ra_window) {
+        file->ra_window = FS_READAHEAD_MIN < fs->readahead_max ? FS_READAHEAD_MIN : (uint16_t)fs->readahead_max;
+    }
+    file->ra_next = last_block + 1;
+    sc_lock_release(&file->ra_lock);
+
+    /* Read data block by block */
+    uint32_t bytes_read = 0;
+    uint32_t current_offset = offset;
+
+    while (bytes_read < read_size) {
+        uint32_t block_index = current_offset / BLOCK_SIZE;
+        uint32_t block_offset = current_offset % BLOCK_SIZE;
+        if (fs->readahead_max) {
+            read_ahead(fs, file, block_index, last_block);
+        }
+        uint32_t bytes_in_block = BLOCK_SIZE - block_offset;
+        uint32_t bytes_to_read = (read_size - bytes_read) < bytes_in_block ?
+                                (read_size - bytes_read) : bytes_in_block;
+
+        uint32_t block_num = cursor_bmap(fs, file, cursor, block_index);
+        if (block_num < fs->reserved_blocks || block_num >= fs->total_blocks) {
+            HANDLE_ERROR(ERR_FILE_CORRUPTED);
+            break;
+        }
+
+        if (block_cache_read(&fs->cache, block_num, block_offset, buffer + bytes_read,
+                             bytes_to_read) != ERR_SUCCESS) {
+            HANDLE_ERROR(ERR_IO_DEVICE_ERROR);
+            break;
+        }
+
+        bytes_read += bytes_to_read;
+        current_offset += bytes_to_read;
+    }
+
+    return (int32_t)bytes_read;
+}
+
+/* Read data from a file */
+int32_t fs_read_file(FileSystem* fs, uint32_t file_index, uint8_t* buffer, uint32_t size, uint32_t offset) {
+    int32_t error_code = ERR_SUCCESS;
+    
+    /* Validate parameters */
+    if (!fs || !buffer) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    if (size == 0) {
+        return 0;  /* Nothing to read */
+    }
+    
+    sc_rwlock_read_lock(&fs->tree_lock);
+    File* file = io_file(fs, file_index, &error_code);
+    int32_t bytes_read = error_code;
+    if (file) {
+        sc_rwlock_read_lock(&file->lock);
+        bytes_read = read_range(fs, file, NULL, buffer, size, offset);
+        sc_rwlock_read_unlock(&file->lock);
+    }
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return bytes_read;
+}
+
+/* Pin spans of a validated file, which is locked for reading. The blocks
+   are looked up and pinned as one run, so the cache lock is taken once and
+   the uncached blocks are read in one request. */
+static int32_t map_range(FileSystem* fs, File* file, fs_span_t* spans, uint32_t max_spans, uint32_t size,
+                         uint32_t offset) {
+    int32_t error_code = ERR_SUCCESS;
+    if (offset >= file->size || size == 0 || max_spans == 0) {
+        return 0;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+
+    uint32_t blocks[FS_MAP_MAX_BLOCKS];
+    cache_buffer_t* buffers[FS_MAP_MAX_BLOCKS];
+    uint32_t first = offset / BLOCK_SIZE;
+    uint32_t run = (offset + size - 1) / BLOCK_SIZE - first + 1;
+    if (run > FS_MAP_MAX_BLOCKS) {
+        run = FS_MAP_MAX_BLOCKS;
+    }
+    bmap_run(fs, file, first, run, blocks);
+    for (uint32_t i = 0; i < run; i++) {
+        if (blocks[i] < fs->reserved_blocks || blocks[i] >= fs->total_blocks) {
+            error_code = ERR_FILE_CORRUPTED;
+            HANDLE_ERROR(error_code);
+            run = i;
+            break;
+        }
+    }
+    int32_t pinned = run ? block_cache_get_batch(&fs->cache, blocks, run, buffers) : 0;
+    if (pinned <= 0 && run) {
+        error_code = ERR_IO_DEVICE_ERROR;
+        HANDLE_ERROR(error_code);
+    }
+
+    uint32_t count = 0;
+    for (int32_t i = 0; i < pinned; i++) {
+        uint32_t block_offset = offset % BLOCK_SIZE;
+        uint32_t chunk = BLOCK_SIZE - block_offset < size ? BLOCK_SIZE - block_offset : size;
+        uint8_t* data = buffers[i]->data + block_offset;
+        if (count && spans[count - 1].data + spans[count - 1].length == data) {
+            spans[count - 1].length += chunk;
+        } else if (count < max_spans) {
+            spans[count].data = data;
+            spans[count].length = chunk;
+            count++;
+        } else {
+            /* Out of spans: the rest go back unused */
+            for (; i < pinned; i++) {
+                block_cache_release(&fs->cache, buffers[i], false);
+            }
+            break;
+        }
+        offset += chunk;
+        size -= chunk;
+    }
+    return count ? (int32_t)count : error_code;
+}
+
+/* Map part of a file without copying */
+int32_t fs_map_file(FileSystem* fs, uint32_t file_index, fs_span_t* spans, uint32_t max_spans,
+                    uint32_t size, uint32_t offset) {
+    int32_t error_code = ERR_SUCCESS;
+
+    if (!fs || !spans) {
+        error_code = ERR_NULL_POINTER;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    sc_rwlock_read_lock(&fs->tree_lock);
+    File* file = io_file(fs, file_index, &error_code);
+    int32_t count = error_code;
+    if (file) {
+        sc_rwlock_read_lock(&file->lock);
+        count = map_range(fs, file, spans, max_spans, size, offset);
+        sc_rwlock_read_unlock(&file->lock);
+    }
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return count;
+}
+
+/* Unpin mapped spans, one cache buffer per block they cover */
+void fs_unmap_file(FileSystem* fs, const fs_span_t* spans, uint32_t count) {
+    if (!fs || !spans) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* end = spans[i].data + spans[i].length;
+        for (const uint8_t* data = spans[i].data; data < end;
+             data += BLOCK_SIZE - (uint32_t)(data - fs->cache.memory) % BLOCK_SIZE) {
+            block_cache_unpin(&fs->cache, data);
         }
     }
-    return -1;
 }
 
-/* Helper function to allocate data blocks */
-static int allocate_blocks(FileSystem* fs, uint32_t* blocks, uint32_t block_count) {
-    /* Linear allocation: hands out sequential block numbers. */
-    if (fs->next_free_block + block_count > fs->total_blocks) {
-        return FS_ERROR_NO_SPACE;
+/* Commit between the steps of a long change to file_index once the
+   running transaction has less than a step's worth of room left. Other
+   writes can fill the new transaction while this one waits to get back
+   in, so the room is checked again after each commit. */
+static int32_t make_journal_room(FileSystem* fs, uint32_t file_index) {
+    while (!journal_room(&fs->journal, FS_JOURNAL_STEP_BLOCKS)) {
+        int32_t result = store_entry(fs, file_index);
+        if (result == ERR_SUCCESS) {
+            result = commit_in_operation(fs);
+        }
+        if (result != ERR_SUCCESS) {
+            return result;
+        }
+    }
+    return ERR_SUCCESS;
+}
+
+/* Point *ref at a private copy of pointer block *ref if other pointers
+   share it: the copy adds a reference to every block it points to and the
+   original loses one */
+static int32_t copy_shared_table(FileSystem* fs, uint32_t* ref) {
+    if (*ref == 0 || block_refs(fs, *ref) == 0) {
+        return ERR_SUCCESS;
+    }
+    uint32_t pointers[FS_POINTERS_PER_BLOCK];
+    int32_t result = block_cache_read(&fs->cache, *ref, 0, pointers, sizeof(pointers));
+    if (result != ERR_SUCCESS) {
+        return result;
+    }
+    uint32_t copy = 0;
+    if (allocate_extent(fs, fs->next_free_block, 1, 1, &copy) == 0) {
+        return ERR_OUT_OF_SPACE;
+    }
+    result = meta_write(fs, copy, 0, pointers, sizeof(pointers));
+    for (uint32_t i = 0; i < FS_POINTERS_PER_BLOCK && result == ERR_SUCCESS; i++) {
+        if (pointers[i]) {
+            result = adjust_refs(fs, pointers[i], 1);
+        }
+    }
+    if (result == ERR_SUCCESS) {
+        result = adjust_refs(fs, *ref, -1);
+    }
+    if (result != ERR_SUCCESS) {
+        release_pointer_block(fs, copy);
+        return result;
+    }
+    *ref = copy;
+    return ERR_SUCCESS;
+}
+
+/* Give a file shared with a snapshot its own pointer blocks, so map_block
+   can change them in place; data blocks are copied one by one as they
+   are written */
+static int32_t unshare_pointers(FileSystem* fs, uint32_t file_index, File* file) {
+    int32_t result = make_journal_room(fs, file_index);
+    if (result == ERR_SUCCESS) {
+        result = copy_shared_table(fs, &file->indirect);
+    }
+    if (result == ERR_SUCCESS) {
+        result = copy_shared_table(fs, &file->double_indirect);
+    }
+    for (uint32_t i = 0; i < FS_POINTERS_PER_BLOCK && file->double_indirect && result == ERR_SUCCESS; i++) {
+        uint32_t table = read_pointer(fs, file->double_indirect, i);
+        uint32_t copy = table;
+        result = make_journal_room(fs, file_index);
+        if (result == ERR_SUCCESS) {
+            result = copy_shared_table(fs, &copy);
+        }
+        if (result == ERR_SUCCESS && copy != table) {
+            result = meta_write(fs, file->double_indirect, i * (uint32_t)sizeof(uint32_t), &copy, sizeof(copy));
+        }
+    }
+    if (result == ERR_SUCCESS) {
+        file->flags &= (uint8_t)~FS_INODE_SHARED;
+        result = store_entry(fs, file_index);
+    }
+    return result;
+}
+
+/* Move logical block of a file off block, which a snapshot shares: a new
+   block takes its contents (unless the write replaces all of them) and its
+   place in the block map, and handles forget the old mapping. Returns the
+   new block, or 0 without space. */
+static uint32_t copy_shared_block(FileSystem* fs, uint32_t file_index, File* file, uint32_t logical,
+                                  uint32_t block, bool overwrite) {
+    uint32_t copy = 0;
+    if (make_journal_room(fs, file_index) != ERR_SUCCESS ||
+        allocate_extent(fs, fs->next_free_block, 1, 1, &copy) == 0) {
+        return 0;
+    }
+    fs->next_free_block = copy + 1;
+    if (!overwrite) {
+        cache_buffer_t* source = block_cache_get(&fs->cache, block, true);
+        cache_buffer_t* target = source ? block_cache_get(&fs->cache, copy, false) : NULL;
+        if (target) {
+            memcpy(target->data, source->data, BLOCK_SIZE);
+            block_cache_release(&fs->cache, target, true);
+        }
+        if (source) {
+            block_cache_release(&fs->cache, source, false);
+        }
+        if (!target) {
+            release_blocks(fs, copy, 1);
+            return 0;
+        }
+    }
+    if (map_block(fs, file, logical, copy) != ERR_SUCCESS) {
+        release_blocks(fs, copy, 1);
+        return 0;
+    }
+    if (adjust_refs(fs, block, -1) != ERR_SUCCESS) {
+        map_block(fs, file, logical, block);
+        release_blocks(fs, copy, 1);
+        return 0;
+    }
+    if (logical < FS_DIRECT_BLOCKS && store_entry(fs, file_index) != ERR_SUCCESS) {
+        /* Put the shared block back in the map and its count back up */
+        adjust_refs(fs, block, 1);
+        map_block(fs, file, logical, block);
+        release_blocks(fs, copy, 1);
+        return 0;
+    }
+    for (uint32_t h = 0; h < FS_MAX_OPEN_FILES; h++) {
+        if (fs->handles[h].file_index == file_index && fs->handles[h].block_logical == logical) {
+            fs->handles[h].block_num = 0;
+        }
+    }
+    return copy;
+}
+
+/* Get a file ready for a write that needs required_blocks blocks from
+   offset on; alloc_lock is held. A file sharing pointer blocks with a
+   snapshot gets its own before anything can be mapped. */
+static int32_t prepare_write(FileSystem* fs, uint32_t file_index, File* file, uint32_t required_blocks,
+                             uint32_t offset) {
+    if ((file->flags & FS_INODE_SHARED) && unshare_pointers(fs, file_index, file) != ERR_SUCCESS) {
+        return ERR_OUT_OF_SPACE;
+    }
+
+    /* Allocate more blocks if needed */
+    uint32_t old_block_count = file->block_count;
+    if (required_blocks > file->block_count) {
+        int result = allocate_blocks(fs, file_index, required_blocks);
+        if (result != FS_SUCCESS && fs->pending_blocks > 0 && commit_in_operation(fs) == ERR_SUCCESS) {
+            result = allocate_blocks(fs, file_index, required_blocks);   /* with this transaction's frees */
+        }
+        if (result != FS_SUCCESS) {
+            return ERR_OUT_OF_SPACE;
+        }
     }
     
-    for (uint32_t i = 0; i < block_count; i++) {
-        blocks[i] = fs->next_free_block++;
+    /* Blocks skipped over by a write past the end of the file read as zeros */
+    for (uint32_t skipped = old_block_count; skipped < offset / BLOCK_SIZE; skipped++) {
+        if (zero_block(fs, fs_bmap(fs, file, skipped), false) != ERR_SUCCESS) {
+            return ERR_IO_DEVICE_ERROR;
+        }
     }
-    return FS_SUCCESS;
+    return ERR_SUCCESS;
 }
 
-/* Helper function to free data blocks */
-static void free_blocks(FileSystem* fs, uint32_t* blocks, uint32_t block_count) {
-    /* Naive free: only rewinds if last freed range sits at the end. */
-    /* Simple implementation - just mark as free by adjusting next_free_block */
-    /* In a real filesystem, we'd maintain a free block bitmap */
-    if (block_count > 0 && blocks[block_count - 1] + 1 == fs->next_free_block) {
-        fs->next_free_block = blocks[0];
+/* Write size bytes at offset into a validated file, growing it as needed;
+   returns the bytes written or an error. The caller holds the file's lock
+   exclusive and op_lock shared, stores the entry and ends the operation. */
+static int32_t write_range(FileSystem* fs, uint32_t file_index, File* file, fs_handle_t* cursor,
+                           const uint8_t* data, uint32_t size, uint32_t offset) {
+    /* Snapshots are read-only */
+    if (file->flags & FS_INODE_SNAPSHOT) {
+        HANDLE_ERROR(ERR_PERMISSION_DENIED);
+        return ERR_PERMISSION_DENIED;
+    }
+
+    /* Calculate required blocks */
+    uint32_t required_size = offset + size;
+    uint32_t required_blocks = (required_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    
+    /* Check maximum file size */
+    if (required_size < offset || required_blocks > MAX_BLOCKS_PER_FILE) {
+        HANDLE_ERROR(ERR_FILE_TOO_LARGE);
+        return ERR_FILE_TOO_LARGE;
+    }
+    
+    /* Only a snapshot, which waits for every write to finish, makes blocks
+       shared, so sampling the count once is enough */
+    uint32_t old_block_count = file->block_count;
+    sc_lock_acquire(&fs->alloc_lock);
+    bool shared = fs->shared_blocks != 0;
+    int32_t result = prepare_write(fs, file_index, file, required_blocks, offset);
+    sc_lock_release(&fs->alloc_lock);
+    if (result != ERR_SUCCESS) {
+        HANDLE_ERROR(result);
+        return result;
+    }
+    
+    /* Write data block by block */
+    uint32_t bytes_written = 0;
+    uint32_t current_offset = offset;
+    
+    while (bytes_written < size) {
+        uint32_t block_index = current_offset / BLOCK_SIZE;
+        uint32_t block_offset = current_offset % BLOCK_SIZE;
+        uint32_t bytes_in_block = BLOCK_SIZE - block_offset;
+        uint32_t bytes_to_write = (size - bytes_written) < bytes_in_block ? 
+                                 (size - bytes_written) : bytes_in_block;
+        
+        uint32_t block_num = cursor_bmap(fs, file, cursor, block_index);
+        if (block_num < fs->reserved_blocks || block_num >= fs->total_blocks) {
+            HANDLE_ERROR(ERR_FILE_CORRUPTED);
+            break;
+        }
+        if (shared && block_index < old_block_count) {
+            sc_lock_acquire(&fs->alloc_lock);
+            if (block_refs(fs, block_num) > 0) {
+                block_num = copy_shared_block(fs, file_index, file, block_index, block_num,
+                                              bytes_to_write == BLOCK_SIZE);
+            }
+            sc_lock_release(&fs->alloc_lock);
+            if (block_num == 0) {
+                HANDLE_ERROR(ERR_OUT_OF_SPACE);
+                break;
+            }
+        }
+
+        /* Newly allocated blocks hold stale device data outside the written range */
+        if (block_index >= old_block_count && bytes_to_write < BLOCK_SIZE &&
+            zero_block(fs, block_num, false) != ERR_SUCCESS) {
+            HANDLE_ERROR(ERR_IO_DEVICE_ERROR);
+            break;
+        }
+        if (block_cache_write(&fs->cache, block_num, block_offset, data + bytes_written,
+                              bytes_to_write) != ERR_SUCCESS) {
+            HANDLE_ERROR(ERR_IO_DEVICE_ERROR);
+            break;
+        }
+        
+        bytes_written += bytes_to_write;
+        current_offset += bytes_to_write;
+    }
+    
+    /* Update file size */
+    if (current_offset > file->size) {
+        file->size = current_offset;
     }
+    return (int32_t)bytes_written;
 }
 
-/* Initialize the file system */
-int32_t fs_init(FileSystem* fs, uint8_t* data_memory, uint32_t memory_size) {
-    /* Initialize root directory and set up the data block pool. */
+/* Store an entry whose size or block count differ from the saved ones */
+static void store_if_changed(FileSystem* fs, uint32_t file_index, uint32_t old_size, uint32_t old_block_count) {
+    const File* file = fs_entry(fs, file_index);
+    if (file->size != old_size || file->block_count != old_block_count) {
+        sc_lock_acquire(&fs->alloc_lock);
+        int32_t result = store_entry(fs, file_index);
+        sc_lock_release(&fs->alloc_lock);
+        if (result != ERR_SUCCESS) {
+            HANDLE_ERROR(ERR_IO_DEVICE_ERROR);
+        }
+    }
+}
+
+/* Lock a validated file for a write, which may change metadata */
+static void lock_for_write(FileSystem* fs, File* file) {
+    sc_rwlock_write_lock(&file->lock);
+    sc_rwlock_read_lock(&fs->op_lock);
+}
+
+static void unlock_after_write(FileSystem* fs, File* file) {
+    sc_rwlock_read_unlock(&fs->op_lock);
+    sc_rwlock_write_unlock(&file->lock);
+}
+
+/* Write data to a file */
+int32_t fs_write_file(FileSystem* fs, uint32_t file_index, const uint8_t* data, uint32_t size, uint32_t offset) {
     int32_t error_code = ERR_SUCCESS;
     
     /* Validate parameters */
-    if (!fs || !data_memory || memory_size < BLOCK_SIZE) {
+    if (!fs || !data) {
         error_code = ERR_NULL_POINTER;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
-    /* Clear all file entries */
-    memset(fs->files, 0, sizeof(fs->files));
-    fs->file_count = 0;
-    fs->data_blocks = data_memory;
-    fs->total_blocks = memory_size / BLOCK_SIZE;
-    fs->next_free_block = 0;
+    if (size == 0) {
+        return 0;  /* Nothing to write */
+    }
     
-    /* Validate block calculation */
-    if (fs->total_blocks == 0) {
-        error_code = ERR_OUT_OF_MEMORY;
+    sc_rwlock_read_lock(&fs->tree_lock);
+    File* file = io_file(fs, file_index, &error_code);
+    int32_t written = error_code;
+    if (file) {
+        lock_for_write(fs, file);
+        uint32_t old_size = file->size;
+        uint32_t old_block_count = file->block_count;
+        written = write_range(fs, file_index, file, NULL, data, size, offset);
+        store_if_changed(fs, file_index, old_size, old_block_count);
+        unlock_after_write(fs, file);
+        end_operation(fs);
+    }
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return written;
+}
+
+/* Whether every span with bytes to move has a buffer; empty spans may have none */
+static bool spans_valid(const fs_span_t* spans, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (!spans[i].data && spans[i].length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Read into several buffers */
+int32_t fs_readv(FileSystem* fs, uint32_t file_index, const fs_span_t* spans, uint32_t count, uint32_t offset) {
+    int32_t error_code = ERR_SUCCESS;
+    if (!fs || !spans || !spans_valid(spans, count)) {
+        error_code = ERR_NULL_POINTER;
         HANDLE_ERROR(error_code);
         return error_code;
     }
-    
-    /* Create root directory */
-    int result = fs_create_directory(fs, "/", 0);
-    if (result < 0) {
-        error_code = ERR_FILE_SYSTEM_INIT_FAILED;
+    sc_rwlock_read_lock(&fs->tree_lock);
+    File* file = io_file(fs, file_index, &error_code);
+    if (!file) {
+        sc_rwlock_read_unlock(&fs->tree_lock);
+        return error_code;
+    }
+
+    sc_rwlock_read_lock(&file->lock);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!spans[i].length) {
+            continue;
+        }
+        int32_t done = read_range(fs, file, NULL, spans[i].data, spans[i].length, offset + total);
+        total += (uint32_t)done;
+        if ((uint32_t)done < spans[i].length) {
+            break;
+        }
+    }
+    sc_rwlock_read_unlock(&file->lock);
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return (int32_t)total;
+}
+
+/* Write from several buffers */
+int32_t fs_writev(FileSystem* fs, uint32_t file_index, const fs_span_t* spans, uint32_t count, uint32_t offset) {
+    int32_t error_code = ERR_SUCCESS;
+    if (!fs || !spans || !spans_valid(spans, count)) {
+        error_code = ERR_NULL_POINTER;
         HANDLE_ERROR(error_code);
         return error_code;
     }
-    
-    return ERR_SUCCESS;
+    sc_rwlock_read_lock(&fs->tree_lock);
+    File* file = io_file(fs, file_index, &error_code);
+    if (!file) {
+        sc_rwlock_read_unlock(&fs->tree_lock);
+        return error_code;
+    }
+
+    lock_for_write(fs, file);
+    uint32_t old_size = file->size;
+    uint32_t old_block_count = file->block_count;
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!spans[i].length) {
+            continue;
+        }
+        int32_t done = write_range(fs, file_index, file, NULL, spans[i].data, spans[i].length, offset + total);
+        if (done < 0) {
+            error_code = done;
+            break;
+        }
+        total += (uint32_t)done;
+        if ((uint32_t)done < spans[i].length) {
+            break;
+        }
+    }
+    store_if_changed(fs, file_index, old_size, old_block_count);
+    unlock_after_write(fs, file);
+    end_operation(fs);
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return total || error_code == ERR_SUCCESS ? (int32_t)total : error_code;
 }
 
-/* Create a new file */
-int32_t fs_create_file(FileSystem* fs, const char* name, uint32_t parent_dir) {
+/* Store and unlock the file of a finished fs_batch run */
+static void finish_run(FileSystem* fs, uint32_t file_index, File* file, bool writing, uint32_t old_size,
+                       uint32_t old_block_count) {
+    if (writing) {
+        store_if_changed(fs, file_index, old_size, old_block_count);
+        unlock_after_write(fs, file);
+    } else {
+        sc_rwlock_read_unlock(&file->lock);
+    }
+}
+
+/* Run a list of reads and writes */
+int32_t fs_batch(FileSystem* fs, fs_op_t* ops, uint32_t count) {
+    if (!fs || (!ops && count)) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
+    }
+
+    sc_rwlock_read_lock(&fs->tree_lock);
+    uint32_t current = FS_NO_ENTRY;
+    File* file = NULL;
+    bool writing = false;
+    int32_t file_error = ERR_INVALID_FILE_HANDLE;
+    uint32_t old_size = 0;
+    uint32_t old_block_count = 0;
+    uint32_t succeeded = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        fs_op_t* op = &ops[i];
+        if (op->file_index != current) {
+            /* A new run: finish the previous file, validate and lock the
+               next one, exclusive only if the run writes */
+            if (file) {
+                finish_run(fs, current, file, writing, old_size, old_block_count);
+            }
+            current = op->file_index;
+            file = io_file(fs, current, &file_error);
+            if (file) {
+                writing = false;
+                for (uint32_t j = i; j < count && ops[j].file_index == current && !writing; j++) {
+                    writing = ops[j].type == FS_OP_WRITE;
+                }
+                if (writing) {
+                    lock_for_write(fs, file);
+                } else {
+                    sc_rwlock_read_lock(&file->lock);
+                }
+                old_size = file->size;
+                old_block_count = file->block_count;
+            }
+        }
+
+        if (!file) {
+            op->result = file_error;
+        } else if (!op->buffer) {
+            op->result = ERR_NULL_POINTER;
+        } else if (op->size == 0) {
+            op->result = 0;
+        } else if (op->type == FS_OP_READ) {
+            op->result = read_range(fs, file, NULL, op->buffer, op->size, op->offset);
+        } else if (op->type == FS_OP_WRITE) {
+            op->result = write_range(fs, current, file, NULL, op->buffer, op->size, op->offset);
+        } else {
+            op->result = ERR_INVALID_PARAMETER;
+        }
+        if (op->result >= 0) {
+            succeeded++;
+        }
+    }
+    if (file) {
+        finish_run(fs, current, file, writing, old_size, old_block_count);
+    }
+    end_operation(fs);
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return (int32_t)succeeded;
+}
+
+/* Delete a file or directory; the tree lock is held exclusive */
+static int32_t delete_entry(FileSystem* fs, uint32_t file_index) {
     int32_t error_code = ERR_SUCCESS;
     
     /* Validate parameters */
-    if (!fs || !name) {
+    if (!fs) {
         error_code = ERR_NULL_POINTER;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
-    if (strlen(name) >= MAX_FILENAME_LENGTH) {
-        error_code = ERR_FILE_NAME_TOO_LONG;
+    if (!entry_in_use(fs, file_index) || fs_entry(fs, file_index)->unlinked) {
+        error_code = ERR_INVALID_FILE_HANDLE;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
-    /* Validate parent directory exists */
-    if (parent_dir != 0) {  /* Root directory is always valid */
-        if (parent_dir >= MAX_FILES_PER_DIR * 2 || !fs->files[parent_dir].used) {
-            error_code = ERR_INVALID_DIRECTORY;
-            HANDLE_ERROR(error_code);
-            return error_code;
-        }
-        if (fs->files[parent_dir].type != FILE_TYPE_DIRECTORY) {
-            error_code = ERR_NOT_A_DIRECTORY;
-            HANDLE_ERROR(error_code);
-            return error_code;
-        }
+    File* file = fs_entry(fs, file_index);
+    
+    /* The root cannot be deleted */
+    if (file->parent_dir == file_index) {
+        error_code = ERR_INVALID_PARAMETER;
+        HANDLE_ERROR(error_code);
+        return error_code;
     }
     
-    /* Check if file already exists */
-    if (fs_find_file(fs, name, parent_dir) >= 0) {
-        error_code = ERR_FILE_EXISTS;
+    /* Check if directory is empty (for directories) */
+    if (file->type == FILE_TYPE_DIRECTORY && file->first_child != FS_NO_ENTRY) {
+        error_code = ERR_DIRECTORY_NOT_EMPTY;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    
+    /* An open file waits for its last handle */
+    if (file->open_count) {
+        file->unlinked = 1;
+        dentry_forget(fs, file->parent_dir, file->name);
+        return ERR_SUCCESS;
+    }
+    return remove_entry(fs, file_index);
+}
+
+/* Delete a file or directory */
+int32_t fs_delete(FileSystem* fs, uint32_t file_index) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
+    }
+    sc_rwlock_write_lock(&fs->tree_lock);
+    int32_t result = delete_entry(fs, file_index);
+    sc_rwlock_write_unlock(&fs->tree_lock);
+    return result;
+}
+
+/* Free an entry's blocks and the entry itself */
+static int32_t remove_entry(FileSystem* fs, uint32_t file_index) {
+    int32_t error_code = ERR_SUCCESS;
+    File* file = fs_entry(fs, file_index);
+    
+    /* Free data blocks */
+    free_blocks(fs, file);
+    
+    /* Mark entry as unused */
+    index_remove(fs, file_index);
+    file->used = 0;
+    file->hash_next = fs->free_entry;
+    fs->free_entry = file_index;
+    fs->file_count--;
+    
+    if (store_entry(fs, file_index) != ERR_SUCCESS) {
+        error_code = ERR_IO_DEVICE_ERROR;
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    end_operation(fs);
+    
+    return ERR_SUCCESS;
+}
+
+/* Handle slot for a handle number, or NULL if it is not open */
+static fs_handle_t* open_handle(FileSystem* fs, int32_t handle) {
+    if (!fs || handle < 0 || handle >= FS_MAX_OPEN_FILES ||
+        fs->handles[handle].file_index == FS_NO_ENTRY) {
+        HANDLE_ERROR(ERR_INVALID_FILE_HANDLE);
+        return NULL;
+    }
+    return &fs->handles[handle];
+}
+
+/* Open a file; the tree lock is held exclusive */
+static int32_t open_file(FileSystem* fs, uint32_t file_index) {
+    int32_t error_code = ERR_SUCCESS;
+    File* file = io_file(fs, file_index, &error_code);
+    if (!file) {
+        return error_code;
+    }
+    if (file->unlinked) {
+        error_code = ERR_INVALID_FILE_HANDLE;
         HANDLE_ERROR(error_code);
         return error_code;
     }
-    
-    /* Find free entry */
-    int entry_index = find_free_entry(fs);
-    if (entry_index < 0) {
-        error_code = ERR_FILE_SYSTEM_FULL;
-        HANDLE_ERROR(error_code);
-        return error_code;
+
+    for (int32_t handle = 0; handle < FS_MAX_OPEN_FILES; handle++) {
+        fs_handle_t* slot = &fs->handles[handle];
+        if (slot->file_index == FS_NO_ENTRY) {
+            slot->file_index = file_index;
+            slot->position = 0;
+            slot->block_num = 0;
+            file->open_count++;
+            return handle;
+        }
+    }
+    error_code = ERR_TOO_MANY_OPEN_FILES;
+    HANDLE_ERROR(error_code);
+    return error_code;
+}
+
+/* Open a file */
+int32_t fs_open(FileSystem* fs, uint32_t file_index) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
+    }
+    sc_rwlock_write_lock(&fs->tree_lock);
+    int32_t handle = open_file(fs, file_index);
+    sc_rwlock_write_unlock(&fs->tree_lock);
+    return handle;
+}
+
+/* Close a handle; the tree lock is held exclusive */
+static int32_t close_handle(FileSystem* fs, int32_t handle) {
+    fs_handle_t* slot = open_handle(fs, handle);
+    if (!slot) {
+        return ERR_INVALID_FILE_HANDLE;
+    }
+    uint32_t file_index = slot->file_index;
+    File* file = fs_entry(fs, file_index);
+    slot->file_index = FS_NO_ENTRY;
+    if (--file->open_count == 0 && file->unlinked) {
+        file->unlinked = 0;
+        return remove_entry(fs, file_index);
+    }
+    return ERR_SUCCESS;
+}
+
+/* Close a handle */
+int32_t fs_close(FileSystem* fs, int32_t handle) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_INVALID_FILE_HANDLE);
+        return ERR_INVALID_FILE_HANDLE;
+    }
+    sc_rwlock_write_lock(&fs->tree_lock);
+    int32_t result = close_handle(fs, handle);
+    sc_rwlock_write_unlock(&fs->tree_lock);
+    return result;
+}
+
+/* Size of the file open at a handle slot */
+static uint32_t handle_file_size(FileSystem* fs, const fs_handle_t* slot) {
+    File* file = fs_entry(fs, slot->file_index);
+    sc_rwlock_read_lock(&file->lock);
+    uint32_t size = file->size;
+    sc_rwlock_read_unlock(&file->lock);
+    return size;
+}
+
+/* Move a handle */
+int32_t fs_seek(FileSystem* fs, int32_t handle, int32_t offset, int32_t origin) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_INVALID_FILE_HANDLE);
+        return ERR_INVALID_FILE_HANDLE;
+    }
+    sc_rwlock_read_lock(&fs->tree_lock);
+    fs_handle_t* slot = open_handle(fs, handle);
+    if (!slot) {
+        sc_rwlock_read_unlock(&fs->tree_lock);
+        return ERR_INVALID_FILE_HANDLE;
+    }
+    int64_t base = origin == FS_SEEK_SET ? 0
+                 : origin == FS_SEEK_CUR ? (int64_t)slot->position
+                 : origin == FS_SEEK_END ? (int64_t)handle_file_size(fs, slot) : -1;
+    int64_t position = base + offset;
+    if (base < 0 || position < 0 || position > (int64_t)MAX_FILE_SIZE) {
+        sc_rwlock_read_unlock(&fs->tree_lock);
+        HANDLE_ERROR(ERR_INVALID_PARAMETER);
+        return ERR_INVALID_PARAMETER;
+    }
+    /* Still under the tree lock, so fs_close cannot hand the slot to
+       another open in between */
+    slot->position = (uint32_t)position;
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return (int32_t)position;
+}
+
+/* Read at a handle's position */
+int32_t fs_read(FileSystem* fs, int32_t handle, uint8_t* buffer, uint32_t size) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_INVALID_FILE_HANDLE);
+        return ERR_INVALID_FILE_HANDLE;
+    }
+    sc_rwlock_read_lock(&fs->tree_lock);
+    fs_handle_t* slot = open_handle(fs, handle);
+    int32_t done = ERR_INVALID_FILE_HANDLE;
+    if (slot && !buffer) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        done = ERR_NULL_POINTER;
+    } else if (slot) {
+        File* file = fs_entry(fs, slot->file_index);
+        sc_rwlock_read_lock(&file->lock);
+        done = read_range(fs, file, slot, buffer, size, slot->position);
+        sc_rwlock_read_unlock(&file->lock);
+        slot->position += (uint32_t)done;
+    }
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return done;
+}
+
+/* Write at a handle's position */
+int32_t fs_write(FileSystem* fs, int32_t handle, const uint8_t* data, uint32_t size) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_INVALID_FILE_HANDLE);
+        return ERR_INVALID_FILE_HANDLE;
+    }
+    sc_rwlock_read_lock(&fs->tree_lock);
+    fs_handle_t* slot = open_handle(fs, handle);
+    int32_t done = slot ? 0 : ERR_INVALID_FILE_HANDLE;
+    if (slot && !data) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        done = ERR_NULL_POINTER;
+    } else if (slot && size > 0) {
+        uint32_t file_index = slot->file_index;
+        File* file = fs_entry(fs, file_index);
+        lock_for_write(fs, file);
+        uint32_t old_size = file->size;
+        uint32_t old_block_count = file->block_count;
+        done = write_range(fs, file_index, file, slot, data, size, slot->position);
+        store_if_changed(fs, file_index, old_size, old_block_count);
+        unlock_after_write(fs, file);
+        end_operation(fs);
+        if (done > 0) {
+            slot->position += (uint32_t)done;
+        }
     }
-    
-    /* Initialize file entry */
-    File* file = &fs->files[entry_index];
-    memset(file, 0, sizeof(File));
-    strcpy(file->name, name);
-    file->type = FILE_TYPE_FILE;
-    file->size = 0;
-    file->block_count = 0;
-    file->parent_dir = parent_dir;
-    file->used = 1;
-    
-    fs->file_count++;
-    return entry_index;
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return done;
 }
 
-/* Create a new directory */
-int32_t fs_create_directory(FileSystem* fs, const char* name, uint32_t parent_dir) {
+/* Find a file by name; the tree lock is held */
+static int32_t find_file(FileSystem* fs, const char* name, uint32_t parent_dir) {
     int32_t error_code = ERR_SUCCESS;
     
     /* Validate parameters */
@@ -150,296 +2576,260 @@ int32_t fs_create_directory(FileSystem* fs, const char* name, uint32_t parent_di
         return error_code;
     }
     
-    if (strlen(name) >= MAX_FILENAME_LENGTH) {
-        error_code = ERR_FILE_NAME_TOO_LONG;
-        HANDLE_ERROR(error_code);
-        return error_code;
-    }
-    
     /* Validate parent directory exists */
     if (parent_dir != 0) {  /* Root directory is always valid */
-        if (parent_dir >= MAX_FILES_PER_DIR * 2 || !fs->files[parent_dir].used) {
+        if (!entry_in_use(fs, parent_dir)) {
             error_code = ERR_INVALID_DIRECTORY;
             HANDLE_ERROR(error_code);
             return error_code;
         }
-        if (fs->files[parent_dir].type != FILE_TYPE_DIRECTORY) {
+        if (fs_entry(fs, parent_dir)->type != FILE_TYPE_DIRECTORY) {
             error_code = ERR_NOT_A_DIRECTORY;
             HANDLE_ERROR(error_code);
             return error_code;
         }
     }
     
-    /* Check if directory already exists */
-    if (fs_find_file(fs, name, parent_dir) >= 0) {
-        error_code = ERR_FILE_EXISTS;
-        HANDLE_ERROR(error_code);
-        return error_code;
+    uint32_t index = index_lookup(fs, parent_dir, name);
+    if (index != FS_NO_ENTRY && !fs_entry(fs, index)->unlinked) {
+        return (int32_t)index;
     }
     
-    /* Find free entry */
-    int entry_index = find_free_entry(fs);
-    if (entry_index < 0) {
-        error_code = ERR_FILE_SYSTEM_FULL;
-        HANDLE_ERROR(error_code);
-        return error_code;
+    return ERR_FILE_NOT_FOUND;
+}
+
+/* Find a file by name */
+int32_t fs_find_file(FileSystem* fs, const char* name, uint32_t parent_dir) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
     }
-    
-    /* Initialize directory entry */
-    File* dir = &fs->files[entry_index];
-    memset(dir, 0, sizeof(File));
-    strcpy(dir->name, name);
-    dir->type = FILE_TYPE_DIRECTORY;
-    dir->size = 0;
-    dir->block_count = 0;
-    dir->parent_dir = parent_dir;
-    dir->used = 1;
-    
-    fs->file_count++;
-    return entry_index;
+    sc_rwlock_read_lock(&fs->tree_lock);
+    int32_t index = find_file(fs, name, parent_dir);
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return index;
 }
 
-/* Read data from a file */
-int32_t fs_read_file(FileSystem* fs, uint32_t file_index, uint8_t* buffer, uint32_t size, uint32_t offset) {
-    /* Read up to size bytes starting at offset, walking block-by-block with bounds checks. */
+/* Resolve a path; the tree lock is held */
+static int32_t lookup_path(FileSystem* fs, const char* path, uint32_t cwd) {
     int32_t error_code = ERR_SUCCESS;
     
     /* Validate parameters */
-    if (!fs || !buffer) {
+    if (!fs || !path) {
         error_code = ERR_NULL_POINTER;
         HANDLE_ERROR(error_code);
         return error_code;
     }
-    
-    if (size == 0) {
-        return 0;  /* Nothing to read */
-    }
-    
-    if (file_index >= MAX_FILES_PER_DIR * 2 || !fs->files[file_index].used) {
-        error_code = ERR_INVALID_FILE_HANDLE;
-        HANDLE_ERROR(error_code);
-        return error_code;
-    }
-    
-    File* file = &fs->files[file_index];
-    if (file->type != FILE_TYPE_FILE) {
-        error_code = ERR_NOT_A_FILE;
+    if (!entry_in_use(fs, cwd) || fs_entry(fs, cwd)->type != FILE_TYPE_DIRECTORY) {
+        error_code = ERR_INVALID_DIRECTORY;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
-    /* Check bounds */
-    if (offset >= file->size) {
-        return 0;  /* Nothing to read */
-    }
-    
-    uint32_t read_size = size;
-    if (offset + size > file->size) {
-        read_size = file->size - offset;
-    }
-    
-    /* Read data block by block */
-    uint32_t bytes_read = 0;
-    uint32_t current_offset = offset;
-    
-    while (bytes_read < read_size && current_offset < file->size) {
-        uint32_t block_index = current_offset / BLOCK_SIZE;
-        uint32_t block_offset = current_offset % BLOCK_SIZE;
-        uint32_t bytes_in_block = BLOCK_SIZE - block_offset;
-        uint32_t bytes_to_read = (read_size - bytes_read) < bytes_in_block ? 
-                                (read_size - bytes_read) : bytes_in_block;
-        
-        if (block_index >= file->block_count) {
-            error_code = ERR_FILE_CORRUPTED;
-            HANDLE_ERROR(error_code);
+    uint32_t current = *path == '/' ? 0 : cwd;
+    for (;;) {
+        while (*path == '/') {
+            path++;
+        }
+        if (!*path) {
             break;
         }
-        
-        uint32_t block_num = file->blocks[block_index];
-        if (block_num >= fs->total_blocks) {
-            error_code = ERR_FILE_CORRUPTED;
+        /* Only directories have components below them */
+        if (fs_entry(fs, current)->type != FILE_TYPE_DIRECTORY) {
+            error_code = ERR_NOT_A_DIRECTORY;
             HANDLE_ERROR(error_code);
-            break;
+            return error_code;
         }
         
-        uint8_t* block_data = fs->data_blocks + (block_num * BLOCK_SIZE);
-        
-        memcpy(buffer + bytes_read, block_data + block_offset, bytes_to_read);
+        /* Hash the component while finding its end, so it is read once */
+        const char* name = path;
+        uint32_t hash = entry_hash_seed(current);
+        while (*path && *path != '/') {
+            hash = entry_hash_step(hash, *path++);
+        }
+        uint32_t length = (uint32_t)(path - name);
+        if (length >= MAX_FILENAME_LENGTH) {
+            error_code = ERR_FILE_NAME_TOO_LONG;
+            HANDLE_ERROR(error_code);
+            return error_code;
+        }
         
-        bytes_read += bytes_to_read;
-        current_offset += bytes_to_read;
+        if (name[0] == '.' && (length == 1 || (length == 2 && name[1] == '.'))) {
+            if (length == 2) {
+                current = fs_entry(fs, current)->parent_dir;
+            }
+        } else {
+            current = dentry_lookup(fs, current, name, length, hash);
+            if (current == FS_NO_ENTRY) {
+                return ERR_FILE_NOT_FOUND;
+            }
+        }
     }
     
-    return bytes_read;
+    return (int32_t)current;
 }
 
-/* Write data to a file */
-int32_t fs_write_file(FileSystem* fs, uint32_t file_index, const uint8_t* data, uint32_t size, uint32_t offset) {
-    /* Grow file if needed by allocating additional blocks, then write per-block. */
-    int32_t error_code = ERR_SUCCESS;
-    
-    /* Validate parameters */
-    if (!fs || !data) {
-        error_code = ERR_NULL_POINTER;
-        HANDLE_ERROR(error_code);
-        return error_code;
+/* Resolve a path */
+int32_t fs_lookup_path(FileSystem* fs, const char* path, uint32_t cwd) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
     }
-    
-    if (size == 0) {
-        return 0;  /* Nothing to write */
+    sc_rwlock_read_lock(&fs->tree_lock);
+    int32_t index = lookup_path(fs, path, cwd);
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return index;
+}
+
+/* Step a depth-first walk of the tree below the root on from index,
+   entering its children when it is a directory and copy is not
+   FS_NO_ENTRY. *copy_parent follows the walk through a copy of the tree:
+   it becomes copy going down and its own parent coming back up. Returns
+   FS_NO_ENTRY once the walk is over. */
+static uint32_t walk_next(const FileSystem* fs, uint32_t index, uint32_t copy, uint32_t* copy_parent) {
+    const File* file = fs_entry(fs, index);
+    if (copy != FS_NO_ENTRY && file->type == FILE_TYPE_DIRECTORY && file->first_child != FS_NO_ENTRY) {
+        *copy_parent = copy;
+        return file->first_child;
     }
-    
-    if (file_index >= MAX_FILES_PER_DIR * 2 || !fs->files[file_index].used) {
-        error_code = ERR_INVALID_FILE_HANDLE;
-        HANDLE_ERROR(error_code);
-        return error_code;
+    while (index != 0) {
+        file = fs_entry(fs, index);
+        if (file->next_sibling != FS_NO_ENTRY) {
+            return file->next_sibling;
+        }
+        index = file->parent_dir;
+        *copy_parent = fs_entry(fs, *copy_parent)->parent_dir;
     }
-    
-    File* file = &fs->files[file_index];
-    if (file->type != FILE_TYPE_FILE) {
-        error_code = ERR_NOT_A_FILE;
-        HANDLE_ERROR(error_code);
-        return error_code;
+    return FS_NO_ENTRY;
+}
+
+/* Copy entry index into directory parent of a snapshot. The copy shares
+   the original's direct blocks and top pointer blocks, each of which gains
+   a reference; what lies below a pointer block is shared through it. */
+static int32_t snapshot_entry(FileSystem* fs, uint32_t index, uint32_t parent, uint32_t* copy_index) {
+    if (!journal_room(&fs->journal, FS_JOURNAL_STEP_BLOCKS) && commit_transaction(fs) != ERR_SUCCESS) {
+        return ERR_IO_DEVICE_ERROR;
     }
-    
-    /* Calculate required blocks */
-    uint32_t required_size = offset + size;
-    uint32_t required_blocks = (required_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    
-    /* Check maximum file size */
-    if (required_blocks > MAX_BLOCKS_PER_FILE) {
-        error_code = ERR_FILE_TOO_LARGE;
-        HANDLE_ERROR(error_code);
-        return error_code;
+    int copy = find_free_entry(fs);
+    if (copy < 0) {
+        return ERR_FILE_SYSTEM_FULL;
     }
-    
-    /* Allocate more blocks if needed */
-    if (required_blocks > file->block_count) {
-        uint32_t additional_blocks = required_blocks - file->block_count;
-        
-        int result = allocate_blocks(fs, file->blocks + file->block_count, additional_blocks);
-        if (result != FS_SUCCESS) {
-            error_code = ERR_OUT_OF_SPACE;
-            HANDLE_ERROR(error_code);
-            return error_code;
-        }
-        file->block_count += additional_blocks;
+    File* file = fs_entry(fs, index);
+    File* clone = fs_entry(fs, (uint32_t)copy);
+    memset(clone, 0, sizeof(File));
+    memcpy(clone->name, file->name, sizeof(clone->name));
+    clone->size = file->size;
+    clone->type = file->type;
+    clone->flags = FS_INODE_SNAPSHOT;
+    memcpy(clone->blocks, file->blocks, sizeof(clone->blocks));
+    clone->indirect = file->indirect;
+    clone->double_indirect = file->double_indirect;
+    clone->block_count = file->block_count;
+    clone->parent_dir = parent;
+    clone->used = 1;
+    index_insert(fs, (uint32_t)copy);
+    fs->file_count++;
+
+    int32_t result = ERR_SUCCESS;
+    for (uint32_t i = 0; i < file->block_count && i < FS_DIRECT_BLOCKS && result == ERR_SUCCESS; i++) {
+        result = adjust_refs(fs, file->blocks[i], 1);
     }
-    
-    /* Write data block by block */
-    uint32_t bytes_written = 0;
-    uint32_t current_offset = offset;
-    
-    while (bytes_written < size) {
-        uint32_t block_index = current_offset / BLOCK_SIZE;
-        uint32_t block_offset = current_offset % BLOCK_SIZE;
-        uint32_t bytes_in_block = BLOCK_SIZE - block_offset;
-        uint32_t bytes_to_write = (size - bytes_written) < bytes_in_block ? 
-                                 (size - bytes_written) : bytes_in_block;
-        
-        if (block_index >= file->block_count) {
-            error_code = ERR_FILE_CORRUPTED;
-            HANDLE_ERROR(error_code);
-            break;
-        }
-        
-        uint32_t block_num = file->blocks[block_index];
-        if (block_num >= fs->total_blocks) {
-            error_code = ERR_FILE_CORRUPTED;
-            HANDLE_ERROR(error_code);
-            break;
-        }
-        
-        uint8_t* block_data = fs->data_blocks + (block_num * BLOCK_SIZE);
-        
-        memcpy(block_data + block_offset, data + bytes_written, bytes_to_write);
-        
-        bytes_written += bytes_to_write;
-        current_offset += bytes_to_write;
+    if (result == ERR_SUCCESS && file->indirect) {
+        result = adjust_refs(fs, file->indirect, 1);
     }
-    
-    /* Update file size */
-    if (current_offset > file->size) {
-        file->size = current_offset;
+    if (result == ERR_SUCCESS && file->double_indirect) {
+        result = adjust_refs(fs, file->double_indirect, 1);
     }
-    
-    return bytes_written;
+    if (result == ERR_SUCCESS && (file->indirect || file->double_indirect)) {
+        file->flags |= FS_INODE_SHARED;
+        clone->flags |= FS_INODE_SHARED;
+        result = store_entry(fs, index);
+    }
+    if (result == ERR_SUCCESS) {
+        result = store_entry(fs, (uint32_t)copy);
+    }
+    *copy_index = (uint32_t)copy;
+    return result;
 }
 
-/* Delete a file or directory */
-int32_t fs_delete(FileSystem* fs, uint32_t file_index) {
+/* Snapshot the tree; the tree lock is held exclusive */
+static int32_t snapshot_tree(FileSystem* fs, const char* name) {
+    /* Two walks over the entries in memory: one counts what the snapshot
+       needs, the other copies. Existing snapshots and files deleted while
+       open are left out. */
     int32_t error_code = ERR_SUCCESS;
-    
+
     /* Validate parameters */
-    if (!fs) {
+    if (!fs || !name) {
         error_code = ERR_NULL_POINTER;
         HANDLE_ERROR(error_code);
         return error_code;
     }
-    
-    if (file_index >= MAX_FILES_PER_DIR * 2 || !fs->files[file_index].used) {
-        error_code = ERR_INVALID_FILE_HANDLE;
+
+    uint32_t snapshots = 0, entries = 0, parent = 0;
+    for (uint32_t index = fs_entry(fs, 0)->first_child; index != FS_NO_ENTRY;) {
+        const File* file = fs_entry(fs, index);
+        bool skip = (file->flags & FS_INODE_SNAPSHOT) || file->unlinked;
+        snapshots += (file->flags & FS_INODE_SNAPSHOT) && file->parent_dir == 0;
+        entries += !skip;
+        index = walk_next(fs, index, skip ? FS_NO_ENTRY : index, &parent);
+    }
+    if (snapshots >= FS_MAX_SNAPSHOTS) {
+        error_code = ERR_FILE_SYSTEM_FULL;
         HANDLE_ERROR(error_code);
         return error_code;
     }
-    
-    File* file = &fs->files[file_index];
-    
-    /* Check if directory is empty (for directories) */
-    if (file->type == FILE_TYPE_DIRECTORY) {
-        for (uint32_t i = 0; i < MAX_FILES_PER_DIR * 2; i++) {
-            if (fs->files[i].used && fs->files[i].parent_dir == file_index) {
-                error_code = ERR_DIRECTORY_NOT_EMPTY;
-                HANDLE_ERROR(error_code);
-                return error_code;
-            }
-        }
-    }
-    
-    /* Free data blocks */
-    free_blocks(fs, file->blocks, file->block_count);
-    
-    /* Mark entry as unused */
-    file->used = 0;
-    fs->file_count--;
-    
-    return ERR_SUCCESS;
-}
-
-/* Find a file by name */
-int32_t fs_find_file(FileSystem* fs, const char* name, uint32_t parent_dir) {
-    int32_t error_code = ERR_SUCCESS;
-    
-    /* Validate parameters */
-    if (!fs || !name) {
-        error_code = ERR_NULL_POINTER;
+    if (entries + 1 > fs->inode_count - fs->file_count) {
+        error_code = ERR_FILE_SYSTEM_FULL;
         HANDLE_ERROR(error_code);
         return error_code;
     }
-    
-    /* Validate parent directory exists */
-    if (parent_dir != 0) {  /* Root directory is always valid */
-        if (parent_dir >= MAX_FILES_PER_DIR * 2 || !fs->files[parent_dir].used) {
-            error_code = ERR_INVALID_DIRECTORY;
-            HANDLE_ERROR(error_code);
-            return error_code;
-        }
-        if (fs->files[parent_dir].type != FILE_TYPE_DIRECTORY) {
-            error_code = ERR_NOT_A_DIRECTORY;
-            HANDLE_ERROR(error_code);
-            return error_code;
-        }
+
+    int32_t root = create_directory(fs, name, 0);
+    if (root < 0) {
+        return root;
     }
-    
-    for (uint32_t i = 0; i < MAX_FILES_PER_DIR * 2; i++) {
-        if (fs->files[i].used && 
-            fs->files[i].parent_dir == parent_dir &&
-            strcmp(fs->files[i].name, name) == 0) {
-            return i;
+    fs_entry(fs, (uint32_t)root)->flags = FS_INODE_SNAPSHOT;
+    error_code = store_entry(fs, (uint32_t)root);
+
+    /* The new directory is under the root as well, but flagged, so the walk
+       passes it by without seeing the copies that land in it */
+    parent = (uint32_t)root;
+    for (uint32_t index = fs_entry(fs, 0)->first_child; index != FS_NO_ENTRY && error_code == ERR_SUCCESS;) {
+        const File* file = fs_entry(fs, index);
+        uint32_t copy = FS_NO_ENTRY;
+        if (!(file->flags & FS_INODE_SNAPSHOT) && !file->unlinked) {
+            error_code = snapshot_entry(fs, index, parent, &copy);
         }
+        index = walk_next(fs, index, copy, &parent);
     }
-    
-    return ERR_FILE_NOT_FOUND;
+    end_operation(fs);
+    if (error_code != ERR_SUCCESS) {
+        HANDLE_ERROR(error_code);
+        return error_code;
+    }
+    return root;
+}
+
+/* Snapshot the tree */
+int32_t fs_snapshot(FileSystem* fs, const char* name) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
+    }
+    sc_rwlock_write_lock(&fs->tree_lock);
+    int32_t root = snapshot_tree(fs, name);
+    sc_rwlock_write_unlock(&fs->tree_lock);
+    return root;
+}
+
+/* Copy an entry out for a caller, holding its lock, without the read-ahead
+   state (which has a lock of its own) or the locks */
+static void copy_entry(File* to, File* from) {
+    sc_rwlock_read_lock(&from->lock);
+    memcpy(to, from, offsetof(File, ra_next));
+    sc_rwlock_read_unlock(&from->lock);
+    memset((uint8_t*)to + offsetof(File, ra_next), 0, sizeof(File) - offsetof(File, ra_next));
 }
 
 /* Get file information */
@@ -453,18 +2843,21 @@ int32_t fs_get_file_info(FileSystem* fs, uint32_t file_index, File* info) {
         return error_code;
     }
     
-    if (file_index >= MAX_FILES_PER_DIR * 2 || !fs->files[file_index].used) {
+    sc_rwlock_read_lock(&fs->tree_lock);
+    if (!entry_in_use(fs, file_index)) {
+        sc_rwlock_read_unlock(&fs->tree_lock);
         error_code = ERR_INVALID_FILE_HANDLE;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
-    memcpy(info, &fs->files[file_index], sizeof(File));
+    copy_entry(info, fs_entry(fs, file_index));
+    sc_rwlock_read_unlock(&fs->tree_lock);
     return ERR_SUCCESS;
 }
 
-/* List directory contents */
-int32_t fs_list_directory(FileSystem* fs, uint32_t dir_index, File* entries, uint32_t max_entries) {
+/* List directory contents; the tree lock is held */
+static int32_t list_directory(FileSystem* fs, uint32_t dir_index, File* entries, uint32_t max_entries) {
     int32_t error_code = ERR_SUCCESS;
     
     /* Validate parameters */
@@ -478,48 +2871,63 @@ int32_t fs_list_directory(FileSystem* fs, uint32_t dir_index, File* entries, uin
         return 0;  /* Nothing to list */
     }
     
-    if (dir_index >= MAX_FILES_PER_DIR * 2 || !fs->files[dir_index].used) {
+    if (!entry_in_use(fs, dir_index)) {
         error_code = ERR_INVALID_DIRECTORY;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
-    if (fs->files[dir_index].type != FILE_TYPE_DIRECTORY) {
+    if (fs_entry(fs, dir_index)->type != FILE_TYPE_DIRECTORY) {
         error_code = ERR_NOT_A_DIRECTORY;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
     uint32_t count = 0;
-    for (uint32_t i = 0; i < MAX_FILES_PER_DIR * 2 && count < max_entries; i++) {
-        if (fs->files[i].used && fs->files[i].parent_dir == dir_index) {
-            memcpy(&entries[count], &fs->files[i], sizeof(File));
+    uint32_t child = fs_entry(fs, dir_index)->first_child;
+    while (child != FS_NO_ENTRY && count < max_entries) {
+        if (!fs_entry(fs, child)->unlinked) {
+            copy_entry(&entries[count], fs_entry(fs, child));
             count++;
         }
+        child = fs_entry(fs, child)->next_sibling;
     }
     
     return count;
 }
 
+/* List directory contents */
+int32_t fs_list_directory(FileSystem* fs, uint32_t dir_index, File* entries, uint32_t max_entries) {
+    if (!fs) {
+        HANDLE_ERROR(ERR_NULL_POINTER);
+        return ERR_NULL_POINTER;
+    }
+    sc_rwlock_read_lock(&fs->tree_lock);
+    int32_t count = list_directory(fs, dir_index, entries, max_entries);
+    sc_rwlock_read_unlock(&fs->tree_lock);
+    return count;
+}
+
 /* Format file system (clear all files) */
 int32_t fs_format(FileSystem* fs) {
     int32_t error_code = ERR_SUCCESS;
     
     /* Validate parameters */
-    if (!fs) {
+    if (!fs || !fs->block_map_memory) {
         error_code = ERR_NULL_POINTER;
         HANDLE_ERROR(error_code);
         return error_code;
     }
     
-    /* Clear all file entries */
-    memset(fs->files, 0, sizeof(fs->files));
-    fs->file_count = 0;
-    fs->next_free_block = 0;
-    
-    /* Create root directory */
-    int result = fs_create_directory(fs, "/", 0);
-    if (result < 0) {
+    /* Drop the mounted state unwritten and start over with the same geometry */
+    block_device_t* device = fs->device;
+    uint32_t inode_count = fs->inode_count;
+    release_state(fs);
+    error_code = fs_mkfs(device, inode_count);
+    if (error_code == ERR_SUCCESS) {
+        error_code = fs_mount(fs, device);
+    }
+    if (error_code != ERR_SUCCESS) {
         error_code = ERR_FILE_SYSTEM_INIT_FAILED;
         HANDLE_ERROR(error_code);
         return error_code;
@@ -548,6 +2956,8 @@ const char* fs_error_string(int32_t error_code) {
         case ERR_FILE_SYSTEM_FULL:      return "File system full";
         case ERR_OUT_OF_SPACE:          return "No space left";
         case ERR_FILE_SYSTEM_INIT_FAILED: return "File system initialization failed";
+        case ERR_TOO_MANY_OPEN_FILES:   return "Too many open files";
+        case ERR_PERMISSION_DENIED:     return "Permission denied";
         
         default:                        return "Unknown file system error";
     }
@@ -1,17 +1,92 @@
-/* file_system.h - Basic file system structures and function declarations */
+/* file_system.h - Basic file system structures and function declarations
+
+   Threads may call the file system at once, apart from fs_mount,
+   fs_unmount, fs_init, fs_init_device, fs_destroy and fs_format, which need
+   it to themselves. Four kinds of lock keep them apart, always taken in
+   this order:
+     tree_lock   the namespace (entries, name index, child lists, handles).
+                 Shared by lookups and file I/O, exclusive for creating,
+                 deleting, snapshots, opening and closing.
+     File.lock   one file's size, block map and data. Shared by readers,
+                 exclusive for a writer, so I/O on different files runs in
+                 parallel.
+     op_lock     shared by writes while they change metadata, exclusive
+                 for a journal commit, so a transaction never ends halfway
+                 through one.
+     alloc_lock  the block allocator, reference counts, inode table blocks
+                 and the journal: short sections inside a write, taken
+                 once to grow or unshare the file and per block only while
+                 a snapshot shares blocks.
+   Read-ahead state and each dentry cache set have small locks of their
+   own, held only around their fields and never while taking another lock
+   or doing I/O, and the block cache has its lock (block_cache.h). A handle
+   must not be used by two threads at once. */
 
 #ifndef FILE_SYSTEM_H
 #define FILE_SYSTEM_H
 
 #include <stdint.h>
 #include <stddef.h>
+#include "bitmap.h"
+#include "block_cache.h"
+#include "block_device.h"
+#include "journal.h"
+#include "spinlock.h"
 
 /* File system constants */
 #define MAX_FILENAME_LENGTH 32
-#define MAX_FILES_PER_DIR   16
-#define MAX_FILE_SIZE       4096    /* 4KB max file size */
-#define BLOCK_SIZE          512     /* 512 bytes per block */
-#define MAX_BLOCKS_PER_FILE 8
+#define FS_NO_ENTRY         0xFFFFFFFFu  /* Terminator for entry links */
+#define BLOCK_SIZE          BLOCK_DEVICE_BLOCK_SIZE  /* 512 bytes per block */
+#define FS_CACHE_BUFFERS    256     /* Block cache size (128 KiB) */
+
+/* Group commit: an operation that leaves the running transaction with at
+   least this many logged blocks (or half of what the journal holds) commits
+   it; fs_sync and fs_unmount always do. Long writes also commit between
+   extents of at most FS_JOURNAL_EXTENT_BLOCKS blocks once fewer than
+   FS_JOURNAL_STEP_BLOCKS, the most one such extent logs, are left. */
+#define FS_JOURNAL_GROUP_BLOCKS   64
+#define FS_JOURNAL_EXTENT_BLOCKS  128
+#define FS_JOURNAL_STEP_BLOCKS    12
+
+/* Dentry cache: (parent, name) -> entry, misses included, in sets of
+   FS_DCACHE_WAYS slots kept in recently used order */
+#define FS_DCACHE_SET_BITS  8
+#define FS_DCACHE_SETS      (1u << FS_DCACHE_SET_BITS)
+#define FS_DCACHE_WAYS      2
+
+/* Snapshots that may exist at once; a block is shared at most once per
+   snapshot, which keeps reference counts within a byte */
+#define FS_MAX_SNAPSHOTS    64
+
+/* Open file handles per file system */
+#define FS_MAX_OPEN_FILES   32
+
+/* fs_seek origins */
+#define FS_SEEK_SET         0
+#define FS_SEEK_CUR         1
+#define FS_SEEK_END         2
+
+/* Cache buffers one fs_map_file call may pin (32 KiB), leaving the rest of
+   the cache to everything else */
+#define FS_MAP_MAX_BLOCKS   (FS_CACHE_BUFFERS / 4)
+
+/* Read-ahead window in blocks: sequential reads start at the minimum and
+   double each time they catch up with it, up to the maximum (one device
+   batch and a quarter of the cache) */
+#define FS_READAHEAD_MIN    4
+#define FS_READAHEAD_MAX    (FS_CACHE_BUFFERS / 4)
+
+/* Entry (inode) table: page-sized chunks, so entries never move once created */
+#define FS_ENTRY_CHUNK_SIZE   4096
+#define FS_INITIAL_BUCKETS    64      /* Name index size at init; doubles with the entry count */
+
+/* Block map: direct pointers, then one single and one double indirect block.
+   Pointer value 0 means "not allocated" (block 0 always holds the superblock). */
+#define FS_DIRECT_BLOCKS      8
+#define FS_POINTERS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+#define MAX_BLOCKS_PER_FILE   (FS_DIRECT_BLOCKS + FS_POINTERS_PER_BLOCK + \
+                               FS_POINTERS_PER_BLOCK * FS_POINTERS_PER_BLOCK)
+#define MAX_FILE_SIZE         (MAX_BLOCKS_PER_FILE * BLOCK_SIZE)   /* a little over 8 MiB */
 
 /* File types */
 #define FILE_TYPE_FILE      0
@@ -30,28 +105,145 @@ typedef struct {
     char name[MAX_FILENAME_LENGTH];
     uint32_t size;
     uint8_t type;           /* FILE_TYPE_FILE or FILE_TYPE_DIRECTORY */
-    uint32_t blocks[MAX_BLOCKS_PER_FILE];  /* Block pointers to data */
-    uint32_t block_count;
+    uint8_t flags;          /* FS_INODE_SHARED, FS_INODE_SNAPSHOT (fs_format.h) */
+    uint32_t blocks[FS_DIRECT_BLOCKS];  /* Direct block pointers to data */
+    uint32_t indirect;      /* Block of pointers to data blocks */
+    uint32_t double_indirect;  /* Block of pointers to indirect blocks */
+    uint32_t block_count;   /* Data blocks, excluding pointer blocks */
     uint32_t parent_dir;    /* Parent directory index */
     uint8_t used;          /* Whether this entry is in use */
+    uint8_t unlinked;       /* Deleted while open: hidden, removed on the last fs_close */
+    uint16_t open_count;    /* Handles open on this file */
+    uint32_t hash_next;     /* Next entry in the same name bucket (free list when unused) */
+    uint32_t first_child;   /* Directories: child list, oldest first */
+    uint32_t last_child;
+    uint32_t next_sibling;  /* Doubly linked list of entries sharing parent_dir */
+    uint32_t prev_sibling;
+    uint32_t ra_next;       /* Read-ahead: block after the last one read */
+    uint32_t ra_ahead;      /* Blocks before this one have been read ahead */
+    uint16_t ra_window;     /* Blocks per read-ahead, 0 until reads turn sequential */
+    sc_lock_t ra_lock;      /* The three read-ahead fields; a leaf lock */
+    sc_rwlock_t lock;       /* See the top of this file; fs_get_file_info copies neither lock */
 } File;
 
+/* A run of file bytes in memory */
+typedef struct {
+    uint8_t* data;
+    uint32_t length;
+} fs_span_t;
+
+/* An open file: a position and the mapping of the block it lies in, so
+   streaming reads and writes skip the block map walk */
+typedef struct {
+    uint32_t file_index;    /* FS_NO_ENTRY when the slot is free */
+    uint32_t position;      /* Offset of the next fs_read or fs_write */
+    uint32_t block_logical; /* File block the cached mapping is for */
+    uint32_t block_num;     /* Its device block; 0 when nothing is cached */
+} fs_handle_t;
+
+/* A cached name lookup */
+typedef struct {
+    uint32_t parent;        /* FS_NO_ENTRY when the slot is empty */
+    uint32_t index;         /* Entry with this name, FS_NO_ENTRY for a cached miss */
+    char name[MAX_FILENAME_LENGTH];
+} fs_dentry_t;
+
+/* Operations for fs_batch */
+#define FS_OP_READ          0
+#define FS_OP_WRITE         1
+
+typedef struct {
+    uint8_t type;           /* FS_OP_READ or FS_OP_WRITE */
+    uint32_t file_index;
+    uint8_t* buffer;        /* Destination of a read, source of a write */
+    uint32_t size;
+    uint32_t offset;
+    int32_t result;         /* Set by fs_batch: bytes transferred or an error code */
+} fs_op_t;
+
 /* Directory structure (same as File for simplicity) */
 typedef File Directory;
 
+#define FS_ENTRIES_PER_CHUNK  (FS_ENTRY_CHUNK_SIZE / sizeof(File))
+
 /* File system structure */
 typedef struct {
-    File files[MAX_FILES_PER_DIR * 2];  /* Allow files and directories */
+    File** entry_chunks;       /* Entry table chunks, each one page from the page allocator */
+    uint32_t chunk_count;
+    uint32_t chunk_slots;      /* Capacity of the entry_chunks array */
+    uint32_t entry_capacity;
+    uint32_t free_entry;       /* Head of the unused entry list */
+    uint32_t* name_buckets;    /* Hash index over (parent_dir, name) */
+    uint32_t bucket_mask;      /* Bucket count - 1 (a power of two) */
     uint32_t file_count;
-    uint32_t next_free_block;  /* Next available data block */
-    uint8_t* data_blocks;      /* Pointer to data block memory */
-    uint32_t total_blocks;     /* Total number of data blocks */
+    uint32_t next_free_block;  /* Allocation hint for files with no blocks yet */
+    block_device_t* device;    /* Backing store for data blocks */
+    memory_block_device_t memory_device;  /* Device used by fs_init */
+    block_cache_t cache;       /* All block I/O goes through here */
+    uint32_t total_blocks;     /* Device size, metadata included */
+    hbitmap_t block_map;       /* Free-block bitmap (set = in use) */
+    uint64_t* block_map_memory;
+    uint32_t reserved_blocks;  /* Superblock, bitmap, refcounts, inodes and journal; data starts here */
+    uint32_t free_block_count;
+    uint32_t bitmap_start;     /* On-disk layout, see fs_format.h */
+    uint32_t refcount_start;
+    uint32_t inode_start;
+    uint32_t inode_count;      /* Entry indices are always below this */
+    uint32_t inode_high_water; /* No inode at or above this has been used */
+    uint32_t block_high_water; /* No block at or above this has been used */
+    uint32_t shared_blocks;    /* Blocks with extra references; 0 skips every sharing check */
+    journal_t journal;         /* Logs every metadata write, see journal.h */
+    uint32_t* pending_frees;   /* (start, length) extents freed in the running transaction */
+    uint32_t pending_count;
+    uint32_t pending_slots;    /* Capacity of pending_frees in extents */
+    uint32_t pending_blocks;   /* Blocks in those extents, not yet in free_block_count */
+    fs_handle_t handles[FS_MAX_OPEN_FILES];
+    fs_dentry_t* dentries;     /* FS_DCACHE_SETS * FS_DCACHE_WAYS; NULL looks up in the name index */
+    sc_lock_t dcache_locks[FS_DCACHE_SETS];  /* One per dentry set */
+    uint64_t dcache_hits;      /* Approximate while lookups run in parallel */
+    uint64_t dcache_misses;
+    uint32_t readahead_max;    /* Largest read-ahead window; 0 turns read-ahead off */
+    sc_rwlock_t tree_lock;     /* Concurrency: see the top of this file */
+    sc_rwlock_t op_lock;
+    sc_lock_t alloc_lock;
 } FileSystem;
 
+/* Entry by index; the index must be below entry_capacity */
+static inline File* fs_entry(const FileSystem* fs, uint32_t index) {
+    return &fs->entry_chunks[index / FS_ENTRIES_PER_CHUNK][index % FS_ENTRIES_PER_CHUNK];
+}
+
 /* File system operations */
-/* Initialize the file system */
+/* Initialize the file system over a RAM data area */
 int32_t fs_init(FileSystem* fs, uint8_t* data_memory, uint32_t memory_size);
 
+/* Format a block device with the default inode count and mount it */
+int32_t fs_init_device(FileSystem* fs, block_device_t* device);
+
+/* Write an empty file system to device; inode_count 0 picks one inode per
+   FS_BLOCKS_PER_INODE blocks. Needs no FileSystem, so host tools can use it. */
+int32_t fs_mkfs(block_device_t* device, uint32_t inode_count);
+
+/* Mount the file system on device. Replays the journal if the last
+   transaction did not reach its home blocks, then reads the bitmap and inode
+   table up to their high-water marks. The device stays marked in use until
+   fs_unmount. */
+int32_t fs_mount(FileSystem* fs, block_device_t* device);
+
+/* Commit, write everything back, mark the device clean and release the file system */
+int32_t fs_unmount(FileSystem* fs);
+
+/* Write cached data and commit the running transaction; everything written
+   before the call survives a crash once it returns */
+int32_t fs_sync(FileSystem* fs);
+
+/* Unmount, ignoring errors (the device or data area belongs to the caller) */
+void fs_destroy(FileSystem* fs);
+
+/* Limit read-ahead windows to max_blocks (at most FS_READAHEAD_MAX, the
+   default after mounting); 0 reads only the blocks asked for */
+int32_t fs_set_readahead(FileSystem* fs, uint32_t max_blocks);
+
 /* Create a new file */
 int32_t fs_create_file(FileSystem* fs, const char* name, uint32_t parent_dir);
 
@@ -61,19 +253,82 @@ int32_t fs_create_directory(FileSystem* fs, const char* name, uint32_t parent_di
 /* Read data from a file */
 int32_t fs_read_file(FileSystem* fs, uint32_t file_index, uint8_t* buffer, uint32_t size, uint32_t offset);
 
+/* Map up to size bytes of a file from offset without copying: fills spans
+   with pointers into pinned cache buffers (blocks that sit next to each
+   other in the cache share a span) and returns the span count, at most
+   max_spans. Stops early after FS_MAP_MAX_BLOCKS blocks, so callers loop
+   over large files. The bytes stay valid, and show later writes to the
+   file, until fs_unmap_file; unmap before deleting the file. A write to a
+   block shared with a snapshot moves it, so the mapping keeps showing the
+   snapshot's bytes. */
+int32_t fs_map_file(FileSystem* fs, uint32_t file_index, fs_span_t* spans, uint32_t max_spans,
+                    uint32_t size, uint32_t offset);
+
+/* Unpin the count spans from fs_map_file */
+void fs_unmap_file(FileSystem* fs, const fs_span_t* spans, uint32_t count);
+
 /* Write data to a file */
 int32_t fs_write_file(FileSystem* fs, uint32_t file_index, const uint8_t* data, uint32_t size, uint32_t offset);
 
-/* Delete a file or directory */
+/* Scatter/gather: read into or write from count spans in turn, covering
+   consecutive bytes of the file from offset. The file is validated once
+   and a write stores its entry and ends its operation once. Spans of
+   length 0 are skipped, whatever their data; a span with bytes but no
+   data fails the whole call with ERR_NULL_POINTER before anything moves.
+   Returns the bytes transferred, short at the end of the file or on an
+   error. */
+int32_t fs_readv(FileSystem* fs, uint32_t file_index, const fs_span_t* spans, uint32_t count, uint32_t offset);
+int32_t fs_writev(FileSystem* fs, uint32_t file_index, const fs_span_t* spans, uint32_t count, uint32_t offset);
+
+/* Run count reads and writes, on any files, in order. Consecutive
+   operations on one file validate it and store its entry once, and the
+   whole batch is one operation for group commit. Each op gets its own
+   result; returns how many succeeded. */
+int32_t fs_batch(FileSystem* fs, fs_op_t* ops, uint32_t count);
+
+/* Delete a file or directory. A file with open handles disappears from
+   lookups and listings at once, but keeps its name, blocks and inode (and
+   its directory stays non-empty) until the last handle closes, so a crash
+   before then leaves it in place. */
 int32_t fs_delete(FileSystem* fs, uint32_t file_index);
 
+/* Open a regular file; returns a handle positioned at offset 0 */
+int32_t fs_open(FileSystem* fs, uint32_t file_index);
+
+/* Close a handle, finishing a delete that waited for it */
+int32_t fs_close(FileSystem* fs, int32_t handle);
+
+/* Move a handle to offset from origin (FS_SEEK_SET, FS_SEEK_CUR or
+   FS_SEEK_END); returns the new position. Seeking past the end is allowed
+   and a later write fills the gap with zeros. */
+int32_t fs_seek(FileSystem* fs, int32_t handle, int32_t offset, int32_t origin);
+
+/* Read or write at a handle's position and advance it by the bytes moved */
+int32_t fs_read(FileSystem* fs, int32_t handle, uint8_t* buffer, uint32_t size);
+int32_t fs_write(FileSystem* fs, int32_t handle, const uint8_t* data, uint32_t size);
+
 /* Find a file by name */
 int32_t fs_find_file(FileSystem* fs, const char* name, uint32_t parent_dir);
 
+/* Resolve a path such as "/a/b/c" to an entry index: absolute paths start
+   at the root, others at cwd. "." and ".." are understood and repeated
+   slashes ignored. Every component goes through the dentry cache, which
+   also remembers names that do not exist. */
+int32_t fs_lookup_path(FileSystem* fs, const char* path, uint32_t cwd);
+
+/* Snapshot the tree: a new root directory called name receives a
+   read-only copy of every file and directory outside other snapshots,
+   sharing their blocks. Takes time in proportion to the entries, not
+   their data; the first write to a shared block gives the writer its own
+   copy. Returns the snapshot directory's index. Snapshot entries reject
+   writes and new children but are deleted like any other, bottom up. */
+int32_t fs_snapshot(FileSystem* fs, const char* name);
+
 /* Get file information */
 int32_t fs_get_file_info(FileSystem* fs, uint32_t file_index, File* info);
 
-/* List directory contents */
+/* List directory contents, in creation order (in entry index order after a
+   remount); the root does not list itself */
 int32_t fs_list_directory(FileSystem* fs, uint32_t dir_index, File* entries, uint32_t max_entries);
 
 /* Format file system (clear all files) */
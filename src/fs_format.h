@@ -0,0 +1,191 @@
+/* fs_format.h - On-disk layout of the S00K file system
+   Shared by file_system.c and the host tools (mkfs.s00k, fsck.s00k).
+   All fields are little-endian, as the kernel only runs on x86.
+
+     block 0                      superblock
+     bitmap_start ..              free-block bitmap, one bit per device block
+                                  (set = in use), 64-bit words
+     refcount_start ..            block reference counts, one byte per device
+                                  block: references beyond the first
+     inode_start ..               inode table, FS_INODES_PER_BLOCK per block;
+                                  inode number = entry index, 0 is the root
+     journal_start ..             metadata journal: a header block, then
+                                  transactions written one after another
+     data_start .. total_blocks   file data and indirect pointer blocks
+
+   The high-water marks bound what mount has to read: no inode at or above
+   inode_high_water and no block at or above block_high_water has ever been
+   used, and mkfs zeroes the bitmap and inode table, so both regions read as
+   empty. They live in the superblock, which every journal transaction
+   carries, so after an unclean shutdown replaying the journal makes them
+   valid again.
+
+   A transaction is one or more descriptor blocks, each followed by copies
+   of the metadata blocks it lists, and a commit block whose checksum
+   covers all of them. Replay applies the transaction at the header's start
+   offset if it carries the header's sequence number and is complete.
+   Sequence numbers only grow, so stale transactions from before the last
+   reset never match.
+
+   Snapshots share blocks between inodes. A block's count covers the
+   pointers to it from inodes and pointer blocks; a shared pointer block
+   counts once, however many inodes reach it, and its own pointers count
+   once too. So a snapshot only adds one reference to each block an inode
+   points at directly, and whoever writes through a shared pointer block
+   first copies it and adds a reference to everything it points at.
+   shared_blocks in the superblock is the number of blocks whose count is
+   not zero. */
+
+#ifndef FS_FORMAT_H
+#define FS_FORMAT_H
+
+#include <stdint.h>
+#include "block_device.h"
+
+#define FS_MAGIC            0x4B303053u   /* "S00K" */
+#define FS_VERSION          3
+#define FS_SUPERBLOCK       0
+
+/* Superblock state */
+#define FS_STATE_CLEAN      1   /* Unmounted with everything written */
+#define FS_STATE_DIRTY      2   /* Mounted, or not cleanly unmounted */
+
+#define FS_INODE_SIZE       128
+#define FS_INODES_PER_BLOCK (BLOCK_DEVICE_BLOCK_SIZE / FS_INODE_SIZE)
+#define FS_BITS_PER_BLOCK   (BLOCK_DEVICE_BLOCK_SIZE * 8)
+#define FS_REFCOUNT_MAX     255   /* One byte per block */
+
+/* Inode flags */
+#define FS_INODE_SHARED     0x01  /* Pointer blocks may be shared with a snapshot */
+#define FS_INODE_SNAPSHOT   0x02  /* Part of a snapshot: read-only */
+
+/* Default inode count for a device: one per 8 KiB, at least FS_MIN_INODES */
+#define FS_BLOCKS_PER_INODE 16
+#define FS_MIN_INODES       64
+
+/* Default journal size: one block per FS_BLOCKS_PER_JOURNAL_BLOCK, clamped */
+#define FS_BLOCKS_PER_JOURNAL_BLOCK 16
+#define FS_MIN_JOURNAL_BLOCKS   32
+#define FS_MAX_JOURNAL_BLOCKS   1024
+
+#define FS_JOURNAL_MAGIC        0x4A303053u   /* "S00J" */
+#define FS_JOURNAL_HEADER       1
+#define FS_JOURNAL_DESCRIPTOR   2
+#define FS_JOURNAL_COMMIT       3
+#define FS_JOURNAL_TAGS         ((BLOCK_DEVICE_BLOCK_SIZE - 4 * sizeof(uint32_t)) / sizeof(uint32_t))
+
+#define FS_ONDISK_NAME_LENGTH    32
+#define FS_ONDISK_DIRECT_BLOCKS  8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t bitmap_start;
+    uint32_t bitmap_blocks;
+    uint32_t inode_start;
+    uint32_t inode_blocks;
+    uint32_t inode_count;
+    uint32_t data_start;
+    uint32_t free_blocks;
+    uint32_t inode_high_water;
+    uint32_t block_high_water;
+    uint32_t state;
+    uint32_t journal_start;
+    uint32_t journal_blocks;
+    uint32_t refcount_start;
+    uint32_t refcount_blocks;
+    uint32_t shared_blocks;
+    uint8_t reserved[BLOCK_DEVICE_BLOCK_SIZE - 19 * sizeof(uint32_t)];
+} fs_superblock_t;
+
+typedef struct {
+    char name[FS_ONDISK_NAME_LENGTH];
+    uint32_t size;
+    uint32_t parent_dir;
+    uint32_t blocks[FS_ONDISK_DIRECT_BLOCKS];
+    uint32_t indirect;
+    uint32_t double_indirect;
+    uint32_t block_count;
+    uint8_t type;
+    uint8_t used;
+    uint8_t flags;          /* FS_INODE_* */
+    uint8_t reserved[FS_INODE_SIZE - FS_ONDISK_NAME_LENGTH - 13 * sizeof(uint32_t) - 3];
+} fs_inode_t;
+
+/* First journal block */
+typedef struct {
+    uint32_t magic;
+    uint32_t type;          /* FS_JOURNAL_HEADER */
+    uint32_t sequence;      /* Sequence number of the first transaction to replay */
+    uint32_t start;         /* Its offset within the journal (>= 1) */
+    uint8_t reserved[BLOCK_DEVICE_BLOCK_SIZE - 4 * sizeof(uint32_t)];
+} fs_journal_header_t;
+
+/* Lists the home blocks of the count block copies that follow it */
+typedef struct {
+    uint32_t magic;
+    uint32_t type;          /* FS_JOURNAL_DESCRIPTOR */
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t blocks[FS_JOURNAL_TAGS];
+} fs_journal_descriptor_t;
+
+/* Ends a transaction; written only after everything before it is on the device */
+typedef struct {
+    uint32_t magic;
+    uint32_t type;          /* FS_JOURNAL_COMMIT */
+    uint32_t sequence;
+    uint32_t checksum;      /* fs_journal_checksum over the descriptors and block copies */
+    uint32_t block_count;   /* Block copies in the transaction */
+    uint8_t reserved[BLOCK_DEVICE_BLOCK_SIZE - 5 * sizeof(uint32_t)];
+} fs_journal_commit_t;
+
+/* Every record must keep its on-disk size exactly (negative array size otherwise) */
+typedef char fs_superblock_size_check[sizeof(fs_superblock_t) == BLOCK_DEVICE_BLOCK_SIZE ? 1 : -1];
+typedef char fs_inode_size_check[sizeof(fs_inode_t) == FS_INODE_SIZE ? 1 : -1];
+typedef char fs_journal_size_check[sizeof(fs_journal_descriptor_t) == BLOCK_DEVICE_BLOCK_SIZE &&
+                                   sizeof(fs_journal_header_t) == BLOCK_DEVICE_BLOCK_SIZE &&
+                                   sizeof(fs_journal_commit_t) == BLOCK_DEVICE_BLOCK_SIZE ? 1 : -1];
+
+/* Geometry of a device formatted with inode_count inodes */
+static inline uint32_t fs_bitmap_blocks(uint32_t total_blocks) {
+    return (total_blocks + FS_BITS_PER_BLOCK - 1) / FS_BITS_PER_BLOCK;
+}
+
+static inline uint32_t fs_refcount_blocks(uint32_t total_blocks) {
+    return (total_blocks + BLOCK_DEVICE_BLOCK_SIZE - 1) / BLOCK_DEVICE_BLOCK_SIZE;
+}
+
+static inline uint32_t fs_inode_blocks(uint32_t inode_count) {
+    return (inode_count + FS_INODES_PER_BLOCK - 1) / FS_INODES_PER_BLOCK;
+}
+
+static inline uint32_t fs_default_journal_blocks(uint32_t total_blocks) {
+    uint32_t blocks = total_blocks / FS_BLOCKS_PER_JOURNAL_BLOCK;
+    if (blocks < FS_MIN_JOURNAL_BLOCKS) {
+        return FS_MIN_JOURNAL_BLOCKS;
+    }
+    return blocks > FS_MAX_JOURNAL_BLOCKS ? FS_MAX_JOURNAL_BLOCKS : blocks;
+}
+
+/* FNV-1a over the 32-bit words of one block, chained through hash
+   (start from FS_JOURNAL_CHECKSUM_SEED) */
+#define FS_JOURNAL_CHECKSUM_SEED 2166136261u
+
+static inline uint32_t fs_journal_checksum(uint32_t hash, const void* block) {
+    const uint32_t* words = (const uint32_t*)block;
+    for (uint32_t i = 0; i < BLOCK_DEVICE_BLOCK_SIZE / sizeof(uint32_t); i++) {
+        hash ^= words[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Journal blocks a transaction of count block copies occupies */
+static inline uint32_t fs_journal_space(uint32_t count) {
+    return count + (count + FS_JOURNAL_TAGS - 1) / FS_JOURNAL_TAGS + 1;
+}
+
+#endif /* FS_FORMAT_H */
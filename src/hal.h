@@ -0,0 +1,24 @@
+/* hal.h - Hosted hardware abstraction shim
+   In the hosted build (S00K_HOSTED) the core subsystems run as an ordinary
+   Linux process: console output goes to stdio, errors are counted instead of
+   drawn on the VGA buffer, and the physical frame window is emulated by an
+   anonymous mapping at its identity addresses. */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Map [KERNEL_END, PHYS_MEMORY_END) at identical virtual addresses so the
+   page allocator can hand out and touch frames. Safe to call repeatedly.
+   Returns 0 on success, -1 if the range is unavailable. */
+int hal_map_physical_memory(void);
+
+/* Errors reported through handle_error since start-up */
+uint32_t hal_error_count(void);
+
+/* Echo handle_error reports to stderr (off by default) */
+void hal_set_error_reporting(bool enabled);
+
+#endif /* HAL_H */
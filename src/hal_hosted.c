@@ -0,0 +1,103 @@
+/* hal_hosted.c - Hosted implementation of the kernel console and error hooks
+   Stands in for kernel.c and io.c when the core subsystems are linked into
+   libs00k_core.a, so nothing here touches ports, the VGA buffer or control
+   registers. */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "hal.h"
+#include "kernel.h"
+#include "error_codes.h"
+#include "memory_management.h"
+
+#ifndef S00K_HOSTED
+#error "hal_hosted.c is only part of the hosted build (define S00K_HOSTED)"
+#endif
+
+static bool physical_memory_mapped = false;
+static bool error_reporting = false;
+static uint32_t error_count = 0;
+
+int hal_map_physical_memory(void) {
+    if (physical_memory_mapped) {
+        return 0;
+    }
+
+    void* want = (void*)(uintptr_t)KERNEL_END;
+    void* got = mmap(want, PHYS_MEMORY_END - KERNEL_END, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (got != want) {
+        fprintf(stderr, "hal: cannot map physical window at %p\n", want);
+        return -1;
+    }
+    physical_memory_mapped = true;
+    return 0;
+}
+
+uint32_t hal_error_count(void) {
+    return error_count;
+}
+
+void hal_set_error_reporting(bool enabled) {
+    error_reporting = enabled;
+}
+
+/* Error handling function */
+void handle_error(int32_t error_code, const char* function, const char* file, uint32_t line) {
+    error_count++;
+    if (error_reporting) {
+        fprintf(stderr, "error %d in %s (%s:%u)\n", error_code, function, file, line);
+    }
+}
+
+/* Panic function for fatal errors */
+void panic(const char* msg) {
+    fprintf(stderr, "KERNEL PANIC: %s\n", msg ? msg : "(null)");
+    abort();
+}
+
+/* I/O functions */
+void print_char(char c) {
+    fputc(c, stdout);
+}
+
+void print(const char* str) {
+    if (str) {
+        fputs(str, stdout);
+    }
+}
+
+char read_char(void) {
+    int c = getchar();
+    return c == EOF ? 0 : (char)c;
+}
+
+char read_char_timeout(uint32_t timeout_ms, int32_t* error_code) {
+    (void)timeout_ms;
+    int c = getchar();
+    if (error_code) {
+        *error_code = c == EOF ? ERR_IO_TIMEOUT : ERR_SUCCESS;
+    }
+    return c == EOF ? 0 : (char)c;
+}
+
+void clear_screen(void) {
+    fflush(stdout);
+}
+
+/* Safe I/O functions with error checking */
+int32_t print_char_safe(char c) {
+    return fputc(c, stdout) == EOF ? ERR_IO_DEVICE_ERROR : ERR_SUCCESS;
+}
+
+int32_t print_string_safe(const char* str) {
+    if (!str) {
+        return ERR_NULL_POINTER;
+    }
+    return fputs(str, stdout) == EOF ? ERR_IO_DEVICE_ERROR : ERR_SUCCESS;
+}
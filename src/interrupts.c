@@ -0,0 +1,206 @@
+/* interrupts.c - IDT setup, 8259 PIC remapping and IRQ routing
+   Every vector gets a gate: the 32 CPU exceptions panic naming the
+   exception, IRQ vectors start masked with a spurious-interrupt handler,
+   and the rest ignore the interrupt. See interrupts.h for the rules
+   handlers follow. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "interrupts.h"
+
+/* provided by kernel.c */
+extern void panic(const char* msg);
+
+/* x86 I/O port operations */
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+/* Gives the PIC time to settle between initialization words */
+static inline void io_wait(void) {
+    outb(0x80, 0);
+}
+
+/* 8259 PIC ports and commands */
+#define PIC_MASTER_COMMAND  0x20
+#define PIC_MASTER_DATA     0x21
+#define PIC_SLAVE_COMMAND   0xA0
+#define PIC_SLAVE_DATA      0xA1
+#define PIC_INIT            0x11    /* ICW1: edge triggered, cascade, ICW4 follows */
+#define PIC_8086_MODE       0x01    /* ICW4 */
+#define PIC_END_OF_IRQ      0x20
+#define PIC_READ_ISR        0x0B    /* OCW3: next command port read is in-service */
+#define PIC_CASCADE_IRQ     2
+
+#define IDT_ENTRIES         256
+#define EXCEPTION_COUNT     32
+#define IRQ_COUNT           16
+#define IDT_INTERRUPT_GATE  0x8E    /* Present, ring 0, 32-bit interrupt gate */
+
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} __attribute__((packed)) idt_entry_t;
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) idt_pointer_t;
+
+static idt_entry_t idt[IDT_ENTRIES] __attribute__((aligned(8)));
+
+static const char* const exception_names[EXCEPTION_COUNT] = {
+    "Divide error", "Debug", "Non-maskable interrupt", "Breakpoint",
+    "Overflow", "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS", "Segment not present",
+    "Stack-segment fault", "General protection fault", "Page fault", "Reserved",
+    "x87 floating-point error", "Alignment check", "Machine check", "SIMD floating-point error",
+    "Virtualization exception", "Control protection exception", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor injection exception", "VMM communication exception", "Security exception", "Reserved"
+};
+
+/* Exceptions never return, so one handler shape serves the vectors that
+   push an error code and those that do not */
+static void exception_panic(uint8_t vector) {
+    static char message[64] = "CPU exception: ";
+    size_t length = 15;
+    for (const char* name = exception_names[vector]; *name && length < sizeof(message) - 1; name++) {
+        message[length++] = *name;
+    }
+    message[length] = '\0';
+    panic(message);
+}
+
+#define EXCEPTION_HANDLER(vector) \
+    INTERRUPT_HANDLER static void exception_##vector(struct interrupt_frame* frame) { \
+        (void)frame; \
+        exception_panic(vector); \
+    }
+
+EXCEPTION_HANDLER(0)  EXCEPTION_HANDLER(1)  EXCEPTION_HANDLER(2)  EXCEPTION_HANDLER(3)
+EXCEPTION_HANDLER(4)  EXCEPTION_HANDLER(5)  EXCEPTION_HANDLER(6)  EXCEPTION_HANDLER(7)
+EXCEPTION_HANDLER(8)  EXCEPTION_HANDLER(9)  EXCEPTION_HANDLER(10) EXCEPTION_HANDLER(11)
+EXCEPTION_HANDLER(12) EXCEPTION_HANDLER(13) EXCEPTION_HANDLER(14) EXCEPTION_HANDLER(15)
+EXCEPTION_HANDLER(16) EXCEPTION_HANDLER(17) EXCEPTION_HANDLER(18) EXCEPTION_HANDLER(19)
+EXCEPTION_HANDLER(20) EXCEPTION_HANDLER(21) EXCEPTION_HANDLER(22) EXCEPTION_HANDLER(23)
+EXCEPTION_HANDLER(24) EXCEPTION_HANDLER(25) EXCEPTION_HANDLER(26) EXCEPTION_HANDLER(27)
+EXCEPTION_HANDLER(28) EXCEPTION_HANDLER(29) EXCEPTION_HANDLER(30) EXCEPTION_HANDLER(31)
+
+static const interrupt_handler_t exception_handlers[EXCEPTION_COUNT] = {
+    exception_0,  exception_1,  exception_2,  exception_3,  exception_4,  exception_5,
+    exception_6,  exception_7,  exception_8,  exception_9,  exception_10, exception_11,
+    exception_12, exception_13, exception_14, exception_15, exception_16, exception_17,
+    exception_18, exception_19, exception_20, exception_21, exception_22, exception_23,
+    exception_24, exception_25, exception_26, exception_27, exception_28, exception_29,
+    exception_30, exception_31
+};
+
+/* A masked line can still raise IRQ 7 or 15 when a request vanishes
+   before the CPU acknowledges it. The PIC then has nothing in service:
+   a spurious IRQ 7 needs no EOI, and a spurious IRQ 15 needs one only at
+   the master, for the cascade line. A real interrupt on a line whose
+   handler was never installed is acknowledged and dropped. */
+static uint8_t pic_in_service(uint16_t command_port) {
+    outb(command_port, PIC_READ_ISR);
+    return inb(command_port);
+}
+
+INTERRUPT_HANDLER static void unhandled_master_irq(struct interrupt_frame* frame) {
+    (void)frame;
+    if (pic_in_service(PIC_MASTER_COMMAND) != 0) {
+        outb(PIC_MASTER_COMMAND, PIC_END_OF_IRQ);
+    }
+}
+
+INTERRUPT_HANDLER static void unhandled_slave_irq(struct interrupt_frame* frame) {
+    (void)frame;
+    if (pic_in_service(PIC_SLAVE_COMMAND) != 0) {
+        outb(PIC_SLAVE_COMMAND, PIC_END_OF_IRQ);
+    }
+    outb(PIC_MASTER_COMMAND, PIC_END_OF_IRQ);
+}
+
+INTERRUPT_HANDLER static void ignored_interrupt(struct interrupt_frame* frame) {
+    (void)frame;
+}
+
+static void set_gate(uint8_t vector, interrupt_handler_t handler) {
+    uint32_t offset = (uint32_t)(uintptr_t)handler;
+    uint16_t selector;
+    __asm__ volatile ("mov %%cs, %0" : "=r"(selector));
+    idt[vector].offset_low = (uint16_t)(offset & 0xFFFF);
+    idt[vector].selector = selector;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = IDT_INTERRUPT_GATE;
+    idt[vector].offset_high = (uint16_t)(offset >> 16);
+}
+
+/* Restart both PICs with IRQ 0-15 on vectors 0x20-0x2F, every line masked
+   except the cascade */
+static void pic_remap(void) {
+    outb(PIC_MASTER_COMMAND, PIC_INIT);
+    io_wait();
+    outb(PIC_SLAVE_COMMAND, PIC_INIT);
+    io_wait();
+    outb(PIC_MASTER_DATA, IRQ_VECTOR_BASE);
+    io_wait();
+    outb(PIC_SLAVE_DATA, IRQ_VECTOR_BASE + 8);
+    io_wait();
+    outb(PIC_MASTER_DATA, 1 << PIC_CASCADE_IRQ);    /* ICW3: slave on IRQ 2 */
+    io_wait();
+    outb(PIC_SLAVE_DATA, PIC_CASCADE_IRQ);          /* ICW3: slave identity */
+    io_wait();
+    outb(PIC_MASTER_DATA, PIC_8086_MODE);
+    io_wait();
+    outb(PIC_SLAVE_DATA, PIC_8086_MODE);
+    io_wait();
+    outb(PIC_MASTER_DATA, (uint8_t)~(1 << PIC_CASCADE_IRQ));
+    outb(PIC_SLAVE_DATA, 0xFF);
+}
+
+void interrupts_init(void) {
+    interrupts_disable();
+    for (uint32_t vector = 0; vector < IDT_ENTRIES; vector++) {
+        set_gate((uint8_t)vector, ignored_interrupt);
+    }
+    for (uint8_t vector = 0; vector < EXCEPTION_COUNT; vector++) {
+        set_gate(vector, exception_handlers[vector]);
+    }
+    for (uint8_t irq = 0; irq < IRQ_COUNT; irq++) {
+        set_gate(IRQ_VECTOR_BASE + irq, irq < 8 ? unhandled_master_irq : unhandled_slave_irq);
+    }
+
+    idt_pointer_t pointer = { sizeof(idt) - 1, (uint32_t)(uintptr_t)idt };
+    __asm__ volatile ("lidt %0" : : "m"(pointer));
+
+    pic_remap();
+}
+
+void interrupts_set_irq_handler(uint8_t irq, interrupt_handler_t handler) {
+    if (irq >= IRQ_COUNT || !handler) {
+        return;
+    }
+    set_gate(IRQ_VECTOR_BASE + irq, handler);
+    if (irq < 8) {
+        outb(PIC_MASTER_DATA, inb(PIC_MASTER_DATA) & (uint8_t)~(1 << irq));
+    } else {
+        outb(PIC_SLAVE_DATA, inb(PIC_SLAVE_DATA) & (uint8_t)~(1 << (irq - 8)));
+    }
+}
+
+void interrupts_end_of_irq(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC_SLAVE_COMMAND, PIC_END_OF_IRQ);
+    }
+    outb(PIC_MASTER_COMMAND, PIC_END_OF_IRQ);
+}
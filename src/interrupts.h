@@ -0,0 +1,68 @@
+/* interrupts.h - Interrupt descriptor table and 8259 PIC
+   interrupts_init loads an IDT in which CPU exceptions panic and every
+   hardware line is masked, with the PICs remapped to vectors 0x20-0x2F
+   so IRQs no longer collide with exceptions. Drivers then install a
+   handler per IRQ, which also unmasks the line.
+
+   Handlers are written in C with GCC's interrupt attribute (declare them
+   with INTERRUPT_HANDLER). They run on the interrupted code's stack, may
+   only use general registers, so must not call memcpy and friends (see
+   string.c), and acknowledge their IRQ with interrupts_end_of_irq. */
+
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+#include <stdint.h>
+
+#define IRQ_TIMER           0
+#define IRQ_KEYBOARD        1
+#define IRQ_VECTOR_BASE     0x20    /* Vector of IRQ 0 after remapping */
+
+/* Saved by the CPU on entry; handlers only pass it along */
+struct interrupt_frame;
+
+#define INTERRUPT_HANDLER __attribute__((interrupt, target("general-regs-only")))
+
+typedef void (*interrupt_handler_t)(struct interrupt_frame* frame);
+
+/* Build and load the IDT and remap the PICs, all lines masked. Interrupts
+   stay disabled until interrupts_enable. */
+void interrupts_init(void);
+
+/* Route irq (0-15) to handler and unmask it */
+void interrupts_set_irq_handler(uint8_t irq, interrupt_handler_t handler);
+
+/* Acknowledge irq at the PIC(s); the last thing a handler does */
+void interrupts_end_of_irq(uint8_t irq);
+
+static inline void interrupts_enable(void) {
+    __asm__ __volatile__("sti" ::: "memory");
+}
+
+static inline void interrupts_disable(void) {
+    __asm__ __volatile__("cli" ::: "memory");
+}
+
+/* Disable interrupts and return the previous state for interrupts_restore,
+   for code that may run with interrupts either on or off */
+static inline uintptr_t interrupts_save(void) {
+    uintptr_t flags;    /* pushf/pop take the width of the operand */
+    __asm__ __volatile__("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void interrupts_restore(uintptr_t flags) {
+    if (flags & 0x200) {    /* EFLAGS.IF */
+        interrupts_enable();
+    }
+}
+
+/* Enable interrupts and sleep until the next one. Call it with interrupts
+   disabled, after finding no work: sti takes effect only after the next
+   instruction, so an interrupt that arrives after the check still wakes
+   the hlt instead of being handled just before it and sleeping through. */
+static inline void interrupts_enable_and_wait(void) {
+    __asm__ __volatile__("sti; hlt" ::: "memory");
+}
+
+#endif /* INTERRUPTS_H */
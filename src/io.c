@@ -1,10 +1,17 @@
 /* io.c - Basic I/O operations for keyboard input and screen output
-   Provides polled keyboard input via the 8042 controller and writes to the
-   VGA text buffer. Includes a timeout-capable reader and safe printing helpers. */
+   Keyboard input is interrupt driven: the IRQ 1 handler moves each
+   scancode from the 8042 controller into a lock-free ring, and readers
+   sleep in hlt until it has data, so waiting at a prompt costs no CPU.
+   Output writes to the VGA text buffer. Includes a timeout-capable reader
+   and safe printing helpers. */
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 #include "error_codes.h"
+#include "interrupts.h"
+#include "spsc_ring.h"
+#include "timer.h"
 
 /* External error handling function */
 extern void handle_error(int32_t error_code, const char* function, const char* file, uint32_t line);
@@ -30,125 +37,90 @@ static inline void outb(uint16_t port, uint8_t value) {
 #define VGA_CTRL_REGISTER     0x3D4
 #define VGA_DATA_REGISTER     0x3D5
 
+/* Scancodes pushed by keyboard_interrupt, popped by read_char_timeout */
+static spsc_ring_t keyboard_ring;
+static bool keyboard_ready = false;
+
+/* Scancode set 1 make codes to unshifted ASCII; 0 for keys without one */
+static const char scancode_to_ascii[128] = {
+    0,   0,   '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b', '\t',
+    'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n', 0,   'a', 's',
+    'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,   '\\', 'z', 'x', 'c', 'v',
+    'b', 'n', 'm', ',', '.', '/', 0,   '*', 0,   ' '
+};
+
 /* Check if keyboard has data available */
 static int keyboard_data_available(void) {
     /* STATUS bit0 indicates whether data is available */
     return (inb(KEYBOARD_STATUS_PORT) & 0x01) != 0;
 }
 
-/* Read keyboard status with error checking */
-static int32_t read_keyboard_status(uint8_t* status) {
-    /* Read status register and return ERR codes on failure */
-    if (!status) {
-        return ERR_NULL_POINTER;
-    }
-    
-    *status = inb(KEYBOARD_STATUS_PORT);
-    return ERR_SUCCESS;
+/* IRQ 1: one scancode per interrupt. A full ring drops the key (counted in
+   keyboard_ring.dropped); the byte must still be read to clear the IRQ. */
+INTERRUPT_HANDLER static void keyboard_interrupt(struct interrupt_frame* frame) {
+    (void)frame;
+    spsc_ring_push(&keyboard_ring, inb(KEYBOARD_DATA_PORT));
+    interrupts_end_of_irq(IRQ_KEYBOARD);
 }
 
-/* Read keyboard data with error checking */
-static int32_t read_keyboard_data(uint8_t* data) {
-    /* Block until a data byte is present or report ERR_IO_DEVICE_ERROR */
-    if (!data) {
-        return ERR_NULL_POINTER;
-    }
-    
-    /* Check if data is available */
-    uint8_t status;
-    int32_t result = read_keyboard_status(&status);
-    if (result != ERR_SUCCESS) {
-        return result;
-    }
-    
-    if (!(status & 0x01)) {
-        return ERR_IO_DEVICE_ERROR;  /* No data available */
-    }
-    
-    *data = inb(KEYBOARD_DATA_PORT);
-    return ERR_SUCCESS;
+/* Route the keyboard IRQ here; needs interrupts_init, and timer_init for
+   read_char_timeout's timeouts */
+void keyboard_init(void) {
+    /* Discard bytes left over from the BIOS so the first IRQ is fresh */
+    while (keyboard_data_available()) {
+        (void)inb(KEYBOARD_DATA_PORT);
+    }
+    interrupts_set_irq_handler(IRQ_KEYBOARD, keyboard_interrupt);
+    keyboard_ready = true;
 }
 
 /* Read a character from keyboard with timeout and error handling */
 char read_char_timeout(uint32_t timeout_ms, int32_t* error_code) {
-    /* Poll keyboard with a coarse-grained timeout; maps basic scancodes to ASCII.
-       Returns 0 on error/timeout with error_code set appropriately. */
-    uint32_t timeout_counter = timeout_ms * 1000; /* Convert to iterations */
+    /* Sleep until a key press that maps to ASCII arrives; releases and
+       unmapped keys are skipped. A timeout_ms of 0 waits forever; others
+       arm a timer that wakes the wait. Returns 0 on error/timeout with
+       error_code set appropriately. */
+    volatile bool timed_out = false;
+    timer_event_t timeout;
     uint8_t scancode;
-    int32_t result;
-    
+
     if (error_code) {
         *error_code = ERR_SUCCESS;
     }
-    
-    /* Wait for keyboard data with timeout */
-    while (timeout_counter > 0) {
-        result = read_keyboard_data(&scancode);
-        if (result == ERR_SUCCESS) {
-            break;  /* Data available */
-        } else if (result != ERR_IO_DEVICE_ERROR) {
-            /* Real error occurred */
-            if (error_code) {
-                *error_code = result;
-            }
-            return 0;
-        }
-        
-        /* Decrement timeout counter */
-        timeout_counter--;
-    }
-    
-    /* Check for timeout */
-    if (timeout_counter == 0) {
+
+    if (!keyboard_ready) {
         if (error_code) {
-            *error_code = ERR_IO_TIMEOUT;
+            *error_code = ERR_IO_DEVICE_ERROR;
         }
         return 0;
     }
-    
-    /* Minimal scancode->ASCII conversion for common keys */
-    switch (scancode & 0x7F) {
-        case 0x1C: return '\n';  /* Enter */
-        case 0x0E: return '\b';  /* Backspace */
-        case 0x0F: return '\t';  /* Tab */
-        case 0x29: return ' ';   /* Space */
-        case 0x02: return (scancode & 0x80) ? 0 : '1';  /* 1 */
-        case 0x03: return (scancode & 0x80) ? 0 : '2';  /* 2 */
-        case 0x04: return (scancode & 0x80) ? 0 : '3';  /* 3 */
-        case 0x05: return (scancode & 0x80) ? 0 : '4';  /* 4 */
-        case 0x06: return (scancode & 0x80) ? 0 : '5';  /* 5 */
-        case 0x07: return (scancode & 0x80) ? 0 : '6';  /* 6 */
-        case 0x08: return (scancode & 0x80) ? 0 : '7';  /* 7 */
-        case 0x09: return (scancode & 0x80) ? 0 : '8';  /* 8 */
-        case 0x0A: return (scancode & 0x80) ? 0 : '9';  /* 9 */
-        case 0x0B: return (scancode & 0x80) ? 0 : '0';  /* 0 */
-        case 0x10: return (scancode & 0x80) ? 0 : 'q';  /* Q */
-        case 0x11: return (scancode & 0x80) ? 0 : 'w';  /* W */
-        case 0x12: return (scancode & 0x80) ? 0 : 'e';  /* E */
-        case 0x13: return (scancode & 0x80) ? 0 : 'r';  /* R */
-        case 0x14: return (scancode & 0x80) ? 0 : 't';  /* T */
-        case 0x15: return (scancode & 0x80) ? 0 : 'y';  /* Y */
-        case 0x16: return (scancode & 0x80) ? 0 : 'u';  /* U */
-        case 0x17: return (scancode & 0x80) ? 0 : 'i';  /* I */
-        case 0x18: return (scancode & 0x80) ? 0 : 'o';  /* O */
-        case 0x19: return (scancode & 0x80) ? 0 : 'p';  /* P */
-        case 0x1E: return (scancode & 0x80) ? 0 : 'a';  /* A */
-        case 0x1F: return (scancode & 0x80) ? 0 : 's';  /* S */
-        case 0x20: return (scancode & 0x80) ? 0 : 'd';  /* D */
-        case 0x21: return (scancode & 0x80) ? 0 : 'f';  /* F */
-        case 0x22: return (scancode & 0x80) ? 0 : 'g';  /* G */
-        case 0x23: return (scancode & 0x80) ? 0 : 'h';  /* H */
-        case 0x24: return (scancode & 0x80) ? 0 : 'j';  /* J */
-        case 0x25: return (scancode & 0x80) ? 0 : 'k';  /* K */
-        case 0x26: return (scancode & 0x80) ? 0 : 'l';  /* L */
-        case 0x2C: return (scancode & 0x80) ? 0 : 'z';  /* Z */
-        case 0x2D: return (scancode & 0x80) ? 0 : 'x';  /* X */
-        case 0x2E: return (scancode & 0x80) ? 0 : 'c';  /* C */
-        case 0x2F: return (scancode & 0x80) ? 0 : 'v';  /* V */
-        case 0x30: return (scancode & 0x80) ? 0 : 'b';  /* B */
-        case 0x31: return (scancode & 0x80) ? 0 : 'n';  /* N */
-        case 0x32: return (scancode & 0x80) ? 0 : 'm';  /* M */
-        default: return 0;  /* Ignore unknown keys or key release */
+
+    if (timeout_ms != 0) {
+        timer_add(&timeout, timeout_ms, timer_set_flag, (void*)&timed_out);
+    }
+    for (;;) {
+        /* Interrupts stay off from the checks until hlt, so a key or tick
+           that lands in between still wakes us */
+        interrupts_disable();
+        if (spsc_ring_pop(&keyboard_ring, &scancode)) {
+            interrupts_enable();
+            char c = (scancode & 0x80) ? 0 : scancode_to_ascii[scancode];
+            if (c) {
+                if (timeout_ms != 0) {
+                    timer_cancel(&timeout);
+                }
+                return c;
+            }
+            continue;
+        }
+        if (timed_out) {
+            interrupts_enable();
+            if (error_code) {
+                *error_code = ERR_IO_TIMEOUT;
+            }
+            return 0;
+        }
+        interrupts_enable_and_wait();
     }
 }
 
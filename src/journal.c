@@ -0,0 +1,322 @@
+/* journal.c - Write-ahead metadata journal
+   A transaction is written as the journal header, then one descriptor per
+   FS_JOURNAL_TAGS logged blocks followed by their copies, then the commit
+   block, all in one pass with a single flush: the commit checksum covers
+   every descriptor and copy, so a transaction torn by a crash fails
+   verification instead of needing a flush of its own before the commit
+   block. Transactions go one after another through the journal and wrap
+   to its first block when the next one would not fit. */
+
+#include "journal.h"
+#include "fs_format.h"
+#include "error_codes.h"
+#include "memory_management.h"
+#include <string.h>
+
+/* Block images inside journal->records */
+#define RECORD_HEADER       0
+#define RECORD_COMMIT       1
+#define RECORD_DESCRIPTOR   2
+
+static inline uint8_t* record(journal_t* journal, uint32_t index) {
+    return journal->records + index * BLOCK_DEVICE_BLOCK_SIZE;
+}
+
+/* Write a header pointing replay at sequence, offset into the journal */
+static int32_t write_header(block_device_t* device, uint32_t start, uint8_t* image,
+                            uint32_t sequence, uint32_t offset) {
+    fs_journal_header_t* header = (fs_journal_header_t*)image;
+    memset(header, 0, sizeof(*header));
+    header->magic = FS_JOURNAL_MAGIC;
+    header->type = FS_JOURNAL_HEADER;
+    header->sequence = sequence;
+    header->start = offset;
+    return block_device_write(device, start, 1, image);
+}
+
+/* Write the header of an empty journal */
+int32_t journal_format(block_device_t* device, uint32_t start, uint32_t blocks) {
+    uint8_t image[BLOCK_DEVICE_BLOCK_SIZE];
+    if (!device || blocks < 2) {
+        return ERR_INVALID_PARAMETER;
+    }
+    return write_header(device, start, image, 1, 1);
+}
+
+/* Walk the transaction at journal->head with journal->sequence. *found is
+   set when it is complete and its checksum matches; with apply set, its
+   block copies are also written home. */
+static int32_t scan_transaction(journal_t* journal, bool apply, bool* found, uint32_t* total) {
+    fs_journal_descriptor_t* descriptor = (fs_journal_descriptor_t*)record(journal, RECORD_DESCRIPTOR);
+    const fs_journal_commit_t* commit = (const fs_journal_commit_t*)descriptor;
+    uint8_t* copy = record(journal, RECORD_HEADER);
+    uint32_t checksum = FS_JOURNAL_CHECKSUM_SEED;
+    uint32_t offset = journal->head;
+
+    *found = false;
+    *total = 0;
+    for (;;) {
+        if (offset >= journal->blocks) {
+            return ERR_SUCCESS;
+        }
+        int32_t result = block_device_read(journal->device, journal->start + offset, 1, (uint8_t*)descriptor);
+        journal->stats.recovery_reads++;
+        if (result != ERR_SUCCESS) {
+            return result;
+        }
+        if (descriptor->magic != FS_JOURNAL_MAGIC || descriptor->sequence != journal->sequence) {
+            return ERR_SUCCESS;
+        }
+        if (descriptor->type == FS_JOURNAL_COMMIT) {
+            *found = *total > 0 && commit->block_count == *total && commit->checksum == checksum;
+            return ERR_SUCCESS;
+        }
+        uint32_t count = descriptor->count;
+        if (descriptor->type != FS_JOURNAL_DESCRIPTOR || count == 0 || count > FS_JOURNAL_TAGS ||
+            count >= journal->blocks - offset) {
+            return ERR_SUCCESS;
+        }
+        checksum = fs_journal_checksum(checksum, descriptor);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t home = descriptor->blocks[i];
+            if (home >= journal->device->block_count) {
+                return ERR_SUCCESS;
+            }
+            result = block_device_read(journal->device, journal->start + offset + 1 + i, 1, copy);
+            journal->stats.recovery_reads++;
+            if (result == ERR_SUCCESS && apply) {
+                result = block_device_write(journal->device, home, 1, copy);
+            }
+            if (result != ERR_SUCCESS) {
+                return result;
+            }
+            checksum = fs_journal_checksum(checksum, copy);
+        }
+        *total += count;
+        offset += 1 + count;
+    }
+}
+
+/* Replay the last committed transaction and set the journal up */
+int32_t journal_recover(journal_t* journal, block_device_t* device, uint32_t start, uint32_t blocks,
+                        bool* replayed) {
+    if (!journal || !device || !replayed) {
+        return ERR_NULL_POINTER;
+    }
+    memset(journal, 0, sizeof(journal_t));
+    *replayed = false;
+    if (blocks < 4 || start + blocks > device->block_count) {
+        return ERR_INVALID_PARAMETER;
+    }
+    journal->device = device;
+    journal->start = start;
+    journal->blocks = blocks;
+
+    /* Largest transaction whose descriptors, copies and commit fit behind the header */
+    uint32_t capacity = blocks - 1 < JOURNAL_MAX_TRANSACTION ? blocks - 1 : JOURNAL_MAX_TRANSACTION;
+    while (fs_journal_space(capacity) > blocks - 1) {
+        capacity--;
+    }
+    journal->capacity = capacity;
+
+    journal->tags = (uint32_t*)allocate_memory(JOURNAL_MAX_TRANSACTION * sizeof(uint32_t) +
+                                               (RECORD_DESCRIPTOR + JOURNAL_RECORDS) * BLOCK_DEVICE_BLOCK_SIZE);
+    if (!journal->tags) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    journal->records = (uint8_t*)(journal->tags + JOURNAL_MAX_TRANSACTION);
+
+    const fs_journal_header_t* header = (const fs_journal_header_t*)record(journal, RECORD_HEADER);
+    int32_t result = block_device_read(device, start, 1, record(journal, RECORD_HEADER));
+    journal->stats.recovery_reads = 1;
+    if (result == ERR_SUCCESS && (header->magic != FS_JOURNAL_MAGIC || header->type != FS_JOURNAL_HEADER ||
+                                  header->start == 0 || header->start >= blocks)) {
+        result = ERR_FILE_CORRUPTED;
+    }
+    if (result != ERR_SUCCESS) {
+        journal_destroy(journal);
+        return result;
+    }
+    journal->sequence = header->sequence;
+    journal->head = header->start;
+
+    /* Verify the whole transaction before writing any of it home */
+    bool found = false;
+    uint32_t total = 0;
+    result = scan_transaction(journal, false, &found, &total);
+    if (result == ERR_SUCCESS && found) {
+        result = scan_transaction(journal, true, &found, &total);
+        if (result == ERR_SUCCESS) {
+            result = block_device_flush(device);
+        }
+        if (result == ERR_SUCCESS) {
+            journal->sequence++;
+            journal->head = 1;
+            journal->stats.replayed_blocks = total;
+            *replayed = true;
+            result = write_header(device, start, record(journal, RECORD_HEADER), journal->sequence, 1);
+        }
+        if (result == ERR_SUCCESS) {
+            result = block_device_flush(device);
+        }
+    }
+    if (result != ERR_SUCCESS) {
+        journal_destroy(journal);
+    }
+    return result;
+}
+
+/* Free the journal memory */
+void journal_destroy(journal_t* journal) {
+    if (!journal) {
+        return;
+    }
+    if (journal->tags) {
+        free_memory(journal->tags);
+    }
+    journal->tags = NULL;
+    journal->records = NULL;
+    journal->count = 0;
+    journal->active = false;
+}
+
+/* Add a buffer to the running transaction */
+int32_t journal_log(journal_t* journal, block_cache_t* cache, cache_buffer_t* buffer) {
+    if (!journal->active || block_cache_held(cache, buffer)) {
+        return ERR_SUCCESS;
+    }
+    if (journal->count == journal->capacity) {
+        if (!journal->overflow) {
+            journal->stats.overflows++;
+        }
+        journal->overflow = true;
+        return ERR_SUCCESS;
+    }
+    /* Still dirty from a committed transaction: its home copy must be current
+       before the header stops pointing at that transaction */
+    int32_t result = block_cache_clean(cache, buffer);
+    if (result != ERR_SUCCESS) {
+        return result;
+    }
+    block_cache_hold(cache, buffer);
+    journal->tags[journal->count++] = buffer->block;
+    return ERR_SUCCESS;
+}
+
+/* Drop logged blocks in [start, start + count) */
+void journal_forget(journal_t* journal, uint32_t start, uint32_t count) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < journal->count; i++) {
+        if (journal->tags[i] - start >= count) {
+            journal->tags[kept++] = journal->tags[i];
+        }
+    }
+    journal->count = kept;
+}
+
+/* Write the running transaction */
+int32_t journal_commit(journal_t* journal, block_cache_t* cache) {
+    /* File data and the blocks of earlier transactions reach home first, so
+       the new transaction is the only one recovery may need */
+    int32_t result = block_cache_flush(cache);
+    if (result != ERR_SUCCESS || journal->count == 0) {
+        journal->overflow = false;
+        return result;
+    }
+
+    uint32_t count = journal->count;
+    uint32_t space = fs_journal_space(count);
+    if (journal->head + space > journal->blocks) {
+        journal->head = 1;
+    }
+
+    /* Held buffers are never evicted, so these are all cache hits */
+    cache_buffer_t* buffers[JOURNAL_MAX_TRANSACTION];
+    uint32_t pinned = 0;
+    while (pinned < count) {
+        buffers[pinned] = block_cache_get(cache, journal->tags[pinned], true);
+        if (!buffers[pinned]) {
+            result = ERR_IO_DEVICE_ERROR;
+            break;
+        }
+        pinned++;
+    }
+
+    /* Header, then each descriptor and its copies, then the commit block, in block order */
+    uint8_t* header = record(journal, RECORD_HEADER);
+    fs_journal_commit_t* commit = (fs_journal_commit_t*)record(journal, RECORD_COMMIT);
+    block_io_t segments[BLOCK_DEVICE_MAX_BATCH];
+    uint32_t queued = 0;
+    uint32_t offset = journal->head;
+    uint32_t checksum = FS_JOURNAL_CHECKSUM_SEED;
+
+    if (result == ERR_SUCCESS) {
+        result = write_header(journal->device, journal->start, header, journal->sequence, journal->head);
+    }
+    for (uint32_t first = 0; first < count && result == ERR_SUCCESS; first += FS_JOURNAL_TAGS) {
+        fs_journal_descriptor_t* descriptor =
+            (fs_journal_descriptor_t*)record(journal, RECORD_DESCRIPTOR + first / FS_JOURNAL_TAGS);
+        uint32_t tags = count - first < FS_JOURNAL_TAGS ? count - first : FS_JOURNAL_TAGS;
+        memset(descriptor, 0, sizeof(*descriptor));
+        descriptor->magic = FS_JOURNAL_MAGIC;
+        descriptor->type = FS_JOURNAL_DESCRIPTOR;
+        descriptor->sequence = journal->sequence;
+        descriptor->count = tags;
+        memcpy(descriptor->blocks, journal->tags + first, tags * sizeof(uint32_t));
+        checksum = fs_journal_checksum(checksum, descriptor);
+
+        for (uint32_t i = 0; i <= tags && result == ERR_SUCCESS; i++) {
+            segments[queued].block = journal->start + offset++;
+            segments[queued].count = 1;
+            segments[queued].buffer = i == 0 ? (uint8_t*)descriptor : buffers[first + i - 1]->data;
+            if (i > 0) {
+                checksum = fs_journal_checksum(checksum, segments[queued].buffer);
+            }
+            if (++queued == BLOCK_DEVICE_MAX_BATCH) {
+                result = block_device_write_batch(journal->device, segments, queued);
+                queued = 0;
+            }
+        }
+    }
+    if (result == ERR_SUCCESS) {
+        memset(commit, 0, sizeof(*commit));
+        commit->magic = FS_JOURNAL_MAGIC;
+        commit->type = FS_JOURNAL_COMMIT;
+        commit->sequence = journal->sequence;
+        commit->checksum = checksum;
+        commit->block_count = count;
+        segments[queued].block = journal->start + offset;
+        segments[queued].count = 1;
+        segments[queued].buffer = (uint8_t*)commit;
+        result = block_device_write_batch(journal->device, segments, queued + 1);
+    }
+    if (result == ERR_SUCCESS) {
+        result = block_device_flush(journal->device);
+    }
+
+    for (uint32_t i = 0; i < pinned; i++) {
+        block_cache_release(cache, buffers[i], false);
+    }
+    if (result != ERR_SUCCESS) {
+        return result;   /* the transaction stays open and its buffers held */
+    }
+
+    block_cache_release_held(cache);
+    journal->head += space;
+    journal->sequence++;
+    journal->count = 0;
+    journal->overflow = false;
+    journal->stats.commits++;
+    journal->stats.logged_blocks += count;
+    return ERR_SUCCESS;
+}
+
+/* Mark the journal empty */
+int32_t journal_close(journal_t* journal) {
+    if (!journal || !journal->records) {
+        return ERR_NULL_POINTER;
+    }
+    journal->active = false;
+    journal->head = 1;
+    return write_header(journal->device, journal->start, record(journal, RECORD_HEADER), journal->sequence, 1);
+}
@@ -0,0 +1,87 @@
+/* journal.h - Write-ahead metadata journal for the file system
+   Metadata blocks (superblock, bitmap, inodes, pointer blocks) are logged
+   by holding their buffers in the block cache and remembering their block
+   numbers. A commit writes the logged blocks as one transaction into the
+   journal region laid out in fs_format.h, flushes, and only then lets the
+   cache write them to their home locations. Many operations share one
+   transaction (group commit), so they also share its two device flushes.
+
+   Every commit first flushes the cache, which puts file data and all blocks
+   of earlier transactions at home; a block of the previous transaction
+   that is logged again is written home before it changes, since that flush
+   skips it. The journal header written with the transaction then points at
+   it alone, so recovery replays at most one transaction. Blocks that are
+   freed while logged are forgotten, so replay never writes stale metadata
+   over a block reused for data. A transaction that would not fit (only a
+   delete of a badly fragmented file on a large device can get there) stops
+   holding further blocks, and those are written in place like before the
+   journal existed. */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "block_cache.h"
+#include "block_device.h"
+
+#define JOURNAL_MAX_TRANSACTION 128     /* Logged blocks per transaction; each holds a cache buffer */
+#define JOURNAL_RECORDS         2       /* Descriptor blocks a full transaction needs */
+
+typedef struct {
+    uint64_t commits;
+    uint64_t logged_blocks;     /* Block copies written to the journal */
+    uint64_t overflows;         /* Transactions that outgrew the journal */
+    uint32_t recovery_reads;    /* Journal blocks read by the last recovery */
+    uint32_t replayed_blocks;   /* Blocks it wrote home */
+} journal_stats_t;
+
+typedef struct {
+    block_device_t* device;
+    uint32_t start;             /* Header block; the log follows it */
+    uint32_t blocks;            /* Journal size, header included */
+    uint32_t head;              /* Offset of the next transaction */
+    uint32_t sequence;          /* Sequence number of the next transaction */
+    uint32_t capacity;          /* Logged blocks that fit in one transaction */
+    uint32_t count;             /* Blocks logged in the running transaction */
+    uint32_t* tags;             /* Their home block numbers */
+    uint8_t* records;           /* Header, commit and descriptor block images */
+    bool active;                /* Metadata writes are being logged */
+    bool overflow;              /* The running transaction stopped holding blocks */
+    journal_stats_t stats;
+} journal_t;
+
+/* Write the header of an empty journal (used by mkfs) */
+int32_t journal_format(block_device_t* device, uint32_t start, uint32_t blocks);
+
+/* Replay the last committed transaction, if it did not reach its home
+   blocks, straight through the device and set up the journal for logging.
+   Runs before the cache exists. *replayed tells whether anything was
+   written, in which case the caller must re-read what it already loaded. */
+int32_t journal_recover(journal_t* journal, block_device_t* device, uint32_t start, uint32_t blocks,
+                        bool* replayed);
+
+/* Free the journal memory */
+void journal_destroy(journal_t* journal);
+
+/* Add a pinned buffer that is about to be modified and released dirty to the
+   running transaction; does nothing when the journal is inactive or it is
+   logged already */
+int32_t journal_log(journal_t* journal, block_cache_t* cache, cache_buffer_t* buffer);
+
+/* Drop freed blocks from the running transaction */
+void journal_forget(journal_t* journal, uint32_t start, uint32_t count);
+
+/* Room for blocks more logged blocks in the running transaction */
+static inline bool journal_room(const journal_t* journal, uint32_t blocks) {
+    return !journal->active || journal->count + blocks <= journal->capacity;
+}
+
+/* Flush the cache, write the running transaction and its commit block, and
+   release its buffers for write-back */
+int32_t journal_commit(journal_t* journal, block_cache_t* cache);
+
+/* Mark the journal empty after the cache has been flushed (clean unmount) */
+int32_t journal_close(journal_t* journal);
+
+#endif /* JOURNAL_H */
@@ -9,9 +9,13 @@
 #include "scalability.h"
 
 /* provided by memory_management.c */
-extern void init_memory_management(void);
-extern void* allocate_memory(size_t size);
-extern void free_memory(void* ptr);
+#include "memory_management.h"
+
+/* provided by slab.c */
+#include "slab.h"
+
+/* provided by string.c */
+#include "string_ops.h"
 
 /* provided by paging.c */
 extern void init_paging(void);
@@ -20,6 +24,13 @@ extern void init_paging(void);
 extern void print_char(char c);
 extern char read_char(void);
 extern void clear_screen(void);
+extern void keyboard_init(void);
+
+/* provided by interrupts.c */
+#include "interrupts.h"
+
+/* provided by timer.c */
+#include "timer.h"
 
 /* provided by file_system.c */
 #include "file_system.h"
@@ -319,6 +330,9 @@ static size_t strlen(const char* str) {
 void kernel_main_c(void) __attribute__((externally_visible));
 void kernel_main_c(void) {
     
+    /* Pick memcpy, memset, strlen and strcmp versions for this CPU */
+    string_init();
+
     /* clear screen using new I/O function */
     clear_screen();
 
@@ -327,6 +341,14 @@ void kernel_main_c(void) {
     /* Initialize memory subsystem */
     init_paging();
     init_memory_management();
+    kmem_init();
+
+    /* Take over the IDT and PICs; the PIT ticks at 1 kHz and keys arrive
+       through IRQ 1 */
+    interrupts_init();
+    timer_init();
+    keyboard_init();
+    interrupts_enable();
 
     /* simple alloc/free demo */
     void* p = allocate_memory(4096);
@@ -433,6 +455,7 @@ void kernel_main_c(void) {
             }
             
             /* Clean up */
+            fs_destroy(fs);
             free_memory(fs);
             free_memory(fs_memory);
             print("File system memory freed\n");
@@ -440,11 +463,15 @@ void kernel_main_c(void) {
     }
 
     print("\n--- Kernel Demo Complete ---\n");
-    print("S00K OS demo complete. System halted.\n");
+    print("Typed keys are echoed below; the CPU sleeps in between.\n> ");
 
-    /* hang */
+    /* echo console; read_char halts until the keyboard interrupt */
     while (1) {
-        __asm__ volatile ("hlt");
+        char c = read_char();
+        print_char(c);
+        if (c == '\n') {
+            print("> ");
+        }
     }
 }
 static int brand_anim_enabled = 1;
@@ -19,6 +19,7 @@ void print_char(char c);
 void print(const char* str);
 char read_char(void);
 char read_char_timeout(uint32_t timeout_ms, int32_t* error_code);
+void keyboard_init(void);
 void clear_screen(void);
 
 /* Safe I/O functions with error checking */
@@ -355,6 +355,7 @@ void kernel_main_optimized(void) {
             }
             
             /* Clean up */
+            fs_destroy(fs);
             free_memory(fs);
             free_memory(fs_memory);
             optimized_print("File system memory freed\n");
@@ -1,25 +1,77 @@
-/* memory_management.c - basic page frame allocator and identity paging with security enhancements
-   Implements a simple page-frame bitmap allocator and registers per-user memory regions
-   for access control. Allocation is page-granular (4 KiB) and ownership is tracked to
-   enforce permissions via the security subsystem. */
+/* memory_management.c - buddy page frame allocator and identity paging with security enhancements
+   Implements a binary buddy allocator over the physical frame range and registers
+   per-user memory regions for access control. Blocks are power-of-two runs of
+   4 KiB pages (order 0 .. BUDDY_MAX_ORDER); free blocks are coalesced with their
+   buddy on release. Runs of pages that need not be a power of two are carved
+   out of the free blocks by allocate_pages. The page bitmap mirrors which
+   frames are handed out and
+   ownership is tracked to enforce permissions via the security subsystem. */
 
 #include <stddef.h>
 #include <stdint.h>
+#include "memory_management.h"
 #include "security.h"
 #include "scalability.h"
+#include "bitmap.h"
 
-#define PAGE_SIZE        4096
-#define KERNEL_END       0x100000     /* 1 MiB, adjust as needed */
-#define PHYS_MEMORY_END  0x1000000    /* 16 MiB for now */
-#define BITMAP_SIZE      (PHYS_MEMORY_END / PAGE_SIZE / 8)
 #define MAX_MEMORY_REGIONS  1024
 
-static uint8_t page_bitmap[BITMAP_SIZE] __attribute__((aligned(PAGE_SIZE))); /* 1 bit per page */
-static uint32_t next_free_page = 0;
-static sc_lock_t mm_lock = 0;
+/* Buddy bookkeeping lives outside the managed pages, since frames above the
+   identity-mapped window cannot be touched while they are free. */
+#define BUDDY_NONE       0xFFFFFFFFu  /* free list terminator */
+#define BUDDY_INVALID    0xFF         /* frame is not the head of a block */
+#define BUDDY_FREE_FLAG  0x80         /* head of a free block (order in low bits) */
 
-/* Security tracking for memory regions */
-static memory_region_t memory_regions[MAX_MEMORY_REGIONS];
+/* Per-CPU magazines of single frames. The common alloc/free path only touches
+   the local magazine; the buddy lists are visited once per PCP_BATCH frames.
+   Each magazine has its own lock, so two CPUs that resolve to the same
+   magazine contend on it instead of corrupting it; normally only the owning
+   CPU takes it. Frames handed out from a magazine record their owner in
+   frame_owner rather than in the region tree. */
+#define PCP_BATCH        16
+#define PCP_CAPACITY     (PCP_BATCH * 2)
+#define BUDDY_PCP_FLAG   0x40         /* single frame parked in a per-CPU magazine */
+
+typedef struct {
+    sc_lock_t lock;             /* count and frames; taken before mm_lock */
+    uint32_t count;
+    uint32_t frames[PCP_CAPACITY];
+} __attribute__((aligned(64))) pcp_cache_t;
+
+/* 1 bit per page, with summary levels for run searches */
+static uint64_t page_words[HBITMAP_WORDS(TOTAL_PAGES)] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t page_summary[HBITMAP_SUMMARY_WORDS(TOTAL_PAGES)];
+static uint64_t page_top[HBITMAP_TOP_WORDS(TOTAL_PAGES)];
+static hbitmap_t page_bitmap;
+static sc_lock_t mm_lock = 0;       /* buddy free lists and page bitmap */
+static sc_lock_t region_lock = 0;   /* memory region table */
+
+static pcp_cache_t pcp_caches[SC_MAX_CPUS];
+static bool pcp_enabled = true;
+static int (*cpu_resolver)(void) = NULL;
+static user_t* frame_owner[TOTAL_PAGES];           /* owner of a magazine-served frame */
+
+static uint8_t block_order[TOTAL_PAGES];           /* per-frame head marker */
+static uint32_t free_next[TOTAL_PAGES];            /* doubly linked free lists, */
+static uint32_t free_prev[TOTAL_PAGES];            /* indexed by frame number */
+static uint32_t free_head[BUDDY_MAX_ORDER + 1];
+static uint32_t free_page_count = 0;
+
+/* Security tracking for memory regions: an AVL tree keyed by base address,
+   built from a static node pool. Regions never overlap, so the only region
+   that can contain an address is the one with the greatest base <= address. */
+#define REGION_NIL  0xFFFF
+
+typedef struct {
+    memory_region_t region;
+    uint16_t left;
+    uint16_t right;
+    uint8_t height;
+} region_node_t;
+
+static region_node_t region_nodes[MAX_MEMORY_REGIONS];
+static uint16_t region_root = REGION_NIL;
+static uint16_t region_free_list = REGION_NIL;  /* chained through left */
 static uint32_t region_count = 0;
 static bool memory_protection_enabled = false;
 
@@ -27,6 +79,7 @@ static bool memory_protection_enabled = false;
 static bool validate_memory_access(const void* address, size_t size, memory_protection_t access_type); /* bounds/overflow/ownership */
 static bool register_memory_region(void* address, size_t size, memory_protection_t protection, user_t* owner);
 static bool unregister_memory_region(const void* address);
+static memory_region_t* find_memory_region(uint32_t address);
 static void log_memory_security_event(const char* event, const char* details, const void* address);
 
 /* Security validation function for memory access */
@@ -43,7 +96,7 @@ static bool validate_memory_access(const void* address, size_t size, memory_prot
     }
     
     /* Detect overflow in address arithmetic */
-    uint32_t start_addr = (uint32_t)address;
+    uint32_t start_addr = (uint32_t)(uintptr_t)address;
     uint32_t end_addr;
     
     /* Check for overflow in address + size calculation */
@@ -65,65 +118,182 @@ static bool validate_memory_access(const void* address, size_t size, memory_prot
         return false;
     }
     
-    /* Validate against registered regions (permissions + owner) */
+    /* Validate against the registered region containing the range (permissions + owner) */
     user_t* current_user = security_get_current_user();
-    for (uint32_t i = 0; i < region_count; i++) {
-        memory_region_t* region = &memory_regions[i];
+    memory_region_t* region = find_memory_region(start_addr);
+    if (region && end_addr <= (uint32_t)(uintptr_t)region->base_address + region->size) {
+        /* Check access permissions */
+        if (!(region->protection & access_type)) {
+            log_memory_security_event("PERMISSION_DENIED", "Insufficient permissions for memory access", address);
+            return false;
+        }
         
-        if (start_addr >= (uint32_t)region->base_address && 
-            end_addr <= (uint32_t)region->base_address + region->size) {
-            
-            /* Check access permissions */
-            if (!(region->protection & access_type)) {
-                log_memory_security_event("PERMISSION_DENIED", "Insufficient permissions for memory access", address);
-                return false;
-            }
-            
-            /* Check ownership */
-            if (region->owner && region->owner != current_user) {
-                log_memory_security_event("WRONG_OWNER", "Memory access by wrong user", address);
-                return false;
-            }
-            
-            return true; /* Valid access */
+        /* Check ownership */
+        if (region->owner && region->owner != current_user) {
+            log_memory_security_event("WRONG_OWNER", "Memory access by wrong user", address);
+            return false;
         }
+        
+        return true; /* Valid access */
     }
     
     log_memory_security_event("UNREGISTERED_REGION", "Access to unregistered memory region", address);
     return false;
 }
 
+/* Region tree helpers */
+static inline uint8_t region_height(uint16_t node) {
+    return node == REGION_NIL ? 0 : region_nodes[node].height;
+}
+
+static inline uintptr_t region_key(uint16_t node) {
+    return (uintptr_t)region_nodes[node].region.base_address;
+}
+
+static void region_update_height(uint16_t node) {
+    uint8_t left = region_height(region_nodes[node].left);
+    uint8_t right = region_height(region_nodes[node].right);
+    region_nodes[node].height = (uint8_t)((left > right ? left : right) + 1);
+}
+
+static uint16_t region_rotate_right(uint16_t node) {
+    uint16_t pivot = region_nodes[node].left;
+    region_nodes[node].left = region_nodes[pivot].right;
+    region_nodes[pivot].right = node;
+    region_update_height(node);
+    region_update_height(pivot);
+    return pivot;
+}
+
+static uint16_t region_rotate_left(uint16_t node) {
+    uint16_t pivot = region_nodes[node].right;
+    region_nodes[node].right = region_nodes[pivot].left;
+    region_nodes[pivot].left = node;
+    region_update_height(node);
+    region_update_height(pivot);
+    return pivot;
+}
+
+/* Restore the AVL invariant at node after one of its subtrees changed height */
+static uint16_t region_rebalance(uint16_t node) {
+    region_update_height(node);
+    int balance = (int)region_height(region_nodes[node].left) - (int)region_height(region_nodes[node].right);
+    if (balance > 1) {
+        uint16_t left = region_nodes[node].left;
+        if (region_height(region_nodes[left].left) < region_height(region_nodes[left].right)) {
+            region_nodes[node].left = region_rotate_left(left);
+        }
+        return region_rotate_right(node);
+    }
+    if (balance < -1) {
+        uint16_t right = region_nodes[node].right;
+        if (region_height(region_nodes[right].right) < region_height(region_nodes[right].left)) {
+            region_nodes[node].right = region_rotate_right(right);
+        }
+        return region_rotate_left(node);
+    }
+    return node;
+}
+
+static uint16_t region_insert(uint16_t node, uint16_t fresh) {
+    if (node == REGION_NIL) {
+        return fresh;
+    }
+    if (region_key(fresh) < region_key(node)) {
+        region_nodes[node].left = region_insert(region_nodes[node].left, fresh);
+    } else {
+        region_nodes[node].right = region_insert(region_nodes[node].right, fresh);
+    }
+    return region_rebalance(node);
+}
+
+/* Detach the minimum of a subtree into *min_node */
+static uint16_t region_remove_min(uint16_t node, uint16_t* min_node) {
+    if (region_nodes[node].left == REGION_NIL) {
+        *min_node = node;
+        return region_nodes[node].right;
+    }
+    region_nodes[node].left = region_remove_min(region_nodes[node].left, min_node);
+    return region_rebalance(node);
+}
+
+static uint16_t region_remove(uint16_t node, uintptr_t key, uint16_t* removed) {
+    if (node == REGION_NIL) {
+        return REGION_NIL;
+    }
+    if (key < region_key(node)) {
+        region_nodes[node].left = region_remove(region_nodes[node].left, key, removed);
+    } else if (key > region_key(node)) {
+        region_nodes[node].right = region_remove(region_nodes[node].right, key, removed);
+    } else {
+        *removed = node;
+        uint16_t left = region_nodes[node].left;
+        uint16_t right = region_nodes[node].right;
+        if (right == REGION_NIL) {
+            return left;
+        }
+        uint16_t successor;
+        right = region_remove_min(right, &successor);
+        region_nodes[successor].left = left;
+        region_nodes[successor].right = right;
+        return region_rebalance(successor);
+    }
+    return region_rebalance(node);
+}
+
+/* Region with the greatest base address <= address, or NULL */
+static memory_region_t* find_memory_region(uint32_t address) {
+    uint16_t node = region_root;
+    uint16_t floor = REGION_NIL;
+    while (node != REGION_NIL) {
+        if (region_key(node) <= address) {
+            floor = node;
+            node = region_nodes[node].right;
+        } else {
+            node = region_nodes[node].left;
+        }
+    }
+    return floor == REGION_NIL ? NULL : &region_nodes[floor].region;
+}
+
 /* Register memory region for access control */
 static bool register_memory_region(void* address, size_t size, memory_protection_t protection, user_t* owner) {
     /* Track an allocated region to enforce access checks later. */
-    if (region_count >= MAX_MEMORY_REGIONS) {
+    if (region_free_list == REGION_NIL) {
         return false;
     }
     
-    memory_regions[region_count].base_address = address;
-    memory_regions[region_count].size = size;
-    memory_regions[region_count].protection = protection;
-    memory_regions[region_count].owner = owner;
-    memory_regions[region_count].is_allocated = true;
+    uint16_t node = region_free_list;
+    region_free_list = region_nodes[node].left;
+    
+    region_nodes[node].region.base_address = address;
+    region_nodes[node].region.size = size;
+    region_nodes[node].region.protection = protection;
+    region_nodes[node].region.owner = owner;
+    region_nodes[node].region.is_allocated = true;
+    region_nodes[node].left = REGION_NIL;
+    region_nodes[node].right = REGION_NIL;
+    region_nodes[node].height = 1;
     
+    region_root = region_insert(region_root, node);
     region_count++;
     return true;
 }
 
 /* Unregister memory region */
 static bool unregister_memory_region(const void* address) {
-    /* Remove region tracking when memory is freed. Compact array by shifting. */
-    for (uint32_t i = 0; i < region_count; i++) {
-        if (memory_regions[i].base_address == address) {
-            /* Shift remaining regions */
-            for (uint32_t j = i; j < region_count - 1; j++) {
-                memory_regions[j] = memory_regions[j + 1];
-            }
-            region_count--;
-            return true;
-        }
+    /* Remove region tracking when memory is freed and recycle the node. */
+    uint16_t removed = REGION_NIL;
+    region_root = region_remove(region_root, (uintptr_t)address, &removed);
+    if (removed == REGION_NIL) {
+        return false;
     }
-    return false;
+    
+    region_nodes[removed].region.is_allocated = false;
+    region_nodes[removed].left = region_free_list;
+    region_free_list = removed;
+    region_count--;
+    return true;
 }
 
 /* Log memory security events */
@@ -134,7 +304,7 @@ static void log_memory_security_event(const char* event, const char* details, co
     
     /* Build detailed message with address */
     char addr_str[32];
-    uint32_t addr_val = (uint32_t)address;
+    uint32_t addr_val = (uint32_t)(uintptr_t)address;
     int i = 0;
     
     /* Convert address to hex string */
@@ -168,47 +338,227 @@ static void log_memory_security_event(const char* event, const char* details, co
 /* set bit in bitmap */
 static inline void bitmap_set(int bit) {
     /* Mark page frame as used */
-    page_bitmap[bit >> 3] |= (1 << (bit & 7));
+    hbitmap_set(&page_bitmap, (uint32_t)bit);
+}
+
+/* Frame <-> address conversion (physical memory is identity mapped) */
+static inline void* frame_to_address(uint32_t frame) {
+    return (void*)(uintptr_t)(frame * PAGE_SIZE);
 }
 
-/* clear bit in bitmap */
-static inline void bitmap_clear(int bit) {
-    /* Mark page frame as free */
-    page_bitmap[bit >> 3] &= ~(1 << (bit & 7));
+static inline uint32_t address_to_frame(const void* address) {
+    return (uint32_t)((uintptr_t)address / PAGE_SIZE);
 }
 
-/* test bit in bitmap */
-static inline int bitmap_test(int bit) {
-    /* Query page frame allocation state */
-    return page_bitmap[bit >> 3] & (1 << (bit & 7));
+/* Smallest order whose block holds size bytes */
+static uint32_t size_to_order(size_t size) {
+    uint32_t order = 0;
+    while (((size_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+/* Push a block onto the free list for its order */
+static void buddy_list_push(uint32_t frame, uint32_t order) {
+    free_prev[frame] = BUDDY_NONE;
+    free_next[frame] = free_head[order];
+    if (free_head[order] != BUDDY_NONE) {
+        free_prev[free_head[order]] = frame;
+    }
+    free_head[order] = frame;
+    block_order[frame] = (uint8_t)(order | BUDDY_FREE_FLAG);
 }
 
-/* find first free page frame */
-static uint32_t find_free_page(void) {
-    /* Linear scan from last hint; returns page index or -1 if none. */
-    for (uint32_t i = next_free_page; i < (PHYS_MEMORY_END / PAGE_SIZE); ++i) {
-        if (!bitmap_test(i)) {
-            next_free_page = i + 1;
-            return i;
+/* Unlink a block from the free list for its order in O(1) */
+static void buddy_list_remove(uint32_t frame, uint32_t order) {
+    if (free_prev[frame] != BUDDY_NONE) {
+        free_next[free_prev[frame]] = free_next[frame];
+    } else {
+        free_head[order] = free_next[frame];
+    }
+    if (free_next[frame] != BUDDY_NONE) {
+        free_prev[free_next[frame]] = free_prev[frame];
+    }
+    block_order[frame] = BUDDY_INVALID;
+}
+
+/* Take a block of the requested order, splitting a larger one if needed.
+   Returns the head frame or BUDDY_NONE when no block is large enough. */
+static uint32_t buddy_alloc(uint32_t order) {
+    uint32_t current = order;
+    while (current <= BUDDY_MAX_ORDER && free_head[current] == BUDDY_NONE) {
+        current++;
+    }
+    if (current > BUDDY_MAX_ORDER) {
+        return BUDDY_NONE; /* out of memory */
+    }
+
+    uint32_t frame = free_head[current];
+    buddy_list_remove(frame, current);
+
+    /* Split down, returning the upper halves to their free lists */
+    while (current > order) {
+        current--;
+        buddy_list_push(frame + (1u << current), current);
+    }
+
+    block_order[frame] = (uint8_t)order;
+    hbitmap_set_range(&page_bitmap, frame, 1u << order);
+    free_page_count -= 1u << order;
+    return frame;
+}
+
+/* Return a block and merge it with its buddy for as long as the buddy is free */
+static void buddy_free(uint32_t frame, uint32_t order) {
+    hbitmap_clear_range(&page_bitmap, frame, 1u << order);
+    free_page_count += 1u << order;
+    block_order[frame] = BUDDY_INVALID;
+
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= TOTAL_PAGES || block_order[buddy] != (order | BUDDY_FREE_FLAG)) {
+            break;
+        }
+        buddy_list_remove(buddy, order);
+        if (buddy < frame) {
+            frame = buddy;
         }
+        order++;
     }
-    return (uint32_t)-1; /* out of memory */
+    buddy_list_push(frame, order);
 }
 
-/* Enhanced identity map a 4 KiB page with security checks */
-static void map_page(uint32_t phys_addr, uint32_t virt_addr) {
-    /* Simplified identity mapping: mark the physical page as used.
-       In a full implementation, this would populate page tables. */
-    /* Security validation */
-    if (!validate_memory_access((const void*)phys_addr, PAGE_SIZE, MEM_PROT_WRITE)) {
-        return; /* Invalid access */
+/* Return an arbitrary run of allocated frames as maximal aligned blocks,
+   each merged with its buddies on the way */
+static void buddy_free_range(uint32_t frame, uint32_t count) {
+    uint32_t end = frame + count;
+    while (frame < end) {
+        uint32_t order = BUDDY_MAX_ORDER;
+        while (order > 0 && ((frame & ((1u << order) - 1)) != 0 || frame + (1u << order) > end)) {
+            order--;
+        }
+        buddy_free(frame, order);
+        frame += 1u << order;
     }
-    
-    /* simplified: assumes page tables already exist and identity map 0-4 MiB */
-    /* for now we just mark the physical page as used */
-    uint32_t frame = phys_addr / PAGE_SIZE;
-    if (frame < (PHYS_MEMORY_END / PAGE_SIZE)) {
-        bitmap_set(frame);
+}
+
+/* Take the free frames [frame, frame + count) off the free lists. Every free
+   block overlapping the run is claimed whole and the parts outside the run
+   are handed straight back. */
+static void buddy_claim_range(uint32_t frame, uint32_t count) {
+    uint32_t end = frame + count;
+    uint32_t p = frame;
+    while (p < end) {
+        /* The free block holding p has the first head at or below p whose order reaches it */
+        uint32_t order = 0;
+        uint32_t head = p;
+        while (order <= BUDDY_MAX_ORDER) {
+            head = p & ~((1u << order) - 1);
+            if (block_order[head] == (order | BUDDY_FREE_FLAG)) {
+                break;
+            }
+            order++;
+        }
+
+        buddy_list_remove(head, order);
+        hbitmap_set_range(&page_bitmap, head, 1u << order);
+        free_page_count -= 1u << order;
+
+        uint32_t block_end = head + (1u << order);
+        if (head < frame) {
+            buddy_free_range(head, frame - head);
+        }
+        if (block_end > end) {
+            buddy_free_range(end, block_end - end);
+        }
+        p = block_end;
+    }
+}
+
+/* CPU the caller runs on: the resolver's answer, else the local APIC id.
+   APIC ids need not be dense, so they are folded onto the magazines. */
+static inline int this_cpu_id(void) {
+    if (cpu_resolver) {
+        return cpu_resolver();
+    }
+#ifndef S00K_HOSTED
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (int)((ebx >> 24) & (SC_MAX_CPUS - 1));
+#else
+    return 0;
+#endif
+}
+
+/* Locked magazine of the CPU serving the caller */
+static inline pcp_cache_t* this_cpu_cache(void) {
+    int cpu = this_cpu_id();
+    if (cpu < 0 || cpu >= SC_MAX_CPUS) {
+        cpu = 0;
+    }
+    pcp_cache_t* pcp = &pcp_caches[cpu];
+    sc_lock_acquire(&pcp->lock);
+    return pcp;
+}
+
+/* Single-frame allocation from the local magazine, refilled in batches */
+static uint32_t pcp_alloc(void) {
+    pcp_cache_t* pcp = this_cpu_cache();
+    if (pcp->count == 0) {
+        sc_lock_acquire(&mm_lock);
+        while (pcp->count < PCP_BATCH) {
+            uint32_t frame = buddy_alloc(0);
+            if (frame == BUDDY_NONE) {
+                break;
+            }
+            block_order[frame] = BUDDY_PCP_FLAG;
+            pcp->frames[pcp->count++] = frame;
+        }
+        sc_lock_release(&mm_lock);
+        if (pcp->count == 0) {
+            sc_lock_release(&pcp->lock);
+            return BUDDY_NONE;
+        }
+    }
+
+    uint32_t frame = pcp->frames[--pcp->count];
+    block_order[frame] = 0;
+    sc_lock_release(&pcp->lock);
+    return frame;
+}
+
+/* Return a single frame to the local magazine, draining the oldest batch when full */
+static void pcp_free(uint32_t frame) {
+    pcp_cache_t* pcp = this_cpu_cache();
+    if (pcp->count == PCP_CAPACITY) {
+        sc_lock_acquire(&mm_lock);
+        for (uint32_t i = 0; i < PCP_BATCH; i++) {
+            buddy_free(pcp->frames[i], 0);
+        }
+        sc_lock_release(&mm_lock);
+        for (uint32_t i = PCP_BATCH; i < PCP_CAPACITY; i++) {
+            pcp->frames[i - PCP_BATCH] = pcp->frames[i];
+        }
+        pcp->count -= PCP_BATCH;
+    }
+
+    block_order[frame] = BUDDY_PCP_FLAG;
+    pcp->frames[pcp->count++] = frame;
+    sc_lock_release(&pcp->lock);
+}
+
+/* Return every parked frame to the buddy lists so they can coalesce */
+static void pcp_drain_all(void) {
+    for (uint32_t cpu = 0; cpu < SC_MAX_CPUS; cpu++) {
+        pcp_cache_t* pcp = &pcp_caches[cpu];
+        sc_lock_acquire(&pcp->lock);
+        sc_lock_acquire(&mm_lock);
+        while (pcp->count > 0) {
+            buddy_free(pcp->frames[--pcp->count], 0);
+        }
+        sc_lock_release(&mm_lock);
+        sc_lock_release(&pcp->lock);
     }
 }
 
@@ -217,26 +567,58 @@ void init_memory_management(void) {
     /* Initialize allocator state and enable protection. Kernel region is registered
        as readable/writable/executable to reflect code/data in low memory. */
     /* zero bitmap */
-    for (int i = 0; i < BITMAP_SIZE; ++i) {
-        page_bitmap[i] = 0;
-    }
+    hbitmap_init(&page_bitmap, page_words, page_summary, page_top, TOTAL_PAGES);
     
-    /* zero memory regions */
+    /* empty the region tree and chain every node onto the free list */
     for (int i = 0; i < MAX_MEMORY_REGIONS; i++) {
-        memory_regions[i].base_address = NULL;
-        memory_regions[i].size = 0;
-        memory_regions[i].protection = MEM_PROT_NONE;
-        memory_regions[i].owner = NULL;
-        memory_regions[i].is_allocated = false;
+        region_nodes[i].region.base_address = NULL;
+        region_nodes[i].region.size = 0;
+        region_nodes[i].region.protection = MEM_PROT_NONE;
+        region_nodes[i].region.owner = NULL;
+        region_nodes[i].region.is_allocated = false;
+        region_nodes[i].left = (uint16_t)(i + 1 < MAX_MEMORY_REGIONS ? i + 1 : REGION_NIL);
+        region_nodes[i].right = REGION_NIL;
+        region_nodes[i].height = 0;
     }
+    region_root = REGION_NIL;
+    region_free_list = 0;
     region_count = 0;
     
+    /* reset buddy free lists */
+    for (uint32_t p = 0; p < TOTAL_PAGES; ++p) {
+        block_order[p] = BUDDY_INVALID;
+    }
+    for (uint32_t order = 0; order <= BUDDY_MAX_ORDER; ++order) {
+        free_head[order] = BUDDY_NONE;
+    }
+    free_page_count = 0;
+    for (uint32_t cpu = 0; cpu < SC_MAX_CPUS; ++cpu) {
+        pcp_caches[cpu].lock = 0;
+        pcp_caches[cpu].count = 0;
+    }
+    for (uint32_t p = 0; p < TOTAL_PAGES; ++p) {
+        frame_owner[p] = NULL;
+    }
+    
     /* mark kernel pages (0 - KERNEL_END) as used */
     uint32_t kernel_pages = (KERNEL_END + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (uint32_t p = 0; p < kernel_pages; ++p) {
-        bitmap_set(p);
+    hbitmap_set_range(&page_bitmap, 0, kernel_pages);
+    
+    /* Seed the free lists with the largest aligned blocks above the kernel.
+       Walk downwards so the lowest blocks end up at the list heads and get
+       handed out first (they sit inside the identity-mapped window). */
+    uint32_t frame = TOTAL_PAGES;
+    while (frame > kernel_pages) {
+        uint32_t order = BUDDY_MAX_ORDER;
+        while (order > 0 &&
+               (frame < (1u << order) || ((frame - (1u << order)) & ((1u << order) - 1)) != 0 ||
+                frame - (1u << order) < kernel_pages)) {
+            order--;
+        }
+        frame -= 1u << order;
+        buddy_list_push(frame, order);
+        free_page_count += 1u << order;
     }
-    next_free_page = kernel_pages;
     
     /* Register kernel memory region */
     register_memory_region((void*)0, KERNEL_END, MEM_PROT_READ | MEM_PROT_WRITE | MEM_PROT_EXECUTE, NULL);
@@ -245,81 +627,265 @@ void init_memory_management(void) {
     memory_protection_enabled = true;
 }
 
-/* Enhanced allocate one 4 KiB page with security checks */
-void* allocate_memory(size_t size) {
+/* Give a block back, single frames through the local magazine */
+static void release_block(uint32_t frame, uint32_t order) {
+    if (order == 0 && pcp_enabled) {
+        pcp_free(frame);
+        return;
+    }
     sc_lock_acquire(&mm_lock);
+    buddy_free(frame, order);
+    sc_lock_release(&mm_lock);
+}
+
+/* Allocate a power-of-two block of pages for owner, or for the kernel when
+   owner is NULL. Kernel blocks always go through the region tree. */
+static void* allocate_block(size_t size, user_t* owner) {
+    if (size == 0 || size > MAX_ALLOCATION_SIZE) {
+        log_memory_security_event("INVALID_SIZE", "Invalid memory allocation size", NULL);
+        return NULL;
+    }
+    
+    uint32_t order = size_to_order(size);
+    if (order == 0 && pcp_enabled && owner) {
+        /* Magazine hit: the frame's owner slot stands in for a region, so
+           neither region_lock nor the security log is on this path */
+        uint32_t frame = pcp_alloc();
+        if (frame == BUDDY_NONE) {
+            log_memory_security_event("OUT_OF_MEMORY", "No free block of requested size available", NULL);
+            return NULL;
+        }
+        __atomic_store_n(&frame_owner[frame], owner, __ATOMIC_RELEASE);
+        return frame_to_address(frame);
+    }
+    
+    sc_lock_acquire(&mm_lock);
+    uint32_t frame = buddy_alloc(order);
+    sc_lock_release(&mm_lock);
+    if (frame == BUDDY_NONE) {
+        log_memory_security_event("OUT_OF_MEMORY", "No free block of requested size available", NULL);
+        return NULL;
+    }
+    
+    void* allocated_address = frame_to_address(frame);
+    
+    /* Register the allocated region */
+    sc_lock_acquire(&region_lock);
+    bool registered = register_memory_region(allocated_address, (size_t)PAGE_SIZE << order,
+                                             MEM_PROT_READ | MEM_PROT_WRITE, owner);
+    sc_lock_release(&region_lock);
+    if (!registered) {
+        log_memory_security_event("REGION_REGISTRATION_FAILED", "Failed to register memory region", allocated_address);
+        sc_lock_acquire(&mm_lock);
+        buddy_free(frame, order);
+        sc_lock_release(&mm_lock);
+        return NULL;
+    }
+    
+    log_memory_security_event("MEMORY_ALLOCATED", "Memory block allocated successfully", allocated_address);
+    return allocated_address;
+}
+
+/* Enhanced allocate a power-of-two block of pages with security checks */
+void* allocate_memory(size_t size) {
     user_t* current_user = security_get_current_user();
     if (!current_user) {
         log_memory_security_event("NO_USER", "Memory allocation attempted without authenticated user", NULL);
-        sc_lock_release(&mm_lock);
         return NULL;
     }
+    return allocate_block(size, current_user);
+}
+
+/* Allocate a block owned by the kernel rather than the current user */
+void* allocate_kernel_memory(size_t size) {
+    return allocate_block(size, NULL);
+}
+
+/* Free a block of owner's, or of the kernel's when owner is NULL */
+static void free_block(void* ptr, user_t* owner) {
+    if (!ptr) {
+        log_memory_security_event("NULL_POINTER_FREE", "Attempted to free null pointer", NULL);
+        return;
+    }
     
-    if (size != PAGE_SIZE) {
-        log_memory_security_event("INVALID_SIZE", "Invalid memory allocation size", NULL);
-        sc_lock_release(&mm_lock);
+    /* Only the head frame of an allocated block may be freed; free, parked
+       and interior frames all carry a marker above BUDDY_MAX_ORDER */
+    uint32_t frame = address_to_frame(ptr);
+    if (frame >= TOTAL_PAGES || (uintptr_t)ptr % PAGE_SIZE != 0 ||
+        block_order[frame] > BUDDY_MAX_ORDER) {
+        log_memory_security_event("INVALID_FRAME", "Invalid page frame during free", ptr);
+        return;
+    }
+    uint32_t order = block_order[frame];
+    
+    /* A frame from a magazine is freed by clearing its owner slot; of two
+       racing frees only one clears it */
+    if (order == 0) {
+        user_t* expected = owner;
+        if (owner && __atomic_compare_exchange_n(&frame_owner[frame], &expected, NULL, false, __ATOMIC_ACQ_REL,
+                                                 __ATOMIC_ACQUIRE)) {
+            release_block(frame, 0);
+            return;
+        }
+        if (__atomic_load_n(&frame_owner[frame], __ATOMIC_ACQUIRE)) {
+            log_memory_security_event("WRONG_OWNER", "Memory access by wrong user", ptr);
+            return;
+        }
+    }
+    
+    /* Validate and unregister in one step; the region table decides which of
+       two racing frees of the same block wins. Users and the kernel may
+       only free their own blocks. */
+    sc_lock_acquire(&region_lock);
+    memory_region_t* region = find_memory_region((uint32_t)(uintptr_t)ptr);
+    if (region && region->base_address == ptr && region->owner != owner) {
+        sc_lock_release(&region_lock);
+        log_memory_security_event("WRONG_OWNER", "Memory access by wrong user", ptr);
+        return;
+    }
+    if (!validate_memory_access(ptr, (size_t)PAGE_SIZE << order, MEM_PROT_WRITE)) {
+        sc_lock_release(&region_lock);
+        log_memory_security_event("INVALID_FREE", "Invalid memory access during free", ptr);
+        return;
+    }
+    bool unregistered = unregister_memory_region(ptr);
+    sc_lock_release(&region_lock);
+    if (!unregistered) {
+        log_memory_security_event("INVALID_FREE", "Block is not registered", ptr);
+        return;
+    }
+    
+    release_block(frame, order);
+    
+    log_memory_security_event("MEMORY_FREED", "Memory block freed successfully", ptr);
+}
+
+/* Enhanced free a previously allocated block with security checks */
+void free_memory(void* ptr) {
+    user_t* current_user = security_get_current_user();
+    if (!current_user) {
+        log_memory_security_event("NO_USER_FREE", "Memory free attempted without authenticated user", ptr);
+        return;
+    }
+    free_block(ptr, current_user);
+}
+
+/* Free a block from allocate_kernel_memory, whoever is logged in */
+void free_kernel_memory(void* ptr) {
+    free_block(ptr, NULL);
+}
+
+/* Allocate count physically contiguous pages aligned to alignment bytes */
+void* allocate_pages(size_t count, size_t alignment) {
+    user_t* current_user = security_get_current_user();
+    if (!current_user) {
+        log_memory_security_event("NO_USER", "Memory allocation attempted without authenticated user", NULL);
         return NULL;
     }
     
-    uint32_t frame = find_free_page();
-    if (frame == (uint32_t)-1) {
-        log_memory_security_event("OUT_OF_MEMORY", "No free pages available", NULL);
-        sc_lock_release(&mm_lock);
+    if (alignment < PAGE_SIZE) {
+        alignment = PAGE_SIZE;
+    }
+    if (count == 0 || count > TOTAL_PAGES || (alignment & (alignment - 1)) != 0 ||
+        alignment > PHYS_MEMORY_END) {
+        log_memory_security_event("INVALID_SIZE", "Invalid page run allocation request", NULL);
+        return NULL;
+    }
+    uint32_t align_frames = (uint32_t)(alignment / PAGE_SIZE);
+    
+    sc_lock_acquire(&mm_lock);
+    uint32_t frame = hbitmap_find_zero_run(&page_bitmap, (uint32_t)count, align_frames);
+    if (frame != HBITMAP_NONE) {
+        buddy_claim_range(frame, (uint32_t)count);
+    }
+    sc_lock_release(&mm_lock);
+    
+    if (frame == HBITMAP_NONE) {
+        log_memory_security_event("OUT_OF_MEMORY", "No contiguous run of requested size available", NULL);
         return NULL;
     }
     
-    bitmap_set(frame);
-    void* allocated_address = (void*)(frame * PAGE_SIZE);
+    void* allocated_address = frame_to_address(frame);
     
-    /* Register the allocated region */
-    if (!register_memory_region(allocated_address, PAGE_SIZE, MEM_PROT_READ | MEM_PROT_WRITE, current_user)) {
+    sc_lock_acquire(&region_lock);
+    bool registered = register_memory_region(allocated_address, count * PAGE_SIZE,
+                                             MEM_PROT_READ | MEM_PROT_WRITE, current_user);
+    sc_lock_release(&region_lock);
+    if (!registered) {
         log_memory_security_event("REGION_REGISTRATION_FAILED", "Failed to register memory region", allocated_address);
-        bitmap_clear(frame);
+        sc_lock_acquire(&mm_lock);
+        buddy_free_range(frame, (uint32_t)count);
         sc_lock_release(&mm_lock);
         return NULL;
     }
     
-    log_memory_security_event("MEMORY_ALLOCATED", "Memory page allocated successfully", allocated_address);
-    sc_lock_release(&mm_lock);
+    log_memory_security_event("MEMORY_ALLOCATED", "Page run allocated successfully", allocated_address);
     return allocated_address;
 }
 
-/* Enhanced free a previously allocated page with security checks */
-void free_memory(void* ptr) {
-    sc_lock_acquire(&mm_lock);
+/* Free a run returned by allocate_pages; count must match the allocation */
+void free_pages(void* ptr, size_t count) {
     if (!ptr) {
         log_memory_security_event("NULL_POINTER_FREE", "Attempted to free null pointer", NULL);
-        sc_lock_release(&mm_lock);
         return;
     }
     
-    /* Validate memory access before freeing */
-    if (!validate_memory_access(ptr, PAGE_SIZE, MEM_PROT_WRITE)) {
-        log_memory_security_event("INVALID_FREE", "Invalid memory access during free", ptr);
-        sc_lock_release(&mm_lock);
+    uint32_t frame = address_to_frame(ptr);
+    if (frame >= TOTAL_PAGES || (uintptr_t)ptr % PAGE_SIZE != 0 || count == 0 || count > TOTAL_PAGES - frame) {
+        log_memory_security_event("INVALID_FRAME", "Invalid page run during free", ptr);
         return;
     }
     
-    /* Check user ownership */
     user_t* current_user = security_get_current_user();
     if (!current_user) {
         log_memory_security_event("NO_USER_FREE", "Memory free attempted without authenticated user", ptr);
-        sc_lock_release(&mm_lock);
         return;
     }
     
-    uint32_t frame = (uint32_t)ptr / PAGE_SIZE;
-    if (frame < (PHYS_MEMORY_END / PAGE_SIZE)) {
-        bitmap_clear(frame);
-        if (frame < next_free_page) next_free_page = frame;
-        
-        /* Unregister the memory region */
-        unregister_memory_region(ptr);
-        
-        log_memory_security_event("MEMORY_FREED", "Memory page freed successfully", ptr);
-        sc_lock_release(&mm_lock);
-    } else {
-        log_memory_security_event("INVALID_FRAME", "Invalid page frame during free", ptr);
-        sc_lock_release(&mm_lock);
+    /* The run must be exactly one registered region */
+    sc_lock_acquire(&region_lock);
+    memory_region_t* region = find_memory_region((uint32_t)(uintptr_t)ptr);
+    if (!region || region->base_address != ptr || region->size != count * PAGE_SIZE ||
+        !validate_memory_access(ptr, count * PAGE_SIZE, MEM_PROT_WRITE)) {
+        sc_lock_release(&region_lock);
+        log_memory_security_event("INVALID_FREE", "Page run does not match an allocation", ptr);
+        return;
+    }
+    unregister_memory_region(ptr);
+    sc_lock_release(&region_lock);
+    
+    sc_lock_acquire(&mm_lock);
+    buddy_free_range(frame, (uint32_t)count);
+    sc_lock_release(&mm_lock);
+    
+    log_memory_security_event("MEMORY_FREED", "Page run freed successfully", ptr);
+}
+
+/* Number of free page frames, including those parked in per-CPU magazines */
+uint32_t memory_free_pages(void) {
+    uint32_t pages = free_page_count;
+    for (uint32_t cpu = 0; cpu < SC_MAX_CPUS; cpu++) {
+        pages += pcp_caches[cpu].count;
+    }
+    return pages;
+}
+
+/* Route single-frame requests through per-CPU magazines or straight to the buddy lists */
+void memory_set_cpu_caches(bool enabled) {
+    if (!enabled) {
+        pcp_enabled = false;
+        pcp_drain_all();
+        return;
     }
-}
\ No newline at end of file
+    pcp_enabled = true;
+}
+
+/* Return all parked frames to the buddy lists */
+void memory_drain_cpu_caches(void) {
+    pcp_drain_all();
+}
+
+/* Override how the allocator identifies the current CPU */
+void memory_set_cpu_resolver(int (*resolver)(void)) {
+    cpu_resolver = resolver;
+}
@@ -0,0 +1,58 @@
+/* memory_management.h - Physical page allocator interface */
+
+#ifndef MEMORY_MANAGEMENT_H
+#define MEMORY_MANAGEMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Physical memory layout */
+#define PAGE_SIZE        4096
+#define KERNEL_END       0x100000     /* 1 MiB, adjust as needed */
+#define PHYS_MEMORY_END  0x1000000    /* 16 MiB for now */
+#define TOTAL_PAGES      (PHYS_MEMORY_END / PAGE_SIZE)
+
+/* Buddy allocator limits: order 0 is one page, BUDDY_MAX_ORDER is 4 MiB */
+#define BUDDY_MAX_ORDER      10
+#define MAX_ALLOCATION_SIZE  ((size_t)PAGE_SIZE << BUDDY_MAX_ORDER)
+
+/* Initialize the page allocator and memory protection */
+void init_memory_management(void);
+
+/* Allocate a physically contiguous block of at least size bytes.
+   The request is rounded up to a power-of-two number of pages and the
+   returned address is aligned to the block size. Returns NULL on failure. */
+void* allocate_memory(size_t size);
+
+/* Free a block returned by allocate_memory */
+void free_memory(void* ptr);
+
+/* The same for memory the kernel owns, such as slab pages: no user needs
+   to be logged in, and any caller may free it with free_kernel_memory,
+   though free_memory refuses it */
+void* allocate_kernel_memory(size_t size);
+void free_kernel_memory(void* ptr);
+
+/* Allocate count physically contiguous pages whose address is a multiple of
+   alignment bytes (a power of two; 0 means page alignment). Unlike
+   allocate_memory the run is not rounded up. Returns NULL on failure. */
+void* allocate_pages(size_t count, size_t alignment);
+
+/* Free a run returned by allocate_pages; count must match the allocation */
+void free_pages(void* ptr, size_t count);
+
+/* Number of page frames currently free, including per-CPU cached frames */
+uint32_t memory_free_pages(void);
+
+/* Single-page allocations are served from per-CPU magazines refilled and
+   drained in batches. Disabling must only be used while no other CPU is
+   allocating. */
+void memory_set_cpu_caches(bool enabled);
+void memory_drain_cpu_caches(void);
+
+/* Replace the CPU id lookup (defaults to the local APIC id, and to CPU 0
+   when hosted); ids outside [0, SC_MAX_CPUS) use CPU 0's magazine */
+void memory_set_cpu_resolver(int (*resolver)(void));
+
+#endif /* MEMORY_MANAGEMENT_H */
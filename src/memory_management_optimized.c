@@ -3,137 +3,50 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "performance_profiler.h"
+#include "bitmap.h"
 
 #define PAGE_SIZE        4096
 #define KERNEL_END       0x100000     /* 1 MiB, adjust as needed */
 #define PHYS_MEMORY_END  0x1000000    /* 16 MiB for now */
-#define BITMAP_SIZE      (PHYS_MEMORY_END / PAGE_SIZE / 8)
+#define TOTAL_PAGES      (PHYS_MEMORY_END / PAGE_SIZE)
 #define CACHE_LINE_SIZE  64
-#define PREFETCH_DISTANCE 8
 
-static uint8_t page_bitmap[BITMAP_SIZE] __attribute__((aligned(PAGE_SIZE)));
+/* Hierarchical page bitmap: one bit per frame plus two summary levels */
+static uint64_t page_words[HBITMAP_WORDS(TOTAL_PAGES)] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t page_summary[HBITMAP_SUMMARY_WORDS(TOTAL_PAGES)];
+static uint64_t page_top[HBITMAP_TOP_WORDS(TOTAL_PAGES)];
+static hbitmap_t page_bitmap;
 static uint32_t next_free_page = 0;
 
-/* Performance optimization: Use bit scan operations for faster free page finding */
-static inline int find_first_zero_bit(uint8_t byte) {
-    if (byte == 0xFF) return -1;
-    
-    /* Use built-in bit scan reverse for faster operation */
-    return __builtin_ctz(~byte);
-}
-
-/* Optimized bitmap operations with prefetching */
 static inline void bitmap_set(int bit) {
-    page_bitmap[bit >> 3] |= (1 << (bit & 7));
+    hbitmap_set(&page_bitmap, (uint32_t)bit);
 }
 
 static inline void bitmap_clear(int bit) {
-    page_bitmap[bit >> 3] &= ~(1 << (bit & 7));
+    hbitmap_clear(&page_bitmap, (uint32_t)bit);
 }
 
 static inline int bitmap_test(int bit) {
-    return page_bitmap[bit >> 3] & (1 << (bit & 7));
+    return hbitmap_test(&page_bitmap, (uint32_t)bit);
 }
 
-/* Optimized find free page with bit scan operations and prefetching */
+/* Find a free page through the summary levels, starting at the hint */
 static uint32_t optimized_find_free_page(void) {
     uint32_t __profile_id = 0;
     if (__profile_id == 0) __profile_id = profiler_register_function("optimized_find_free_page");
     profiler_start_function(__profile_id);
     
-    register uint32_t start_page = next_free_page;
-    register uint32_t total_pages = PHYS_MEMORY_END / PAGE_SIZE;
-    
-    /* Prefetch bitmap data for better cache performance */
-    for (register uint32_t i = start_page >> 3; i < (start_page >> 3) + PREFETCH_DISTANCE && i < BITMAP_SIZE; i++) {
-        PREFETCH(&page_bitmap[i]);
-    }
-    
-    /* Search in chunks of 8 bytes (64 pages) for better cache utilization */
-    register uint32_t byte_index = start_page >> 3;
-    register uint32_t bit_index = start_page & 7;
-    
-    for (; byte_index < BITMAP_SIZE; byte_index++) {
-        register uint8_t current_byte = page_bitmap[byte_index];
-        
-        if (LIKELY(current_byte != 0xFF)) {
-            /* Found a byte with free bits */
-            register int free_bit = find_first_zero_bit(current_byte);
-            if (free_bit >= 0) {
-                register uint32_t result = (byte_index << 3) + free_bit;
-                if (LIKELY(result < total_pages)) {
-                    next_free_page = result + 1;
-                    profiler_end_function(__profile_id);
-                    return result;
-                }
-            }
-        }
-        
-        /* Prefetch next chunk */
-        if (byte_index + PREFETCH_DISTANCE < BITMAP_SIZE) {
-            PREFETCH(&page_bitmap[byte_index + PREFETCH_DISTANCE]);
-        }
+    register uint32_t result = hbitmap_find_zero(&page_bitmap, next_free_page);
+    if (UNLIKELY(result == HBITMAP_NONE)) {
+        /* Wrap around and search from beginning */
+        result = hbitmap_find_zero(&page_bitmap, 0);
     }
-    
-    /* Wrap around and search from beginning */
-    for (byte_index = 0; byte_index < (start_page >> 3); byte_index++) {
-        register uint8_t current_byte = page_bitmap[byte_index];
-        
-        if (LIKELY(current_byte != 0xFF)) {
-            register int free_bit = find_first_zero_bit(current_byte);
-            if (free_bit >= 0) {
-                register uint32_t result = (byte_index << 3) + free_bit;
-                if (LIKELY(result < total_pages)) {
-                    next_free_page = result + 1;
-                    profiler_end_function(__profile_id);
-                    return result;
-                }
-            }
-        }
+    if (LIKELY(result != HBITMAP_NONE)) {
+        next_free_page = result + 1;
     }
     
     profiler_end_function(__profile_id);
-    return (uint32_t)-1; /* out of memory */
-}
-
-/* Optimized bulk bitmap operations */
-static inline void bitmap_set_range(uint32_t start_bit, uint32_t count) {
-    register uint32_t start_byte = start_bit >> 3;
-    register uint32_t start_bit_in_byte = start_bit & 7;
-    register uint32_t end_bit = start_bit + count;
-    register uint32_t end_byte = end_bit >> 3;
-    register uint32_t end_bit_in_byte = end_bit & 7;
-    
-    /* Handle first byte with partial bits */
-    if (start_bit_in_byte != 0) {
-        register uint8_t mask = (0xFF << start_bit_in_byte);
-        if (start_byte == end_byte) {
-            mask &= (0xFF >> (8 - end_bit_in_byte));
-        }
-        page_bitmap[start_byte] |= mask;
-        start_byte++;
-    }
-    
-    /* Handle full bytes */
-    for (register uint32_t i = start_byte; i < end_byte; i++) {
-        page_bitmap[i] = 0xFF;
-    }
-    
-    /* Handle last byte with partial bits */
-    if (end_byte > start_byte && end_bit_in_byte != 0) {
-        register uint8_t mask = (0xFF >> (8 - end_bit_in_byte));
-        page_bitmap[end_byte] |= mask;
-    }
-}
-
-/* Optimized identity map with bulk operations */
-static inline void optimized_map_page(uint32_t phys_addr, uint32_t virt_addr) {
-    register uint32_t frame = phys_addr / PAGE_SIZE;
-    register uint32_t total_frames = PHYS_MEMORY_END / PAGE_SIZE;
-    
-    if (LIKELY(frame < total_frames)) {
-        bitmap_set(frame);
-    }
+    return result == HBITMAP_NONE ? (uint32_t)-1 : result; /* -1: out of memory */
 }
 
 /* Optimized memory initialization with bulk operations */
@@ -145,21 +58,11 @@ void optimized_init_memory_management(void) {
     /* Use bulk memset for faster initialization */
     register uint32_t kernel_pages = (KERNEL_END + PAGE_SIZE - 1) / PAGE_SIZE;
     
-    /* Clear bitmap efficiently */
-    register uint64_t* bitmap_64 = (uint64_t*)page_bitmap;
-    register size_t bitmap_64_size = BITMAP_SIZE / sizeof(uint64_t);
-    
-    for (register size_t i = 0; i < bitmap_64_size; i++) {
-        bitmap_64[i] = 0;
-    }
-    
-    /* Handle remaining bytes */
-    for (register size_t i = bitmap_64_size * sizeof(uint64_t); i < BITMAP_SIZE; i++) {
-        page_bitmap[i] = 0;
-    }
+    /* Clear bitmap and its summary levels */
+    hbitmap_init(&page_bitmap, page_words, page_summary, page_top, TOTAL_PAGES);
     
     /* Mark kernel pages as used using bulk operations */
-    bitmap_set_range(0, kernel_pages);
+    hbitmap_set_range(&page_bitmap, 0, kernel_pages);
     
     next_free_page = kernel_pages;
     
@@ -189,7 +92,7 @@ void* optimized_allocate_memory(size_t size) {
     profiler_record_memory_allocation(PAGE_SIZE, 1);
     profiler_end_function(__profile_id);
     
-    return (void*)(frame * PAGE_SIZE);
+    return (void*)(uintptr_t)(frame * PAGE_SIZE);
 }
 
 /* Optimized memory deallocation */
@@ -203,7 +106,7 @@ void optimized_free_memory(void* ptr) {
         return;
     }
     
-    register uint32_t frame = (uint32_t)ptr / PAGE_SIZE;
+    register uint32_t frame = (uint32_t)((uintptr_t)ptr / PAGE_SIZE);
     register uint32_t total_frames = PHYS_MEMORY_END / PAGE_SIZE;
     
     if (LIKELY(frame < total_frames)) {
@@ -262,7 +165,6 @@ void* optimized_allocate_small_memory(size_t size) {
     
     /* First-fit allocation strategy */
     small_alloc_block_t* current = small_alloc_list;
-    small_alloc_block_t* prev = NULL;
     
     while (current) {
         if (!current->used && current->size >= size) {
@@ -284,7 +186,6 @@ void* optimized_allocate_small_memory(size_t size) {
             return (void*)((uint8_t*)current + sizeof(small_alloc_block_t));
         }
         
-        prev = current;
         current = current->next;
     }
     
@@ -1,7 +1,13 @@
 /* performance_profiler.c - Performance profiling implementation */
 
+#ifdef S00K_HOSTED
+#define _POSIX_C_SOURCE 199309L     /* clock_gettime */
+#include <time.h>
+#endif
+
 #include "performance_profiler.h"
 #include <string.h>
+#include "timer.h"
 
 /* Global profiler session */
 profiler_session_t g_profiler_session = {0};
@@ -26,11 +32,14 @@ static struct {
     uint64_t write_bytes;
 } io_stats = {0};
 
+static profiler_cache_stats_t cache_stats = {0};
+
 /* Initialize the profiler */
 void profiler_init(void) {
     memset(&g_profiler_session, 0, sizeof(profiler_session_t));
     memset(&memory_stats, 0, sizeof(memory_stats));
     memset(&io_stats, 0, sizeof(io_stats));
+    memset(&cache_stats, 0, sizeof(cache_stats));
     g_profiler_session.session_start_time = profiler_get_current_time_ns();
     g_profiler_session.profiling_enabled = 1;
 }
@@ -50,16 +59,21 @@ void profiler_reset(void) {
     profiler_init();
 }
 
-/* Get current time in nanoseconds using CPU timestamp counter */
+/* Get current time in nanoseconds: the TSC scaled by the rate timer_init
+   measured (0 before then), or the host's monotonic clock when hosted */
 uint64_t profiler_get_current_time_ns(void) {
-    uint32_t lo, hi;
-    __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
-    return ((uint64_t)hi << 32) | lo;
+#ifdef S00K_HOSTED
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+    return timer_cycles_to_ns(timer_read_tsc());
+#endif
 }
 
 /* Get CPU cycles */
 uint64_t profiler_get_cpu_cycles(void) {
-    return profiler_get_current_time_ns();
+    return timer_read_tsc();
 }
 
 /* Register a function for profiling */
@@ -156,6 +170,51 @@ void profiler_record_io_operation(const char* operation, uint32_t bytes, uint64_
     }
 }
 
+/* Record a block cache lookup */
+void profiler_record_cache_access(uint8_t hit) {
+    if (hit) {
+        cache_stats.hits++;
+    } else {
+        cache_stats.misses++;
+    }
+}
+
+/* Record blocks moved between a block cache and its device */
+void profiler_record_cache_transfer(uint8_t write, uint32_t blocks, uint64_t time_ns) {
+    if (write) {
+        cache_stats.device_writes += blocks;
+    } else {
+        cache_stats.device_reads += blocks;
+    }
+    cache_stats.device_time_ns += time_ns;
+}
+
+/* Record one write-back pass over dirty buffers */
+void profiler_record_cache_writeback_batch(void) {
+    cache_stats.writeback_batches++;
+}
+
+/* Record blocks read ahead by a window of window blocks */
+void profiler_record_readahead(uint32_t blocks, uint32_t window) {
+    cache_stats.readahead_blocks += blocks;
+    cache_stats.readahead_window = window;
+    if (window > cache_stats.readahead_window_max) {
+        cache_stats.readahead_window_max = window;
+    }
+}
+
+/* Record the first use of a read-ahead block */
+void profiler_record_readahead_hit(void) {
+    cache_stats.readahead_hits++;
+}
+
+/* Copy out the block cache counters */
+void profiler_get_cache_stats(profiler_cache_stats_t* stats) {
+    if (stats) {
+        *stats = cache_stats;
+    }
+}
+
 /* Print profiling report */
 void profiler_print_report(void) {
     /* Simple print function for now - will integrate with kernel print later */
@@ -164,6 +223,7 @@ void profiler_print_report(void) {
 
 /* Print top functions by execution time */
 void profiler_print_top_functions(uint32_t count) {
+    (void)count;
     /* Sort functions by total execution time and print top N */
     /* Implementation would go here */
 }
@@ -39,6 +39,20 @@ typedef struct {
     uint8_t active;
 } function_timer_t;
 
+/* Block cache statistics, summed over every block cache */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t device_reads;       /* Blocks read from devices on a miss */
+    uint64_t device_writes;      /* Dirty blocks written back */
+    uint64_t writeback_batches;
+    uint64_t device_time_ns;     /* Time spent in device reads and writes */
+    uint64_t readahead_blocks;   /* Blocks read ahead of use */
+    uint64_t readahead_hits;     /* Read-ahead blocks that were then looked up */
+    uint32_t readahead_window;   /* Window of the last read-ahead, in blocks */
+    uint32_t readahead_window_max;
+} profiler_cache_stats_t;
+
 /* Global profiler session */
 extern profiler_session_t g_profiler_session;
 
@@ -64,6 +78,14 @@ void profiler_print_memory_stats(void);
 void profiler_record_io_operation(const char* operation, uint32_t bytes, uint64_t time_ns);
 void profiler_print_io_stats(void);
 
+/* Block cache profiling functions */
+void profiler_record_cache_access(uint8_t hit);
+void profiler_record_cache_transfer(uint8_t write, uint32_t blocks, uint64_t time_ns);
+void profiler_record_cache_writeback_batch(void);
+void profiler_record_readahead(uint32_t blocks, uint32_t window);
+void profiler_record_readahead_hit(void);
+void profiler_get_cache_stats(profiler_cache_stats_t* stats);
+
 /* Macro for easy function profiling */
 #define PROFILE_FUNCTION(name) \
     static uint32_t __profile_id = 0; \
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "spinlock.h"
 
 typedef enum {
     THREAD_READY = 0,
@@ -36,18 +37,7 @@ static int sc_cpu_load[SC_MAX_CPUS];
 static int sc_cpu_count = 1;
 static int sc_current_thread = -1;
 
-typedef volatile int sc_lock_t;
-
-static void sc_lock_acquire(sc_lock_t* lock) {
-    while (*lock) {}
-    *lock = 1;
-}
-
-static void sc_lock_release(sc_lock_t* lock) {
-    *lock = 0;
-}
-
-static void init_scheduler(int cpus) {
+static inline void init_scheduler(int cpus) {
     if (cpus < 1) cpus = 1;
     if (cpus > SC_MAX_CPUS) cpus = SC_MAX_CPUS;
     sc_cpu_count = cpus;
@@ -58,7 +48,7 @@ static void init_scheduler(int cpus) {
     sc_current_thread = -1;
 }
 
-static int get_thread_count(void) {
+static inline int get_thread_count(void) {
     int count = 0;
     for (int i = 0; i < sc_thread_count; i++) {
         if (sc_threads[i].state != THREAD_DONE) count++;
@@ -66,16 +56,21 @@ static int get_thread_count(void) {
     return count;
 }
 
-static int get_cpu_load(int cpu_id) {
+static inline int get_cpu_load(int cpu_id) {
     if (cpu_id < 0 || cpu_id >= sc_cpu_count) return 0;
     return sc_cpu_load[cpu_id];
 }
 
-static int current_thread_id(void) {
+static inline int current_thread_id(void) {
     return sc_current_thread;
 }
 
-static int push_rq(int id) {
+static inline int current_cpu_id(void) {
+    if (sc_current_thread < 0) return 0;
+    return sc_threads[sc_current_thread].cpu_id;
+}
+
+static inline int push_rq(int id) {
     int next = (sc_rq_tail + 1) % SC_MAX_THREADS;
     if (next == sc_rq_head) return -1;
     sc_run_queue[sc_rq_tail] = id;
@@ -83,14 +78,14 @@ static int push_rq(int id) {
     return 0;
 }
 
-static int pop_rq(void) {
+static inline int pop_rq(void) {
     if (sc_rq_head == sc_rq_tail) return -1;
     int id = sc_run_queue[sc_rq_head];
     sc_rq_head = (sc_rq_head + 1) % SC_MAX_THREADS;
     return id;
 }
 
-static int create_thread(thread_fn entry, void* arg, int priority) {
+static inline int create_thread(thread_fn entry, void* arg, int priority) {
     if (!entry) return -1;
     if (sc_thread_count >= SC_MAX_THREADS) return -1;
     int best_cpu = 0;
@@ -112,7 +107,7 @@ static int create_thread(thread_fn entry, void* arg, int priority) {
     return id;
 }
 
-static void yield(void) {
+static inline void yield(void) {
     if (sc_current_thread < 0) return;
     int id = sc_current_thread;
     sc_threads[id].state = THREAD_READY;
@@ -120,7 +115,7 @@ static void yield(void) {
     sc_current_thread = -1;
 }
 
-static void complete_current_thread(void) {
+static inline void complete_current_thread(void) {
     if (sc_current_thread < 0) return;
     int id = sc_current_thread;
     sc_threads[id].state = THREAD_DONE;
@@ -128,7 +123,7 @@ static void complete_current_thread(void) {
     sc_current_thread = -1;
 }
 
-static void load_balance(void) {
+static inline void load_balance(void) {
     int min_cpu = 0, max_cpu = 0;
     for (int i = 1; i < sc_cpu_count; i++) {
         if (sc_cpu_load[i] < sc_cpu_load[min_cpu]) min_cpu = i;
@@ -145,7 +140,7 @@ static void load_balance(void) {
     }
 }
 
-static void schedule_process(void) {
+static inline void schedule_process(void) {
     int id = pop_rq();
     if (id < 0) return;
     if (sc_threads[id].state != THREAD_READY) {
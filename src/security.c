@@ -7,6 +7,12 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <string.h>
+#include "string_ops.h"
+
+/* Unaligned loads for the constant-time compare */
+typedef uint8_t security_v16_t __attribute__((vector_size(16), may_alias, aligned(1)));
+typedef uint64_t security_v2_t __attribute__((vector_size(16)));
+typedef size_t security_word_t __attribute__((may_alias, aligned(1)));
 
 /* Simple hash function for passwords (not cryptographically secure, for demonstration) */
 static uint32_t simple_hash(const char* str) {
@@ -76,16 +82,17 @@ bool security_init(void) {
     log_index = 0;
     log_count = 0;
     
+    /* security_create_user refuses to run before initialization */
+    security_state.is_initialized = true;
+    security_state.security_events_logged = 0;
+    security_state.security_violations_logged = 0;
+    
     /* Create default admin user */
     security_create_user("admin", "admin123", PRIVILEGE_ADMIN);
     
     /* Create default guest user */
     security_create_user("guest", "guest", PRIVILEGE_GUEST);
     
-    security_state.is_initialized = true;
-    security_state.security_events_logged = 0;
-    security_state.security_violations_logged = 0;
-    
     add_security_log_entry("SECURITY_INIT", "Security subsystem initialized", NULL);
     
     return true;
@@ -164,7 +171,7 @@ bool security_create_user(const char* username, const char* password, privilege_
     
     /* Store password hash (simplified) */
     uint8_t* hash_ptr = (uint8_t*)&hash;
-    for (int i = 0; i < sizeof(uint32_t) && i < MAX_PASSWORD_LENGTH; i++) {
+    for (size_t i = 0; i < sizeof(uint32_t) && i < MAX_PASSWORD_LENGTH; i++) {
         new_user->password_hash[i] = hash_ptr[i];
     }
     
@@ -412,12 +419,13 @@ bool security_check_buffer_bounds(const void* buffer, size_t size, const void* p
 /* Check memory access */
 bool security_check_memory_access(const void* address, size_t size, memory_protection_t access_type) {
     /* Simplified implementation - in real OS this would check page tables */
+    (void)access_type;  /* no page tables to hold permissions yet */
     if (!address || size == 0) {
         return false;
     }
     
     /* Check for overflow in address calculation */
-    uint32_t start_addr = (uint32_t)address;
+    uint32_t start_addr = (uint32_t)(uintptr_t)address;
     uint32_t end_addr = start_addr + size;
     
     if (end_addr < start_addr) {
@@ -438,7 +446,7 @@ bool security_validate_kernel_pointer(const void* ptr) {
         return false;
     }
     
-    uint32_t addr = (uint32_t)ptr;
+    uint32_t addr = (uint32_t)(uintptr_t)ptr;
     
     /* Check if pointer is in kernel space */
     if (addr < 0x100000 || addr >= 0x1000000) {
@@ -546,7 +554,40 @@ uint32_t security_hash_password(const char* password) {
     return simple_hash(password);
 }
 
-/* Constant time comparison */
+/* OR of a[i] ^ b[i] over length bytes: 16 at a time, then the rest one by
+   one. There are no early exits, so the loads and instructions depend on
+   length alone, never on the data. */
+__attribute__((target("sse2")))
+static uint32_t difference_sse2(const uint8_t* a, const uint8_t* b, size_t length) {
+    security_v16_t blocks = {0};
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        blocks |= *(const security_v16_t*)(a + i) ^ *(const security_v16_t*)(b + i);
+    }
+    security_v2_t halves = (security_v2_t)blocks;
+    uint64_t folded = halves[0] | halves[1];
+    uint32_t result = (uint32_t)folded | (uint32_t)(folded >> 32);
+    for (; i < length; i++) {
+        result |= a[i] ^ b[i];
+    }
+    return result;
+}
+
+/* The same a word at a time, for CPUs without SSE2 */
+static uint32_t difference_words(const uint8_t* a, const uint8_t* b, size_t length) {
+    size_t words = 0;
+    size_t i = 0;
+    for (; i + sizeof(size_t) <= length; i += sizeof(size_t)) {
+        words |= *(const security_word_t*)(a + i) ^ *(const security_word_t*)(b + i);
+    }
+    uint32_t result = (uint32_t)words | (uint32_t)((uint64_t)words >> 32);
+    for (; i < length; i++) {
+        result |= a[i] ^ b[i];
+    }
+    return result;
+}
+
+/* Constant time comparison; the path taken depends on the CPU only */
 bool security_constant_time_compare(const void* a, const void* b, size_t length) {
     if (!a || !b) {
         return false;
@@ -554,26 +595,20 @@ bool security_constant_time_compare(const void* a, const void* b, size_t length)
     
     const uint8_t* a_bytes = (const uint8_t*)a;
     const uint8_t* b_bytes = (const uint8_t*)b;
-    uint8_t result = 0;
-    
-    for (size_t i = 0; i < length; i++) {
-        result |= a_bytes[i] ^ b_bytes[i];
-    }
-    
+    uint32_t result = (string_cpu_features() & STRING_CPU_SSE2) ? difference_sse2(a_bytes, b_bytes, length)
+                                                                : difference_words(a_bytes, b_bytes, length);
     return result == 0;
 }
 
-/* Zero memory securely */
+/* Zero memory securely: wide stores, then a barrier that tells the
+   compiler the zeros are read, so the stores are never dropped as dead */
 void security_zero_memory(void* ptr, size_t size) {
     if (!ptr || size == 0) {
         return;
     }
     
-    volatile uint8_t* volatile_ptr = (volatile uint8_t*)ptr;
-    
-    for (size_t i = 0; i < size; i++) {
-        volatile_ptr[i] = 0;
-    }
+    string_memset(ptr, 0, size);
+    __asm__ __volatile__("" : : "r"(ptr) : "memory");
 }
 
 /* Check if string is printable */
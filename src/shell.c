@@ -403,8 +403,8 @@ void run_shell(void) {
         }
         
         /* Clear sensitive data */
-        for (int i = 0; i < MAX_USERNAME_LENGTH; i++) username[i] = 0;
-        for (int i = 0; i < MAX_PASSWORD_LENGTH; i++) password[i] = 0;
+        security_zero_memory(username, sizeof(username));
+        security_zero_memory(password, sizeof(password));
     }
     
     if (!authenticated) {
@@ -508,9 +508,7 @@ void run_shell(void) {
         execute_command(command_buffer);
         
         /* Clear command buffer for security */
-        for (int i = 0; i < MAX_COMMAND_LENGTH; i++) {
-            command_buffer[i] = 0;
-        }
+        security_zero_memory(command_buffer, sizeof(command_buffer));
     }
 }
 
@@ -612,6 +610,9 @@ static void display_error(const char* operation, int32_t error_code) {
         case ERR_FILE_SYSTEM_INIT_FAILED:
             print("file system initialization failed");
             break;
+        case ERR_TOO_MANY_OPEN_FILES:
+            print("too many open files");
+            break;
         case ERR_IO_TIMEOUT:
             print("I/O timeout");
             break;
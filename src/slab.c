@@ -0,0 +1,367 @@
+/* slab.c - Object cache (slab) allocator
+   Each cache carves single kernel-owned pages from allocate_kernel_memory,
+   so any user's thread may free an object, into equally sized,
+   aligned object slots. A slab header at the start of the page holds a free
+   bitmap, so allocation is a bit scan over a handful of words and freeing is
+   a single bit flip. Slabs move between partial/full/empty lists so the
+   allocator never walks more than the head of a list. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "slab.h"
+#include "memory_management.h"
+#include "error_codes.h"
+#include "scalability.h"
+
+#define KMEM_MAX_OBJECTS     (PAGE_SIZE / KMEM_MIN_OBJECT_SIZE)
+#define KMEM_MAP_WORDS       (KMEM_MAX_OBJECTS / 64)
+#define KMEM_EMPTY_SLABS_KEPT 1     /* empty slabs cached before pages are returned */
+#define KMEM_SIZE_CLASSES    8      /* 16 .. 2048 bytes */
+
+typedef struct kmem_slab {
+    kmem_cache_t* cache;
+    struct kmem_slab* next;
+    struct kmem_slab* prev;
+    uint32_t in_use;
+    uint64_t free_map[KMEM_MAP_WORDS];  /* bit set = object slot is free */
+} kmem_slab_t;
+
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LENGTH];
+    uint32_t object_size;
+    uint32_t objects_per_slab;
+    uint32_t first_offset;      /* offset of object 0 within the slab page */
+    kmem_ctor_t ctor;
+    kmem_slab_t* partial;       /* slabs with at least one free object */
+    kmem_slab_t* full;
+    kmem_slab_t* empty;
+    uint32_t empty_count;
+    uint32_t slab_count;
+    uint32_t active_objects;
+    uint64_t total_allocations;
+    sc_lock_t lock;
+    uint8_t used;
+};
+
+static kmem_cache_t kmem_caches[MAX_KMEM_CACHES];
+static sc_lock_t kmem_caches_lock = 0;  /* claiming and releasing kmem_caches slots */
+static kmem_cache_t* kmem_size_caches[KMEM_SIZE_CLASSES];
+static const char* const kmem_size_names[KMEM_SIZE_CLASSES] = {
+    "kmem-16", "kmem-32", "kmem-64", "kmem-128",
+    "kmem-256", "kmem-512", "kmem-1024", "kmem-2048"
+};
+
+/* Round value up to a power-of-two boundary */
+static inline uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+/* Slab lists are doubly linked so a slab can be moved in O(1) */
+static void slab_list_push(kmem_slab_t** list, kmem_slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static void slab_list_remove(kmem_slab_t** list, kmem_slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/* Object address for a slot index */
+static inline uint8_t* slab_object(kmem_cache_t* cache, kmem_slab_t* slab, uint32_t index) {
+    return (uint8_t*)slab + cache->first_offset + index * cache->object_size;
+}
+
+/* Grab a fresh page, build its free map and run the constructor */
+static kmem_slab_t* slab_create(kmem_cache_t* cache) {
+    kmem_slab_t* slab = (kmem_slab_t*)allocate_kernel_memory(PAGE_SIZE);
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->in_use = 0;
+    for (uint32_t w = 0; w < KMEM_MAP_WORDS; w++) {
+        uint32_t first = w * 64;
+        if (first >= cache->objects_per_slab) {
+            slab->free_map[w] = 0;
+        } else if (cache->objects_per_slab - first >= 64) {
+            slab->free_map[w] = ~(uint64_t)0;
+        } else {
+            slab->free_map[w] = ((uint64_t)1 << (cache->objects_per_slab - first)) - 1;
+        }
+    }
+
+    if (cache->ctor) {
+        for (uint32_t i = 0; i < cache->objects_per_slab; i++) {
+            cache->ctor(slab_object(cache, slab, i));
+        }
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+/* Return a slab page to the page allocator */
+static void slab_destroy(kmem_cache_t* cache, kmem_slab_t* slab) {
+    cache->slab_count--;
+    free_kernel_memory(slab);
+}
+
+/* Create a cache of fixed-size objects */
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                uint32_t flags, kmem_ctor_t ctor) {
+    if (!name || size == 0 || size > KMEM_MAX_OBJECT_SIZE) {
+        return NULL;
+    }
+
+    /* Alignment: at least 8 bytes, a cache line when requested, power of two */
+    uint32_t object_align = 8;
+    while (object_align < align) {
+        object_align <<= 1;
+    }
+    if ((flags & KMEM_FLAG_HWALIGN) && object_align < KMEM_CACHE_LINE_SIZE) {
+        object_align = KMEM_CACHE_LINE_SIZE;
+    }
+    if (object_align > PAGE_SIZE / 2) {
+        return NULL;
+    }
+
+    uint32_t object_size = size < KMEM_MIN_OBJECT_SIZE ? KMEM_MIN_OBJECT_SIZE : (uint32_t)size;
+    object_size = align_up(object_size, object_align);
+    uint32_t first_offset = align_up(sizeof(kmem_slab_t), object_align);
+    uint32_t objects = (PAGE_SIZE - first_offset) / object_size;
+    if (objects == 0) {
+        return NULL;
+    }
+    if (objects > KMEM_MAX_OBJECTS) {
+        objects = KMEM_MAX_OBJECTS;
+    }
+
+    sc_lock_acquire(&kmem_caches_lock);
+    kmem_cache_t* cache = NULL;
+    for (uint32_t i = 0; i < MAX_KMEM_CACHES; i++) {
+        if (!kmem_caches[i].used) {
+            cache = &kmem_caches[i];
+            break;
+        }
+    }
+    if (!cache) {
+        sc_lock_release(&kmem_caches_lock);
+        return NULL;
+    }
+
+    uint32_t n = 0;
+    while (name[n] && n < KMEM_CACHE_NAME_LENGTH - 1) {
+        cache->name[n] = name[n];
+        n++;
+    }
+    cache->name[n] = '\0';
+    cache->object_size = object_size;
+    cache->objects_per_slab = objects;
+    cache->first_offset = first_offset;
+    cache->ctor = ctor;
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->empty_count = 0;
+    cache->slab_count = 0;
+    cache->active_objects = 0;
+    cache->total_allocations = 0;
+    cache->lock = 0;
+    cache->used = 1;
+    sc_lock_release(&kmem_caches_lock);
+    return cache;
+}
+
+/* Destroy an empty cache */
+int32_t kmem_cache_destroy(kmem_cache_t* cache) {
+    if (!cache || !cache->used) {
+        return ERR_NULL_POINTER;
+    }
+
+    sc_lock_acquire(&cache->lock);
+    if (cache->active_objects != 0) {
+        sc_lock_release(&cache->lock);
+        return ERR_INVALID_STATE;
+    }
+
+    while (cache->empty) {
+        kmem_slab_t* slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        slab_destroy(cache, slab);
+    }
+    cache->empty_count = 0;
+    sc_lock_acquire(&kmem_caches_lock);
+    cache->used = 0;
+    sc_lock_release(&kmem_caches_lock);
+    sc_lock_release(&cache->lock);
+    return ERR_SUCCESS;
+}
+
+/* Allocate one object */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    if (!cache || !cache->used) {
+        return NULL;
+    }
+
+    sc_lock_acquire(&cache->lock);
+
+    /* Prefer partially used slabs, then cached empty ones, then a new page */
+    kmem_slab_t* slab = cache->partial;
+    if (!slab) {
+        if (cache->empty) {
+            slab = cache->empty;
+            slab_list_remove(&cache->empty, slab);
+            cache->empty_count--;
+        } else {
+            slab = slab_create(cache);
+            if (!slab) {
+                sc_lock_release(&cache->lock);
+                return NULL;
+            }
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    uint32_t w = 0;
+    while (slab->free_map[w] == 0) {
+        w++;
+    }
+    uint32_t bit = (uint32_t)__builtin_ctzll(slab->free_map[w]);
+    slab->free_map[w] &= ~((uint64_t)1 << bit);
+    slab->in_use++;
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    cache->active_objects++;
+    cache->total_allocations++;
+    void* object = slab_object(cache, slab, w * 64 + bit);
+    sc_lock_release(&cache->lock);
+    return object;
+}
+
+/* Return an object to its cache */
+void kmem_cache_free(kmem_cache_t* cache, void* object) {
+    if (!cache || !object) {
+        return;
+    }
+
+    kmem_slab_t* slab = (kmem_slab_t*)((uintptr_t)object & ~(uintptr_t)(PAGE_SIZE - 1));
+    if (slab->cache != cache) {
+        return; /* Not one of ours, ignore */
+    }
+
+    uint32_t offset = (uint32_t)((uint8_t*)object - (uint8_t*)slab);
+    if (offset < cache->first_offset || (offset - cache->first_offset) % cache->object_size != 0) {
+        return; /* Not the start of an object slot */
+    }
+    uint32_t index = (offset - cache->first_offset) / cache->object_size;
+    if (index >= cache->objects_per_slab) {
+        return;
+    }
+
+    sc_lock_acquire(&cache->lock);
+    uint64_t mask = (uint64_t)1 << (index & 63);
+    if (slab->free_map[index >> 6] & mask) {
+        sc_lock_release(&cache->lock);
+        return; /* Double free, ignore */
+    }
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    slab->free_map[index >> 6] |= mask;
+    slab->in_use--;
+    cache->active_objects--;
+
+    /* Keep a small number of empty slabs around to absorb alloc/free churn */
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty_count < KMEM_EMPTY_SLABS_KEPT) {
+            slab_list_push(&cache->empty, slab);
+            cache->empty_count++;
+        } else {
+            slab_destroy(cache, slab);
+        }
+    }
+    sc_lock_release(&cache->lock);
+}
+
+/* Read cache statistics */
+int32_t kmem_cache_get_stats(kmem_cache_t* cache, kmem_cache_stats_t* stats) {
+    if (!cache || !stats || !cache->used) {
+        return ERR_NULL_POINTER;
+    }
+
+    stats->name = cache->name;
+    stats->object_size = cache->object_size;
+    stats->objects_per_slab = cache->objects_per_slab;
+    stats->slab_count = cache->slab_count;
+    stats->active_objects = cache->active_objects;
+    stats->total_allocations = cache->total_allocations;
+    return ERR_SUCCESS;
+}
+
+/* Initialize the generic size-class caches. Classes up to a cache line are
+   aligned to their size, larger ones to a cache line: aligning those to
+   their size would only push object 0 further past the slab header. */
+void kmem_init(void) {
+    uint32_t size = KMEM_MIN_OBJECT_SIZE;
+    for (uint32_t i = 0; i < KMEM_SIZE_CLASSES; i++) {
+        uint32_t flags = size >= KMEM_CACHE_LINE_SIZE ? KMEM_FLAG_HWALIGN : KMEM_FLAG_NONE;
+        uint32_t align = size < KMEM_CACHE_LINE_SIZE ? size : KMEM_CACHE_LINE_SIZE;
+        kmem_size_caches[i] = kmem_cache_create(kmem_size_names[i], size, align, flags, NULL);
+        size <<= 1;
+    }
+}
+
+/* General-purpose allocation */
+void* kmem_alloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (size > KMEM_MAX_OBJECT_SIZE) {
+        return allocate_kernel_memory(size); /* Large objects get whole pages */
+    }
+
+    uint32_t index = 0;
+    size_t class_size = KMEM_MIN_OBJECT_SIZE;
+    while (class_size < size) {
+        class_size <<= 1;
+        index++;
+    }
+    return kmem_cache_alloc(kmem_size_caches[index]);
+}
+
+/* General-purpose free; slab objects never sit at a page boundary */
+void kmem_free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    if (((uintptr_t)ptr & (PAGE_SIZE - 1)) == 0) {
+        free_kernel_memory(ptr);
+        return;
+    }
+
+    kmem_slab_t* slab = (kmem_slab_t*)((uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1));
+    kmem_cache_free(slab->cache, ptr);
+}
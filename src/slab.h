@@ -0,0 +1,60 @@
+/* slab.h - Object cache (slab) allocator layered over the page allocator */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cache limits */
+#define MAX_KMEM_CACHES          32
+#define KMEM_CACHE_NAME_LENGTH   32
+#define KMEM_MIN_OBJECT_SIZE     16
+#define KMEM_MAX_OBJECT_SIZE     2048
+#define KMEM_CACHE_LINE_SIZE     64
+
+/* Cache creation flags */
+#define KMEM_FLAG_NONE       0x0
+#define KMEM_FLAG_HWALIGN    0x1     /* align objects to a cache line */
+
+/* Object constructor, run once per object when a slab is populated.
+   Objects must be returned to the cache in their constructed state. */
+typedef void (*kmem_ctor_t)(void* object);
+
+/* Opaque cache handle */
+typedef struct kmem_cache kmem_cache_t;
+
+/* Cache statistics */
+typedef struct {
+    const char* name;
+    uint32_t object_size;       /* stride between objects, including padding */
+    uint32_t objects_per_slab;
+    uint32_t slab_count;
+    uint32_t active_objects;
+    uint64_t total_allocations;
+} kmem_cache_stats_t;
+
+/* Initialize the generic size-class caches used by kmem_alloc */
+void kmem_init(void);
+
+/* Create a cache of fixed-size objects; returns NULL on failure */
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                uint32_t flags, kmem_ctor_t ctor);
+
+/* Destroy an empty cache and return its slabs to the page allocator */
+int32_t kmem_cache_destroy(kmem_cache_t* cache);
+
+/* Allocate one object from a cache in O(1) */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/* Return an object to its cache */
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+
+/* Read cache statistics */
+int32_t kmem_cache_get_stats(kmem_cache_t* cache, kmem_cache_stats_t* stats);
+
+/* General-purpose allocation from the power-of-two size-class caches */
+void* kmem_alloc(size_t size);
+void kmem_free(void* ptr);
+
+#endif /* SLAB_H */
@@ -0,0 +1,93 @@
+/* spinlock.h - Spinning locks for short critical sections
+   sc_lock_t is a test-and-set lock. sc_rwlock_t lets any number of readers
+   in at once, or one writer; a writer that is waiting keeps new readers
+   out, so a steady stream of them cannot starve it. Neither may be taken
+   recursively. Waiters spin with sc_cpu_relax, which in the hosted build
+   yields the processor: there the holder is a thread that may have been
+   preempted, and spinning would only keep it from running.
+
+   Where locks nest, they are taken in this order:
+     file system  tree_lock, File.lock, op_lock, alloc_lock, then the
+                  block cache lock (file_system.h, block_cache.h).
+                  File.ra_lock and the dentry cache set locks are leaves:
+                  no other lock is taken while one is held, so read-ahead
+                  maps and fetches its window after releasing ra_lock.
+     page frames  a per-CPU magazine lock, then mm_lock. */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#ifdef S00K_HOSTED
+#include <sched.h>
+#endif
+
+typedef volatile int sc_lock_t;
+typedef volatile int sc_rwlock_t;
+
+#define SC_RWLOCK_WRITER 0x40000000     /* Set by a writer; the low bits count readers */
+
+static inline void sc_cpu_relax(void) {
+#ifdef S00K_HOSTED
+    sched_yield();
+#else
+    __asm__ __volatile__("pause" ::: "memory");
+#endif
+}
+
+static inline void sc_lock_acquire(sc_lock_t* lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            sc_cpu_relax();
+        }
+    }
+}
+
+static inline void sc_lock_release(sc_lock_t* lock) {
+    __sync_lock_release(lock);
+}
+
+static inline void sc_rwlock_read_lock(sc_rwlock_t* lock) {
+    for (;;) {
+        int value = __atomic_load_n(lock, __ATOMIC_RELAXED);
+        if (!(value & SC_RWLOCK_WRITER) && __sync_bool_compare_and_swap(lock, value, value + 1)) {
+            return;
+        }
+        sc_cpu_relax();
+    }
+}
+
+static inline void sc_rwlock_read_unlock(sc_rwlock_t* lock) {
+    __sync_fetch_and_sub(lock, 1);
+}
+
+/* Claim the writer bit, then wait for the readers already inside to leave */
+static inline void sc_rwlock_write_lock(sc_rwlock_t* lock) {
+    for (;;) {
+        int value = __atomic_load_n(lock, __ATOMIC_RELAXED);
+        if (!(value & SC_RWLOCK_WRITER) &&
+            __sync_bool_compare_and_swap(lock, value, value | SC_RWLOCK_WRITER)) {
+            break;
+        }
+        sc_cpu_relax();
+    }
+    while (__atomic_load_n(lock, __ATOMIC_ACQUIRE) != SC_RWLOCK_WRITER) {
+        sc_cpu_relax();
+    }
+}
+
+static inline void sc_rwlock_write_unlock(sc_rwlock_t* lock) {
+    __sync_fetch_and_sub(lock, SC_RWLOCK_WRITER);
+}
+
+/* Turn the caller's read lock into the write lock, which only works while
+   no other reader is inside and no writer waits; nonzero on success */
+static inline int sc_rwlock_try_upgrade(sc_rwlock_t* lock) {
+    return __sync_bool_compare_and_swap(lock, 1, SC_RWLOCK_WRITER);
+}
+
+/* Turn the write lock back into a read lock without letting a writer in between */
+static inline void sc_rwlock_downgrade(sc_rwlock_t* lock) {
+    __sync_fetch_and_add(lock, 1 - SC_RWLOCK_WRITER);
+}
+
+#endif /* SPINLOCK_H */
@@ -0,0 +1,55 @@
+/* spsc_ring.h - Lock-free single-producer, single-consumer byte ring
+   One side only pushes and the other only pops, so neither needs a lock:
+   the producer alone writes head and the consumer alone writes tail, and
+   each publishes its index with a release store after touching the data
+   the index covers. The producer may be an interrupt handler and the
+   consumer the code it interrupts, or two threads on different CPUs.
+
+   Indices run freely and wrap at 2^32; head - tail is the fill level, so
+   all SPSC_RING_SIZE slots are usable. A push onto a full ring drops the
+   byte and counts it rather than overwrite unread data. */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPSC_RING_SIZE 256      /* Power of two */
+
+typedef struct {
+    uint8_t data[SPSC_RING_SIZE];
+    uint32_t head;              /* Next slot to fill; written by the producer */
+    uint32_t tail;              /* Next slot to drain; written by the consumer */
+    uint32_t dropped;           /* Pushes refused while full; producer only */
+} spsc_ring_t;
+
+/* Producer side */
+static inline bool spsc_ring_push(spsc_ring_t* ring, uint8_t byte) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == SPSC_RING_SIZE) {
+        ring->dropped++;
+        return false;
+    }
+    ring->data[head & (SPSC_RING_SIZE - 1)] = byte;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Consumer side */
+static inline bool spsc_ring_pop(spsc_ring_t* ring, uint8_t* byte) {
+    uint32_t tail = ring->tail;
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    *byte = ring->data[tail & (SPSC_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Consumer side; a push may make it stale as soon as it returns */
+static inline bool spsc_ring_empty(spsc_ring_t* ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail;
+}
+
+#endif /* SPSC_RING_H */
@@ -1,9 +1,108 @@
-/* string.c - Simple string utility functions */
+/* string.c - Memory and string functions for the kernel
+   Every function comes in several versions (see string_ops.h): byte loops
+   that run anywhere, word-at-a-time versions, SSE2 and AVX2 versions
+   written with GCC vector extensions, so no intrinsics headers are needed,
+   and rep movsb/stosb for ERMS CPUs. The wide versions never load bytes
+   from a page the caller did not hand over: copies and fills stay inside
+   the buffer, strlen reads aligned blocks, and strcmp only reads a block
+   from both strings when neither block crosses a page boundary. */
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <cpuid.h>
+#include "string_ops.h"
 
-/* Simple memset implementation */
-void* memset(void* dest, int value, size_t count) {
+/* Keep GCC from turning the loops below back into calls to memcpy/memset */
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+
+#define STRING_PAGE_SIZE    4096
+
+/* CPUID bits */
+#define CPUID_1_EDX_SSE2    (1u << 26)
+#define CPUID_1_ECX_XSAVE   (1u << 26)
+#define CPUID_1_ECX_OSXSAVE (1u << 27)
+#define CPUID_1_ECX_AVX     (1u << 28)
+#define CPUID_7_EBX_AVX2    (1u << 5)
+#define CPUID_7_EBX_ERMS    (1u << 9)
+
+/* XCR0: register state the OS saves, and so lets programs use */
+#define XCR0_X87            0x1u
+#define XCR0_SSE            0x2u
+#define XCR0_AVX            0x4u
+
+/* Unaligned, aliasing loads and stores */
+typedef size_t string_word_t __attribute__((may_alias, aligned(1)));
+typedef uint64_t string_u64_t __attribute__((may_alias, aligned(1)));
+typedef uint32_t string_u32_t __attribute__((may_alias, aligned(1)));
+typedef char string_v16_t __attribute__((vector_size(16), may_alias, aligned(1)));
+typedef char string_v16a_t __attribute__((vector_size(16), may_alias));
+typedef char string_v32_t __attribute__((vector_size(32), may_alias, aligned(1)));
+typedef char string_v32a_t __attribute__((vector_size(32), may_alias));
+
+#define WORD_SIZE   sizeof(size_t)
+#define WORD_ONES   ((size_t)-1 / 0xFF)     /* 0x01 in every byte */
+#define WORD_HIGHS  (WORD_ONES << 7)        /* 0x80 in every byte */
+
+/* Nonzero if any byte of word is zero */
+static inline size_t word_has_zero(size_t word) {
+    return (word - WORD_ONES) & ~word & WORD_HIGHS;
+}
+
+/* One bit per byte of a vector compare: set where the bytes matched */
+#define MASK16(compare) ((uint32_t)__builtin_ia32_pmovmskb128((string_v16a_t)(compare)))
+#define MASK32(compare) ((uint32_t)__builtin_ia32_pmovmskb256((string_v32a_t)(compare)))
+
+/* Whether a block of size bytes at p stays inside its page */
+#define WITHIN_PAGE(p, size) (((uintptr_t)(p) & (STRING_PAGE_SIZE - 1)) <= STRING_PAGE_SIZE - (size))
+
+/* Copies and fills of fewer than 16 bytes, as two overlapping moves */
+static inline void copy_small(uint8_t* d, const uint8_t* s, size_t count) {
+    if (count >= 8) {
+        uint64_t first = *(const string_u64_t*)s;
+        uint64_t last = *(const string_u64_t*)(s + count - 8);
+        *(string_u64_t*)d = first;
+        *(string_u64_t*)(d + count - 8) = last;
+    } else if (count >= 4) {
+        uint32_t first = *(const string_u32_t*)s;
+        uint32_t last = *(const string_u32_t*)(s + count - 4);
+        *(string_u32_t*)d = first;
+        *(string_u32_t*)(d + count - 4) = last;
+    } else if (count) {
+        d[0] = s[0];
+        d[count / 2] = s[count / 2];
+        d[count - 1] = s[count - 1];
+    }
+}
+
+static inline void fill_small(uint8_t* d, uint8_t value, size_t count) {
+    if (count >= 8) {
+        uint64_t pattern = 0x0101010101010101ull * value;
+        *(string_u64_t*)d = pattern;
+        *(string_u64_t*)(d + count - 8) = pattern;
+    } else if (count >= 4) {
+        uint32_t pattern = 0x01010101u * value;
+        *(string_u32_t*)d = pattern;
+        *(string_u32_t*)(d + count - 4) = pattern;
+    } else if (count) {
+        d[0] = value;
+        d[count / 2] = value;
+        d[count - 1] = value;
+    }
+}
+
+/* Byte loops */
+
+static void* copy_bytes(void* dest, const void* src, size_t count) {
+    unsigned char* d = (unsigned char*)dest;
+    const unsigned char* s = (const unsigned char*)src;
+    while (count--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+static void* fill_bytes(void* dest, int value, size_t count) {
     unsigned char* p = (unsigned char*)dest;
     while (count--) {
         *p++ = (unsigned char)value;
@@ -11,16 +110,441 @@ void* memset(void* dest, int value, size_t count) {
     return dest;
 }
 
-/* Simple memcpy implementation */
-void* memcpy(void* dest, const void* src, size_t count) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
+static size_t length_bytes(const char* str) {
+    size_t len = 0;
+    while (str[len]) len++;
+    return len;
+}
+
+static int compare_bytes(const char* str1, const char* str2) {
+    while (*str1 && *str1 == *str2) {
+        str1++;
+        str2++;
+    }
+    return *(unsigned char*)str1 - *(unsigned char*)str2;
+}
+
+/* Word at a time: stores are aligned, and strings are read in aligned
+   words, which cannot cross a page */
+
+static void* copy_words(void* dest, const void* src, size_t count) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    for (; count && ((uintptr_t)d & (WORD_SIZE - 1)); count--) {
+        *d++ = *s++;
+    }
+    for (; count >= 4 * WORD_SIZE; count -= 4 * WORD_SIZE, d += 4 * WORD_SIZE, s += 4 * WORD_SIZE) {
+        size_t w0 = ((const string_word_t*)s)[0], w1 = ((const string_word_t*)s)[1];
+        size_t w2 = ((const string_word_t*)s)[2], w3 = ((const string_word_t*)s)[3];
+        ((string_word_t*)d)[0] = w0;
+        ((string_word_t*)d)[1] = w1;
+        ((string_word_t*)d)[2] = w2;
+        ((string_word_t*)d)[3] = w3;
+    }
+    for (; count >= WORD_SIZE; count -= WORD_SIZE, d += WORD_SIZE, s += WORD_SIZE) {
+        *(string_word_t*)d = *(const string_word_t*)s;
+    }
     while (count--) {
         *d++ = *s++;
     }
     return dest;
 }
 
+static void* fill_words(void* dest, int value, size_t count) {
+    uint8_t* d = dest;
+    size_t pattern = WORD_ONES * (uint8_t)value;
+    for (; count && ((uintptr_t)d & (WORD_SIZE - 1)); count--) {
+        *d++ = (uint8_t)value;
+    }
+    for (; count >= 4 * WORD_SIZE; count -= 4 * WORD_SIZE, d += 4 * WORD_SIZE) {
+        ((string_word_t*)d)[0] = pattern;
+        ((string_word_t*)d)[1] = pattern;
+        ((string_word_t*)d)[2] = pattern;
+        ((string_word_t*)d)[3] = pattern;
+    }
+    for (; count >= WORD_SIZE; count -= WORD_SIZE, d += WORD_SIZE) {
+        *(string_word_t*)d = pattern;
+    }
+    while (count--) {
+        *d++ = (uint8_t)value;
+    }
+    return dest;
+}
+
+static size_t length_words(const char* str) {
+    const char* p = str;
+    for (; (uintptr_t)p & (WORD_SIZE - 1); p++) {
+        if (!*p) {
+            return (size_t)(p - str);
+        }
+    }
+    while (!word_has_zero(*(const string_word_t*)p)) {
+        p += WORD_SIZE;
+    }
+    while (*p) {
+        p++;
+    }
+    return (size_t)(p - str);
+}
+
+/* Strings at the same offset within a word are compared a word at a time */
+static int compare_words(const char* str1, const char* str2) {
+    const unsigned char* a = (const unsigned char*)str1;
+    const unsigned char* b = (const unsigned char*)str2;
+    if ((((uintptr_t)a ^ (uintptr_t)b) & (WORD_SIZE - 1)) == 0) {
+        for (; (uintptr_t)a & (WORD_SIZE - 1); a++, b++) {
+            if (!*a || *a != *b) {
+                return *a - *b;
+            }
+        }
+        for (;;) {
+            size_t word = *(const string_word_t*)a;
+            if (word != *(const string_word_t*)b || word_has_zero(word)) {
+                break;
+            }
+            a += WORD_SIZE;
+            b += WORD_SIZE;
+        }
+    }
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a - *b;
+}
+
+/* SSE2: unaligned first and last blocks, aligned stores in between */
+
+__attribute__((target("sse2")))
+static void* copy_sse2(void* dest, const void* src, size_t count) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    if (count < 16) {
+        copy_small(d, s, count);
+        return dest;
+    }
+    string_v16_t first = *(const string_v16_t*)s;
+    string_v16_t last = *(const string_v16_t*)(s + count - 16);
+    uint8_t* end = d + count - 16;
+    size_t skip = 16 - ((uintptr_t)d & 15);
+    uint8_t* out = d + skip;
+    const uint8_t* in = s + skip;
+    for (; out + 64 <= end; out += 64, in += 64) {
+        string_v16_t v0 = ((const string_v16_t*)in)[0], v1 = ((const string_v16_t*)in)[1];
+        string_v16_t v2 = ((const string_v16_t*)in)[2], v3 = ((const string_v16_t*)in)[3];
+        ((string_v16a_t*)out)[0] = v0;
+        ((string_v16a_t*)out)[1] = v1;
+        ((string_v16a_t*)out)[2] = v2;
+        ((string_v16a_t*)out)[3] = v3;
+    }
+    for (; out < end; out += 16, in += 16) {
+        *(string_v16a_t*)out = *(const string_v16_t*)in;
+    }
+    *(string_v16_t*)d = first;
+    *(string_v16_t*)end = last;
+    return dest;
+}
+
+__attribute__((target("sse2")))
+static void* fill_sse2(void* dest, int value, size_t count) {
+    uint8_t* d = dest;
+    if (count < 16) {
+        fill_small(d, (uint8_t)value, count);
+        return dest;
+    }
+    string_v16_t pattern = (string_v16_t){0} + (char)value;
+    uint8_t* end = d + count - 16;
+    uint8_t* out = d + 16 - ((uintptr_t)d & 15);
+    for (; out + 64 <= end; out += 64) {
+        ((string_v16a_t*)out)[0] = pattern;
+        ((string_v16a_t*)out)[1] = pattern;
+        ((string_v16a_t*)out)[2] = pattern;
+        ((string_v16a_t*)out)[3] = pattern;
+    }
+    for (; out < end; out += 16) {
+        *(string_v16a_t*)out = pattern;
+    }
+    *(string_v16_t*)d = pattern;
+    *(string_v16_t*)end = pattern;
+    return dest;
+}
+
+__attribute__((target("sse2")))
+static size_t length_sse2(const char* str) {
+    const string_v16a_t zero = {0};
+    uint32_t offset = (uintptr_t)str & 15;
+    const string_v16a_t* block = (const string_v16a_t*)(str - offset);
+    uint32_t mask = MASK16(*block == zero) >> offset;
+    if (mask) {
+        return __builtin_ctz(mask);
+    }
+    do {
+        block++;
+        mask = MASK16(*block == zero);
+    } while (!mask);
+    return (size_t)((const char*)block - str) + __builtin_ctz(mask);
+}
+
+__attribute__((target("sse2")))
+static int compare_sse2(const char* str1, const char* str2) {
+    const string_v16_t zero = {0};
+    const unsigned char* a = (const unsigned char*)str1;
+    const unsigned char* b = (const unsigned char*)str2;
+    for (;;) {
+        if (WITHIN_PAGE(a, 16) && WITHIN_PAGE(b, 16)) {
+            string_v16_t va = *(const string_v16_t*)a;
+            string_v16_t vb = *(const string_v16_t*)b;
+            uint32_t same = MASK16(va == vb) & ~MASK16(va == zero);   /* equal, not the end */
+            if (same != 0xFFFF) {
+                uint32_t i = __builtin_ctz(~same);
+                return a[i] - b[i];
+            }
+            a += 16;
+            b += 16;
+        } else {
+            if (!*a || *a != *b) {
+                return *a - *b;
+            }
+            a++;
+            b++;
+        }
+    }
+}
+
+/* AVX2: as SSE2 with 32-byte blocks */
+
+__attribute__((target("avx2")))
+static void* copy_avx2(void* dest, const void* src, size_t count) {
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    if (count < 32) {
+        if (count >= 16) {
+            string_v16_t first = *(const string_v16_t*)s;
+            string_v16_t last = *(const string_v16_t*)(s + count - 16);
+            *(string_v16_t*)d = first;
+            *(string_v16_t*)(d + count - 16) = last;
+        } else {
+            copy_small(d, s, count);
+        }
+        return dest;
+    }
+    string_v32_t first = *(const string_v32_t*)s;
+    string_v32_t last = *(const string_v32_t*)(s + count - 32);
+    uint8_t* end = d + count - 32;
+    size_t skip = 32 - ((uintptr_t)d & 31);
+    uint8_t* out = d + skip;
+    const uint8_t* in = s + skip;
+    for (; out + 128 <= end; out += 128, in += 128) {
+        string_v32_t v0 = ((const string_v32_t*)in)[0], v1 = ((const string_v32_t*)in)[1];
+        string_v32_t v2 = ((const string_v32_t*)in)[2], v3 = ((const string_v32_t*)in)[3];
+        ((string_v32a_t*)out)[0] = v0;
+        ((string_v32a_t*)out)[1] = v1;
+        ((string_v32a_t*)out)[2] = v2;
+        ((string_v32a_t*)out)[3] = v3;
+    }
+    for (; out < end; out += 32, in += 32) {
+        *(string_v32a_t*)out = *(const string_v32_t*)in;
+    }
+    *(string_v32_t*)d = first;
+    *(string_v32_t*)end = last;
+    return dest;
+}
+
+__attribute__((target("avx2")))
+static void* fill_avx2(void* dest, int value, size_t count) {
+    uint8_t* d = dest;
+    if (count < 32) {
+        if (count >= 16) {
+            string_v16_t pattern = (string_v16_t){0} + (char)value;
+            *(string_v16_t*)d = pattern;
+            *(string_v16_t*)(d + count - 16) = pattern;
+        } else {
+            fill_small(d, (uint8_t)value, count);
+        }
+        return dest;
+    }
+    string_v32_t pattern = (string_v32_t){0} + (char)value;
+    uint8_t* end = d + count - 32;
+    uint8_t* out = d + 32 - ((uintptr_t)d & 31);
+    for (; out + 128 <= end; out += 128) {
+        ((string_v32a_t*)out)[0] = pattern;
+        ((string_v32a_t*)out)[1] = pattern;
+        ((string_v32a_t*)out)[2] = pattern;
+        ((string_v32a_t*)out)[3] = pattern;
+    }
+    for (; out < end; out += 32) {
+        *(string_v32a_t*)out = pattern;
+    }
+    *(string_v32_t*)d = pattern;
+    *(string_v32_t*)end = pattern;
+    return dest;
+}
+
+__attribute__((target("avx2")))
+static size_t length_avx2(const char* str) {
+    const string_v32a_t zero = {0};
+    uint32_t offset = (uintptr_t)str & 31;
+    const string_v32a_t* block = (const string_v32a_t*)(str - offset);
+    uint32_t mask = MASK32(*block == zero) >> offset;
+    if (mask) {
+        return __builtin_ctz(mask);
+    }
+    do {
+        block++;
+        mask = MASK32(*block == zero);
+    } while (!mask);
+    return (size_t)((const char*)block - str) + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2")))
+static int compare_avx2(const char* str1, const char* str2) {
+    const string_v32_t zero = {0};
+    const unsigned char* a = (const unsigned char*)str1;
+    const unsigned char* b = (const unsigned char*)str2;
+    for (;;) {
+        if (WITHIN_PAGE(a, 32) && WITHIN_PAGE(b, 32)) {
+            string_v32_t va = *(const string_v32_t*)a;
+            string_v32_t vb = *(const string_v32_t*)b;
+            uint32_t same = MASK32(va == vb) & ~MASK32(va == zero);   /* equal, not the end */
+            if (same != 0xFFFFFFFFu) {
+                uint32_t i = __builtin_ctz(~same);
+                return a[i] - b[i];
+            }
+            a += 32;
+            b += 32;
+        } else {
+            if (!*a || *a != *b) {
+                return *a - *b;
+            }
+            a++;
+            b++;
+        }
+    }
+}
+
+/* ERMS: the microcode moves whole cache lines once the count is large */
+
+static void* copy_erms(void* dest, const void* src, size_t count) {
+    void* d = dest;
+    __asm__ __volatile__("rep movsb" : "+D"(d), "+S"(src), "+c"(count) : : "memory");
+    return dest;
+}
+
+static void* fill_erms(void* dest, int value, size_t count) {
+    void* d = dest;
+    __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(count) : "a"(value) : "memory");
+    return dest;
+}
+
+const string_variant_t string_variants[STRING_VARIANT_COUNT] = {
+    { "bytes", 0,               copy_bytes, fill_bytes, length_bytes, compare_bytes },
+    { "words", 0,               copy_words, fill_words, length_words, compare_words },
+    { "sse2",  STRING_CPU_SSE2, copy_sse2,  fill_sse2,  length_sse2,  compare_sse2  },
+    { "avx2",  STRING_CPU_AVX2, copy_avx2,  fill_avx2,  length_avx2,  compare_avx2  },
+    { "erms",  STRING_CPU_ERMS, copy_erms,  fill_erms,  NULL,         NULL          },
+};
+
+static uint32_t cpu_features = 0;
+static const string_variant_t* selected = &string_variants[1];
+static size_t erms_min = SIZE_MAX;
+
+#ifndef S00K_HOSTED
+/* Let the kernel use SSE, and with XSAVE AVX: no FPU emulation, FXSAVE and
+   SIMD exceptions enabled, and the AVX state switched on in XCR0. Nothing
+   saves these registers across interrupts, so interrupt handlers must not
+   call the functions in this file. */
+static void enable_simd(uint32_t cpuid_1_ecx) {
+    uintptr_t cr0, cr4;                         /* native width, 64 bits on x86-64 */
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~(uintptr_t)0x4) | 0x2u;       /* clear EM, set MP */
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(cr0));
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= 0x600u;                              /* OSFXSR, OSXMMEXCPT */
+    if (cpuid_1_ecx & CPUID_1_ECX_XSAVE) {
+        cr4 |= 0x40000u;                        /* OSXSAVE */
+    }
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4));
+    if (cpuid_1_ecx & CPUID_1_ECX_XSAVE) {
+        uint32_t xcr0 = XCR0_X87 | XCR0_SSE | ((cpuid_1_ecx & CPUID_1_ECX_AVX) ? XCR0_AVX : 0);
+        __asm__ __volatile__("xsetbv" : : "c"(0), "a"(xcr0), "d"(0));
+    }
+}
+#endif
+
+/* Select the widest versions this CPU runs */
+uint32_t string_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t features = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+#ifndef S00K_HOSTED
+        if (edx & CPUID_1_EDX_SSE2) {
+            enable_simd(ecx);
+            __get_cpuid(1, &eax, &ebx, &ecx, &edx);     /* OSXSAVE now reflects CR4 */
+        }
+#endif
+        if (edx & CPUID_1_EDX_SSE2) {
+            features |= STRING_CPU_SSE2;
+        }
+        bool avx_state = false;
+        if ((ecx & (CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX)) == (CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX)) {
+            uint32_t xcr0_low, xcr0_high;
+            __asm__ __volatile__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+            avx_state = (xcr0_low & (XCR0_SSE | XCR0_AVX)) == (XCR0_SSE | XCR0_AVX);
+        }
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            if ((ebx & CPUID_7_EBX_AVX2) && avx_state && (features & STRING_CPU_SSE2)) {
+                features |= STRING_CPU_AVX2;
+            }
+            if (ebx & CPUID_7_EBX_ERMS) {
+                features |= STRING_CPU_ERMS;
+            }
+        }
+    }
+
+    cpu_features = features;
+    selected = (features & STRING_CPU_AVX2) ? &string_variants[3] :
+               (features & STRING_CPU_SSE2) ? &string_variants[2] : &string_variants[1];
+    erms_min = (features & STRING_CPU_ERMS) ? STRING_ERMS_MIN : SIZE_MAX;
+    return features;
+}
+
+uint32_t string_cpu_features(void) {
+    return cpu_features;
+}
+
+void* string_memcpy(void* dest, const void* src, size_t count) {
+    if (count >= erms_min) {
+        return copy_erms(dest, src, count);
+    }
+    return selected->copy(dest, src, count);
+}
+
+void* string_memset(void* dest, int value, size_t count) {
+    if (count >= erms_min) {
+        return fill_erms(dest, value, count);
+    }
+    return selected->fill(dest, value, count);
+}
+
+size_t string_strlen(const char* str) {
+    return selected->length(str);
+}
+
+int string_strcmp(const char* str1, const char* str2) {
+    return selected->compare(str1, str2);
+}
+
+#ifndef S00K_HOSTED
+/* The kernel's C library functions; hosted builds keep their own */
+
+void* memset(void* dest, int value, size_t count) {
+    return string_memset(dest, value, count);
+}
+
+void* memcpy(void* dest, const void* src, size_t count) {
+    return string_memcpy(dest, src, count);
+}
+
 /* Simple strcpy implementation */
 char* strcpy(char* dest, const char* src) {
     char* original = dest;
@@ -28,18 +552,11 @@ char* strcpy(char* dest, const char* src) {
     return original;
 }
 
-/* Simple strlen implementation */
 size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len]) len++;
-    return len;
+    return string_strlen(str);
 }
 
-/* Simple strcmp implementation */
 int strcmp(const char* str1, const char* str2) {
-    while (*str1 && *str1 == *str2) {
-        str1++;
-        str2++;
-    }
-    return *(unsigned char*)str1 - *(unsigned char*)str2;
-}
\ No newline at end of file
+    return string_strcmp(str1, str2);
+}
+#endif
@@ -0,0 +1,54 @@
+/* string_ops.h - Memory and string primitives tuned to the CPU
+   string.c gives the kernel memcpy, memset, strlen and strcmp. Each comes
+   as a byte loop, a word-at-a-time version and SSE2 and AVX2 versions;
+   string_init reads CPUID once at boot and routes the functions to the
+   widest version the CPU supports. On CPUs with ERMS (fast rep movsb),
+   copies and fills of STRING_ERMS_MIN bytes or more use rep movsb and
+   rep stosb instead. Until string_init runs the word versions are used.
+
+   Hosted builds keep the C library's functions; the versions here are
+   still built and reachable through string_variants and string_memcpy and
+   friends, for the benchmarks. */
+
+#ifndef STRING_OPS_H
+#define STRING_OPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CPU features the versions depend on */
+#define STRING_CPU_SSE2     0x1
+#define STRING_CPU_AVX2     0x2
+#define STRING_CPU_ERMS     0x4
+
+#define STRING_ERMS_MIN     2048    /* Smallest copy or fill sent to rep movsb/stosb */
+
+/* One implementation of the four functions; a NULL slot means the variant
+   has no version of that function */
+typedef struct {
+    const char* name;
+    uint32_t features;          /* STRING_CPU_* bits it needs */
+    void* (*copy)(void* dest, const void* src, size_t count);
+    void* (*fill)(void* dest, int value, size_t count);
+    size_t (*length)(const char* str);
+    int (*compare)(const char* str1, const char* str2);
+} string_variant_t;
+
+/* Byte loops, words, SSE2, AVX2 and ERMS, in that order */
+#define STRING_VARIANT_COUNT 5
+extern const string_variant_t string_variants[STRING_VARIANT_COUNT];
+
+/* Detect the CPU's features (enabling SSE and AVX state in the kernel) and
+   select the versions used from then on; returns the STRING_CPU_* bits */
+uint32_t string_init(void);
+
+/* STRING_CPU_* bits found by string_init */
+uint32_t string_cpu_features(void);
+
+/* The selected versions; the kernel's memcpy, memset, strlen and strcmp */
+void* string_memcpy(void* dest, const void* src, size_t count);
+void* string_memset(void* dest, int value, size_t count);
+size_t string_strlen(const char* str);
+int string_strcmp(const char* str1, const char* str2);
+
+#endif /* STRING_OPS_H */
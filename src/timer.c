@@ -0,0 +1,210 @@
+/* timer.c - PIT tick source, TSC calibration and timer wheel
+   See timer.h. The wheel is shared between the tick interrupt and the
+   code arming timers, so changes to it run with interrupts disabled. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "timer.h"
+#include "interrupts.h"
+
+/* Runs with interrupts masked in the kernel; hosted code is single threaded */
+#ifndef S00K_HOSTED
+#define TIMER_LOCK()        uintptr_t timer_flags = interrupts_save()
+#define TIMER_UNLOCK()      interrupts_restore(timer_flags)
+#else
+#define TIMER_LOCK()        do { } while (0)
+#define TIMER_UNLOCK()      do { } while (0)
+#endif
+
+#if TIMER_HZ % 1000 != 0
+#error "timer_add converts milliseconds to ticks by a whole factor"
+#endif
+
+#define TSC_SHIFT           24      /* Fraction bits of tsc_ns_mult */
+
+static timer_event_t* wheel[TIMER_WHEEL_SLOTS];
+static volatile uint64_t ticks;
+
+/* Nanoseconds per TSC cycle, fixed point with TSC_SHIFT fraction bits */
+static uint32_t tsc_khz;
+static uint64_t tsc_ns_mult;
+
+uint64_t timer_ticks(void) {
+    TIMER_LOCK();
+    uint64_t now = ticks;
+    TIMER_UNLOCK();
+    return now;
+}
+
+void timer_tick(void) {
+    uint64_t now = ticks + 1;
+    ticks = now;
+    timer_event_t* event = wheel[now & (TIMER_WHEEL_SLOTS - 1)];
+    while (event) {
+        timer_event_t* next = event->next;
+        if (event->expires <= now) {
+            if (event->prev) {
+                event->prev->next = event->next;
+            } else {
+                wheel[now & (TIMER_WHEEL_SLOTS - 1)] = event->next;
+            }
+            if (event->next) {
+                event->next->prev = event->prev;
+            }
+            event->pending = false;
+            event->callback(event->arg);
+        }
+        event = next;
+    }
+}
+
+void timer_add(timer_event_t* event, uint32_t delay_ms, timer_callback_t callback, void* arg) {
+    if (!event || !callback) {
+        return;
+    }
+    TIMER_LOCK();
+    /* The current tick is already partly over, so count from the next */
+    event->expires = ticks + (uint64_t)delay_ms * (TIMER_HZ / 1000) + 1;
+    event->callback = callback;
+    event->arg = arg;
+    event->pending = true;
+    timer_event_t** slot = &wheel[event->expires & (TIMER_WHEEL_SLOTS - 1)];
+    event->prev = NULL;
+    event->next = *slot;
+    if (*slot) {
+        (*slot)->prev = event;
+    }
+    *slot = event;
+    TIMER_UNLOCK();
+}
+
+bool timer_cancel(timer_event_t* event) {
+    if (!event) {
+        return false;
+    }
+    TIMER_LOCK();
+    bool pending = event->pending;
+    if (pending) {
+        if (event->prev) {
+            event->prev->next = event->next;
+        } else {
+            wheel[event->expires & (TIMER_WHEEL_SLOTS - 1)] = event->next;
+        }
+        if (event->next) {
+            event->next->prev = event->prev;
+        }
+        event->pending = false;
+    }
+    TIMER_UNLOCK();
+    return pending;
+}
+
+void timer_set_flag(void* arg) {
+    *(volatile bool*)arg = true;
+}
+
+/* 64-by-32-bit division without libgcc's __udivdi3; only used at init */
+static uint64_t divide_u64(uint64_t dividend, uint32_t divisor) {
+    uint64_t quotient = 0;
+    uint64_t remainder = 0;
+    for (int bit = 63; bit >= 0; bit--) {
+        remainder = (remainder << 1) | ((dividend >> bit) & 1);
+        if (remainder >= divisor) {
+            remainder -= divisor;
+            quotient |= 1ull << bit;
+        }
+    }
+    return quotient;
+}
+
+void timer_set_tsc_khz(uint32_t khz) {
+    tsc_khz = khz;
+    tsc_ns_mult = khz ? divide_u64(1000000ull << TSC_SHIFT, khz) : 0;
+}
+
+uint32_t timer_tsc_khz(void) {
+    return tsc_khz;
+}
+
+/* cycles * mult >> TSC_SHIFT in two 32x32-bit halves, so the product
+   cannot overflow for any realistic uptime */
+uint64_t timer_cycles_to_ns(uint64_t cycles) {
+    uint64_t high = (cycles >> 32) * tsc_ns_mult;
+    uint64_t low = (cycles & 0xFFFFFFFFu) * tsc_ns_mult;
+    return (high << (32 - TSC_SHIFT)) + (low >> TSC_SHIFT);
+}
+
+#ifndef S00K_HOSTED
+
+/* x86 I/O port operations */
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+/* 8253/8254 PIT */
+#define PIT_FREQUENCY       1193182
+#define PIT_CHANNEL0        0x40
+#define PIT_CHANNEL2        0x42
+#define PIT_COMMAND         0x43
+#define PIT_GATE_PORT       0x61    /* bit 0 gates channel 2, bit 1 the speaker, bit 5 reads OUT2 */
+#define PIT_RATE_GENERATOR  0x34    /* Channel 0, low then high byte, mode 2 */
+#define PIT_ONE_SHOT        0xB0    /* Channel 2, low then high byte, mode 0 */
+#define PIT_DIVISOR         ((PIT_FREQUENCY + TIMER_HZ / 2) / TIMER_HZ)
+
+#define CALIBRATE_MS        50
+#define CALIBRATE_COUNT     (PIT_FREQUENCY * CALIBRATE_MS / 1000)
+
+INTERRUPT_HANDLER static void timer_interrupt(struct interrupt_frame* frame) {
+    (void)frame;
+    timer_tick();
+    interrupts_end_of_irq(IRQ_TIMER);
+}
+
+/* Count TSC cycles while PIT channel 2 counts down CALIBRATE_MS, polling
+   its output rather than waiting for interrupts */
+static uint32_t calibrate_tsc_khz(void) {
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (uint8_t)((gate & ~0x02) | 0x01));
+    outb(PIT_COMMAND, PIT_ONE_SHOT);
+    outb(PIT_CHANNEL2, CALIBRATE_COUNT & 0xFF);
+    outb(PIT_CHANNEL2, CALIBRATE_COUNT >> 8);
+    uint64_t start = timer_read_tsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+    }
+    uint64_t cycles = timer_read_tsc() - start;
+    outb(PIT_GATE_PORT, gate);
+    /* 50 ms of cycles fits in 32 bits below 85 GHz */
+    return (uint32_t)cycles / CALIBRATE_MS;
+}
+
+void timer_init(void) {
+    timer_set_tsc_khz(calibrate_tsc_khz());
+
+    outb(PIT_COMMAND, PIT_RATE_GENERATOR);
+    outb(PIT_CHANNEL0, PIT_DIVISOR & 0xFF);
+    outb(PIT_CHANNEL0, PIT_DIVISOR >> 8);
+    interrupts_set_irq_handler(IRQ_TIMER, timer_interrupt);
+}
+
+void timer_sleep_ms(uint32_t ms) {
+    volatile bool done = false;
+    timer_event_t event;
+    timer_add(&event, ms, timer_set_flag, (void*)&done);
+    for (;;) {
+        interrupts_disable();
+        if (done) {
+            break;
+        }
+        interrupts_enable_and_wait();
+    }
+    interrupts_enable();
+}
+
+#endif /* S00K_HOSTED */
@@ -0,0 +1,77 @@
+/* timer.h - PIT tick source, TSC clock and timer wheel
+   timer_init programs PIT channel 0 to interrupt TIMER_HZ times a second
+   and counts the interrupts in a 64-bit monotonic tick counter. It also
+   measures the TSC rate against PIT channel 2, after which TSC readings
+   convert to nanoseconds with one fixed-point multiply
+   (profiler_get_current_time_ns uses this).
+
+   Sleeps and timeouts are timer_event_t entries in a hashed wheel of
+   TIMER_WHEEL_SLOTS one-tick slots, indexed by expiry tick. Adding or
+   cancelling an entry is O(1), and each tick only looks at one slot.
+   Entries more than a lap away stay in their slot until their tick comes
+   round. Callbacks run inside the timer interrupt: they must be short,
+   may add timers, and must not cancel other timers.
+
+   The hosted build has no PIT: the wheel and the TSC conversion are built
+   for the benchmarks, which advance the clock with timer_tick. */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_HZ            1000    /* Ticks per second; one tick is 1 ms */
+#define TIMER_WHEEL_SLOTS   256     /* Power of two */
+
+typedef void (*timer_callback_t)(void* arg);
+
+typedef struct timer_event {
+    struct timer_event* next;
+    struct timer_event* prev;
+    uint64_t expires;               /* Tick it fires on */
+    timer_callback_t callback;
+    void* arg;
+    bool pending;                   /* In the wheel, not yet fired */
+} timer_event_t;
+
+#ifndef S00K_HOSTED
+/* Start the tick interrupt and calibrate the TSC; needs interrupts_init.
+   Ticks begin once interrupts are enabled. */
+void timer_init(void);
+
+/* Sleep in hlt for at least ms milliseconds; needs interrupts enabled */
+void timer_sleep_ms(uint32_t ms);
+#endif
+
+/* Ticks since timer_init */
+uint64_t timer_ticks(void);
+
+/* Advance the clock one tick and fire the timers due; the tick interrupt's
+   work, called directly by hosted code */
+void timer_tick(void);
+
+/* Arm event to call callback(arg) at least delay_ms from now. The event
+   must stay valid, and not be re-added, until it fires or is cancelled. */
+void timer_add(timer_event_t* event, uint32_t delay_ms, timer_callback_t callback, void* arg);
+
+/* Disarm event; false if it already fired or was never added */
+bool timer_cancel(timer_event_t* event);
+
+/* Callback that sets the volatile bool arg points to, for waits that sleep
+   until either their event or a timeout happens */
+void timer_set_flag(void* arg);
+
+/* TSC rate used for conversions: measured by timer_init, or set directly.
+   Conversions return 0 until a rate is known. */
+void timer_set_tsc_khz(uint32_t khz);
+uint32_t timer_tsc_khz(void);
+uint64_t timer_cycles_to_ns(uint64_t cycles);
+
+static inline uint64_t timer_read_tsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif /* TIMER_H */
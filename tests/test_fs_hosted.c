@@ -0,0 +1,735 @@
+/* test_fs_hosted.c - File system behaviour tests against the real code
+   The Unity suites in this directory exercise mocks; these link against
+   libs00k_core.a, the kernel's allocator, block cache and file system
+   built for user space (see bench/bench.h), and check what each part
+   promises, one test per feature. Build and run them with `make
+   test-hosted` (part of `make test`). Set TEST_IMAGE to place the disk
+   images somewhere other than the build directory; the crash test checks
+   each recovered image with fsck.s00k. */
+
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "block_cache.h"
+#include "file_system.h"
+
+#define RAM_SIZE          (16u * 1024 * 1024)
+#define IMAGE_MIB         8
+#define BIG_FILE_SIZE     (2u * 1024 * 1024)   /* well into the double indirect block */
+
+#define CRASH_FILES       48
+#define CRASH_OPS         400
+#define CRASH_SYNC_EVERY  16
+#define CRASH_POINTS      96
+#define CRASH_MAX_SIZE    (24 * 1024)
+
+static int checks_failed;
+static int tests_failed;
+
+/* Record a failed check and carry on with the rest of the test */
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "  FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            checks_failed++; \
+        } \
+    } while (0)
+
+static FileSystem fs;
+static uint8_t ram[RAM_SIZE];
+static uint8_t contents[BIG_FILE_SIZE];
+static uint8_t buffer[BIG_FILE_SIZE];
+static const char* image_path;
+
+/* Byte at offset of the file numbered seed; any prefix of a file has
+   exactly one valid content */
+static void fill(uint32_t seed, uint32_t offset, uint8_t* out, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        out[i] = (uint8_t)((offset + i) * 7 + seed * 13 + ((offset + i) >> 9));
+    }
+}
+
+static uint32_t next_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/* New file called name in parent holding size bytes of fill(seed) */
+static int32_t make_file(const char* name, uint32_t parent, uint32_t seed, uint32_t size) {
+    int32_t index = fs_create_file(&fs, name, parent);
+    fill(seed, 0, contents, size);
+    if (index >= 0 && size && fs_write_file(&fs, (uint32_t)index, contents, size, 0) != (int32_t)size) {
+        return -1;
+    }
+    return index;
+}
+
+/* Whether the file holds exactly size bytes of fill(seed) */
+static bool file_matches(int32_t index, uint32_t seed, uint32_t size) {
+    File info;
+    if (index < 0 || fs_get_file_info(&fs, (uint32_t)index, &info) != FS_SUCCESS || info.size != size) {
+        return false;
+    }
+    fill(seed, 0, contents, size);
+    return fs_read_file(&fs, (uint32_t)index, buffer, size, 0) == (int32_t)size && memcmp(buffer, contents, size) == 0;
+}
+
+/* Free blocks once every deferred free has been committed */
+static uint32_t settled_free_blocks(void) {
+    return fs_sync(&fs) == FS_SUCCESS ? fs.free_block_count : 0;
+}
+
+/* Blocks come from the bitmap in runs and go back on delete */
+static void test_block_allocator(void) {
+    CHECK(fs_init(&fs, ram, IMAGE_MIB * 1024 * 1024) == FS_SUCCESS);
+    uint32_t start = settled_free_blocks();
+
+    /* Eight direct blocks and the 120 behind the indirect block */
+    int32_t file = make_file("extent", 0, 1, 128 * BLOCK_SIZE);
+    File info;
+    CHECK(fs_get_file_info(&fs, (uint32_t)file, &info) == FS_SUCCESS);
+    CHECK(info.block_count == 128);
+    for (uint32_t i = 1; i < FS_DIRECT_BLOCKS; i++) {
+        CHECK(info.blocks[i] == info.blocks[0] + i);
+    }
+    CHECK(settled_free_blocks() == start - 129);
+
+    /* Blocks freed in a transaction are reused only after it commits */
+    CHECK(fs_delete(&fs, (uint32_t)file) == FS_SUCCESS);
+    CHECK(settled_free_blocks() == start);
+
+    /* A device's worth of data fails cleanly and leaves nothing behind */
+    file = fs_create_file(&fs, "huge", 0);
+    fill(2, 0, contents, BIG_FILE_SIZE);
+    int32_t written = 0;
+    for (uint32_t offset = 0; written >= 0 && offset < 4 * BIG_FILE_SIZE; offset += BIG_FILE_SIZE) {
+        written = fs_write_file(&fs, (uint32_t)file, contents, BIG_FILE_SIZE, offset);
+    }
+    CHECK(written < 0);
+    CHECK(fs_delete(&fs, (uint32_t)file) == FS_SUCCESS);
+    CHECK(settled_free_blocks() == start);
+    fs_destroy(&fs);
+}
+
+/* Names resolve per directory through the hash index, and stay right as
+   entries come and go */
+static void test_name_index(void) {
+    CHECK(fs_init(&fs, ram, IMAGE_MIB * 1024 * 1024) == FS_SUCCESS);
+    int32_t a = fs_create_directory(&fs, "a", 0);
+    int32_t b = fs_create_directory(&fs, "b", 0);
+    CHECK(a > 0 && b > 0 && a != b);
+    CHECK(fs_create_directory(&fs, "a", 0) < 0);
+
+    char name[MAX_FILENAME_LENGTH];
+    static int32_t in_a[300];
+    static int32_t in_b[300];
+    for (uint32_t i = 0; i < 300; i++) {
+        snprintf(name, sizeof(name), "n%u", i);
+        in_a[i] = fs_create_file(&fs, name, (uint32_t)a);
+        in_b[i] = fs_create_file(&fs, name, (uint32_t)b);
+        CHECK(in_a[i] >= 0 && in_b[i] >= 0 && in_a[i] != in_b[i]);
+    }
+    for (uint32_t i = 0; i < 300; i += 2) {
+        CHECK(fs_delete(&fs, (uint32_t)in_a[i]) == FS_SUCCESS);
+    }
+    for (uint32_t i = 0; i < 300; i++) {
+        snprintf(name, sizeof(name), "n%u", i);
+        CHECK(i % 2 ? fs_find_file(&fs, name, (uint32_t)a) == in_a[i] : fs_find_file(&fs, name, (uint32_t)a) < 0);
+        CHECK(fs_find_file(&fs, name, (uint32_t)b) == in_b[i]);
+    }
+    CHECK(fs_find_file(&fs, "n0", 0) < 0);
+
+    /* Listings keep creation order */
+    static File entries[300];
+    CHECK(fs_list_directory(&fs, (uint32_t)a, entries, 300) == 150);
+    for (uint32_t i = 0; i < 150; i++) {
+        snprintf(name, sizeof(name), "n%u", 2 * i + 1);
+        CHECK(strcmp(entries[i].name, name) == 0);
+    }
+
+    /* A directory with children cannot go; an empty one can */
+    CHECK(fs_delete(&fs, (uint32_t)a) != FS_SUCCESS);
+    for (uint32_t i = 1; i < 300; i += 2) {
+        CHECK(fs_delete(&fs, (uint32_t)in_a[i]) == FS_SUCCESS);
+    }
+    CHECK(fs_delete(&fs, (uint32_t)a) == FS_SUCCESS);
+    CHECK(fs_find_file(&fs, "a", 0) < 0);
+    fs_destroy(&fs);
+}
+
+/* Files past the direct and single indirect blocks, more entries than the
+   old fixed table held, and the size limit */
+static void test_large_files(void) {
+    CHECK(fs_init(&fs, ram, RAM_SIZE) == FS_SUCCESS);
+    uint32_t start = settled_free_blocks();
+    int32_t file = fs_create_file(&fs, "big", 0);
+    fill(3, 0, contents, BIG_FILE_SIZE);
+    /* Unaligned pieces, the last starting inside the double indirect range */
+    CHECK(fs_write_file(&fs, (uint32_t)file, contents, 1000, 0) == 1000);
+    CHECK(fs_write_file(&fs, (uint32_t)file, contents + 1000, 70000, 1000) == 70000);
+    CHECK(fs_write_file(&fs, (uint32_t)file, contents + 71000, BIG_FILE_SIZE - 71000, 71000) ==
+          (int32_t)(BIG_FILE_SIZE - 71000));
+    CHECK(file_matches(file, 3, BIG_FILE_SIZE));
+    CHECK(fs_read_file(&fs, (uint32_t)file, buffer, 100, BIG_FILE_SIZE - 40) == 40);
+
+    CHECK(fs_write_file(&fs, (uint32_t)file, contents, 20, MAX_FILE_SIZE - 10) < 0);
+    CHECK(file_matches(file, 3, BIG_FILE_SIZE));
+    CHECK(fs_delete(&fs, (uint32_t)file) == FS_SUCCESS);
+    CHECK(settled_free_blocks() == start);
+
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "small%u", i);
+        CHECK(make_file(name, 0, i, i * 3) >= 0);
+    }
+    for (uint32_t i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "small%u", i);
+        CHECK(file_matches(fs_find_file(&fs, name, 0), i, i * 3));
+    }
+    fs_destroy(&fs);
+}
+
+/* Writes stay in the cache until a flush or an eviction sends them on */
+static void test_block_cache(void) {
+    static uint8_t disk[64 * BLOCK_SIZE];
+    memset(disk, 0, sizeof(disk));
+    memory_block_device_t mem;
+    memory_block_device_init(&mem, disk, sizeof(disk));
+    block_cache_t cache;
+    CHECK(block_cache_init(&cache, &mem.device, 8) == FS_SUCCESS);
+
+    fill(4, 0, contents, BLOCK_SIZE);
+    CHECK(block_cache_write(&cache, 3, 0, contents, BLOCK_SIZE) == FS_SUCCESS);
+    CHECK(block_cache_read(&cache, 3, 0, buffer, BLOCK_SIZE) == FS_SUCCESS);
+    CHECK(memcmp(buffer, contents, BLOCK_SIZE) == 0);
+    CHECK(disk[3 * BLOCK_SIZE] == 0 && memcmp(disk + 3 * BLOCK_SIZE, contents, BLOCK_SIZE) != 0);
+    CHECK(block_cache_flush(&cache) == FS_SUCCESS);
+    CHECK(memcmp(disk + 3 * BLOCK_SIZE, contents, BLOCK_SIZE) == 0);
+
+    /* Four times the buffers: evictions write the dirty blocks back */
+    fill(5, 0, contents, 32 * BLOCK_SIZE);
+    for (uint32_t block = 0; block < 32; block++) {
+        CHECK(block_cache_write(&cache, 32 + block, 0, contents + block * BLOCK_SIZE, BLOCK_SIZE) == FS_SUCCESS);
+    }
+    CHECK(memcmp(disk + 32 * BLOCK_SIZE, contents, 24 * BLOCK_SIZE) == 0);
+    CHECK(block_cache_flush(&cache) == FS_SUCCESS);
+    CHECK(memcmp(disk + 32 * BLOCK_SIZE, contents, 32 * BLOCK_SIZE) == 0);
+
+    /* Partial writes keep the rest of the block */
+    uint8_t bytes[4] = { 1, 2, 3, 4 };
+    CHECK(block_cache_write(&cache, 40, 100, bytes, sizeof(bytes)) == FS_SUCCESS);
+    CHECK(block_cache_read(&cache, 40, 0, buffer, BLOCK_SIZE) == FS_SUCCESS);
+    CHECK(memcmp(buffer + 100, bytes, sizeof(bytes)) == 0);
+    CHECK(memcmp(buffer, contents + 8 * BLOCK_SIZE, 100) == 0);
+    uint64_t misses = cache.stats.misses;
+    CHECK(block_cache_read(&cache, 40, 0, buffer, BLOCK_SIZE) == FS_SUCCESS);
+    CHECK(cache.stats.misses == misses);
+    block_cache_destroy(&cache);
+}
+
+/* An image file keeps its blocks across close and reopen */
+static void test_image_device(void) {
+    file_block_device_t image;
+    CHECK(file_block_device_open(&image, image_path, 64, true) == FS_SUCCESS);
+    CHECK(image.device.block_count == 64);
+    fill(6, 0, contents, 64 * BLOCK_SIZE);
+    block_io_t segments[2] = {
+        { 0, 10, contents },
+        { 20, 44, contents + 20 * BLOCK_SIZE },
+    };
+    CHECK(block_device_write_batch(&image.device, segments, 2) == FS_SUCCESS);
+    CHECK(block_device_write(&image.device, 10, 10, contents + 10 * BLOCK_SIZE) == FS_SUCCESS);
+    CHECK(block_device_write(&image.device, 60, 8, contents) < 0);
+    CHECK(block_device_flush(&image.device) == FS_SUCCESS);
+    file_block_device_close(&image);
+
+    CHECK(file_block_device_open(&image, image_path, 0, false) == FS_SUCCESS);
+    CHECK(image.device.block_count == 64);
+    memset(buffer, 0, 64 * BLOCK_SIZE);
+    CHECK(block_device_read(&image.device, 0, 64, buffer) == FS_SUCCESS);
+    CHECK(memcmp(buffer, contents, 64 * BLOCK_SIZE) == 0);
+    CHECK(block_device_read(&image.device, 64, 1, buffer) < 0);
+    file_block_device_close(&image);
+    unlink(image_path);
+}
+
+/* A tree written to an image comes back after unmount and mount */
+static void test_mount(void) {
+    file_block_device_t image;
+    CHECK(file_block_device_open(&image, image_path, IMAGE_MIB * (1024 * 1024 / BLOCK_SIZE), true) == FS_SUCCESS);
+    CHECK(fs_mount(&fs, &image.device) != FS_SUCCESS);   /* nothing formatted yet */
+    CHECK(fs_mkfs(&image.device, 0) == FS_SUCCESS);
+    CHECK(fs_mount(&fs, &image.device) == FS_SUCCESS);
+    int32_t dir = fs_create_directory(&fs, "docs", 0);
+    CHECK(make_file("readme", (uint32_t)dir, 7, 5000) >= 0);
+    CHECK(make_file("large", (uint32_t)dir, 8, 300000) >= 0);
+    CHECK(make_file("empty", 0, 9, 0) >= 0);
+    uint32_t free_blocks = settled_free_blocks();
+    CHECK(fs_unmount(&fs) == FS_SUCCESS);
+
+    CHECK(fs_mount(&fs, &image.device) == FS_SUCCESS);
+    dir = fs_find_file(&fs, "docs", 0);
+    CHECK(dir > 0);
+    CHECK(file_matches(fs_find_file(&fs, "readme", (uint32_t)dir), 7, 5000));
+    CHECK(file_matches(fs_find_file(&fs, "large", (uint32_t)dir), 8, 300000));
+    CHECK(file_matches(fs_find_file(&fs, "empty", 0), 9, 0));
+    CHECK(fs.free_block_count == free_blocks);
+    File entries[4];
+    CHECK(fs_list_directory(&fs, (uint32_t)dir, entries, 4) == 2);
+    CHECK(fs_unmount(&fs) == FS_SUCCESS);
+    file_block_device_close(&image);
+    unlink(image_path);
+}
+
+/* Crash recovery: a fixed workload of creates, appends and deletes runs
+   over a device that stops writing after a given number of blocks, for
+   many such cut-off points. Each crashed image must mount (replaying the
+   journal), keep every file left alone since the last fs_sync as synced,
+   hold only valid contents and pass fsck.s00k. */
+typedef struct {
+    bool exists;
+    uint32_t size;
+} file_state_t;
+
+static file_state_t current[CRASH_FILES];
+static file_state_t synced[CRASH_FILES];
+static bool touched[CRASH_FILES];     /* Changed since the last completed fs_sync */
+
+/* The workload, stopping early once the device has crashed */
+static void crash_workload(bench_crash_device_t* crash) {
+    memset(current, 0, sizeof(current));
+    memset(synced, 0, sizeof(synced));
+    memset(touched, 0, sizeof(touched));
+    int32_t dir = fs_create_directory(&fs, "data", 0);
+    if (dir < 0 || fs_sync(&fs) != FS_SUCCESS) {
+        return;
+    }
+
+    uint32_t state = 5;
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t op = 0; op < CRASH_OPS && !crash->crashed; op++) {
+        uint32_t file = next_random(&state) % CRASH_FILES;
+        snprintf(name, sizeof(name), "f%02u", file);
+        file_state_t* f = &current[file];
+        if (f->exists && next_random(&state) % 4 == 0) {
+            if (fs_delete(&fs, (uint32_t)fs_find_file(&fs, name, (uint32_t)dir)) != FS_SUCCESS) {
+                return;
+            }
+            f->exists = false;
+            f->size = 0;
+        } else {
+            int32_t index = f->exists ? fs_find_file(&fs, name, (uint32_t)dir)
+                                      : fs_create_file(&fs, name, (uint32_t)dir);
+            uint32_t grow = 1 + next_random(&state) % 6000;
+            if (f->size + grow > CRASH_MAX_SIZE) {
+                grow = CRASH_MAX_SIZE - f->size;
+            }
+            f->exists = true;
+            fill(file, f->size, contents, grow);
+            if (index < 0 ||
+                (grow && fs_write_file(&fs, (uint32_t)index, contents, grow, f->size) != (int32_t)grow)) {
+                return;
+            }
+            f->size += grow;
+        }
+        touched[file] = true;
+
+        if (op % CRASH_SYNC_EVERY == CRASH_SYNC_EVERY - 1) {
+            if (fs_sync(&fs) != FS_SUCCESS || crash->crashed) {
+                return;   /* a sync cut short by the crash promises nothing */
+            }
+            memcpy(synced, current, sizeof(synced));
+            memset(touched, 0, sizeof(touched));
+        }
+    }
+}
+
+/* Mount the crashed image and check what survived; false on any loss */
+static bool crash_verify(block_device_t* device) {
+    if (fs_mount(&fs, device) != FS_SUCCESS) {
+        return false;
+    }
+    bool ok = true;
+    int32_t dir = fs_find_file(&fs, "data", 0);
+    char name[MAX_FILENAME_LENGTH];
+    for (uint32_t file = 0; dir >= 0 && file < CRASH_FILES; file++) {
+        snprintf(name, sizeof(name), "f%02u", file);
+        int32_t index = fs_find_file(&fs, name, (uint32_t)dir);
+        File info;
+        bool present = index >= 0 && fs_get_file_info(&fs, (uint32_t)index, &info) == FS_SUCCESS;
+        if (!touched[file] && (present != synced[file].exists || (present && info.size != synced[file].size))) {
+            ok = false;   /* lost a synced file */
+        }
+        if (present && !file_matches(index, file, info.size)) {
+            ok = false;
+        }
+    }
+    if (fs_unmount(&fs) != FS_SUCCESS) {
+        return false;
+    }
+    char command[512];
+    snprintf(command, sizeof(command), "./build/hosted/fsck.s00k %s > /dev/null", image_path);
+    return ok && system(command) == 0;
+}
+
+/* One workload run with the device failing after budget blocks; false if
+   the image did not recover. Sets written to the blocks written. */
+static bool crash_run(file_block_device_t* image, uint64_t budget, uint64_t* written) {
+    if (fs_mkfs(&image->device, 0) != FS_SUCCESS) {
+        return false;
+    }
+    bench_crash_device_t crash;
+    bench_crash_device_init(&crash, &image->device, budget);
+    if (fs_mount(&fs, &crash.device) != FS_SUCCESS) {
+        return false;
+    }
+    crash_workload(&crash);
+    fs_destroy(&fs);   /* after a crash nothing it writes reaches the image */
+    *written = crash.blocks_written;
+    if (crash.crashed && !crash_verify(&image->device)) {
+        fprintf(stderr, "  crash after %llu blocks not recovered\n", (unsigned long long)budget);
+        return false;
+    }
+    return true;
+}
+
+static void test_journal_recovery(void) {
+    file_block_device_t image;
+    CHECK(file_block_device_open(&image, image_path, IMAGE_MIB * (1024 * 1024 / BLOCK_SIZE), true) == FS_SUCCESS);
+
+    /* A run without a crash gives the range of cut-off points */
+    uint64_t total = 0;
+    uint64_t written;
+    CHECK(crash_run(&image, UINT64_MAX, &total) && total > 0);
+    for (uint32_t i = 0; total && i < CRASH_POINTS; i++) {
+        CHECK(crash_run(&image, total * i / CRASH_POINTS + i % 7, &written));
+    }
+
+    /* Committed but never written home: mount replays the transaction */
+    CHECK(fs_mkfs(&image.device, 0) == FS_SUCCESS);
+    bench_crash_device_t crash;
+    bench_crash_device_init(&crash, &image.device, UINT64_MAX);
+    CHECK(fs_mount(&fs, &crash.device) == FS_SUCCESS);
+    CHECK(make_file("replayed", 0, 10, 20000) >= 0);
+    CHECK(fs_sync(&fs) == FS_SUCCESS);
+    crash.crashed = true;
+    fs_destroy(&fs);
+    CHECK(fs_mount(&fs, &image.device) == FS_SUCCESS);
+    CHECK(fs.journal.stats.replayed_blocks > 0);
+    CHECK(file_matches(fs_find_file(&fs, "replayed", 0), 10, 20000));
+    CHECK(fs_unmount(&fs) == FS_SUCCESS);
+
+    file_block_device_close(&image);
+    unlink(image_path);
+}
+
+/* Mapped spans show the file's bytes in place, including later writes */
+static void test_map_file(void) {
+    CHECK(fs_init(&fs, ram, IMAGE_MIB * 1024 * 1024) == FS_SUCCESS);
+    uint32_t size = 80 * BLOCK_SIZE;
+    int32_t file = make_file("mapped", 0, 11, size);
+    CHECK(fs_sync(&fs) == FS_SUCCESS);
+
+    /* One call maps at most FS_MAP_MAX_BLOCKS blocks */
+    fs_span_t spans[FS_MAP_MAX_BLOCKS];
+    int32_t count = fs_map_file(&fs, (uint32_t)file, spans, FS_MAP_MAX_BLOCKS, size, 100);
+    CHECK(count > 0);
+    uint32_t mapped = 0;
+    for (int32_t i = 0; i < count; i++) {
+        memcpy(buffer + mapped, spans[i].data, spans[i].length);
+        mapped += spans[i].length;
+    }
+    CHECK(mapped == FS_MAP_MAX_BLOCKS * BLOCK_SIZE - 100);
+    CHECK(memcmp(buffer, contents + 100, mapped) == 0);
+
+    uint8_t byte = (uint8_t)~contents[100];
+    CHECK(fs_write_file(&fs, (uint32_t)file, &byte, 1, 100) == 1);
+    CHECK(spans[0].data[0] == byte);
+    fs_unmap_file(&fs, spans, (uint32_t)count);
+
+    /* The tail, and nothing past the end */
+    count = fs_map_file(&fs, (uint32_t)file, spans, FS_MAP_MAX_BLOCKS, size, size - 600);
+    CHECK(count > 0 && spans[0].length + (count > 1 ? spans[1].length : 0) == 600);
+    fs_unmap_file(&fs, spans, (uint32_t)(count > 0 ? count : 0));
+    CHECK(fs_map_file(&fs, (uint32_t)file, spans, FS_MAP_MAX_BLOCKS, 10, size) == 0);
+
+    for (uint32_t i = 0; i < fs.cache.buffer_count; i++) {
+        CHECK(fs.cache.buffers[i].pins == 0);
+    }
+    fs_destroy(&fs);
+}
+
+/* Scatter/gather and batches move the same bytes as single calls */
+static void test_vectored_io(void) {
+    CHECK(fs_init(&fs, ram, IMAGE_MIB * 1024 * 1024) == FS_SUCCESS);
+    int32_t file = fs_create_file(&fs, "vec", 0);
+    fill(12, 10, contents, 3701);
+    fs_span_t spans[3] = {
+        { contents, 700 },
+        { contents + 700, 1 },
+        { contents + 701, 3000 },
+    };
+    CHECK(fs_writev(&fs, (uint32_t)file, spans, 3, 10) == 3701);
+    File info;
+    CHECK(fs_get_file_info(&fs, (uint32_t)file, &info) == FS_SUCCESS && info.size == 3711);
+    CHECK(fs_read_file(&fs, (uint32_t)file, buffer, 3701, 10) == 3701);
+    CHECK(memcmp(buffer, contents, 3701) == 0);
+
+    static uint8_t first[1000];
+    static uint8_t second[4000];
+    fs_span_t into[2] = { { first, sizeof(first) }, { second, sizeof(second) } };
+    CHECK(fs_readv(&fs, (uint32_t)file, into, 2, 10) == 3701);   /* short at the end */
+    CHECK(memcmp(first, contents, 1000) == 0 && memcmp(second, contents + 1000, 2701) == 0);
+
+    /* Empty spans are skipped, with or without a buffer; a span with bytes
+       but no buffer fails the call before anything moves */
+    fs_span_t gaps[4] = { { NULL, 0 }, { first, 0 }, { first, 100 }, { NULL, 0 } };
+    CHECK(fs_readv(&fs, (uint32_t)file, gaps, 4, 10) == 100);
+    CHECK(memcmp(first, contents, 100) == 0);
+    CHECK(fs_writev(&fs, (uint32_t)file, gaps, 4, 3711) == 100);
+    CHECK(fs_get_file_info(&fs, (uint32_t)file, &info) == FS_SUCCESS && info.size == 3811);
+    fs_span_t broken[2] = { { first, 100 }, { NULL, 10 } };
+    CHECK(fs_writev(&fs, (uint32_t)file, broken, 2, 0) < 0);
+    CHECK(fs_readv(&fs, (uint32_t)file, broken, 2, 0) < 0);
+    CHECK(fs_get_file_info(&fs, (uint32_t)file, &info) == FS_SUCCESS && info.size == 3811);
+
+    int32_t other = fs_create_file(&fs, "other", 0);
+    static uint8_t read_back[3000];
+    fs_op_t ops[4] = {
+        { FS_OP_WRITE, (uint32_t)other, contents, 3000, 0, 0 },
+        { FS_OP_WRITE, (uint32_t)file, contents, 5, 3811, 0 },
+        { FS_OP_READ, (uint32_t)other, read_back, 3000, 0, 0 },
+        { FS_OP_READ, 99999, read_back, 10, 0, 0 },
+    };
+    CHECK(fs_batch(&fs, ops, 4) == 3);
+    CHECK(ops[0].result == 3000 && ops[1].result == 5 && ops[2].result == 3000 && ops[3].result < 0);
+    CHECK(memcmp(read_back, contents, 3000) == 0);
+    CHECK(fs_get_file_info(&fs, (uint32_t)file, &info) == FS_SUCCESS && info.size == 3816);
+    fs_destroy(&fs);
+}
+
+/* Handles: positions, seeks, gaps, the handle limit and delete while open */
+static void test_handles(void) {
+    CHECK(fs_init(&fs, ram, IMAGE_MIB * 1024 * 1024) == FS_SUCCESS);
+    int32_t file = fs_create_file(&fs, "handled", 0);
+    int32_t handle = fs_open(&fs, (uint32_t)file);
+    CHECK(handle >= 0);
+    fill(13, 0, contents, 3000);
+    CHECK(fs_write(&fs, handle, contents, 1000) == 1000);
+    CHECK(fs_write(&fs, handle, contents + 1000, 2000) == 2000);
+    CHECK(fs_seek(&fs, handle, 0, FS_SEEK_SET) == 0);
+    CHECK(fs_read(&fs, handle, buffer, 1500) == 1500);
+    CHECK(fs_read(&fs, handle, buffer + 1500, 3000) == 1500);
+    CHECK(memcmp(buffer, contents, 3000) == 0);
+    CHECK(fs_read(&fs, handle, buffer, 10) == 0);
+    CHECK(fs_seek(&fs, handle, -10, FS_SEEK_END) == 2990);
+    CHECK(fs_seek(&fs, handle, -90, FS_SEEK_CUR) == 2900);
+    CHECK(fs_seek(&fs, handle, -1, FS_SEEK_SET) < 0);
+
+    /* A write past the end fills the gap with zeros */
+    CHECK(fs_seek(&fs, handle, 5000, FS_SEEK_SET) == 5000);
+    CHECK(fs_write(&fs, handle, contents, 5) == 5);
+    CHECK(fs_read_file(&fs, (uint32_t)file, buffer, 2005, 3000) == 2005);
+    bool zeros = true;
+    for (uint32_t i = 0; i < 2000; i++) {
+        zeros = zeros && buffer[i] == 0;
+    }
+    CHECK(zeros && memcmp(buffer + 2000, contents, 5) == 0);
+
+    /* Only so many handles at once */
+    int32_t handles[FS_MAX_OPEN_FILES];
+    uint32_t opened = 1;
+    while (opened < FS_MAX_OPEN_FILES && (handles[opened] = fs_open(&fs, (uint32_t)file)) >= 0) {
+        opened++;
+    }
+    CHECK(opened == FS_MAX_OPEN_FILES);
+    CHECK(fs_open(&fs, (uint32_t)file) < 0);
+    for (uint32_t i = 1; i < opened; i++) {
+        CHECK(fs_close(&fs, handles[i]) == FS_SUCCESS);
+    }
+
+    /* Deleted while open: gone from lookups, readable through the handle */
+    uint32_t start = settled_free_blocks();
+    CHECK(fs_delete(&fs, (uint32_t)file) == FS_SUCCESS);
+    CHECK(fs_find_file(&fs, "handled", 0) < 0);
+    CHECK(fs_seek(&fs, handle, 0, FS_SEEK_SET) == 0);
+    CHECK(fs_read(&fs, handle, buffer, 3000) == 3000 && memcmp(buffer, contents, 3000) == 0);
+    CHECK(settled_free_blocks() == start);
+    CHECK(fs_close(&fs, handle) == FS_SUCCESS);
+    CHECK(settled_free_blocks() > start);
+    CHECK(fs_close(&fs, handle) != FS_SUCCESS);
+    fs_destroy(&fs);
+}
+
+/* Paths resolve through the dentry cache, which never serves a stale name */
+static void test_lookup_path(void) {
+    CHECK(fs_init(&fs, ram, IMAGE_MIB * 1024 * 1024) == FS_SUCCESS);
+    int32_t usr = fs_create_directory(&fs, "usr", 0);
+    int32_t lib = fs_create_directory(&fs, "lib", (uint32_t)usr);
+    int32_t file = fs_create_file(&fs, "libc", (uint32_t)lib);
+    CHECK(file > 0);
+    CHECK(fs_lookup_path(&fs, "/usr/lib/libc", 0) == file);
+    CHECK(fs_lookup_path(&fs, "usr//lib/./libc", 0) == file);
+    CHECK(fs_lookup_path(&fs, "/usr/lib/../lib/libc", (uint32_t)lib) == file);
+    CHECK(fs_lookup_path(&fs, "lib/libc", (uint32_t)usr) == file);
+    CHECK(fs_lookup_path(&fs, "..", (uint32_t)lib) == usr);
+    CHECK(fs_lookup_path(&fs, "/", (uint32_t)lib) == 0);
+    CHECK(fs_lookup_path(&fs, "/usr/lib/libc/x", 0) < 0);
+
+    uint64_t hits = fs.dcache_hits;
+    CHECK(fs_lookup_path(&fs, "/usr/lib/libc", 0) == file);
+    CHECK(fs.dcache_hits >= hits + 3);
+
+    /* A cached miss gives way to a new entry, and a delete to a miss */
+    CHECK(fs_lookup_path(&fs, "/usr/new", 0) < 0);
+    int32_t created = fs_create_file(&fs, "new", (uint32_t)usr);
+    CHECK(fs_lookup_path(&fs, "/usr/new", 0) == created);
+    CHECK(fs_delete(&fs, (uint32_t)file) == FS_SUCCESS);
+    CHECK(fs_lookup_path(&fs, "/usr/lib/libc", 0) < 0);
+    fs_destroy(&fs);
+}
+
+/* Memory device that counts read requests, a batch being one */
+typedef struct {
+    block_device_t device;
+    memory_block_device_t mem;
+    uint64_t requests;
+} counting_device_t;
+
+static counting_device_t counting;
+
+static int32_t counting_read(block_device_t* dev, uint32_t block, uint32_t count, uint8_t* data) {
+    (void)dev;
+    counting.requests++;
+    return block_device_read(&counting.mem.device, block, count, data);
+}
+
+static int32_t counting_write(block_device_t* dev, uint32_t block, uint32_t count, const uint8_t* data) {
+    (void)dev;
+    return block_device_write(&counting.mem.device, block, count, data);
+}
+
+static int32_t counting_flush(block_device_t* dev) {
+    (void)dev;
+    return block_device_flush(&counting.mem.device);
+}
+
+static int32_t counting_read_batch(block_device_t* dev, const block_io_t* segments, uint32_t count) {
+    (void)dev;
+    counting.requests++;
+    return block_device_read_batch(&counting.mem.device, segments, count);
+}
+
+static const block_device_ops_t counting_ops = {
+    counting_read, counting_write, counting_flush, counting_read_batch, NULL, NULL,
+};
+
+/* Read the stream file front to back from a cold cache; returns the
+   device requests and sets the blocks read ahead and used */
+static uint64_t cold_read(uint32_t readahead, uint64_t* readahead_hits) {
+    CHECK(fs_mount(&fs, &counting.device) == FS_SUCCESS);
+    CHECK(fs_set_readahead(&fs, readahead) == FS_SUCCESS);
+    int32_t file = fs_find_file(&fs, "stream", 0);
+    uint64_t requests = counting.requests;
+    for (uint32_t offset = 0; offset < BIG_FILE_SIZE / 2; offset += 4096) {
+        CHECK(fs_read_file(&fs, (uint32_t)file, buffer + offset, 4096, offset) == 4096);
+    }
+    requests = counting.requests - requests;
+    *readahead_hits = fs.cache.stats.readahead_hits;
+    fill(14, 0, contents, BIG_FILE_SIZE / 2);
+    CHECK(memcmp(buffer, contents, BIG_FILE_SIZE / 2) == 0);
+    CHECK(fs_unmount(&fs) == FS_SUCCESS);
+    return requests;
+}
+
+/* Sequential reads: read-ahead fetches the same bytes in far fewer device
+   requests, and every block it fetches is still cached when its turn comes */
+static void test_readahead(void) {
+    memory_block_device_init(&counting.mem, ram, RAM_SIZE);
+    counting.device.ops = &counting_ops;
+    counting.device.block_count = counting.mem.device.block_count;
+    CHECK(fs_mkfs(&counting.device, 0) == FS_SUCCESS);
+    CHECK(fs_mount(&fs, &counting.device) == FS_SUCCESS);
+    CHECK(make_file("stream", 0, 14, BIG_FILE_SIZE / 2) >= 0);
+    CHECK(fs_unmount(&fs) == FS_SUCCESS);
+
+    uint64_t hits_off;
+    uint64_t hits_on;
+    uint64_t requests_off = cold_read(0, &hits_off);
+    uint64_t requests_on = cold_read(FS_READAHEAD_MAX, &hits_on);
+    CHECK(hits_off == 0);
+    CHECK(hits_on == BIG_FILE_SIZE / 2 / BLOCK_SIZE);
+    CHECK(requests_on * 8 < requests_off);
+}
+
+/* Snapshots keep the old bytes while the live tree changes, refuse
+   writes, and give their blocks back when deleted */
+static void test_snapshots(void) {
+    CHECK(fs_init(&fs, ram, IMAGE_MIB * 1024 * 1024) == FS_SUCCESS);
+    int32_t dir = fs_create_directory(&fs, "d", 0);
+    int32_t file = make_file("doc", (uint32_t)dir, 15, 3000);
+    uint32_t start = settled_free_blocks();
+
+    int32_t snap = fs_snapshot(&fs, "snap");
+    CHECK(snap > 0);
+    CHECK(settled_free_blocks() == start);   /* blocks are shared, not copied */
+    int32_t copy = fs_lookup_path(&fs, "/snap/d/doc", 0);
+    CHECK(copy > 0 && copy != file);
+
+    fill(16, 0, contents, 3000);
+    CHECK(fs_write_file(&fs, (uint32_t)file, contents, 3000, 0) == 3000);
+    CHECK(file_matches(file, 16, 3000));
+    CHECK(file_matches(copy, 15, 3000));
+    CHECK(fs_write_file(&fs, (uint32_t)copy, contents, 10, 0) < 0);
+    CHECK(fs_create_file(&fs, "extra", (uint32_t)snap) < 0);
+    CHECK(file_matches(copy, 15, 3000));
+
+    /* Deleted bottom up, the snapshot returns the blocks the writes copied */
+    CHECK(fs_delete(&fs, (uint32_t)copy) == FS_SUCCESS);
+    CHECK(fs_delete(&fs, (uint32_t)fs_lookup_path(&fs, "/snap/d", 0)) == FS_SUCCESS);
+    CHECK(fs_delete(&fs, (uint32_t)snap) == FS_SUCCESS);
+    CHECK(settled_free_blocks() == start);
+    CHECK(file_matches(file, 16, 3000));
+    fs_destroy(&fs);
+}
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} test_case_t;
+
+static const test_case_t tests[] = {
+    { "block allocator", test_block_allocator },
+    { "name index", test_name_index },
+    { "large files", test_large_files },
+    { "block cache write-back", test_block_cache },
+    { "image device", test_image_device },
+    { "mount and unmount", test_mount },
+    { "journal crash recovery", test_journal_recovery },
+    { "fs_map_file", test_map_file },
+    { "vectored and batched I/O", test_vectored_io },
+    { "file handles", test_handles },
+    { "path lookup", test_lookup_path },
+    { "read-ahead", test_readahead },
+    { "snapshots", test_snapshots },
+};
+
+int main(void) {
+    if (bench_setup() != 0) {
+        return 1;
+    }
+    image_path = getenv("TEST_IMAGE");
+    if (!image_path) {
+        image_path = "build/hosted/test_fs_hosted.img";
+    }
+    uint32_t count = sizeof(tests) / sizeof(tests[0]);
+    for (uint32_t i = 0; i < count; i++) {
+        int before = checks_failed;
+        tests[i].run();
+        printf("%-28s %s\n", tests[i].name, checks_failed == before ? "PASS" : "FAIL");
+        tests_failed += checks_failed != before;
+    }
+    printf("%u tests, %d failed\n", count, tests_failed);
+    return tests_failed ? 1 : 0;
+}
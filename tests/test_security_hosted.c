@@ -0,0 +1,159 @@
+/* test_security_hosted.c - Timing-safety tests against the real code
+   Links against libs00k_core.a like test_fs_hosted.c and checks that
+   security_constant_time_compare and security_zero_memory execute the
+   same number of instructions for every input of a given length: equal
+   buffers, a difference in the first or last byte, or everywhere. A
+   traced child single-steps each call. Where this process cannot trace
+   a child (no ptrace, or a sandbox that forbids it) the test reports SKIP
+   rather than passing. Build and run with `make test-hosted`. */
+
+#include "bench.h"
+#include <signal.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "string_ops.h"
+
+#define SECURITY_MAX      1024
+
+static const uint32_t traced_lengths[] = { 0, 1, 15, 16, 17, 64, 100, 128, 1000 };
+
+static int checks_failed;
+static int tests_failed;
+static int tests_skipped;
+static bool skipped;
+
+/* Record a failed check and carry on with the rest of the test */
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "  FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            checks_failed++; \
+        } \
+    } while (0)
+
+static uint8_t first[SECURITY_MAX];
+static uint8_t second[SECURITY_MAX];
+static volatile uint32_t sink;
+
+/* Fill the buffers as one of the inputs: 0 equal, 1 first byte differs,
+   2 last byte differs, 3 every byte differs */
+static void prepare(int input, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        first[i] = (uint8_t)(i * 31 + 7);
+        second[i] = input == 3 ? (uint8_t)~first[i] : first[i];
+    }
+    if (length && input == 1) {
+        second[0] ^= 0x40;
+    }
+    if (length && input == 2) {
+        second[length - 1] ^= 0x01;
+    }
+}
+
+/* Instructions a forked, traced child executes between two stops around
+   one call; -1 if the process cannot be traced here */
+static long count_instructions(bool zeroing, uint32_t length) {
+    pid_t child = fork();
+    if (child == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) {
+            _exit(1);
+        }
+        raise(SIGSTOP);
+        if (zeroing) {
+            security_zero_memory(first, length);
+        } else {
+            sink = security_constant_time_compare(first, second, length);
+        }
+        raise(SIGSTOP);
+        _exit(0);
+    }
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFSTOPPED(status)) {
+        return -1;
+    }
+    long steps = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SINGLESTEP, child, NULL, NULL) != 0 || waitpid(child, &status, 0) != child ||
+            !WIFSTOPPED(status)) {
+            steps = -1;
+            break;
+        }
+        if (WSTOPSIG(status) == SIGSTOP) {
+            break;
+        }
+        steps++;
+    }
+    kill(child, SIGKILL);
+    waitpid(child, &status, 0);
+    return steps;
+}
+
+/* Both give the right result, and zeroing stops at the length */
+static void test_results(void) {
+    for (int input = 0; input < 4; input++) {
+        prepare(input, 100);
+        CHECK(security_constant_time_compare(first, second, 100) == (input == 0));
+    }
+    CHECK(security_constant_time_compare(first, second, 0));
+    prepare(0, 101);
+    security_zero_memory(first, 100);
+    for (uint32_t i = 0; i < 100; i++) {
+        CHECK(first[i] == 0);
+    }
+    CHECK(first[100] == second[100] && first[100] != 0);
+}
+
+static void test_instruction_counts(void) {
+    for (uint32_t l = 0; l < sizeof(traced_lengths) / sizeof(traced_lengths[0]); l++) {
+        uint32_t length = traced_lengths[l];
+        for (int zeroing = 0; zeroing < 2; zeroing++) {
+            long equal = 0;
+            for (int input = 0; input < 4; input++) {
+                prepare(input, length);
+                long steps = count_instructions(zeroing, length);
+                if (steps < 0) {
+                    skipped = true;
+                    return;
+                }
+                if (input == 0) {
+                    equal = steps;
+                } else if (steps != equal) {
+                    fprintf(stderr, "  %s of %u B: %ld instructions for input %d, %ld for equal buffers\n",
+                            zeroing ? "zeroing" : "compare", length, steps, input, equal);
+                    checks_failed++;
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} test_case_t;
+
+static const test_case_t tests[] = {
+    { "compare and zero results", test_results },
+    { "data-independent timing", test_instruction_counts },
+};
+
+int main(void) {
+    string_init();
+    uint32_t count = sizeof(tests) / sizeof(tests[0]);
+    for (uint32_t i = 0; i < count; i++) {
+        int before = checks_failed;
+        skipped = false;
+        tests[i].run();
+        if (skipped) {
+            printf("%-28s SKIP (this process cannot be traced)\n", tests[i].name);
+            tests_skipped++;
+            continue;
+        }
+        printf("%-28s %s\n", tests[i].name, checks_failed == before ? "PASS" : "FAIL");
+        tests_failed += checks_failed != before;
+    }
+    printf("%u tests, %d failed, %d skipped\n", count, tests_failed, tests_skipped);
+    return tests_failed ? 1 : 0;
+}
@@ -0,0 +1,266 @@
+/* fsck_s00k.c - Check an S00K disk image without mounting it
+   Usage: fsck.s00k image
+   Reads the raw structures described in fs_format.h and checks the
+   superblock geometry and journal header, every inode (name, type, parent,
+   block pointers), that blocks are only shared as often as their reference
+   counts say, and that the saved bitmap, free count and high-water marks
+   agree with the blocks the inodes actually reference. References are
+   counted the way fs_format.h defines them: a pointer block reached a
+   second time counts once more, but its pointers are not followed again. The journal is not replayed: an image with a
+   transaction waiting in it should be mounted once before it is checked.
+   Exits 0 when the image is consistent and 1 when errors were found. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_system.h"
+#include "fs_format.h"
+#include "error_codes.h"
+
+static block_device_t* device;
+static fs_superblock_t super;
+static uint16_t* references;    /* Pointers to each block from inodes and pointer blocks */
+static uint32_t error_count;
+
+static void report(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "fsck.s00k: ");
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    error_count++;
+}
+
+static int read_block(uint32_t block, void* buffer) {
+    if (block_device_read(device, block, 1, (uint8_t*)buffer) != ERR_SUCCESS) {
+        report("cannot read block %u", block);
+        return 0;
+    }
+    return 1;
+}
+
+/* Count a reference to block from inode; 0 if it is out of the data region
+   or was already referenced (whether it may be is checked at the end) */
+static int claim(uint32_t inode, uint32_t block) {
+    if (block < super.data_start || block >= super.total_blocks) {
+        report("inode %u points outside the data region (block %u)", inode, block);
+        return 0;
+    }
+    if (references[block] < UINT16_MAX) {
+        references[block]++;
+    }
+    return references[block] == 1;
+}
+
+/* Claim a pointer block and, the first time, the first count blocks it
+   points to; depth 2 pointer blocks point to further pointer blocks */
+static uint32_t claim_table(uint32_t inode, uint32_t table, uint32_t count, int depth) {
+    uint32_t pointers[FS_POINTERS_PER_BLOCK];
+    if (!claim(inode, table) || !read_block(table, pointers)) {
+        return 0;
+    }
+    uint32_t per_entry = depth == 2 ? FS_POINTERS_PER_BLOCK : 1;
+    uint32_t claimed = 0;
+    for (uint32_t i = 0; i < FS_POINTERS_PER_BLOCK && claimed < count; i++) {
+        uint32_t want = count - claimed < per_entry ? count - claimed : per_entry;
+        if (depth == 2) {
+            claim_table(inode, pointers[i], want, 1);
+        } else {
+            claim(inode, pointers[i]);
+        }
+        claimed += want;
+    }
+    return claimed;
+}
+
+static void check_blocks(uint32_t index, const fs_inode_t* inode) {
+    uint32_t remaining = inode->block_count;
+    for (uint32_t i = 0; i < FS_ONDISK_DIRECT_BLOCKS && remaining > 0; i++, remaining--) {
+        claim(index, inode->blocks[i]);
+    }
+    if (remaining > 0) {
+        uint32_t count = remaining < FS_POINTERS_PER_BLOCK ? remaining : FS_POINTERS_PER_BLOCK;
+        claim_table(index, inode->indirect, count, 1);
+        remaining -= count;
+    }
+    if (remaining > 0) {
+        claim_table(index, inode->double_indirect, remaining, 2);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: fsck.s00k image\n");
+        return 2;
+    }
+    file_block_device_t image;
+    if (file_block_device_open(&image, argv[1], 0, false) != ERR_SUCCESS) {
+        fprintf(stderr, "fsck.s00k: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    device = &image.device;
+
+    /* Superblock */
+    if (!read_block(FS_SUPERBLOCK, &super)) {
+        return 1;
+    }
+    if (super.magic != FS_MAGIC || super.version != FS_VERSION || super.block_size != BLOCK_SIZE) {
+        report("no S00K file system (magic %#x, version %u)", super.magic, super.version);
+        return 1;
+    }
+    if (super.total_blocks != device->block_count || super.bitmap_start != FS_SUPERBLOCK + 1 ||
+        super.bitmap_blocks != fs_bitmap_blocks(super.total_blocks) ||
+        super.refcount_start != super.bitmap_start + super.bitmap_blocks ||
+        super.refcount_blocks != fs_refcount_blocks(super.total_blocks) ||
+        super.inode_start != super.refcount_start + super.refcount_blocks ||
+        super.inode_blocks != fs_inode_blocks(super.inode_count) ||
+        super.journal_start != super.inode_start + super.inode_blocks ||
+        super.journal_blocks < FS_MIN_JOURNAL_BLOCKS ||
+        super.data_start != super.journal_start + super.journal_blocks ||
+        super.data_start >= super.total_blocks) {
+        report("superblock geometry does not fit a %u block image (data_start %u)",
+               device->block_count, super.data_start);
+        return 1;
+    }
+    if (super.state != FS_STATE_CLEAN) {
+        fprintf(stderr, "fsck.s00k: warning: file system was not cleanly unmounted\n");
+    }
+
+    /* Journal header, and whether an unclean shutdown left a transaction in it */
+    fs_journal_header_t header;
+    fs_journal_descriptor_t descriptor;
+    if (read_block(super.journal_start, &header)) {
+        if (header.magic != FS_JOURNAL_MAGIC || header.type != FS_JOURNAL_HEADER ||
+            header.start == 0 || header.start >= super.journal_blocks) {
+            report("bad journal header");
+        } else if (super.state != FS_STATE_CLEAN &&
+                   read_block(super.journal_start + header.start, &descriptor) &&
+                   descriptor.magic == FS_JOURNAL_MAGIC && descriptor.type == FS_JOURNAL_DESCRIPTOR &&
+                   descriptor.sequence == header.sequence) {
+            fprintf(stderr, "fsck.s00k: warning: journal holds transaction %u; mount to replay it\n",
+                    header.sequence);
+        }
+    }
+
+    /* Inodes */
+    fs_inode_t* inodes = malloc((size_t)super.inode_blocks * BLOCK_SIZE);
+    references = calloc(super.total_blocks, sizeof(uint16_t));
+    if (!inodes || !references) {
+        fprintf(stderr, "fsck.s00k: out of memory\n");
+        return 1;
+    }
+    for (uint32_t b = 0; b < super.inode_blocks; b++) {
+        read_block(super.inode_start + b, (uint8_t*)inodes + (size_t)b * BLOCK_SIZE);
+    }
+    for (uint32_t b = 0; b < super.data_start; b++) {
+        references[b] = 1;
+    }
+
+    uint32_t used = 0, high_water = 0;
+    for (uint32_t i = 0; i < super.inode_count; i++) {
+        const fs_inode_t* inode = &inodes[i];
+        if (!inode->used) {
+            continue;
+        }
+        used++;
+        high_water = i + 1;
+        if (inode->name[0] == '\0' || inode->name[FS_ONDISK_NAME_LENGTH - 1] != '\0') {
+            report("inode %u has a bad name", i);
+        }
+        if (inode->type != FILE_TYPE_FILE && inode->type != FILE_TYPE_DIRECTORY) {
+            report("inode %u has unknown type %u", i, inode->type);
+        }
+        if (i == 0 && (inode->type != FILE_TYPE_DIRECTORY || inode->parent_dir != 0)) {
+            report("root inode is not a directory that is its own parent");
+        }
+        if (i != 0 && (inode->parent_dir >= super.inode_count || inode->parent_dir == i ||
+                       !inodes[inode->parent_dir].used ||
+                       inodes[inode->parent_dir].type != FILE_TYPE_DIRECTORY)) {
+            report("inode %u has invalid parent %u", i, inode->parent_dir);
+        }
+        if (inode->block_count > MAX_BLOCKS_PER_FILE || inode->size > inode->block_count * BLOCK_SIZE) {
+            report("inode %u has size %u beyond its blocks", i, inode->size);
+            continue;
+        }
+        check_blocks(i, inode);
+    }
+    if (!inodes[0].used) {
+        report("root inode is missing");
+    }
+
+    /* Unique names within each directory (quadratic per directory is fine for a checker) */
+    for (uint32_t i = 1; i < high_water; i++) {
+        for (uint32_t j = i + 1; inodes[i].used && j < high_water; j++) {
+            if (inodes[j].used && inodes[j].parent_dir == inodes[i].parent_dir &&
+                strncmp(inodes[i].name, inodes[j].name, FS_ONDISK_NAME_LENGTH) == 0) {
+                report("inodes %u and %u have the same name in one directory", i, j);
+            }
+        }
+    }
+
+    /* Reference counts against the pointers found */
+    uint8_t counts[BLOCK_SIZE];
+    uint32_t shared_blocks = 0;
+    for (uint32_t b = 0; b < super.refcount_blocks; b++) {
+        if (!read_block(super.refcount_start + b, counts)) {
+            continue;
+        }
+        for (uint32_t i = 0; i < BLOCK_SIZE && b * BLOCK_SIZE + i < super.total_blocks; i++) {
+            uint32_t block = b * BLOCK_SIZE + i;
+            uint32_t expected = references[block] ? references[block] - 1u : 0;
+            if (counts[i] != expected) {
+                report("block %u is referenced %u times, but its count says %u", block, references[block],
+                       counts[i] + 1u);
+            }
+            shared_blocks += counts[i] != 0;
+        }
+    }
+    if (super.shared_blocks != shared_blocks) {
+        report("superblock shared count %u, reference counts have %u", super.shared_blocks, shared_blocks);
+    }
+
+    /* Bitmap against the referenced blocks */
+    uint8_t bitmap[BLOCK_SIZE];
+    uint32_t free_blocks = 0, block_high_water = super.data_start;
+    for (uint32_t b = 0; b < super.bitmap_blocks; b++) {
+        if (!read_block(super.bitmap_start + b, bitmap)) {
+            continue;
+        }
+        for (uint32_t bit = 0; bit < FS_BITS_PER_BLOCK; bit++) {
+            uint32_t block = b * FS_BITS_PER_BLOCK + bit;
+            if (block >= super.total_blocks) {
+                break;   /* padding bits past the end are ignored */
+            }
+            int in_use = (bitmap[bit / 8] >> (bit % 8)) & 1;
+            int wanted = references[block] != 0;
+            if (in_use != wanted) {
+                report(in_use ? "block %u is marked in use but unreferenced"
+                              : "block %u is referenced but marked free", block);
+            }
+            if (in_use) {
+                block_high_water = block + 1;
+            } else {
+                free_blocks++;
+            }
+        }
+    }
+
+    if (super.free_blocks != free_blocks) {
+        report("superblock free count %u, bitmap has %u free", super.free_blocks, free_blocks);
+    }
+    if (super.state == FS_STATE_CLEAN && high_water > super.inode_high_water) {
+        report("inode %u in use above the high-water mark %u", high_water - 1, super.inode_high_water);
+    }
+    if (super.state == FS_STATE_CLEAN && block_high_water > super.block_high_water) {
+        report("block %u in use above the high-water mark %u", block_high_water - 1, super.block_high_water);
+    }
+
+    printf("%s: %u/%u inodes, %u/%u blocks free, %u error%s\n", argv[1], used, super.inode_count,
+           free_blocks, super.total_blocks, error_count, error_count == 1 ? "" : "s");
+    free(inodes);
+    free(references);
+    file_block_device_close(&image);
+    return error_count ? 1 : 0;
+}
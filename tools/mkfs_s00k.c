@@ -0,0 +1,60 @@
+/* mkfs_s00k.c - Write an empty S00K file system to a disk image
+   Usage: mkfs.s00k [-i inodes] [-s size_mib] image
+   With -s the image is created (or resized) to size_mib MiB first; without
+   it the existing image is formatted in place. The inode count defaults to
+   one per FS_BLOCKS_PER_INODE blocks. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_system.h"
+#include "fs_format.h"
+#include "error_codes.h"
+
+static void usage(void) {
+    fprintf(stderr, "usage: mkfs.s00k [-i inodes] [-s size_mib] image\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    uint32_t inodes = 0;
+    uint32_t size_mib = 0;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            inodes = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            size_mib = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (!path) {
+        usage();
+    }
+
+    file_block_device_t image;
+    uint32_t blocks = size_mib * (1024u * 1024u / BLOCK_DEVICE_BLOCK_SIZE);
+    if (file_block_device_open(&image, path, blocks, size_mib != 0) != ERR_SUCCESS) {
+        fprintf(stderr, "mkfs.s00k: cannot open %s\n", path);
+        return 1;
+    }
+
+    int32_t result = fs_mkfs(&image.device, inodes);
+    if (result != ERR_SUCCESS) {
+        fprintf(stderr, "mkfs.s00k: %s: %s\n", path, fs_error_string(result));
+        file_block_device_close(&image);
+        return 1;
+    }
+
+    fs_superblock_t super;
+    block_device_read(&image.device, FS_SUPERBLOCK, 1, (uint8_t*)&super);
+    printf("%s: %u blocks of %u bytes, %u inodes, data from block %u (%u blocks free)\n",
+           path, super.total_blocks, super.block_size, super.inode_count, super.data_start,
+           super.free_blocks);
+    file_block_device_close(&image);
+    return 0;
+}